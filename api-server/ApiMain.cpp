@@ -1,41 +1,39 @@
 #include <boost/asio.hpp>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 
 #include "ApiServer.h"
-#include "DataBaseManager.h"
+#include "Config.h"
+#include "ShardRouter.h"
 #include "UserDAL.h"
 #include "UserRepository.h"
 #include "ThreadPool.h"
 #include "Logger.h"
 #include "FileStrategy.h"
+#include "schema.h"
 
-int main()
+int main(int argc, char** argv)
 {
     constexpr uint16_t API_PORT = 8080;
     constexpr int WORKER_THREADS = 4;
 
     auto logger = std::make_shared<Logger>(std::make_unique<FileStrategy>(LogLevel::PROD));
 
-    std::ifstream sql_file("../database/scheme/001_init_scheme.sql");
-    if (!sql_file.is_open())
+    // optional path to the root folder holding default_config.json
+    const std::string path_to_root = argc >= 2 ? argv[1] : "./";
+    if (!SmtpClient::Config::Instance().Load(path_to_root + "default_config.json"))
     {
-        std::cerr << "[ApiServer] Failed to open migration file\n";
-        return 1;
+        logger->Log(LogLevel::PROD, "[ApiServer] Couldn`t read config. Default values will be used");
     }
-    std::stringstream ss;
-    ss << sql_file.rdbuf();
-    std::string migration_sql = ss.str();
 
-    DataBaseManager db("prod.db", migration_sql, logger, 4);
-    if (!db.isConnected())
+    auto db = ShardRouter::open("prod.db", SmtpClient::Config::Instance().GetDatabase().db_shards, initSchema(),
+                                logger, 4);
+    if (!db->isConnected())
     {
         logger->Log(LogLevel::PROD, "[ApiServer] Database connection failed");
         return 1;
     }
 
-    UserRepository user_repo(db);
+    UserRepository user_repo(*db);
 
     ThreadPool pool;
     pool.initialize(WORKER_THREADS);
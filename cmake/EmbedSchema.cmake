@@ -0,0 +1,16 @@
+# Concatenates the numbered migration scripts into one file, each behind a
+# "-- @migration <n>" line that DataBaseManager uses to run it at most once.
+#   cmake -DSCHEME_DIR=<dir> -DOUTPUT=<file> -P EmbedSchema.cmake
+file(GLOB scripts "${SCHEME_DIR}/[0-9][0-9][0-9]_*.sql")
+list(SORT scripts)
+
+set(content "")
+foreach(script IN LISTS scripts)
+    get_filename_component(name "${script}" NAME)
+    string(SUBSTRING "${name}" 0 3 version)
+    math(EXPR version "${version}")
+    file(READ "${script}" body)
+    string(APPEND content "-- @migration ${version}\n${body}\n")
+endforeach()
+
+file(WRITE "${OUTPUT}" "${content}")
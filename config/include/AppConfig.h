@@ -21,7 +21,15 @@ struct ImapConfig
 	std::string migration_path = "../../database/scheme/001_init_scheme.sql";
 	int timeout_mins = 30;
 	int worker_threads = 4;
+	int io_threads = 4; // threads running the io_context; sessions stay serialized by their strands
 	int handshake_timeout_secs = 10;
+	int compress_level = 6;
+	int compress_window_bits = 15;
+	int compress_mem_level = 8;
+	int compress_max_buffer_kb = 1024;
+	std::string spool_dir = "mailstore/spool";
+	int max_append_size_mb = 25;
+	int max_command_line_kb = 64; // longer command lines (literals excluded) get BAD
 };
 
 struct LoggingConfig
@@ -44,6 +52,13 @@ struct ProtoConfig
 struct DatabaseConfig
 {
 	int default_page_limit = 50;
+	int read_cache_kb = 4000;  // page cache of every read connection
+	int mmap_size_mb = 256;    // memory-mapped reads; 0 reads through the page cache only
+	int checkpoint_interval_ms = 1000; // 0 leaves checkpoints to SQLite's auto-checkpoint on commit
+	int checkpoint_passive_frames = 1000;  // WAL frames not yet copied back that trigger a PASSIVE checkpoint
+	int checkpoint_restart_frames = 10000; // WAL length at which a RESTART waits out readers to rewind it
+	int expunged_history = 10000; // QRESYNC tombstones kept per folder; older resyncs diff UID sets instead
+	int db_shards = 1; // above 1 users are spread over <db>.shard<k>.db files with a directory db
 };
 
 struct MimeConfig
@@ -74,7 +74,15 @@ bool Config::Load(const std::string& path)
 	m_config.imap.migration_path = ToString(map, "imap.migration_path", m_config.imap.migration_path);
 	m_config.imap.timeout_mins = ToInt (map, "imap.timeout_mins", m_config.imap.timeout_mins);
     m_config.imap.worker_threads = ToInt(map, "imap.worker_threads", m_config.imap.worker_threads);
+    m_config.imap.io_threads = ToInt(map, "imap.io_threads", m_config.imap.io_threads);
     m_config.imap.handshake_timeout_secs = ToInt(map, "imap.handshake_timeout_secs", m_config.imap.handshake_timeout_secs);
+    m_config.imap.compress_level = ToInt(map, "imap.compress_level", m_config.imap.compress_level);
+    m_config.imap.compress_window_bits = ToInt(map, "imap.compress_window_bits", m_config.imap.compress_window_bits);
+    m_config.imap.compress_mem_level = ToInt(map, "imap.compress_mem_level", m_config.imap.compress_mem_level);
+    m_config.imap.compress_max_buffer_kb = ToInt(map, "imap.compress_max_buffer_kb", m_config.imap.compress_max_buffer_kb);
+    m_config.imap.spool_dir = ToString(map, "imap.spool_dir", m_config.imap.spool_dir);
+    m_config.imap.max_append_size_mb = ToInt(map, "imap.max_append_size_mb", m_config.imap.max_append_size_mb);
+    m_config.imap.max_command_line_kb = ToInt(map, "imap.max_command_line_kb", m_config.imap.max_command_line_kb);
 
 	// logging
 	m_config.logging.log_level = ToString(map, "logging.log_level", m_config.logging.log_level);
@@ -91,6 +99,13 @@ bool Config::Load(const std::string& path)
 
 	// database
 	m_config.database.default_page_limit = ToInt(map, "database.default_page_limit", m_config.database.default_page_limit);
+	m_config.database.read_cache_kb = ToInt(map, "database.read_cache_kb", m_config.database.read_cache_kb);
+	m_config.database.mmap_size_mb = ToInt(map, "database.mmap_size_mb", m_config.database.mmap_size_mb);
+	m_config.database.checkpoint_interval_ms = ToInt(map, "database.checkpoint_interval_ms", m_config.database.checkpoint_interval_ms);
+	m_config.database.checkpoint_passive_frames = ToInt(map, "database.checkpoint_passive_frames", m_config.database.checkpoint_passive_frames);
+	m_config.database.checkpoint_restart_frames = ToInt(map, "database.checkpoint_restart_frames", m_config.database.checkpoint_restart_frames);
+	m_config.database.expunged_history = ToInt(map, "database.expunged_history", m_config.database.expunged_history);
+	m_config.database.db_shards = ToInt(map, "database.db_shards", m_config.database.db_shards);
 
 	// mime
 	m_config.mime.header_chunk_size = ToInt (map, "mime.header_chunk_size", m_config.mime.header_chunk_size);
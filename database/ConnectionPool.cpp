@@ -1,17 +1,33 @@
 #include "ConnectionPool.h"
 #include "Config.h"
 
+namespace
+{
+    // Connection this thread released last; reusing it keeps its page cache warm.
+    struct Affinity
+    {
+        const ConnectionPool* pool = nullptr;
+        size_t slot = 0;
+    };
+    thread_local Affinity t_affinity;
+    thread_local const ConnectionPool* t_pinned_to_writer = nullptr;
+
+    constexpr uint64_t INDEX_MASK = 0xffffffffu;
+}
+
 ConnectionPool::ConnectionPool(const std::string& db_path, int pool_size)
 {
     if (pool_size <= 0)
         pool_size = SmtpClient::Config::Instance().GetServer().worker_threads;
+    const auto& cfg = SmtpClient::Config::Instance().GetDatabase();
 
-    m_slots.resize(pool_size);
+    m_slots = std::vector<Slot>(pool_size);
     for (auto& slot : m_slots)
     {
         int rc = sqlite3_open_v2(db_path.c_str(), &slot.conn, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr);
         if (rc != SQLITE_OK)
         {
+            m_statements.clear();
             for (auto& s : m_slots)
                 if (s.conn) { sqlite3_close(s.conn); s.conn = nullptr; }
             throw std::runtime_error(std::string("ConnectionPool: cannot open read connection: ") + sqlite3_errstr(rc));
@@ -19,38 +35,162 @@ ConnectionPool::ConnectionPool(const std::string& db_path, int pool_size)
 
         sqlite3_exec(slot.conn, "PRAGMA journal_mode=WAL;", nullptr, nullptr, nullptr);
         sqlite3_exec(slot.conn, "PRAGMA synchronous=NORMAL;", nullptr, nullptr, nullptr);
-        sqlite3_exec(slot.conn, "PRAGMA cache_size=-4000;", nullptr, nullptr, nullptr);
+        std::string cache = "PRAGMA cache_size=-" + std::to_string(cfg.read_cache_kb) + ";";
+        std::string mmap = "PRAGMA mmap_size=" + std::to_string(static_cast<int64_t>(cfg.mmap_size_mb) << 20) + ";";
+        sqlite3_exec(slot.conn, cache.c_str(), nullptr, nullptr, nullptr);
+        sqlite3_exec(slot.conn, mmap.c_str(), nullptr, nullptr, nullptr);
+        m_statements.emplace(slot.conn, std::make_unique<StatementCache>(slot.conn));
+    }
+
+    for (size_t i = m_slots.size(); i-- > 0;)
+    {
+        m_index.emplace(m_slots[i].conn, i);
+        push(i);
     }
 }
 
 ConnectionPool::~ConnectionPool()
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    // cached statements must be finalized before their connections close
+    m_statements.clear();
     for (auto& slot : m_slots)
         if (slot.conn) { sqlite3_close(slot.conn); slot.conn = nullptr; }
 }
 
-sqlite3* ConnectionPool::acquire()
+void ConnectionPool::attachWriter(sqlite3* conn)
+{
+    m_writer = conn;
+    m_statements.emplace(conn, std::make_unique<StatementCache>(conn));
+}
+
+void ConnectionPool::pinReadsToWriter()
 {
-    std::unique_lock<std::mutex> lock(m_mutex);
-    m_cv.wait(lock, [this]
+    t_pinned_to_writer = this;
+}
+
+StatementCache* ConnectionPool::statements(sqlite3* conn) const
+{
+    auto it = m_statements.find(conn);
+    return it != m_statements.end() ? it->second.get() : nullptr;
+}
+
+void ConnectionPool::push(size_t index)
+{
+    Slot& slot = m_slots[index];
+    bool expected = false;
+    if (!slot.on_list.compare_exchange_strong(expected, true))
+        return;
+
+    uint64_t head = m_free_head.load();
+    uint64_t next;
+    do
     {
-        for (const auto& s : m_slots) if (!s.in_use) return true;
-        return false;
-    });
+        slot.next.store(static_cast<uint32_t>(head & INDEX_MASK), std::memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | (index + 1);
+    } while (!m_free_head.compare_exchange_weak(head, next));
+}
 
-    for (auto& slot : m_slots)
-        if (!slot.in_use) { slot.in_use = true; return slot.conn; }
+bool ConnectionPool::pop(size_t& index)
+{
+    uint64_t head = m_free_head.load();
+    uint64_t next;
+    do
+    {
+        if ((head & INDEX_MASK) == 0)
+            return false;
+        index = (head & INDEX_MASK) - 1;
+        next = ((head >> 32) + 1) << 32 | m_slots[index].next.load(std::memory_order_relaxed);
+    } while (!m_free_head.compare_exchange_weak(head, next));
+
+    m_slots[index].on_list.store(false);
+    return true;
+}
 
-    throw std::runtime_error("ConnectionPool::acquire: logic error");
+bool ConnectionPool::tryClaim(size_t index)
+{
+    bool expected = false;
+    return m_slots[index].in_use.compare_exchange_strong(expected, true);
+}
+
+sqlite3* ConnectionPool::tryAcquire()
+{
+    if (t_affinity.pool == this && t_affinity.slot < m_slots.size() && tryClaim(t_affinity.slot))
+    {
+        m_affinity_hits.fetch_add(1, std::memory_order_relaxed);
+        return m_slots[t_affinity.slot].conn;
+    }
+
+    // entries whose slot was meanwhile taken through affinity are dropped, release pushes them again
+    size_t index;
+    while (pop(index))
+    {
+        if (tryClaim(index))
+            return m_slots[index].conn;
+    }
+    return nullptr;
+}
+
+sqlite3* ConnectionPool::acquire()
+{
+    if (t_pinned_to_writer == this && m_writer)
+        return m_writer;
+
+    m_acquires.fetch_add(1, std::memory_order_relaxed);
+    if (sqlite3* conn = tryAcquire())
+        return conn;
+
+    auto started = std::chrono::steady_clock::now();
+    sqlite3* conn = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(m_wait_mutex);
+        m_waiters.fetch_add(1);
+        m_cv.wait(lock, [this, &conn] { return (conn = tryAcquire()) != nullptr; });
+        m_waiters.fetch_sub(1);
+    }
+
+    int64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+    m_waits.fetch_add(1, std::memory_order_relaxed);
+    m_wait_total_ns.fetch_add(waited, std::memory_order_relaxed);
+    int64_t max = m_wait_max_ns.load(std::memory_order_relaxed);
+    while (waited > max && !m_wait_max_ns.compare_exchange_weak(max, waited, std::memory_order_relaxed)) {}
+    return conn;
 }
 
 void ConnectionPool::release(sqlite3* conn)
 {
+    auto it = m_index.find(conn);
+    if (it == m_index.end())
+        return;
+
+    // the counters are per connection; read them while this thread still owns it
+    int hits = 0, misses = 0, high = 0;
+    sqlite3_db_status(conn, SQLITE_DBSTATUS_CACHE_HIT, &hits, &high, 1);
+    sqlite3_db_status(conn, SQLITE_DBSTATUS_CACHE_MISS, &misses, &high, 1);
+    m_cache_hits.fetch_add(static_cast<uint64_t>(hits), std::memory_order_relaxed);
+    m_cache_misses.fetch_add(static_cast<uint64_t>(misses), std::memory_order_relaxed);
+
+    size_t index = it->second;
+    m_slots[index].in_use.store(false);
+    push(index);
+    t_affinity = {this, index};
+
+    if (m_waiters.load() > 0)
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        for (auto& slot : m_slots)
-            if (slot.conn == conn) { slot.in_use = false; break; }
+        // taking the mutex orders this release after a waiter's last failed check
+        { std::lock_guard<std::mutex> lock(m_wait_mutex); }
+        m_cv.notify_one();
     }
-    m_cv.notify_one();
-}
\ No newline at end of file
+}
+
+ConnectionPool::Stats ConnectionPool::stats() const
+{
+    Stats s;
+    s.acquires = m_acquires.load(std::memory_order_relaxed);
+    s.affinity_hits = m_affinity_hits.load(std::memory_order_relaxed);
+    s.waits = m_waits.load(std::memory_order_relaxed);
+    s.wait_total = std::chrono::nanoseconds(m_wait_total_ns.load(std::memory_order_relaxed));
+    s.wait_max = std::chrono::nanoseconds(m_wait_max_ns.load(std::memory_order_relaxed));
+    s.cache_hits = m_cache_hits.load(std::memory_order_relaxed);
+    s.cache_misses = m_cache_misses.load(std::memory_order_relaxed);
+    return s;
+}
@@ -1,15 +1,32 @@
 #pragma once
 
 #include <sqlite3.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <stdexcept>
+#include "StatementCache.h"
 
 class ConnectionPool
 {
 public:
+    struct Stats
+    {
+        uint64_t acquires = 0;
+        uint64_t affinity_hits = 0;  // the thread got back the connection it used last
+        uint64_t waits = 0;          // acquires that found every connection busy
+        std::chrono::nanoseconds wait_total{0};
+        std::chrono::nanoseconds wait_max{0};
+        uint64_t cache_hits = 0;     // page lookups served from a read connection's cache
+        uint64_t cache_misses = 0;
+    };
+
     explicit ConnectionPool(const std::string& db_path, int pool_size = 0);
     ~ConnectionPool();
 
@@ -19,12 +36,51 @@ public:
     sqlite3* acquire();
     void release(sqlite3* conn);
 
+    // Gives the write connection a statement cache of its own; call once, before the pool is shared.
+    void attachWriter(sqlite3* conn);
+    // Statement cache of a pooled or attached connection, nullptr for any other connection.
+    StatementCache* statements(sqlite3* conn) const;
+    // From now on acquire() on the calling thread returns the attached write connection, so a
+    // writer thread reads its own uncommitted changes.
+    void pinReadsToWriter();
+
+    Stats stats() const;
+
 private:
-    struct Slot { sqlite3* conn = nullptr; bool in_use = false; };
+    // A slot may sit on the free list and be taken directly through thread affinity at the
+    // same time: in_use decides ownership, the list is only a hint where to look.
+    struct Slot
+    {
+        sqlite3* conn = nullptr;
+        std::atomic<bool> in_use{false};
+        std::atomic<bool> on_list{false};
+        std::atomic<uint32_t> next{0};  // index + 1 of the next free slot, 0 ends the list
+    };
 
     std::vector<Slot> m_slots;
-    std::mutex m_mutex;
+    sqlite3* m_writer = nullptr;
+    std::unordered_map<sqlite3*, size_t> m_index;
+    std::unordered_map<sqlite3*, std::unique_ptr<StatementCache>> m_statements;
+
+    // Treiber stack of free slots: low half is index + 1 of the top, high half an ABA tag
+    std::atomic<uint64_t> m_free_head{0};
+
+    std::atomic<int> m_waiters{0};
+    std::mutex m_wait_mutex;
     std::condition_variable m_cv;
+
+    std::atomic<uint64_t> m_acquires{0};
+    std::atomic<uint64_t> m_affinity_hits{0};
+    std::atomic<uint64_t> m_waits{0};
+    std::atomic<int64_t> m_wait_total_ns{0};
+    std::atomic<int64_t> m_wait_max_ns{0};
+    std::atomic<uint64_t> m_cache_hits{0};
+    std::atomic<uint64_t> m_cache_misses{0};
+
+    bool tryClaim(size_t index);
+    sqlite3* tryAcquire();
+    void push(size_t index);
+    bool pop(size_t& index);
 };
 
 class ReadGuard
@@ -34,6 +90,7 @@ public:
     ~ReadGuard() { m_pool.release(m_conn); }
 
     sqlite3* db() const { return m_conn; }
+    StatementCache* statements() const { return m_pool.statements(m_conn); }
 
     ReadGuard(const ReadGuard&) = delete;
     ReadGuard& operator=(const ReadGuard&) = delete;
@@ -41,4 +98,4 @@ public:
 private:
     ConnectionPool& m_pool;
     sqlite3* m_conn;
-};
\ No newline at end of file
+};
@@ -1,7 +1,7 @@
 #include "FolderDAL.h"
 
 #define FOLDER_SELECT \
-    "SELECT id, user_id, parent_id, name, next_uid, is_subscribed " \
+    "SELECT id, user_id, parent_id, name, next_uid, is_subscribed, highest_modseq " \
     "FROM folders "
 
 FolderDAL::FolderDAL(sqlite3* write_conn, ConnectionPool& pool)
@@ -9,6 +9,8 @@ FolderDAL::FolderDAL(sqlite3* write_conn, ConnectionPool& pool)
     , m_pool(pool)
 {}
 
+thread_local std::string FolderDAL::m_last_error;
+
 bool FolderDAL::setError(const char* sqlite_errmsg)
 {
     m_last_error = sqlite_errmsg ? sqlite_errmsg : "unknown error";
@@ -37,6 +39,7 @@ Folder FolderDAL::rowToFolder(sqlite3_stmt* stmt)
 
     f.next_uid = sqlite3_column_int64(stmt, 4);
     f.is_subscribed = sqlite3_column_int(stmt, 5) != 0;
+    f.highest_modseq = sqlite3_column_int64(stmt, 6);
 
     return f;
 }
@@ -46,7 +49,6 @@ std::vector<Folder> FolderDAL::fetchRows(sqlite3_stmt* stmt) const
     std::vector<Folder> results;
     while (sqlite3_step(stmt) == SQLITE_ROW)
         results.push_back(rowToFolder(stmt));
-    sqlite3_finalize(stmt);
     return results;
 }
 
@@ -55,8 +57,8 @@ std::optional<Folder> FolderDAL::findByID(int64_t id) const
     ReadGuard g(m_pool);
     const char* sql = FOLDER_SELECT "WHERE id = ? LIMIT 1;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return std::nullopt;
 
     sqlite3_bind_int64(stmt, 1, id);
@@ -65,7 +67,6 @@ std::optional<Folder> FolderDAL::findByID(int64_t id) const
     if (sqlite3_step(stmt) == SQLITE_ROW)
         result = rowToFolder(stmt);
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -74,8 +75,8 @@ std::vector<Folder> FolderDAL::findByUser(int64_t user_id, int limit, int offset
     ReadGuard g(m_pool);
     const char* sql = FOLDER_SELECT "WHERE user_id = ? ORDER BY name ASC LIMIT ? OFFSET ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     sqlite3_bind_int64(stmt, 1, user_id);
@@ -89,8 +90,8 @@ std::optional<Folder> FolderDAL::findByName(int64_t user_id, const std::string&
     ReadGuard g(m_pool);
     const char* sql = FOLDER_SELECT "WHERE user_id = ? AND name = ? LIMIT 1;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return std::nullopt;
 
     sqlite3_bind_int64(stmt, 1, user_id);
@@ -100,7 +101,6 @@ std::optional<Folder> FolderDAL::findByName(int64_t user_id, const std::string&
     if (sqlite3_step(stmt) == SQLITE_ROW)
         result = rowToFolder(stmt);
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -110,8 +110,8 @@ bool FolderDAL::insert(Folder& folder)
         "INSERT INTO folders (user_id, parent_id, name, next_uid, is_subscribed) "
         "VALUES (?, ?, ?, ?, ?);";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int64(stmt, 1, folder.user_id);
@@ -131,7 +131,6 @@ bool FolderDAL::insert(Folder& folder)
     else
         setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -145,8 +144,8 @@ bool FolderDAL::update(const Folder& folder)
         "user_id = ?, parent_id = ?, name = ?, next_uid = ?, is_subscribed = ? "
         "WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int64(stmt, 1, folder.user_id);
@@ -164,7 +163,6 @@ bool FolderDAL::update(const Folder& folder)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -172,8 +170,8 @@ bool FolderDAL::incrementNextUID(int64_t id)
 {
     const char* sql = "UPDATE folders SET next_uid = next_uid + 1 WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int64(stmt, 1, id);
@@ -181,16 +179,35 @@ bool FolderDAL::incrementNextUID(int64_t id)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
+bool FolderDAL::reserveUIDs(int64_t id, int64_t count, int64_t& first_uid)
+{
+    const char* sql = "UPDATE folders SET next_uid = next_uid + ? WHERE id = ? RETURNING next_uid - ?;";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_int64(stmt, 1, count);
+    sqlite3_bind_int64(stmt, 2, id);
+    sqlite3_bind_int64(stmt, 3, count);
+
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) first_uid = sqlite3_column_int64(stmt, 0);
+    else if (rc == SQLITE_DONE) m_last_error = "reserveUIDs: folder not found";
+    else setError(sqlite3_errmsg(m_write_conn));
+
+    return rc == SQLITE_ROW;
+}
+
 bool FolderDAL::hardDelete(int64_t id)
 {
     const char* sql = "DELETE FROM folders WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int64(stmt, 1, id);
@@ -198,7 +215,6 @@ bool FolderDAL::hardDelete(int64_t id)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -206,8 +222,8 @@ bool FolderDAL::setSubscribed(int64_t folder_id, bool subscribed)
 {
     const char* sql = "UPDATE folders SET is_subscribed = ? WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int(stmt, 1, subscribed ? 1 : 0);
@@ -216,7 +232,6 @@ bool FolderDAL::setSubscribed(int64_t folder_id, bool subscribed)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -226,8 +241,8 @@ std::vector<Folder> FolderDAL::findByParent(int64_t parent_id, int limit, int of
     const char* sql = FOLDER_SELECT
         "WHERE parent_id = ? ORDER BY name ASC LIMIT ? OFFSET ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     sqlite3_bind_int64(stmt, 1, parent_id);
@@ -22,6 +22,8 @@ public:
     bool insert(Folder& folder);
     bool update(const Folder& folder);
     bool incrementNextUID(int64_t id);
+    // advances next_uid by count; first_uid receives the start of the reserved block
+    bool reserveUIDs(int64_t id, int64_t count, int64_t& first_uid);
     bool hardDelete(int64_t id);
     bool setSubscribed(int64_t folder_id, bool subscribed);
     
@@ -31,7 +33,7 @@ public:
 private:
     sqlite3* m_write_conn;
     ConnectionPool& m_pool;
-    mutable std::string m_last_error;
+    static thread_local std::string m_last_error;
 
     bool setError(const char* sqlite_errmsg);
     std::vector<Folder> fetchRows(sqlite3_stmt* stmt) const;
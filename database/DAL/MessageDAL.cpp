@@ -1,83 +1,471 @@
 #include "MessageDAL.h"
 
+#include <algorithm>
+#include <cctype>
+#include <set>
+#include <sstream>
+#include <variant>
+
 #define MESSAGE_SELECT                                                                                                 \
-	"SELECT id, user_id, folder_id, uid, "                                                                             \
-	"       raw_file_path, size_bytes, mime_structure, "                                                               \
-	"       message_id_header, in_reply_to, references_header, "                                                       \
-	"       from_address, sender_address, subject, "                                                                   \
-	"       is_seen, is_deleted, is_draft, is_answered, is_flagged, is_recent, "                                       \
-	"       internal_date, date_header "                                                                               \
-	"FROM messages "
+    "SELECT id, user_id, folder_id, uid, "                                                                             \
+    "       raw_file_path, size_bytes, mime_structure, "                                                               \
+    "       message_id_header, in_reply_to, references_header, "                                                       \
+    "       from_address, sender_address, subject, "                                                                   \
+    "       flags, internal_date, date_header, modseq, thread_id, sort_subject, "                                      \
+    "       " MESSAGE_KEYWORDS " "                                                                                     \
+    "FROM messages "
+
+// space separated keyword names of the row; one probe of the message_keywords primary key
+#define MESSAGE_KEYWORDS                                                                                               \
+    "(SELECT group_concat(k.name, ' ') FROM message_keywords mk JOIN keywords k ON k.id = mk.keyword_id "             \
+    " WHERE mk.message_id = messages.id)"
+
+#define MESSAGE_FLAGS_SELECT "SELECT id, uid, modseq, flags, " MESSAGE_KEYWORDS " FROM messages "
+#define MESSAGE_HEADER_SELECT                                                                                          \
+    "SELECT id, uid, modseq, flags, size_bytes, internal_date, " MESSAGE_KEYWORDS " FROM messages "
+
+// the bit tests in the schema triggers and partial indexes are written with these values
+static_assert(MessageFlags::Seen == 1u << 0 && MessageFlags::Deleted == 1u << 1 && MessageFlags::Draft == 1u << 2 &&
+                  MessageFlags::Answered == 1u << 3 && MessageFlags::Flagged == 1u << 4 &&
+                  MessageFlags::Recent == 1u << 5,
+              "messages.flags must follow the MessageFlags layout");
+
+namespace
+{
 
-MessageDAL::MessageDAL(sqlite3* write_conn, ConnectionPool& pool)
-    : m_write_conn(write_conn)
-    , m_pool(pool)
-{}
+using SqlBind = std::variant<int64_t, std::string>;
 
-bool MessageDAL::setError(const char* sqlite_errmsg)
+// FTS5 phrase query with prefix matching on the last token, optionally limited to one column.
+std::string ftsPhrase(const char* column, const std::string& value)
 {
-	m_last_error = sqlite_errmsg ? sqlite_errmsg : "unknown error";
-	return false;
+    std::string escaped;
+    for (char c : value)
+    {
+        if (c == '"') escaped += '"';
+        escaped += c;
+    }
+
+    std::string phrase = "\"" + escaped + "\"*";
+    return column ? std::string("{") + column + "} : " + phrase : phrase;
 }
 
-const std::string& MessageDAL::getLastError() const
+uint32_t flagBit(SearchCriteria::Type type)
 {
-	return m_last_error;
+    using T = SearchCriteria::Type;
+    switch (type)
+    {
+    case T::Seen:     return MessageFlags::Seen;
+    case T::Deleted:  return MessageFlags::Deleted;
+    case T::Draft:    return MessageFlags::Draft;
+    case T::Answered: return MessageFlags::Answered;
+    case T::Flagged:  return MessageFlags::Flagged;
+    case T::Recent:   return MessageFlags::Recent;
+    default:          return 0;
+    }
 }
 
-Message MessageDAL::rowToMessage(sqlite3_stmt* stmt)
+uint32_t flagsOf(const Message& msg)
+{
+    return (msg.is_seen ? MessageFlags::Seen : 0) | (msg.is_deleted ? MessageFlags::Deleted : 0) |
+           (msg.is_draft ? MessageFlags::Draft : 0) | (msg.is_answered ? MessageFlags::Answered : 0) |
+           (msg.is_flagged ? MessageFlags::Flagged : 0) | (msg.is_recent ? MessageFlags::Recent : 0);
+}
+
+// folder_id is the folder the outer query is limited to; UID sets are looked up in it.
+void compileCriteria(const SearchCriteria& c, int64_t folder_id, std::string& sql, std::vector<SqlBind>& binds)
+{
+    using T = SearchCriteria::Type;
+
+    auto fts = [&](const char* column)
+    {
+        if (c.value.empty())
+        {
+            sql += "1";
+            return;
+        }
+        sql += "id IN (SELECT rowid FROM messages_fts WHERE messages_fts MATCH ?)";
+        binds.emplace_back(ftsPhrase(column, c.value));
+    };
+
+    // spelled like the partial indexes of the schema, literal bit included, so the planner can use them
+    auto flag = [&](uint32_t bit, bool set)
+    {
+        sql += "(flags & " + std::to_string(bit) + (set ? ") <> 0" : ") = 0");
+    };
+
+    auto group = [&](const char* op)
+    {
+        if (c.children.empty())
+        {
+            sql += "1";
+            return;
+        }
+        sql += "(";
+        for (size_t i = 0; i < c.children.size(); ++i)
+        {
+            if (i > 0) sql += op;
+            compileCriteria(c.children[i], folder_id, sql, binds);
+        }
+        sql += ")";
+    };
+
+    switch (c.type)
+    {
+    case T::All:      sql += "1"; break;
+    case T::None:     sql += "0"; break;
+    case T::And:      group(" AND "); break;
+    case T::Or:       group(" OR "); break;
+    case T::Not:
+        // UNSEEN and friends test the bit for zero instead of negating the set test
+        if (c.children.size() == 1 && flagBit(c.children[0].type) != 0)
+        {
+            flag(flagBit(c.children[0].type), false);
+            break;
+        }
+        sql += "NOT ";
+        group(" AND ");
+        break;
+
+    case T::Seen:
+    case T::Deleted:
+    case T::Draft:
+    case T::Answered:
+    case T::Flagged:
+    case T::Recent:
+        flag(flagBit(c.type), true);
+        break;
+
+    case T::Keyword:
+        sql += "id IN (SELECT mk.message_id FROM message_keywords mk JOIN keywords k ON k.id = mk.keyword_id "
+               "WHERE k.name = ?)";
+        binds.emplace_back(c.value);
+        break;
+
+    // internal_date is "YYYY-MM-DD hh:mm:ss", so plain string comparison keeps the index usable
+    case T::Before:
+        sql += "internal_date < ?";
+        binds.emplace_back(c.value);
+        break;
+    case T::On:
+        sql += "(internal_date >= ? AND internal_date < date(?, '+1 day'))";
+        binds.emplace_back(c.value);
+        binds.emplace_back(c.value);
+        break;
+    case T::Since:
+        sql += "internal_date >= ?";
+        binds.emplace_back(c.value);
+        break;
+
+    case T::Larger:
+        sql += "size_bytes > ?";
+        binds.emplace_back(c.number);
+        break;
+    case T::Smaller:
+        sql += "size_bytes < ?";
+        binds.emplace_back(c.number);
+        break;
+
+    case T::From:     fts("from_address"); break;
+    case T::To:       fts("to_address"); break;
+    case T::Cc:       fts("cc_address"); break;
+    case T::Subject:  fts("subject"); break;
+    case T::Body:     fts("body"); break;
+    case T::Text:     fts(nullptr); break;
+
+    // Bcc is never part of the indexed headers, it only exists as a recipient row
+    case T::Bcc:
+        sql += "id IN (SELECT message_id FROM recipients WHERE type = 'bcc' AND address LIKE ?)";
+        binds.emplace_back("%" + c.value + "%");
+        break;
+    case T::MessageID:
+        sql += "message_id_header LIKE ?";
+        binds.emplace_back("%" + c.value + "%");
+        break;
+
+    case T::Uid:
+        if (c.ranges.empty())
+        {
+            sql += "0";
+            break;
+        }
+    {
+        // one bound [[lo,hi],...] array rather than an OR per range, which runs into SQLite's
+        // expression depth limit (1000) on sparse sets. CROSS JOIN keeps the ranges as the outer
+        // loop, so each one is an index range scan of the folder instead of a scan of every range per row.
+        std::string json = "[";
+        for (size_t i = 0; i < c.ranges.size(); ++i)
+        {
+            if (i > 0) json += ",";
+            json += "[" + std::to_string(c.ranges[i].first) + "," + std::to_string(c.ranges[i].second) + "]";
+        }
+        json += "]";
+
+        sql += "uid IN (SELECT m.uid FROM json_each(?) AS r CROSS JOIN messages AS m "
+               "ON m.folder_id = ? AND m.uid BETWEEN r.value ->> 0 AND r.value ->> 1)";
+        binds.emplace_back(std::move(json));
+        binds.emplace_back(folder_id);
+        break;
+    }
+    }
+}
+
+void bindAll(sqlite3_stmt* stmt, const std::vector<SqlBind>& binds, int first_col)
+{
+    for (size_t i = 0; i < binds.size(); ++i)
+    {
+        int col = static_cast<int>(i) + first_col;
+        if (const auto* num = std::get_if<int64_t>(&binds[i]))
+            sqlite3_bind_int64(stmt, col, *num);
+        else
+            sqlite3_bind_text(stmt, col, std::get<std::string>(binds[i]).c_str(), -1, SQLITE_TRANSIENT);
+    }
+}
+
+// Interns names and applies them to the message ids selected by target (binds included).
+bool applyKeywords(sqlite3* db, const std::string& target, const std::vector<SqlBind>& target_binds,
+                   FlagOperation operation, const std::vector<std::string>& names)
+{
+    if (operation != FlagOperation::Remove)
+    {
+        Statement intern(db, "INSERT OR IGNORE INTO keywords (name) VALUES (?);");
+        if (!intern) return false;
+        for (const auto& name : names)
+        {
+            sqlite3_bind_text(intern, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(intern) != SQLITE_DONE) return false;
+            sqlite3_reset(intern);
+        }
+    }
+
+    std::string in_names = "(";
+    for (size_t i = 0; i < names.size(); ++i)
+        in_names += i == 0 ? "?" : ", ?";
+    in_names += ")";
+
+    // every statement below binds the target first, then the names
+    auto run = [&](const std::string& sql)
+    {
+        Statement stmt(db, sql);
+        if (!stmt) return false;
+
+        bindAll(stmt, target_binds, 1);
+        int col = static_cast<int>(target_binds.size()) + 1;
+        for (const auto& name : names)
+            sqlite3_bind_text(stmt, col++, name.c_str(), -1, SQLITE_TRANSIENT);
+        return sqlite3_step(stmt) == SQLITE_DONE;
+    };
+
+    switch (operation)
+    {
+    case FlagOperation::Replace:
+        if (!run("DELETE FROM message_keywords WHERE message_id IN (" + target + ")" +
+                     (names.empty() ? std::string(";")
+                                    : " AND keyword_id NOT IN (SELECT id FROM keywords WHERE name IN " + in_names + ");")))
+            return false;
+        if (names.empty()) return true;
+        [[fallthrough]];
+
+    case FlagOperation::Add:
+        return run("INSERT OR IGNORE INTO message_keywords (message_id, keyword_id) "
+                   "SELECT t.id, k.id FROM (" + target + ") t, keywords k WHERE k.name IN " + in_names + ";");
+
+    case FlagOperation::Remove:
+        if (names.empty()) return true;
+        return run("DELETE FROM message_keywords WHERE message_id IN (" + target + ") "
+                   "AND keyword_id IN (SELECT id FROM keywords WHERE name IN " + in_names + ");");
+    }
+    return true;
+}
+
+// The Date header is kept verbatim (RFC 2822 text), so DATE falls back to the arrival time.
+const char* sortColumn(SortKey::Field field)
 {
-	Message msg;
+    using F = SortKey::Field;
+    switch (field)
+    {
+    case F::Arrival:
+    case F::Date:    return "internal_date";
+    case F::Size:    return "size_bytes";
+    case F::Subject: return "sort_subject";
+    case F::From:    return "from_address COLLATE NOCASE";
+    case F::To:
+        return "(SELECT address FROM recipients r WHERE r.message_id = messages.id AND r.type = 'to' "
+               "ORDER BY r.id LIMIT 1) COLLATE NOCASE";
+    case F::Cc:
+        return "(SELECT address FROM recipients r WHERE r.message_id = messages.id AND r.type = 'cc' "
+               "ORDER BY r.id LIMIT 1) COLLATE NOCASE";
+    }
+    return "uid";
+}
 
-	auto text = [&](int col) -> std::string
-	{
-		const unsigned char* raw = sqlite3_column_text(stmt, col);
-		return raw ? reinterpret_cast<const char*>(raw) : "";
-	};
+MessageFlagsRow rowToFlags(sqlite3_stmt* stmt)
+{
+    MessageFlagsRow row;
+    row.id = sqlite3_column_int64(stmt, 0);
+    row.uid = sqlite3_column_int64(stmt, 1);
+    row.modseq = sqlite3_column_int64(stmt, 2);
+    row.flags = static_cast<uint32_t>(sqlite3_column_int(stmt, 3));
+    if (const unsigned char* keywords = sqlite3_column_text(stmt, 4))
+        row.keywords.assign(reinterpret_cast<const char*>(keywords), sqlite3_column_bytes(stmt, 4));
+    return row;
+}
 
-	auto optText = [&](int col) -> std::optional<std::string>
-	{
-		if (sqlite3_column_type(stmt, col) == SQLITE_NULL) return std::nullopt;
-		return text(col);
-	};
+MessageHeaderRow rowToHeader(sqlite3_stmt* stmt)
+{
+    MessageHeaderRow row;
+    row.id = sqlite3_column_int64(stmt, 0);
+    row.uid = sqlite3_column_int64(stmt, 1);
+    row.modseq = sqlite3_column_int64(stmt, 2);
+    row.flags = static_cast<uint32_t>(sqlite3_column_int(stmt, 3));
+    row.size_bytes = sqlite3_column_int64(stmt, 4);
+    const unsigned char* date = sqlite3_column_text(stmt, 5);
+    if (date) row.internal_date.assign(reinterpret_cast<const char*>(date), sqlite3_column_bytes(stmt, 5));
+    if (const unsigned char* keywords = sqlite3_column_text(stmt, 6))
+        row.keywords.assign(reinterpret_cast<const char*>(keywords), sqlite3_column_bytes(stmt, 6));
+    return row;
+}
 
-	if (sqlite3_column_type(stmt, 0) != SQLITE_NULL) msg.id = sqlite3_column_int64(stmt, 0);
+FolderStatus rowToStatus(sqlite3_stmt* stmt, int first_col)
+{
+    FolderStatus status;
+    status.messages = sqlite3_column_int64(stmt, first_col);
+    status.recent = sqlite3_column_int64(stmt, first_col + 1);
+    status.unseen = sqlite3_column_int64(stmt, first_col + 2);
+    status.deleted = sqlite3_column_int64(stmt, first_col + 3);
+    status.total_bytes = sqlite3_column_int64(stmt, first_col + 4);
+    return status;
+}
 
-	msg.user_id = sqlite3_column_int64(stmt, 1);
-	msg.folder_id = sqlite3_column_int64(stmt, 2);
-	msg.uid = sqlite3_column_int64(stmt, 3);
+} // namespace
 
-	msg.raw_file_path = text(4);
-	msg.size_bytes = sqlite3_column_int64(stmt, 5);
-	msg.mime_structure = optText(6);
+MessageDAL::MessageDAL(sqlite3* write_conn, ConnectionPool& pool)
+    : m_write_conn(write_conn)
+    , m_pool(pool)
+{}
 
-	msg.message_id_header = optText(7);
-	msg.in_reply_to = optText(8);
-	msg.references_header = optText(9);
-	msg.from_address = text(10);
-	msg.sender_address = optText(11);
-	msg.subject = optText(12);
+thread_local std::string MessageDAL::m_last_error;
 
-	msg.is_seen = sqlite3_column_int(stmt, 13) != 0;
-	msg.is_deleted = sqlite3_column_int(stmt, 14) != 0;
-	msg.is_draft = sqlite3_column_int(stmt, 15) != 0;
-	msg.is_answered = sqlite3_column_int(stmt, 16) != 0;
-	msg.is_flagged = sqlite3_column_int(stmt, 17) != 0;
-	msg.is_recent = sqlite3_column_int(stmt, 18) != 0;
+bool MessageDAL::setError(const char* sqlite_errmsg)
+{
+    m_last_error = sqlite_errmsg ? sqlite_errmsg : "unknown error";
+    return false;
+}
 
-	msg.internal_date = text(19);
-	msg.date_header = optText(20);
+const std::string& MessageDAL::getLastError() const
+{
+    return m_last_error;
+}
 
-	return msg;
+Message MessageDAL::rowToMessage(sqlite3_stmt* stmt)
+{
+    Message msg;
+
+    auto text = [&](int col) -> std::string
+    {
+        const unsigned char* raw = sqlite3_column_text(stmt, col);
+        return raw ? reinterpret_cast<const char*>(raw) : "";
+    };
+
+    auto optText = [&](int col) -> std::optional<std::string>
+    {
+        if (sqlite3_column_type(stmt, col) == SQLITE_NULL) return std::nullopt;
+        return text(col);
+    };
+
+    if (sqlite3_column_type(stmt, 0) != SQLITE_NULL) msg.id = sqlite3_column_int64(stmt, 0);
+
+    msg.user_id = sqlite3_column_int64(stmt, 1);
+    msg.folder_id = sqlite3_column_int64(stmt, 2);
+    msg.uid = sqlite3_column_int64(stmt, 3);
+
+    msg.raw_file_path = text(4);
+    msg.size_bytes = sqlite3_column_int64(stmt, 5);
+    msg.mime_structure = optText(6);
+
+    msg.message_id_header = optText(7);
+    msg.in_reply_to = optText(8);
+    msg.references_header = optText(9);
+    msg.from_address = text(10);
+    msg.sender_address = optText(11);
+    msg.subject = optText(12);
+
+    uint32_t flags = static_cast<uint32_t>(sqlite3_column_int(stmt, 13));
+    msg.is_seen = (flags & MessageFlags::Seen) != 0;
+    msg.is_deleted = (flags & MessageFlags::Deleted) != 0;
+    msg.is_draft = (flags & MessageFlags::Draft) != 0;
+    msg.is_answered = (flags & MessageFlags::Answered) != 0;
+    msg.is_flagged = (flags & MessageFlags::Flagged) != 0;
+    msg.is_recent = (flags & MessageFlags::Recent) != 0;
+
+    msg.internal_date = text(14);
+    msg.date_header = optText(15);
+    msg.modseq = sqlite3_column_int64(stmt, 16);
+    if (sqlite3_column_type(stmt, 17) != SQLITE_NULL) msg.thread_id = sqlite3_column_int64(stmt, 17);
+    msg.sort_subject = text(18);
+    msg.keywords = text(19);
+
+    return msg;
 }
 
 std::vector<Message> MessageDAL::fetchRows(sqlite3_stmt* stmt) const
 {
-	std::vector<Message> result;
-	while (sqlite3_step(stmt) == SQLITE_ROW)
-		result.push_back(rowToMessage(stmt));
-	sqlite3_finalize(stmt);
-	return result;
+    std::vector<Message> result;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        result.push_back(rowToMessage(stmt));
+    return result;
+}
+
+void MessageDAL::appendRow(MessageRowSet& rows, sqlite3_stmt* stmt)
+{
+    MessageView row;
+
+    auto text = [&](int col) -> std::string_view
+    {
+        const unsigned char* raw = sqlite3_column_text(stmt, col);
+        return raw ? rows.store(raw, static_cast<size_t>(sqlite3_column_bytes(stmt, col))) : std::string_view();
+    };
+
+    auto optText = [&](int col) -> std::optional<std::string_view>
+    {
+        if (sqlite3_column_type(stmt, col) == SQLITE_NULL) return std::nullopt;
+        return text(col);
+    };
+
+    if (sqlite3_column_type(stmt, 0) != SQLITE_NULL) row.id = sqlite3_column_int64(stmt, 0);
+
+    row.user_id = sqlite3_column_int64(stmt, 1);
+    row.folder_id = sqlite3_column_int64(stmt, 2);
+    row.uid = sqlite3_column_int64(stmt, 3);
+
+    row.raw_file_path = text(4);
+    row.size_bytes = sqlite3_column_int64(stmt, 5);
+    row.mime_structure = optText(6);
+
+    row.message_id_header = optText(7);
+    row.in_reply_to = optText(8);
+    row.references_header = optText(9);
+    row.from_address = text(10);
+    row.sender_address = optText(11);
+    row.subject = optText(12);
+
+    row.flags = static_cast<uint32_t>(sqlite3_column_int(stmt, 13));
+
+    row.internal_date = text(14);
+    row.date_header = optText(15);
+    row.modseq = sqlite3_column_int64(stmt, 16);
+    if (sqlite3_column_type(stmt, 17) != SQLITE_NULL) row.thread_id = sqlite3_column_int64(stmt, 17);
+    row.sort_subject = text(18);
+    row.keywords = text(19);
+
+    rows.push_back(row);
+}
+
+MessageRowSet MessageDAL::fetchRowSet(sqlite3_stmt* stmt, size_t expected_rows) const
+{
+    MessageRowSet rows(expected_rows);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        appendRow(rows, stmt);
+    return rows;
 }
 
 std::optional<Message> MessageDAL::findByID(int64_t id) const
@@ -85,17 +473,16 @@ std::optional<Message> MessageDAL::findByID(int64_t id) const
     ReadGuard g(m_pool);
     const char* sql = MESSAGE_SELECT "WHERE id = ? LIMIT 1;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return std::nullopt;
 
-	sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_bind_int64(stmt, 1, id);
 
-	std::optional<Message> result;
-	if (sqlite3_step(stmt) == SQLITE_ROW) result = rowToMessage(stmt);
+    std::optional<Message> result;
+    if (sqlite3_step(stmt) == SQLITE_ROW) result = rowToMessage(stmt);
 
-	sqlite3_finalize(stmt);
-	return result;
+    return result;
 }
 
 std::optional<Message> MessageDAL::findByUID(int64_t folder_id, int64_t uid) const
@@ -103,27 +490,26 @@ std::optional<Message> MessageDAL::findByUID(int64_t folder_id, int64_t uid) con
     ReadGuard g(m_pool);
     const char* sql = MESSAGE_SELECT "WHERE folder_id = ? AND uid = ? LIMIT 1;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return std::nullopt;
 
-	sqlite3_bind_int64(stmt, 1, folder_id);
-	sqlite3_bind_int64(stmt, 2, uid);
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    sqlite3_bind_int64(stmt, 2, uid);
 
-	std::optional<Message> result;
-	if (sqlite3_step(stmt) == SQLITE_ROW) result = rowToMessage(stmt);
+    std::optional<Message> result;
+    if (sqlite3_step(stmt) == SQLITE_ROW) result = rowToMessage(stmt);
 
-	sqlite3_finalize(stmt);
-	return result;
+    return result;
 }
 
 std::vector<Message> MessageDAL::findByUser(int64_t user_id, int limit, int offset) const
 {
     ReadGuard g(m_pool);
-    const char* sql = MESSAGE_SELECT "WHERE user_id = ? ORDER BY internal_date DESC LIMIT ? OFFSET ?;";
+    const char* sql = MESSAGE_SELECT "WHERE user_id = ? ORDER BY internal_date DESC, id DESC LIMIT ? OFFSET ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     sqlite3_bind_int64(stmt, 1, user_id);
@@ -132,13 +518,31 @@ std::vector<Message> MessageDAL::findByUser(int64_t user_id, int limit, int offs
     return fetchRows(stmt);
 }
 
+std::vector<Message> MessageDAL::findByUserBefore(int64_t user_id, const std::string& before_date, int64_t before_id,
+                                                  int limit) const
+{
+    ReadGuard g(m_pool);
+    const char* sql = MESSAGE_SELECT "WHERE user_id = ? AND (internal_date, id) < (?, ?) "
+                      "ORDER BY internal_date DESC, id DESC LIMIT ?;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return {};
+
+    sqlite3_bind_int64(stmt, 1, user_id);
+    sqlite3_bind_text(stmt, 2, before_date.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 3, before_id);
+    sqlite3_bind_int(stmt, 4, limit);
+    return fetchRows(stmt);
+}
+
 std::vector<Message> MessageDAL::findByFolder(int64_t folder_id, int limit, int offset) const
 {
     ReadGuard g(m_pool);
     const char* sql = MESSAGE_SELECT "WHERE folder_id = ? ORDER BY uid ASC LIMIT ? OFFSET ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     sqlite3_bind_int64(stmt, 1, folder_id);
@@ -147,13 +551,28 @@ std::vector<Message> MessageDAL::findByFolder(int64_t folder_id, int limit, int
     return fetchRows(stmt);
 }
 
+MessageRowSet MessageDAL::findByFolderAfter(int64_t folder_id, int64_t after_uid, int limit) const
+{
+    ReadGuard g(m_pool);
+    const char* sql = MESSAGE_SELECT "WHERE folder_id = ? AND uid > ? ORDER BY uid ASC LIMIT ?;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return MessageRowSet(0);
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    sqlite3_bind_int64(stmt, 2, after_uid);
+    sqlite3_bind_int(stmt, 3, limit);
+    return fetchRowSet(stmt, static_cast<size_t>(std::max(limit, 0)));
+}
+
 std::vector<Message> MessageDAL::findUnseen(int64_t folder_id, int limit, int offset) const
 {
     ReadGuard g(m_pool);
-    const char* sql = MESSAGE_SELECT "WHERE folder_id = ? AND is_seen = 0 ORDER BY uid ASC LIMIT ? OFFSET ?;";
+    const char* sql = MESSAGE_SELECT "WHERE folder_id = ? AND (flags & 1) = 0 ORDER BY uid ASC LIMIT ? OFFSET ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     sqlite3_bind_int64(stmt, 1, folder_id);
@@ -162,13 +581,28 @@ std::vector<Message> MessageDAL::findUnseen(int64_t folder_id, int limit, int of
     return fetchRows(stmt);
 }
 
+std::vector<Message> MessageDAL::findUnseenAfter(int64_t folder_id, int64_t after_uid, int limit) const
+{
+    ReadGuard g(m_pool);
+    const char* sql = MESSAGE_SELECT "WHERE folder_id = ? AND (flags & 1) = 0 AND uid > ? ORDER BY uid ASC LIMIT ?;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return {};
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    sqlite3_bind_int64(stmt, 2, after_uid);
+    sqlite3_bind_int(stmt, 3, limit);
+    return fetchRows(stmt);
+}
+
 std::vector<Message> MessageDAL::findDeleted(int64_t folder_id, int limit, int offset) const
 {
     ReadGuard g(m_pool);
-    const char* sql = MESSAGE_SELECT "WHERE folder_id = ? AND is_deleted = 1 ORDER BY uid ASC LIMIT ? OFFSET ?;";
+    const char* sql = MESSAGE_SELECT "WHERE folder_id = ? AND (flags & 2) <> 0 ORDER BY uid ASC LIMIT ? OFFSET ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     sqlite3_bind_int64(stmt, 1, folder_id);
@@ -180,10 +614,10 @@ std::vector<Message> MessageDAL::findDeleted(int64_t folder_id, int limit, int o
 std::vector<Message> MessageDAL::findFlagged(int64_t folder_id, int limit, int offset) const
 {
     ReadGuard g(m_pool);
-    const char* sql = MESSAGE_SELECT "WHERE folder_id = ? AND is_flagged = 1 ORDER BY uid ASC LIMIT ? OFFSET ?;";
+    const char* sql = MESSAGE_SELECT "WHERE folder_id = ? AND (flags & 16) <> 0 ORDER BY uid ASC LIMIT ? OFFSET ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     sqlite3_bind_int64(stmt, 1, folder_id);
@@ -199,8 +633,9 @@ std::vector<Message> MessageDAL::search(int64_t user_id, const std::string& quer
         "WHERE user_id = ? AND (subject LIKE ? OR from_address LIKE ?) "
         "ORDER BY internal_date DESC LIMIT ? OFFSET ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    // Plain substring match, as the API and MUA always had; messages_fts only backs IMAP SEARCH.
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     std::string pattern = "%" + query + "%";
@@ -212,27 +647,316 @@ std::vector<Message> MessageDAL::search(int64_t user_id, const std::string& quer
     return fetchRows(stmt);
 }
 
-bool MessageDAL::insert(Message& msg)
+std::vector<MessageFlagsRow> MessageDAL::findChangedSince(int64_t folder_id, int64_t modseq) const
+{
+    ReadGuard g(m_pool);
+    const char* sql = MESSAGE_FLAGS_SELECT "WHERE folder_id = ? AND modseq > ? ORDER BY uid ASC;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return {};
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    sqlite3_bind_int64(stmt, 2, modseq);
+
+    std::vector<MessageFlagsRow> result;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        result.push_back(rowToFlags(stmt));
+    return result;
+}
+
+std::optional<MessageFlagsRow> MessageDAL::findFlagsByID(int64_t id) const
+{
+    ReadGuard g(m_pool);
+    const char* sql = MESSAGE_FLAGS_SELECT "WHERE id = ? LIMIT 1;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return std::nullopt;
+
+    sqlite3_bind_int64(stmt, 1, id);
+
+    std::optional<MessageFlagsRow> result;
+    if (sqlite3_step(stmt) == SQLITE_ROW) result = rowToFlags(stmt);
+    return result;
+}
+
+std::vector<MessageHeaderRow> MessageDAL::findHeaderRows(int64_t folder_id,
+                                                         const std::vector<std::pair<int64_t, int64_t>>& uid_ranges) const
+{
+    SearchCriteria in_set = SearchCriteria::leaf(SearchCriteria::Type::Uid);
+    in_set.ranges = uid_ranges;
+
+    std::string sql = MESSAGE_HEADER_SELECT "WHERE folder_id = ? AND ";
+    std::vector<SqlBind> binds;
+    compileCriteria(in_set, folder_id, sql, binds);
+    sql += " ORDER BY uid ASC;";
+
+    ReadGuard g(m_pool);
+    Statement stmt(g.db(), sql);
+    if (!stmt)
+        return {};
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    bindAll(stmt, binds, 2);
+
+    std::vector<MessageHeaderRow> result;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        result.push_back(rowToHeader(stmt));
+    return result;
+}
+
+std::optional<std::vector<int64_t>> MessageDAL::findExpungedSince(int64_t folder_id, int64_t modseq) const
+{
+    ReadGuard g(m_pool);
+    {
+        Statement floor(m_pool, g.db(), "SELECT expunged_modseq FROM folders WHERE id = ?;");
+        if (!floor)
+            return std::nullopt;
+
+        sqlite3_bind_int64(floor, 1, folder_id);
+        if (sqlite3_step(floor) == SQLITE_ROW && modseq < sqlite3_column_int64(floor, 0))
+            return std::nullopt;
+    }
+
+    const char* sql = "SELECT uid FROM expunged_messages WHERE folder_id = ? AND modseq > ? ORDER BY uid ASC;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return std::vector<int64_t>{};
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    sqlite3_bind_int64(stmt, 2, modseq);
+
+    std::vector<int64_t> uids;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        uids.push_back(sqlite3_column_int64(stmt, 0));
+
+    return uids;
+}
+
+std::vector<MessagePart> MessageDAL::findParts(int64_t message_id) const
+{
+    ReadGuard g(m_pool);
+    const char* sql = "SELECT section, header_start, body_start, body_end FROM message_parts "
+                      "WHERE message_id = ? ORDER BY section ASC;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return {};
+
+    sqlite3_bind_int64(stmt, 1, message_id);
+
+    std::vector<MessagePart> parts;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        MessagePart part;
+        part.message_id = message_id;
+        part.section = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        part.header_start = sqlite3_column_int64(stmt, 1);
+        part.body_start = sqlite3_column_int64(stmt, 2);
+        part.body_end = sqlite3_column_int64(stmt, 3);
+        parts.push_back(std::move(part));
+    }
+
+    return parts;
+}
+
+std::vector<int64_t> MessageDAL::findUIDsByFolder(int64_t folder_id) const
 {
-	const char* sql = "INSERT INTO messages "
-					  "  (user_id, folder_id, uid, raw_file_path, size_bytes, mime_structure, "
-					  "   message_id_header, in_reply_to, references_header, "
-					  "   from_address, sender_address, subject, "
-					  "   is_seen, is_deleted, is_draft, is_answered, is_flagged, is_recent, "
-					  "   internal_date, date_header) "
-					  "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+    ReadGuard g(m_pool);
+    const char* sql = "SELECT uid FROM messages WHERE folder_id = ? ORDER BY uid ASC;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return {};
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+
+    std::vector<int64_t> uids;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        uids.push_back(sqlite3_column_int64(stmt, 0));
+
+    return uids;
+}
+
+FolderStatus MessageDAL::statusByFolder(int64_t folder_id) const
+{
+    ReadGuard g(m_pool);
+    const char* sql = "SELECT messages, recent, unseen, deleted, total_bytes FROM folder_stats WHERE folder_id = ?;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return {};
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+
+    // no row yet means the folder never held a message
+    if (sqlite3_step(stmt) != SQLITE_ROW)
+        return {};
+
+    return rowToStatus(stmt, 0);
+}
+
+std::unordered_map<int64_t, FolderStatus> MessageDAL::statusByUser(int64_t user_id) const
+{
+    ReadGuard g(m_pool);
+    const char* sql = "SELECT s.folder_id, s.messages, s.recent, s.unseen, s.deleted, s.total_bytes "
+                      "FROM folders f JOIN folder_stats s ON s.folder_id = f.id WHERE f.user_id = ?;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return {};
+
+    sqlite3_bind_int64(stmt, 1, user_id);
+
+    std::unordered_map<int64_t, FolderStatus> statuses;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        statuses[sqlite3_column_int64(stmt, 0)] = rowToStatus(stmt, 1);
+
+    return statuses;
+}
+
+std::vector<int64_t> MessageDAL::searchUIDs(int64_t folder_id, const SearchCriteria& criteria) const
+{
+    std::string sql = "SELECT uid FROM messages WHERE folder_id = ? AND ";
+    std::vector<SqlBind> binds;
+    compileCriteria(criteria, folder_id, sql, binds);
+    sql += " ORDER BY uid ASC;";
+
+    ReadGuard g(m_pool);
+    Statement stmt(g.db(), sql);
+    if (!stmt)
+    {
+        m_last_error = sqlite3_errmsg(g.db());
+        return {};
+    }
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    bindAll(stmt, binds, 2);
+
+    std::vector<int64_t> uids;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        uids.push_back(sqlite3_column_int64(stmt, 0));
+
+    return uids;
+}
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+std::vector<int64_t> MessageDAL::sortUIDs(int64_t folder_id, const SearchCriteria& criteria,
+                                          const std::vector<SortKey>& keys) const
+{
+    std::string sql = "SELECT uid FROM messages WHERE folder_id = ? AND ";
+    std::vector<SqlBind> binds;
+    compileCriteria(criteria, folder_id, sql, binds);
+
+    sql += " ORDER BY ";
+    for (const auto& key : keys)
+    {
+        sql += sortColumn(key.field);
+        sql += key.reverse ? " DESC, " : " ASC, ";
+    }
+    sql += "uid ASC;";
+
+    ReadGuard g(m_pool);
+    Statement stmt(g.db(), sql);
+    if (!stmt)
+    {
+        m_last_error = sqlite3_errmsg(g.db());
+        return {};
+    }
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    bindAll(stmt, binds, 2);
+
+    std::vector<int64_t> uids;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        uids.push_back(sqlite3_column_int64(stmt, 0));
+
+    return uids;
+}
+
+MessageRowSet MessageDAL::searchMessages(int64_t folder_id, const SearchCriteria& criteria) const
+{
+    std::string sql = MESSAGE_SELECT "WHERE folder_id = ? AND ";
+    std::vector<SqlBind> binds;
+    compileCriteria(criteria, folder_id, sql, binds);
+    sql += " ORDER BY internal_date ASC, uid ASC;";
+
+    ReadGuard g(m_pool);
+    Statement stmt(g.db(), sql);
+    if (!stmt)
+    {
+        m_last_error = sqlite3_errmsg(g.db());
+        return MessageRowSet(0);
+    }
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    bindAll(stmt, binds, 2);
+
+    return fetchRowSet(stmt, 0);
+}
+
+std::optional<int64_t> MessageDAL::findThreadID(int64_t user_id, const std::optional<std::string>& in_reply_to,
+                                                const std::optional<std::string>& references) const
+{
+    // nearest ancestor first: the direct parent, then References from the last entry backwards
+    std::vector<std::string> candidates;
+    if (in_reply_to.has_value() && !in_reply_to->empty())
+        candidates.push_back(*in_reply_to);
+    if (references.has_value())
+    {
+        std::istringstream iss(*references);
+        std::vector<std::string> refs;
+        for (std::string ref; iss >> ref;)
+            refs.push_back(ref);
+        candidates.insert(candidates.end(), refs.rbegin(), refs.rend());
+    }
+    if (candidates.empty()) return std::nullopt;
+
+    ReadGuard g(m_pool);
+    const char* sql = "SELECT thread_id FROM messages "
+                      "WHERE message_id_header = ? AND user_id = ? AND thread_id IS NOT NULL LIMIT 1;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return std::nullopt;
+
+    std::optional<int64_t> thread_id;
+    for (const auto& candidate : candidates)
+    {
+        sqlite3_bind_text(stmt, 1, candidate.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, user_id);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            thread_id = sqlite3_column_int64(stmt, 0);
+            break;
+        }
+        sqlite3_reset(stmt);
+    }
+
+    return thread_id;
+}
+
+bool MessageDAL::insert(Message& msg)
+{
+    const char* sql = "INSERT INTO messages "
+                      "  (user_id, folder_id, uid, raw_file_path, size_bytes, mime_structure, "
+                      "   message_id_header, in_reply_to, references_header, "
+                      "   from_address, sender_address, subject, "
+                      "   flags, internal_date, date_header, thread_id, sort_subject) "
+                      "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
-	auto bindOptText = [&](int col, const std::optional<std::string>& val)
-	{
-		if (val.has_value())
-			sqlite3_bind_text(stmt, col, val->c_str(), -1, SQLITE_TRANSIENT);
-		else
-			sqlite3_bind_null(stmt, col);
-	};
+    auto bindOptText = [&](int col, const std::optional<std::string>& val)
+    {
+        if (val.has_value())
+            sqlite3_bind_text(stmt, col, val->c_str(), -1, SQLITE_TRANSIENT);
+        else
+            sqlite3_bind_null(stmt, col);
+    };
 
     sqlite3_bind_int64(stmt, 1, msg.user_id);
     sqlite3_bind_int64(stmt, 2, msg.folder_id);
@@ -246,14 +970,15 @@ bool MessageDAL::insert(Message& msg)
     sqlite3_bind_text(stmt, 10, msg.from_address.c_str(), -1, SQLITE_TRANSIENT);
     bindOptText(11, msg.sender_address);
     bindOptText(12, msg.subject);
-    sqlite3_bind_int(stmt, 13, msg.is_seen     ? 1 : 0);
-    sqlite3_bind_int(stmt, 14, msg.is_deleted  ? 1 : 0);
-    sqlite3_bind_int(stmt, 15, msg.is_draft    ? 1 : 0);
-    sqlite3_bind_int(stmt, 16, msg.is_answered ? 1 : 0);
-    sqlite3_bind_int(stmt, 17, msg.is_flagged  ? 1 : 0);
-    sqlite3_bind_int(stmt, 18, msg.is_recent   ? 1 : 0);
-    sqlite3_bind_text(stmt, 19, msg.internal_date.c_str(), -1, SQLITE_TRANSIENT);
-    bindOptText(20, msg.date_header);
+    sqlite3_bind_int64(stmt, 13, flagsOf(msg));
+    sqlite3_bind_text(stmt, 14, msg.internal_date.c_str(), -1, SQLITE_TRANSIENT);
+    bindOptText(15, msg.date_header);
+    if (msg.thread_id.has_value())
+        sqlite3_bind_int64(stmt, 16, msg.thread_id.value());
+    else
+        sqlite3_bind_null(stmt, 16);
+    msg.sort_subject = baseSubject(msg.subject.value_or(""));
+    sqlite3_bind_text(stmt, 17, msg.sort_subject.c_str(), -1, SQLITE_TRANSIENT);
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (ok)
@@ -261,35 +986,47 @@ bool MessageDAL::insert(Message& msg)
     else
         setError(sqlite3_errmsg(m_write_conn));
 
-	sqlite3_finalize(stmt);
-	return ok;
+    // modseq and a new thread root are stamped by insert triggers, read them back so the caller sees them
+    if (ok)
+    {
+        const char* back_sql = "SELECT modseq, thread_id FROM messages WHERE id = ?;";
+        Statement q(m_pool, m_write_conn, back_sql);
+        if (q)
+        {
+            sqlite3_bind_int64(q, 1, msg.id.value());
+            if (sqlite3_step(q) == SQLITE_ROW)
+            {
+                msg.modseq = sqlite3_column_int64(q, 0);
+                msg.thread_id = sqlite3_column_int64(q, 1);
+            }
+        }
+    }
+    return ok;
 }
 
 bool MessageDAL::update(const Message& msg)
 {
-	if (!msg.id.has_value()) return setError("update() called on a Message with no id");
-
-	const char* sql = "UPDATE messages SET "
-					  "  user_id = ?, folder_id = ?, uid = ?, "
-					  "  raw_file_path = ?, size_bytes = ?, mime_structure = ?, "
-					  "  message_id_header = ?, in_reply_to = ?, references_header = ?, "
-					  "  from_address = ?, sender_address = ?, subject = ?, "
-					  "  is_seen = ?, is_deleted = ?, is_draft = ?, "
-					  "  is_answered = ?, is_flagged = ?, is_recent = ?, "
-					  "  internal_date = ?, date_header = ? "
-					  "WHERE id = ?;";
-
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    if (!msg.id.has_value()) return setError("update() called on a Message with no id");
+
+    const char* sql = "UPDATE messages SET "
+                      "  user_id = ?, folder_id = ?, uid = ?, "
+                      "  raw_file_path = ?, size_bytes = ?, mime_structure = ?, "
+                      "  message_id_header = ?, in_reply_to = ?, references_header = ?, "
+                      "  from_address = ?, sender_address = ?, subject = ?, "
+                      "  flags = ?, internal_date = ?, date_header = ?, sort_subject = ? "
+                      "WHERE id = ?;";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
-	auto bindOptText = [&](int col, const std::optional<std::string>& val)
-	{
-		if (val.has_value())
-			sqlite3_bind_text(stmt, col, val->c_str(), -1, SQLITE_TRANSIENT);
-		else
-			sqlite3_bind_null(stmt, col);
-	};
+    auto bindOptText = [&](int col, const std::optional<std::string>& val)
+    {
+        if (val.has_value())
+            sqlite3_bind_text(stmt, col, val->c_str(), -1, SQLITE_TRANSIENT);
+        else
+            sqlite3_bind_null(stmt, col);
+    };
 
     sqlite3_bind_int64(stmt, 1, msg.user_id);
     sqlite3_bind_int64(stmt, 2, msg.folder_id);
@@ -303,128 +1040,288 @@ bool MessageDAL::update(const Message& msg)
     sqlite3_bind_text(stmt, 10, msg.from_address.c_str(), -1, SQLITE_TRANSIENT);
     bindOptText(11, msg.sender_address);
     bindOptText(12, msg.subject);
-    sqlite3_bind_int(stmt, 13, msg.is_seen     ? 1 : 0);
-    sqlite3_bind_int(stmt, 14, msg.is_deleted  ? 1 : 0);
-    sqlite3_bind_int(stmt, 15, msg.is_draft    ? 1 : 0);
-    sqlite3_bind_int(stmt, 16, msg.is_answered ? 1 : 0);
-    sqlite3_bind_int(stmt, 17, msg.is_flagged  ? 1 : 0);
-    sqlite3_bind_int(stmt, 18, msg.is_recent   ? 1 : 0);
-    sqlite3_bind_text(stmt, 19, msg.internal_date.c_str(), -1, SQLITE_TRANSIENT);
-    bindOptText(20, msg.date_header);
-    sqlite3_bind_int64(stmt, 21, msg.id.value());
+    sqlite3_bind_int64(stmt, 13, flagsOf(msg));
+    sqlite3_bind_text(stmt, 14, msg.internal_date.c_str(), -1, SQLITE_TRANSIENT);
+    bindOptText(15, msg.date_header);
+    std::string sort_subject = baseSubject(msg.subject.value_or(""));
+    sqlite3_bind_text(stmt, 16, sort_subject.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 17, msg.id.value());
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-	sqlite3_finalize(stmt);
-	return ok;
+    return ok;
+}
+
+bool MessageDAL::adoptReplies(int64_t user_id, const std::string& message_id_header, int64_t thread_id)
+{
+    // replies that arrived before their parent started threads of their own; fold them in
+    const char* sql = "UPDATE messages SET thread_id = ?1 "
+                      "WHERE user_id = ?2 AND thread_id IN ("
+                      "  SELECT id FROM messages "
+                      "  WHERE in_reply_to = ?3 AND user_id = ?2 AND thread_id = id AND id <> ?1);";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_int64(stmt, 1, thread_id);
+    sqlite3_bind_int64(stmt, 2, user_id);
+    sqlite3_bind_text(stmt, 3, message_id_header.c_str(), -1, SQLITE_TRANSIENT);
+
+    bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
+    if (!ok) setError(sqlite3_errmsg(m_write_conn));
+
+    return ok;
+}
+
+std::string MessageDAL::baseSubject(const std::string& subject)
+{
+    // RFC 5256, section 2.1: lower-cased, whitespace collapsed, reply/forward markers removed
+    std::string s;
+    for (char c : subject)
+    {
+        char ch = std::isspace(static_cast<unsigned char>(c)) ? ' ' : static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        if (ch == ' ' && (s.empty() || s.back() == ' ')) continue;
+        s += ch;
+    }
+
+    auto trim = [](std::string& str)
+    {
+        size_t start = str.find_first_not_of(' ');
+        size_t end = str.find_last_not_of(' ');
+        str = (start == std::string::npos) ? "" : str.substr(start, end - start + 1);
+    };
+
+    // position just past a "[...]" blob starting at pos, or npos
+    auto skipBlob = [&](size_t pos) -> size_t
+    {
+        if (pos >= s.size() || s[pos] != '[') return std::string::npos;
+        size_t close = s.find(']', pos);
+        if (close == std::string::npos || s.find('[', pos + 1) < close) return std::string::npos;
+        close++;
+        while (close < s.size() && s[close] == ' ') close++;
+        return close;
+    };
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        trim(s);
+
+        while (s.size() >= 5 && s.compare(s.size() - 5, 5, "(fwd)") == 0)
+        {
+            s.erase(s.size() - 5);
+            trim(s);
+            changed = true;
+        }
+
+        // subj-leader: *subj-blob subj-refwd, where subj-refwd = ("re" / "fw" / "fwd") [subj-blob] ":"
+        size_t pos = 0;
+        for (size_t next; (next = skipBlob(pos)) != std::string::npos;)
+            pos = next;
+
+        size_t after = std::string::npos;
+        for (const char* marker : {"fwd", "fw", "re"})
+        {
+            size_t len = std::char_traits<char>::length(marker);
+            if (s.compare(pos, len, marker) != 0) continue;
+            size_t p = pos + len;
+            while (p < s.size() && s[p] == ' ') p++;
+            if (size_t blob_end = skipBlob(p); blob_end != std::string::npos) p = blob_end;
+            if (p < s.size() && s[p] == ':')
+            {
+                after = p + 1;
+                break;
+            }
+        }
+
+        if (after != std::string::npos)
+        {
+            s.erase(0, after);
+            changed = true;
+        }
+        else if (size_t blob_end = skipBlob(0); blob_end != std::string::npos && blob_end < s.size())
+        {
+            // a leading blob goes only if something remains after it
+            s.erase(0, blob_end);
+            changed = true;
+        }
+
+        if (!changed && s.size() > 6 && s.compare(0, 5, "[fwd:") == 0 && s.back() == ']')
+        {
+            s = s.substr(5, s.size() - 6);
+            changed = true;
+        }
+    }
+
+    return s;
 }
 
 bool MessageDAL::updateSeen(int64_t id, bool seen)
 {
-	const char* sql = "UPDATE messages SET is_seen = ? WHERE id = ?;";
+    const char* sql = "UPDATE messages SET flags = (flags & ~1) | ? WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_bind_int(stmt, 1, seen ? 1 : 0);
+    sqlite3_bind_int64(stmt, 1, seen ? MessageFlags::Seen : 0);
     sqlite3_bind_int64(stmt, 2, id);
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-	sqlite3_finalize(stmt);
-	return ok;
+    return ok;
 }
 
 bool MessageDAL::updateDeleted(int64_t id, bool deleted)
 {
-	const char* sql = "UPDATE messages SET is_deleted = ? WHERE id = ?;";
+    const char* sql = "UPDATE messages SET flags = (flags & ~2) | ? WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_bind_int(stmt, 1, deleted ? 1 : 0);
+    sqlite3_bind_int64(stmt, 1, deleted ? MessageFlags::Deleted : 0);
     sqlite3_bind_int64(stmt, 2, id);
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-	sqlite3_finalize(stmt);
-	return ok;
+    return ok;
 }
 
 bool MessageDAL::updateFlags(int64_t id, bool is_seen, bool is_deleted, bool is_draft, bool is_answered,
-							 bool is_flagged, bool is_recent)
+                             bool is_flagged, bool is_recent)
 {
-	const char* sql = "UPDATE messages SET "
-					  "  is_seen = ?, is_deleted = ?, is_draft = ?, "
-					  "  is_answered = ?, is_flagged = ?, is_recent = ? "
-					  "WHERE id = ?;";
+    const char* sql = "UPDATE messages SET flags = ? WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_bind_int(stmt, 1, is_seen     ? 1 : 0);
-    sqlite3_bind_int(stmt, 2, is_deleted  ? 1 : 0);
-    sqlite3_bind_int(stmt, 3, is_draft    ? 1 : 0);
-    sqlite3_bind_int(stmt, 4, is_answered ? 1 : 0);
-    sqlite3_bind_int(stmt, 5, is_flagged  ? 1 : 0);
-    sqlite3_bind_int(stmt, 6, is_recent   ? 1 : 0);
-    sqlite3_bind_int64(stmt, 7, id);
+    uint32_t flags = (is_seen ? MessageFlags::Seen : 0) | (is_deleted ? MessageFlags::Deleted : 0) |
+                     (is_draft ? MessageFlags::Draft : 0) | (is_answered ? MessageFlags::Answered : 0) |
+                     (is_flagged ? MessageFlags::Flagged : 0) | (is_recent ? MessageFlags::Recent : 0);
+    sqlite3_bind_int64(stmt, 1, flags);
+    sqlite3_bind_int64(stmt, 2, id);
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-	sqlite3_finalize(stmt);
-	return ok;
+    return ok;
 }
 
 bool MessageDAL::moveToFolder(int64_t id, int64_t folder_id, int64_t new_uid)
 {
     const char* sql = "UPDATE messages SET folder_id = ?, uid = ? WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
-	sqlite3_bind_int64(stmt, 1, folder_id);
-	sqlite3_bind_int64(stmt, 2, new_uid);
-	sqlite3_bind_int64(stmt, 3, id);
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    sqlite3_bind_int64(stmt, 2, new_uid);
+    sqlite3_bind_int64(stmt, 3, id);
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-	sqlite3_finalize(stmt);
-	return ok;
+    return ok;
+}
+
+bool MessageDAL::pruneExpunged(int64_t folder_id, int64_t keep)
+{
+    // the modseq of the newest tombstone past the kept ones becomes the floor
+    const char* floor_sql = "UPDATE folders SET expunged_modseq = max(expunged_modseq, coalesce(("
+                            "  SELECT modseq FROM expunged_messages WHERE folder_id = ?1 "
+                            "  ORDER BY modseq DESC LIMIT 1 OFFSET ?2), 0)) "
+                            "WHERE id = ?1;";
+    const char* prune_sql = "DELETE FROM expunged_messages WHERE folder_id = ?1 "
+                            "AND modseq <= (SELECT expunged_modseq FROM folders WHERE id = ?1);";
+
+    for (const char* sql : {floor_sql, prune_sql})
+    {
+        Statement stmt(m_pool, m_write_conn, sql);
+        if (!stmt)
+            return setError(sqlite3_errmsg(m_write_conn));
+
+        sqlite3_bind_int64(stmt, 1, folder_id);
+        if (sql == floor_sql) sqlite3_bind_int64(stmt, 2, keep);
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+            return setError(sqlite3_errmsg(m_write_conn));
+    }
+    return true;
 }
 
 bool MessageDAL::hardDelete(int64_t id)
 {
-	const char* sql = "DELETE FROM messages WHERE id = ?;";
+    const char* sql = "DELETE FROM messages WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
-	sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_bind_int64(stmt, 1, id);
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
+    return ok;
+}
+
+bool MessageDAL::expungeDeleted(int64_t folder_id, std::vector<std::pair<int64_t, std::string>>& removed)
+{
+    const char* sql = "DELETE FROM messages WHERE folder_id = ? AND (flags & 2) <> 0 RETURNING uid, raw_file_path;";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        auto path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        removed.emplace_back(sqlite3_column_int64(stmt, 0), path ? path : "");
+    }
+
+    bool ok = (rc == SQLITE_DONE);
+    if (!ok) setError(sqlite3_errmsg(m_write_conn));
+
+    // RETURNING order is unspecified
+    std::sort(removed.begin(), removed.end());
+    return ok;
+}
+
+bool MessageDAL::isFileReferenced(const std::string& raw_file_path, bool& referenced)
+{
+    const char* sql = "SELECT 1 FROM messages WHERE raw_file_path = ? LIMIT 1;";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_text(stmt, 1, raw_file_path.c_str(), -1, SQLITE_TRANSIENT);
+
+    int rc = sqlite3_step(stmt);
+    referenced = (rc == SQLITE_ROW);
+    bool ok = (rc == SQLITE_ROW || rc == SQLITE_DONE);
+    if (!ok) setError(sqlite3_errmsg(m_write_conn));
+
     return ok;
 }
 
 bool MessageDAL::clearRecentByFolder(int64_t folder_id)
 {
-    const char* sql = "UPDATE messages SET is_recent = 0 WHERE folder_id = ?;";
+    // rows already without \\Recent are left alone, so reselecting a folder writes nothing
+    const char* sql = "UPDATE messages SET flags = flags & ~32 WHERE folder_id = ? AND (flags & 32) <> 0;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int64(stmt, 1, folder_id);
@@ -432,6 +1329,311 @@ bool MessageDAL::clearRecentByFolder(int64_t folder_id)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-	sqlite3_finalize(stmt);
-	return ok;
-}
\ No newline at end of file
+    return ok;
+}
+
+bool MessageDAL::indexContent(int64_t id, const std::string& to, const std::string& cc, const std::string& body)
+{
+    const char* sql = "UPDATE messages_fts SET to_address = ?, cc_address = ?, body = ? WHERE rowid = ?;";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_text(stmt, 1, to.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, cc.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, body.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 4, id);
+
+    bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
+    if (!ok) setError(sqlite3_errmsg(m_write_conn));
+
+    return ok;
+}
+
+bool MessageDAL::copyIndexedContent(int64_t source_id, int64_t target_id)
+{
+    const char* sql = "UPDATE messages_fts SET (to_address, cc_address, body) = "
+                      "  (SELECT to_address, cc_address, body FROM messages_fts WHERE rowid = ?) "
+                      "WHERE rowid = ?;";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_int64(stmt, 1, source_id);
+    sqlite3_bind_int64(stmt, 2, target_id);
+
+    bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
+    if (!ok) setError(sqlite3_errmsg(m_write_conn));
+
+    return ok;
+}
+
+bool MessageDAL::insertParts(int64_t message_id, const std::vector<MessagePart>& parts)
+{
+    const char* sql = "INSERT OR REPLACE INTO message_parts "
+                      "  (message_id, section, header_start, body_start, body_end) VALUES (?, ?, ?, ?, ?);";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    bool ok = true;
+    for (const auto& part : parts)
+    {
+        sqlite3_bind_int64(stmt, 1, message_id);
+        sqlite3_bind_text(stmt, 2, part.section.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 3, part.header_start);
+        sqlite3_bind_int64(stmt, 4, part.body_start);
+        sqlite3_bind_int64(stmt, 5, part.body_end);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+        {
+            ok = setError(sqlite3_errmsg(m_write_conn));
+            break;
+        }
+        sqlite3_reset(stmt);
+    }
+
+    return ok;
+}
+
+bool MessageDAL::copyParts(int64_t source_id, int64_t target_id)
+{
+    const char* sql = "INSERT OR REPLACE INTO message_parts "
+                      "  (message_id, section, header_start, body_start, body_end) "
+                      "SELECT ?, section, header_start, body_start, body_end FROM message_parts WHERE message_id = ?;";
+
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_int64(stmt, 1, target_id);
+    sqlite3_bind_int64(stmt, 2, source_id);
+
+    bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
+    if (!ok) setError(sqlite3_errmsg(m_write_conn));
+
+    return ok;
+}
+
+bool MessageDAL::findUIDsInRanges(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                                  std::vector<int64_t>& uids)
+{
+    SearchCriteria in_set = SearchCriteria::leaf(SearchCriteria::Type::Uid);
+    in_set.ranges = uid_ranges;
+
+    std::string sql = "SELECT uid FROM messages WHERE folder_id = ? AND ";
+    std::vector<SqlBind> binds;
+    compileCriteria(in_set, folder_id, sql, binds);
+    sql += " ORDER BY uid ASC;";
+
+    Statement stmt(m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    bindAll(stmt, binds, 2);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        uids.push_back(sqlite3_column_int64(stmt, 0));
+
+    bool ok = (rc == SQLITE_DONE);
+    if (!ok) setError(sqlite3_errmsg(m_write_conn));
+
+    return ok;
+}
+
+// The copies reference the same raw_file_path, so no message file is touched. Recipients,
+// MIME part offsets and the indexed body follow through the (source id -> copy id) mapping,
+// which is recomputed from the reserved UID block for every statement.
+bool MessageDAL::copyRanges(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                            int64_t target_folder_id, int64_t first_uid)
+{
+    SearchCriteria in_set = SearchCriteria::leaf(SearchCriteria::Type::Uid);
+    in_set.ranges = uid_ranges;
+
+    std::string source = "SELECT ? + row_number() OVER (ORDER BY uid) - 1 AS new_uid, * "
+                         "FROM messages WHERE folder_id = ? AND ";
+    std::vector<SqlBind> binds;
+    compileCriteria(in_set, folder_id, source, binds);
+
+    const std::string mapping = "WITH src AS (" + source + "), "
+                                "map AS (SELECT src.id AS src_id, d.id AS dst_id FROM src "
+                                "        JOIN messages d ON d.folder_id = ? AND d.uid = src.new_uid) ";
+
+    const std::string statements[] = {
+        "WITH src AS (" + source + ") "
+        "INSERT INTO messages "
+        "  (user_id, folder_id, uid, raw_file_path, size_bytes, mime_structure, "
+        "   message_id_header, in_reply_to, references_header, "
+        "   from_address, sender_address, subject, "
+        "   flags, internal_date, date_header, thread_id, sort_subject) "
+        "SELECT user_id, ?, new_uid, raw_file_path, size_bytes, mime_structure, "
+        "       message_id_header, in_reply_to, references_header, "
+        "       from_address, sender_address, subject, "
+        "       flags, internal_date, date_header, thread_id, sort_subject "
+        "FROM src ORDER BY new_uid;",
+
+        mapping + "INSERT INTO recipients (message_id, address, type) "
+                  "SELECT map.dst_id, r.address, r.type FROM map JOIN recipients r ON r.message_id = map.src_id "
+                  "ORDER BY r.id;",
+
+        mapping + "INSERT OR REPLACE INTO message_parts "
+                  "  (message_id, section, header_start, body_start, body_end) "
+                  "SELECT map.dst_id, p.section, p.header_start, p.body_start, p.body_end "
+                  "FROM map JOIN message_parts p ON p.message_id = map.src_id;",
+
+        mapping + "INSERT INTO message_keywords (message_id, keyword_id) "
+                  "SELECT map.dst_id, mk.keyword_id FROM map JOIN message_keywords mk ON mk.message_id = map.src_id;",
+
+        mapping + "UPDATE messages_fts SET (to_address, cc_address, body) = "
+                  "  (SELECT s.to_address, s.cc_address, s.body FROM map "
+                  "   JOIN messages_fts s ON s.rowid = map.src_id WHERE map.dst_id = messages_fts.rowid) "
+                  "WHERE rowid IN (SELECT dst_id FROM map);",
+    };
+
+    for (const auto& sql : statements)
+    {
+        Statement stmt(m_write_conn, sql);
+        if (!stmt)
+            return setError(sqlite3_errmsg(m_write_conn));
+
+        // every statement starts with src(first_uid, folder_id, ranges...) followed by the target
+        sqlite3_bind_int64(stmt, 1, first_uid);
+        sqlite3_bind_int64(stmt, 2, folder_id);
+        bindAll(stmt, binds, 3);
+        sqlite3_bind_int64(stmt, static_cast<int>(binds.size()) + 3, target_folder_id);
+
+        bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
+        if (!ok) setError(sqlite3_errmsg(m_write_conn));
+
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// One UPDATE re-homes the whole set; trg_messages_modseq_move leaves the tombstones behind.
+bool MessageDAL::moveRanges(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                            int64_t target_folder_id, int64_t first_uid)
+{
+    SearchCriteria in_set = SearchCriteria::leaf(SearchCriteria::Type::Uid);
+    in_set.ranges = uid_ranges;
+
+    std::string sql = "UPDATE messages SET folder_id = ?, uid = ? + r.rn - 1 "
+                      "FROM (SELECT id, row_number() OVER (ORDER BY uid) AS rn "
+                      "      FROM messages WHERE folder_id = ? AND ";
+    std::vector<SqlBind> binds;
+    compileCriteria(in_set, folder_id, sql, binds);
+    sql += ") AS r WHERE messages.id = r.id;";
+
+    Statement stmt(m_write_conn, sql);
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_int64(stmt, 1, target_folder_id);
+    sqlite3_bind_int64(stmt, 2, first_uid);
+    sqlite3_bind_int64(stmt, 3, folder_id);
+    bindAll(stmt, binds, 4);
+
+    bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
+    if (!ok) setError(sqlite3_errmsg(m_write_conn));
+
+    return ok;
+}
+
+bool MessageDAL::updateKeywords(int64_t id, FlagOperation operation, const std::vector<std::string>& names)
+{
+    if (!applyKeywords(m_write_conn, "SELECT ? AS id", {id}, operation, names))
+        return setError(sqlite3_errmsg(m_write_conn));
+    return true;
+}
+
+// Runs on the write connection inside the caller's transaction, so the rows read back
+// already carry the mod-sequences stamped by trg_messages_modseq_flags.
+bool MessageDAL::updateFlagsBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                                 FlagOperation operation, uint32_t flags, const std::vector<std::string>& keywords,
+                                 std::optional<int64_t> unchanged_since, std::vector<MessageFlagsRow>& updated,
+                                 std::vector<int64_t>& modified)
+{
+    uint32_t set_mask   = operation == FlagOperation::Remove ? 0 : flags;
+    uint32_t clear_mask = operation == FlagOperation::Add ? 0
+                        : operation == FlagOperation::Remove ? flags
+                        : MessageFlags::All;
+
+    SearchCriteria in_set = SearchCriteria::leaf(SearchCriteria::Type::Uid);
+    in_set.ranges = uid_ranges;
+
+    std::string where = " WHERE folder_id = ? AND ";
+    std::vector<SqlBind> where_binds;
+    compileCriteria(in_set, folder_id, where, where_binds);
+
+    if (unchanged_since.has_value())
+    {
+        Statement stmt(m_write_conn, "SELECT uid FROM messages" + where + " AND modseq > ? ORDER BY uid ASC;");
+        if (!stmt)
+            return setError(sqlite3_errmsg(m_write_conn));
+
+        sqlite3_bind_int64(stmt, 1, folder_id);
+        bindAll(stmt, where_binds, 2);
+        sqlite3_bind_int64(stmt, static_cast<int>(where_binds.size()) + 2, unchanged_since.value());
+
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            modified.push_back(sqlite3_column_int64(stmt, 0));
+    }
+
+    std::string sql = "UPDATE messages SET flags = (flags & ~?) | ?" + where;
+    if (unchanged_since.has_value()) sql += " AND modseq <= ?";
+    sql += ";";
+
+    {
+        Statement stmt(m_write_conn, sql);
+        if (!stmt)
+            return setError(sqlite3_errmsg(m_write_conn));
+
+        sqlite3_bind_int64(stmt, 1, clear_mask);
+        sqlite3_bind_int64(stmt, 2, set_mask);
+        sqlite3_bind_int64(stmt, 3, folder_id);
+        bindAll(stmt, where_binds, 4);
+        if (unchanged_since.has_value())
+            sqlite3_bind_int64(stmt, 4 + static_cast<int>(where_binds.size()), unchanged_since.value());
+
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+            return setError(sqlite3_errmsg(m_write_conn));
+    }
+
+    // a replace without keywords still clears the ones the messages had
+    if (!keywords.empty() || operation == FlagOperation::Replace)
+    {
+        std::string target = "SELECT id FROM messages" + where;
+        std::vector<SqlBind> target_binds{folder_id};
+        target_binds.insert(target_binds.end(), where_binds.begin(), where_binds.end());
+        if (!modified.empty())
+        {
+            SearchCriteria skip = SearchCriteria::leaf(SearchCriteria::Type::Uid);
+            for (int64_t uid : modified) skip.ranges.emplace_back(uid, uid);
+            target += " AND NOT ";
+            compileCriteria(skip, folder_id, target, target_binds);
+        }
+
+        if (!applyKeywords(m_write_conn, target, target_binds, operation, keywords))
+            return setError(sqlite3_errmsg(m_write_conn));
+    }
+
+    Statement stmt(m_write_conn, MESSAGE_FLAGS_SELECT + where + " ORDER BY uid ASC;");
+    if (!stmt)
+        return setError(sqlite3_errmsg(m_write_conn));
+
+    sqlite3_bind_int64(stmt, 1, folder_id);
+    bindAll(stmt, where_binds, 2);
+
+    std::set<int64_t> skipped(modified.begin(), modified.end());
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        MessageFlagsRow row = rowToFlags(stmt);
+        if (skipped.count(row.uid) == 0) updated.push_back(row);
+    }
+    return true;
+}
@@ -4,9 +4,16 @@
 #include <optional>
 #include <string>
 #include <cstdint>
+#include <unordered_map>
 #include <sqlite3.h>
 
+#include "Entity/Folder.h"
 #include "Entity/Message.h"
+#include "Entity/MessageFlags.h"
+#include "Entity/MessagePart.h"
+#include "Entity/MessageRowSet.h"
+#include "Entity/MessageRows.h"
+#include "Entity/SearchCriteria.h"
 #include "ConnectionPool.h"
 
 class MessageDAL
@@ -19,9 +26,35 @@ public:
     std::vector<Message> findByUser(int64_t user_id, int limit = 50, int offset = 0) const;
     std::vector<Message> findByFolder(int64_t folder_id, int limit = 50, int offset = 0) const;
     std::vector<Message> findUnseen(int64_t folder_id, int limit = 50, int offset = 0) const;
+    // Keyset pages: pass the last row of the previous page instead of an offset, so deep
+    // pages cost the same as the first one
+    std::vector<Message> findByUserBefore(int64_t user_id, const std::string& before_date, int64_t before_id,
+                                          int limit = 50) const;
+    MessageRowSet findByFolderAfter(int64_t folder_id, int64_t after_uid, int limit = 50) const;
+    std::vector<Message> findUnseenAfter(int64_t folder_id, int64_t after_uid, int limit = 50) const;
     std::vector<Message> findDeleted(int64_t folder_id, int limit = 50, int offset = 0) const;
     std::vector<Message> findFlagged(int64_t folder_id, int limit = 50, int offset = 0) const;
     std::vector<Message> search(int64_t user_id, const std::string& query, int limit = 50, int offset = 0) const;
+    // Projections for folder-wide paths: only the columns of the row type are read
+    std::vector<MessageFlagsRow> findChangedSince(int64_t folder_id, int64_t modseq) const;
+    std::optional<MessageFlagsRow> findFlagsByID(int64_t id) const;
+    std::vector<MessageHeaderRow> findHeaderRows(int64_t folder_id,
+                                                 const std::vector<std::pair<int64_t, int64_t>>& uid_ranges) const;
+    // nullopt when tombstones newer than modseq were already pruned
+    std::optional<std::vector<int64_t>> findExpungedSince(int64_t folder_id, int64_t modseq) const;
+    std::vector<int64_t> findUIDsByFolder(int64_t folder_id) const;
+    // O(1) reads of the trigger-maintained folder_stats row
+    FolderStatus statusByFolder(int64_t folder_id) const;
+    // counters of every folder of the user that ever held messages, keyed by folder id
+    std::unordered_map<int64_t, FolderStatus> statusByUser(int64_t user_id) const;
+    std::vector<int64_t> searchUIDs(int64_t folder_id, const SearchCriteria& criteria) const;
+    std::vector<int64_t> sortUIDs(int64_t folder_id, const SearchCriteria& criteria,
+                                  const std::vector<SortKey>& keys) const;
+    // strings of the whole result share one arena, see MessageRowSet
+    MessageRowSet searchMessages(int64_t folder_id, const SearchCriteria& criteria) const;
+    std::vector<MessagePart> findParts(int64_t message_id) const;
+    std::optional<int64_t> findThreadID(int64_t user_id, const std::optional<std::string>& in_reply_to,
+                                        const std::optional<std::string>& references) const;
 
     bool insert(Message& msg);
     bool update(const Message& msg);
@@ -29,18 +62,49 @@ public:
     bool updateDeleted(int64_t id, bool deleted);
     bool updateFlags(int64_t id, bool is_seen, bool is_deleted, bool is_draft,
                      bool is_answered, bool is_flagged, bool is_recent);
+    // names are interned into the keywords table on first use
+    bool updateKeywords(int64_t id, FlagOperation operation, const std::vector<std::string>& names);
+    bool updateFlagsBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                         FlagOperation operation, uint32_t flags, const std::vector<std::string>& keywords,
+                         std::optional<int64_t> unchanged_since, std::vector<MessageFlagsRow>& updated,
+                         std::vector<int64_t>& modified);
     bool moveToFolder(int64_t id, int64_t folder_id, int64_t new_uid);
+    // drops all but the newest keep tombstones of the folder and raises its expunged_modseq
+    bool pruneExpunged(int64_t folder_id, int64_t keep);
+
+    // Set-based COPY/MOVE of the messages of folder_id inside uid_ranges. The caller reserves
+    // [first_uid, first_uid + n) in the target; messages keep their UID order. uids receives
+    // the source UIDs (ascending) and must be fetched first with findUIDsInRanges.
+    bool findUIDsInRanges(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                          std::vector<int64_t>& uids);
+    bool copyRanges(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                    int64_t target_folder_id, int64_t first_uid);
+    bool moveRanges(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                    int64_t target_folder_id, int64_t first_uid);
     bool hardDelete(int64_t id);
+    // removes every \Deleted message of the folder, returning (uid, raw_file_path) sorted by uid
+    bool expungeDeleted(int64_t folder_id, std::vector<std::pair<int64_t, std::string>>& removed);
+    // on the write connection, so it sees rows deleted by the surrounding transaction
+    bool isFileReferenced(const std::string& raw_file_path, bool& referenced);
     bool clearRecentByFolder(int64_t folder_id);
+    bool indexContent(int64_t id, const std::string& to, const std::string& cc, const std::string& body);
+    bool copyIndexedContent(int64_t source_id, int64_t target_id);
+    bool insertParts(int64_t message_id, const std::vector<MessagePart>& parts);
+    bool copyParts(int64_t source_id, int64_t target_id);
+    bool adoptReplies(int64_t user_id, const std::string& message_id_header, int64_t thread_id);
+
+    static std::string baseSubject(const std::string& subject);
 
     const std::string& getLastError() const;
 
 private:
     sqlite3* m_write_conn;
     ConnectionPool& m_pool;
-    mutable std::string m_last_error;
+    static thread_local std::string m_last_error;
 
     bool setError(const char* sqlite_errmsg);
     std::vector<Message> fetchRows(sqlite3_stmt* stmt) const;
     static Message rowToMessage(sqlite3_stmt* stmt);
+    MessageRowSet fetchRowSet(sqlite3_stmt* stmt, size_t expected_rows) const;
+    static void appendRow(MessageRowSet& rows, sqlite3_stmt* stmt);
 };
\ No newline at end of file
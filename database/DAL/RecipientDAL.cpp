@@ -9,6 +9,8 @@ RecipientDAL::RecipientDAL(sqlite3* write_conn, ConnectionPool& pool)
     , m_pool(pool)
 {}
 
+thread_local std::string RecipientDAL::m_last_error;
+
 bool RecipientDAL::setError(const char* sqlite_errmsg)
 {
     m_last_error = sqlite_errmsg ? sqlite_errmsg : "unknown error";
@@ -46,7 +48,6 @@ std::vector<Recipient> RecipientDAL::fetchRows(sqlite3_stmt* stmt) const
     std::vector<Recipient> results;
     while (sqlite3_step(stmt) == SQLITE_ROW)
         results.push_back(rowToRecipient(stmt));
-    sqlite3_finalize(stmt);
     return results;
 }
 
@@ -55,8 +56,8 @@ std::optional<Recipient> RecipientDAL::findByID(int64_t id) const
     ReadGuard g(m_pool);
     const char* sql = RECIPIENT_SELECT "WHERE id = ? LIMIT 1;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return std::nullopt;
 
     sqlite3_bind_int64(stmt, 1, id);
@@ -65,7 +66,6 @@ std::optional<Recipient> RecipientDAL::findByID(int64_t id) const
     if (sqlite3_step(stmt) == SQLITE_ROW)
         result = rowToRecipient(stmt);
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -74,8 +74,8 @@ std::vector<Recipient> RecipientDAL::findByMessage(int64_t message_id) const
     ReadGuard g(m_pool);
     const char* sql = RECIPIENT_SELECT "WHERE message_id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     sqlite3_bind_int64(stmt, 1, message_id);
@@ -88,8 +88,8 @@ bool RecipientDAL::insert(Recipient& recipient)
         "INSERT INTO recipients (message_id, address, type) "
         "VALUES (?, ?, ?);";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int64(stmt, 1, recipient.message_id);
@@ -102,7 +102,6 @@ bool RecipientDAL::insert(Recipient& recipient)
     else
         setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -115,8 +114,8 @@ bool RecipientDAL::update(const Recipient& recipient)
         "UPDATE recipients SET message_id = ?, address = ?, type = ? "
         "WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int64(stmt, 1, recipient.message_id);
@@ -127,7 +126,6 @@ bool RecipientDAL::update(const Recipient& recipient)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -135,8 +133,8 @@ bool RecipientDAL::hardDelete(int64_t id)
 {
     const char* sql = "DELETE FROM recipients WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int64(stmt, 1, id);
@@ -144,6 +142,5 @@ bool RecipientDAL::hardDelete(int64_t id)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
\ No newline at end of file
@@ -26,7 +26,7 @@ public:
 private:
     sqlite3* m_write_conn;
     ConnectionPool& m_pool;
-    mutable std::string m_last_error;
+    static thread_local std::string m_last_error;
 
     bool setError(const char* sqlite_errmsg);
     std::vector<Recipient> fetchRows(sqlite3_stmt* stmt) const;
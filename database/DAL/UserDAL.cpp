@@ -13,6 +13,8 @@ UserDAL::UserDAL(sqlite3* write_conn, ConnectionPool& pool)
     , m_pool(pool)
 {}
 
+thread_local std::string UserDAL::m_last_error;
+
 bool UserDAL::setError(const char* sqlite_errmsg)
 {
     m_last_error = sqlite_errmsg ? sqlite_errmsg : "unknown error";
@@ -59,7 +61,6 @@ std::vector<User> UserDAL::fetchRows(sqlite3_stmt* stmt) const
     std::vector<User> result;
     while (sqlite3_step(stmt) == SQLITE_ROW)
         result.push_back(rowToUser(stmt));
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -68,8 +69,8 @@ std::optional<User> UserDAL::findByID(int64_t id) const
     ReadGuard g(m_pool);
     const char* sql = USER_SELECT "WHERE id = ? LIMIT 1;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return std::nullopt;
 
     sqlite3_bind_int64(stmt, 1, id);
@@ -78,7 +79,6 @@ std::optional<User> UserDAL::findByID(int64_t id) const
     if (sqlite3_step(stmt) == SQLITE_ROW)
         result = rowToUser(stmt);
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -87,8 +87,8 @@ std::optional<User> UserDAL::findByUsername(const std::string& username) const
     ReadGuard g(m_pool);
     const char* sql = USER_SELECT_NO_AVATAR "WHERE username = ? LIMIT 1;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return std::nullopt;
 
     sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
@@ -97,7 +97,6 @@ std::optional<User> UserDAL::findByUsername(const std::string& username) const
     if (sqlite3_step(stmt) == SQLITE_ROW)
         result = rowToUser(stmt);
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -106,8 +105,8 @@ std::vector<User> UserDAL::findAll(int limit, int offset) const
     ReadGuard g(m_pool);
     const char* sql = USER_SELECT_NO_AVATAR "ORDER BY username ASC LIMIT ? OFFSET ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return {};
 
     sqlite3_bind_int(stmt, 1, limit);
@@ -115,19 +114,32 @@ std::vector<User> UserDAL::findAll(int limit, int offset) const
     return fetchRows(stmt);
 }
 
+std::vector<User> UserDAL::findAllAfter(const std::string& after_username, int limit) const
+{
+    ReadGuard g(m_pool);
+    const char* sql = USER_SELECT_NO_AVATAR "WHERE username > ? ORDER BY username ASC LIMIT ?;";
+
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
+        return {};
+
+    sqlite3_bind_text(stmt, 1, after_username.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 2, limit);
+    return fetchRows(stmt);
+}
+
 bool UserDAL::existsByUsername(const std::string& username) const
 {
     ReadGuard g(m_pool);
     const char* sql = "SELECT 1 FROM users WHERE username = ? LIMIT 1;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return false;
 
     sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
 
     bool exists = (sqlite3_step(stmt) == SQLITE_ROW);
-    sqlite3_finalize(stmt);
     return exists;
 }
 
@@ -136,15 +148,14 @@ int64_t UserDAL::count() const
     ReadGuard g(m_pool);
     const char* sql = "SELECT COUNT(*) FROM users;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return -1;
 
     int64_t result = -1;
     if (sqlite3_step(stmt) == SQLITE_ROW)
         result = sqlite3_column_int64(stmt, 0);
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -153,8 +164,8 @@ std::optional<std::string> UserDAL::getAvatar(int64_t id) const
     ReadGuard g(m_pool);
     const char* sql = "SELECT avatar_b64 FROM users WHERE id = ? LIMIT 1;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(g.db(), sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, g.db(), sql);
+    if (!stmt)
         return std::nullopt;
 
     sqlite3_bind_int64(stmt, 1, id);
@@ -166,7 +177,6 @@ std::optional<std::string> UserDAL::getAvatar(int64_t id) const
         if (raw) result = reinterpret_cast<const char*>(raw);
     }
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -176,8 +186,8 @@ bool UserDAL::insert(User& user)
         "INSERT INTO users (username, password_hash, first_name, last_name, birthdate, avatar_b64) "
         "VALUES (?, ?, ?, ?, ?, ?);";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     auto bindOpt = [&](int pos, const std::optional<std::string>& val)
@@ -199,7 +209,6 @@ bool UserDAL::insert(User& user)
     else
         setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -213,8 +222,8 @@ bool UserDAL::update(const User& user)
         "first_name = ?, last_name = ?, birthdate = ?, avatar_b64 = ? "
         "WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     auto bindOpt = [&](int pos, const std::optional<std::string>& val)
@@ -234,7 +243,6 @@ bool UserDAL::update(const User& user)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -242,8 +250,8 @@ bool UserDAL::updatePassword(int64_t id, const std::string& new_password_hash)
 {
     const char* sql = "UPDATE users SET password_hash = ? WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_text(stmt, 1, new_password_hash.c_str(), -1, SQLITE_TRANSIENT);
@@ -252,7 +260,6 @@ bool UserDAL::updatePassword(int64_t id, const std::string& new_password_hash)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -264,8 +271,8 @@ bool UserDAL::updateProfile(int64_t id, const std::optional<std::string>& first_
         "UPDATE users SET first_name = ?, last_name = ?, birthdate = ? "
         "WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     auto bindOpt = [&](int pos, const std::optional<std::string>& val)
@@ -282,7 +289,6 @@ bool UserDAL::updateProfile(int64_t id, const std::optional<std::string>& first_
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -290,8 +296,8 @@ bool UserDAL::updateAvatar(int64_t id, const std::optional<std::string>& avatar_
 {
     const char* sql = "UPDATE users SET avatar_b64 = ? WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     if (avatar_b64.has_value())
@@ -304,7 +310,6 @@ bool UserDAL::updateAvatar(int64_t id, const std::optional<std::string>& avatar_
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
 
@@ -312,8 +317,8 @@ bool UserDAL::hardDelete(int64_t id)
 {
     const char* sql = "DELETE FROM users WHERE id = ?;";
 
-    sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(m_write_conn, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    Statement stmt(m_pool, m_write_conn, sql);
+    if (!stmt)
         return setError(sqlite3_errmsg(m_write_conn));
 
     sqlite3_bind_int64(stmt, 1, id);
@@ -321,6 +326,5 @@ bool UserDAL::hardDelete(int64_t id)
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     if (!ok) setError(sqlite3_errmsg(m_write_conn));
 
-    sqlite3_finalize(stmt);
     return ok;
 }
\ No newline at end of file
@@ -16,6 +16,8 @@ public:
     std::optional<User> findByID(int64_t id) const;
     std::optional<User> findByUsername(const std::string& username) const;
     std::vector<User> findAll(int limit = 50, int offset = 0) const;
+    // keyset page: the users sorting after after_username
+    std::vector<User> findAllAfter(const std::string& after_username, int limit = 50) const;
     bool existsByUsername(const std::string& username) const;
     int64_t count() const;
     std::optional<std::string> getAvatar(int64_t id) const;
@@ -34,7 +36,7 @@ public:
 private:
     sqlite3* m_write_conn;
     ConnectionPool& m_pool;
-    mutable std::string m_last_error;
+    static thread_local std::string m_last_error;
 
     bool setError(const char* sqlite_errmsg);
     std::vector<User> fetchRows(sqlite3_stmt* stmt) const;
@@ -1,8 +1,23 @@
 #include "DataBaseManager.h"
+#include "Config.h"
+#include "DAL/MessageDAL.h"
+
+#include <cstdlib>
+
+namespace
+{
+    // base_subject(text): lets migrations backfill sort_subject with the rule MessageDAL applies on insert
+    void baseSubjectFunction(sqlite3_context* ctx, int, sqlite3_value** argv)
+    {
+        const unsigned char* subject = sqlite3_value_text(argv[0]);
+        std::string base = MessageDAL::baseSubject(subject ? reinterpret_cast<const char*>(subject) : "");
+        sqlite3_result_text(ctx, base.c_str(), static_cast<int>(base.size()), SQLITE_TRANSIENT);
+    }
+}
 
 DataBaseManager::DataBaseManager(const std::string& db_path, std::string_view migration_sql,
                                  std::shared_ptr<ILogger> logger, int read_pool_size)
-    : m_logger(std::move(logger))
+    : m_logger(std::move(logger)), m_file_collector(std::make_unique<FileCollector>(m_logger))
 {
     int rc = sqlite3_open(db_path.c_str(), &m_db);
     if (rc != SQLITE_OK)
@@ -33,6 +48,12 @@ DataBaseManager::DataBaseManager(const std::string& db_path, std::string_view mi
         return;
     }
 
+    // a RESTART checkpoint holds the writer back until readers move on; wait instead of failing
+    sqlite3_busy_timeout(m_db, BUSY_TIMEOUT_MS);
+
+    sqlite3_create_function(m_db, "base_subject", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                            &baseSubjectFunction, nullptr, nullptr);
+
     if (!applyMigration(migration_sql))
     {
         if (m_logger) m_logger->Log(LogLevel::PROD, "[DB] Migration failed");
@@ -46,6 +67,7 @@ DataBaseManager::DataBaseManager(const std::string& db_path, std::string_view mi
     try
     {
         m_read_pool = std::make_unique<ConnectionPool>(db_path, read_pool_size);
+        m_read_pool->attachWriter(m_db);
     }
     catch (const std::exception& e)
     {
@@ -55,11 +77,25 @@ DataBaseManager::DataBaseManager(const std::string& db_path, std::string_view mi
         return;
     }
 
+    const auto& cfg = SmtpClient::Config::Instance().GetDatabase();
+    if (cfg.checkpoint_interval_ms > 0)
+    {
+        WalCheckpointer::Options options;
+        options.interval       = std::chrono::milliseconds(cfg.checkpoint_interval_ms);
+        options.passive_frames = cfg.checkpoint_passive_frames;
+        options.restart_frames = cfg.checkpoint_restart_frames;
+        m_checkpointer = std::make_unique<WalCheckpointer>(db_path, m_db, options, m_logger);
+    }
+
+    m_write_queue = std::make_unique<WriteQueue>(m_db, m_write_mutex, *m_read_pool, m_logger);
     m_connected = true;
 }
 
 DataBaseManager::~DataBaseManager()
 {
+    m_write_queue.reset();
+    m_checkpointer.reset();
+    m_file_collector.reset();
     m_read_pool.reset();
     if (m_db) sqlite3_close(m_db);
 }
@@ -70,14 +106,26 @@ sqlite3* DataBaseManager::getDB() const
     return m_db;
 }
 
+bool DataBaseManager::write(WriteQueue::Work work)
+{
+    if (!m_write_queue) return false;
+    return m_write_queue->execute(std::move(work));
+}
+
+std::unique_lock<std::mutex> DataBaseManager::writeLock()
+{
+    if (m_write_queue && m_write_queue->onWriterThread())
+        return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(m_write_mutex);
+}
+
 bool DataBaseManager::isConnected() const
 {
     return m_connected;
 }
 
-bool DataBaseManager::applyMigration(std::string_view migration_sql)
+bool DataBaseManager::execute(const std::string& sql)
 {
-    std::string sql(migration_sql);
     char* err_msg = nullptr;
     int rc = sqlite3_exec(m_db, sql.c_str(), nullptr, nullptr, &err_msg);
     if (rc != SQLITE_OK)
@@ -88,4 +136,49 @@ bool DataBaseManager::applyMigration(std::string_view migration_sql)
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+bool DataBaseManager::applyMigration(std::string_view migration_sql)
+{
+    // a script without markers (directory schema, tests) is plain DDL and runs as a whole
+    if (migration_sql.find(MIGRATION_MARKER) == std::string_view::npos)
+        return execute(std::string(migration_sql));
+
+    int applied = 0;
+    {
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(m_db, "PRAGMA user_version;", -1, &stmt, nullptr) != SQLITE_OK) return false;
+        if (sqlite3_step(stmt) == SQLITE_ROW) applied = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+
+    // every step runs in its own transaction and records its number in user_version
+    size_t pos = migration_sql.find(MIGRATION_MARKER);
+    while (pos != std::string_view::npos)
+    {
+        size_t body = migration_sql.find('\n', pos);
+        if (body == std::string_view::npos) break;
+
+        int version = std::atoi(std::string(migration_sql.substr(pos + MIGRATION_MARKER.size(),
+                                                                 body - pos - MIGRATION_MARKER.size())).c_str());
+        size_t next = migration_sql.find(MIGRATION_MARKER, body);
+        std::string_view step = migration_sql.substr(body, next == std::string_view::npos ? next : next - body);
+        pos = next;
+
+        if (version <= applied) continue;
+
+        if (!execute("BEGIN IMMEDIATE;")) return false;
+        if (!execute(std::string(step) + "\nPRAGMA user_version = " + std::to_string(version) + ";") ||
+            !execute("COMMIT;"))
+        {
+            sqlite3_exec(m_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            if (m_logger) m_logger->Log(LogLevel::PROD, "[DB] Migration " + std::to_string(version) + " rolled back");
+            return false;
+        }
+
+        applied = version;
+        if (m_logger) m_logger->Log(LogLevel::DEBUG, "[DB] Migration " + std::to_string(version) + " applied");
+    }
+
+    return true;
+}
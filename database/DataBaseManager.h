@@ -7,6 +7,10 @@
 #include <sqlite3.h>
 #include "ILogger.h"
 #include "ConnectionPool.h"
+#include "FileCollector.h"
+#include "FolderTreeCache.h"
+#include "WalCheckpointer.h"
+#include "WriteQueue.h"
 
 class DataBaseManager
 {
@@ -24,14 +28,32 @@ public:
     bool isConnected() const;
 
     ConnectionPool& pool() { return *m_read_pool; }
-    std::unique_lock<std::mutex> writeLock() { return std::unique_lock<std::mutex>(m_write_mutex); }
+    FileCollector& fileCollector() { return *m_file_collector; }
+    FolderTreeCache& folderTrees() { return m_folder_trees; }
+    WriteQueue& writeQueue() { return *m_write_queue; }
+    // nullptr when checkpoint_interval_ms is 0 and SQLite checkpoints on commit itself
+    WalCheckpointer* checkpointer() { return m_checkpointer.get(); }
+    // Runs work on the writer thread, group-committed with concurrent writes.
+    bool write(WriteQueue::Work work);
+    // Direct access for code outside the queue; on the writer thread the batch already holds it.
+    std::unique_lock<std::mutex> writeLock();
 
 private:
+    static constexpr int BUSY_TIMEOUT_MS = 5000;
+
     sqlite3* m_db = nullptr;
     bool m_connected = false;
     std::shared_ptr<ILogger> m_logger;
     std::mutex m_write_mutex;
     std::unique_ptr<ConnectionPool> m_read_pool;
+    std::unique_ptr<FileCollector> m_file_collector;
+    std::unique_ptr<WalCheckpointer> m_checkpointer;
+    std::unique_ptr<WriteQueue> m_write_queue;
+    FolderTreeCache m_folder_trees;
+
+    // "-- @migration <n>" opens step n of an embedded schema, see cmake/EmbedSchema.cmake
+    static constexpr std::string_view MIGRATION_MARKER = "-- @migration ";
 
+    bool execute(const std::string& sql);
     bool applyMigration(std::string_view migration_sql);
 };
\ No newline at end of file
@@ -13,6 +13,7 @@ struct Folder
 	std::string name;
 	int64_t next_uid = 1;
 	bool is_subscribed = false;
+	int64_t highest_modseq = 0;
 
 	bool operator==(const Folder& other)
 	{
@@ -20,4 +21,14 @@ struct Folder
 			   this->name == other.name && this->next_uid == other.next_uid &&
 			   this->is_subscribed == other.is_subscribed;
 	}
-};
\ No newline at end of file
+};
+
+// Message counters of one folder as reported by SELECT and STATUS, read from folder_stats
+struct FolderStatus
+{
+	int64_t messages = 0;
+	int64_t recent = 0;
+	int64_t unseen = 0;
+	int64_t deleted = 0;
+	int64_t total_bytes = 0;
+};
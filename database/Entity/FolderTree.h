@@ -0,0 +1,17 @@
+#pragma once
+
+#include <vector>
+
+#include "Entity/Folder.h"
+
+struct FolderTreeNode
+{
+	Folder folder;
+	bool has_children = false; // some folder names this one as parent_id
+};
+
+// Every folder of one user, ordered by name, as LIST and LSUB walk it.
+struct FolderTree
+{
+	std::vector<FolderTreeNode> nodes;
+};
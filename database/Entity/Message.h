@@ -28,7 +28,17 @@ struct Message
     bool is_answered = false;
     bool is_flagged = false;
     bool is_recent = true;
+    // custom keywords (flag-keyword atoms), space separated, stored in message_keywords
+    std::string keywords;
 
     std::string internal_date;
     std::optional<std::string> date_header;
+
+    // CONDSTORE mod-sequence of the last change, maintained by schema triggers.
+    int64_t modseq = 0;
+
+    // Conversation root (RFC 5256 THREAD), resolved from In-Reply-To/References on insert.
+    std::optional<int64_t> thread_id;
+    // Base subject for SORT SUBJECT, derived from subject by MessageDAL.
+    std::string sort_subject;
 };
\ No newline at end of file
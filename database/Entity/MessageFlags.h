@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// IMAP system flags as a bit mask, used by set-based flag updates (STORE).
+namespace MessageFlags
+{
+constexpr uint32_t Seen     = 1u << 0;
+constexpr uint32_t Deleted  = 1u << 1;
+constexpr uint32_t Draft    = 1u << 2;
+constexpr uint32_t Answered = 1u << 3;
+constexpr uint32_t Flagged  = 1u << 4;
+constexpr uint32_t Recent   = 1u << 5;
+constexpr uint32_t All      = Seen | Deleted | Draft | Answered | Flagged | Recent;
+
+// "\Seen" -> Seen, 0 for anything that is not a system flag
+inline uint32_t fromName(const std::string& name)
+{
+    if (name == "\\Seen")     return Seen;
+    if (name == "\\Deleted")  return Deleted;
+    if (name == "\\Draft")    return Draft;
+    if (name == "\\Answered") return Answered;
+    if (name == "\\Flagged")  return Flagged;
+    if (name == "\\Recent")   return Recent;
+    return 0;
+}
+} // namespace MessageFlags
+
+// STORE +FLAGS / -FLAGS / FLAGS
+enum class FlagOperation
+{
+    Add,
+    Remove,
+    Replace
+};
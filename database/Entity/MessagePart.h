@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Byte range of one MIME part inside messages.raw_file_path (IMAP partial FETCH).
+struct MessagePart
+{
+    int64_t message_id = 0;
+    std::string section;        // "" for the whole message, "1", "1.2", ...
+    int64_t header_start = 0;
+    int64_t body_start = 0;
+    int64_t body_end = 0;       // exclusive
+};
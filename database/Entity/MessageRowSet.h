@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Entity/Message.h"
+#include "Entity/MessageFlags.h"
+
+// A messages row whose text columns point into the arena of the MessageRowSet that holds it;
+// it is valid only as long as that set is.
+struct MessageView
+{
+    std::optional<int64_t> id;
+    int64_t user_id = 0;
+    int64_t folder_id = 0;
+    int64_t uid = 0;
+
+    std::string_view raw_file_path;
+    int64_t size_bytes = 0;
+    std::optional<std::string_view> mime_structure;
+
+    std::optional<std::string_view> message_id_header;
+    std::optional<std::string_view> in_reply_to;
+    std::optional<std::string_view> references_header;
+    std::string_view from_address;
+    std::optional<std::string_view> sender_address;
+    std::optional<std::string_view> subject;
+
+    uint32_t flags = 0; // MessageFlags bits
+    std::string_view keywords;
+
+    std::string_view internal_date;
+    std::optional<std::string_view> date_header;
+    int64_t modseq = 0;
+    std::optional<int64_t> thread_id;
+    std::string_view sort_subject;
+
+    bool has(uint32_t flag) const { return (flags & flag) != 0; }
+
+    // an owning copy, for code that keeps the row beyond the set
+    Message toMessage() const
+    {
+        auto own = [](const std::optional<std::string_view>& v) -> std::optional<std::string>
+        {
+            if (!v.has_value()) return std::nullopt;
+            return std::string(*v);
+        };
+
+        Message msg;
+        msg.id = id;
+        msg.user_id = user_id;
+        msg.folder_id = folder_id;
+        msg.uid = uid;
+        msg.raw_file_path = std::string(raw_file_path);
+        msg.size_bytes = size_bytes;
+        msg.mime_structure = own(mime_structure);
+        msg.message_id_header = own(message_id_header);
+        msg.in_reply_to = own(in_reply_to);
+        msg.references_header = own(references_header);
+        msg.from_address = std::string(from_address);
+        msg.sender_address = own(sender_address);
+        msg.subject = own(subject);
+        msg.is_seen = has(MessageFlags::Seen);
+        msg.is_deleted = has(MessageFlags::Deleted);
+        msg.is_draft = has(MessageFlags::Draft);
+        msg.is_answered = has(MessageFlags::Answered);
+        msg.is_flagged = has(MessageFlags::Flagged);
+        msg.is_recent = has(MessageFlags::Recent);
+        msg.keywords = std::string(keywords);
+        msg.internal_date = std::string(internal_date);
+        msg.date_header = own(date_header);
+        msg.modseq = modseq;
+        msg.thread_id = thread_id;
+        msg.sort_subject = std::string(sort_subject);
+        return msg;
+    }
+};
+
+// Result of a bulk messages query. Every text column is copied into one monotonic arena that
+// grows in large blocks and is released at once with the set, so a listing costs a handful of
+// allocations instead of one per row and column.
+class MessageRowSet
+{
+public:
+    static constexpr size_t BYTES_PER_ROW = 256; // paths, addresses, subject and dates of a typical row
+
+    explicit MessageRowSet(size_t expected_rows)
+        : m_arena(std::make_unique<std::pmr::monotonic_buffer_resource>(
+              std::max<size_t>(expected_rows, 16) * BYTES_PER_ROW))
+    {
+        m_rows.reserve(expected_rows);
+    }
+
+    // copies size bytes into the arena
+    std::string_view store(const void* data, size_t size)
+    {
+        if (size == 0) return {};
+        char* copy = static_cast<char*>(m_arena->allocate(size, 1));
+        std::memcpy(copy, data, size);
+        return {copy, size};
+    }
+
+    void push_back(const MessageView& row) { m_rows.push_back(row); }
+
+    size_t size() const { return m_rows.size(); }
+    bool empty() const { return m_rows.empty(); }
+    MessageView& operator[](size_t i) { return m_rows[i]; }
+    const MessageView& operator[](size_t i) const { return m_rows[i]; }
+    const MessageView& back() const { return m_rows.back(); }
+
+    std::vector<MessageView>::iterator begin() { return m_rows.begin(); }
+    std::vector<MessageView>::iterator end() { return m_rows.end(); }
+    std::vector<MessageView>::const_iterator begin() const { return m_rows.begin(); }
+    std::vector<MessageView>::const_iterator end() const { return m_rows.end(); }
+
+private:
+    // behind a pointer so a moved set keeps its views pointing at the same blocks
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> m_arena;
+    std::vector<MessageView> m_rows;
+};
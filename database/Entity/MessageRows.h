@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Entity/MessageFlags.h"
+
+// Narrow projections of a messages row for folder-wide paths (STORE, CHANGEDSINCE, FETCH FLAGS):
+// they read only the columns they carry and never copy the path, address or header text.
+
+struct MessageFlagsRow
+{
+    int64_t id = 0;
+    int64_t uid = 0;
+    int64_t modseq = 0;
+    uint32_t flags = 0;    // MessageFlags bits
+    std::string keywords;  // custom keywords, space separated
+
+    bool has(uint32_t flag) const { return (flags & flag) != 0; }
+};
+
+// Everything a FETCH of FLAGS, INTERNALDATE, RFC822.SIZE, MODSEQ and UID answers with.
+struct MessageHeaderRow
+{
+    int64_t id = 0;
+    int64_t uid = 0;
+    int64_t modseq = 0;
+    uint32_t flags = 0;
+    int64_t size_bytes = 0;
+    std::string internal_date;
+    std::string keywords;
+
+    bool has(uint32_t flag) const { return (flags & flag) != 0; }
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Backend-neutral form of an IMAP SEARCH program (RFC 3501, section 6.4.4).
+// The protocol layer builds the tree, MessageDAL compiles it into one SQL query.
+struct SearchCriteria
+{
+    enum class Type
+    {
+        All,
+        And,
+        Or,
+        Not,
+
+        Seen,
+        Deleted,
+        Draft,
+        Answered,
+        Flagged,
+        Recent,
+        Keyword, // value = keyword name
+
+        Before,  // internal date, value = "YYYY-MM-DD"
+        On,
+        Since,
+
+        Larger,  // size in bytes, number
+        Smaller,
+
+        From,    // full-text, value
+        To,
+        Cc,
+        Bcc,
+        Subject,
+        Body,
+        Text,
+        MessageID,
+
+        Uid,     // ranges = inclusive [first, last] pairs
+        None     // matches nothing
+    };
+
+    Type type = Type::All;
+    std::string value;
+    int64_t number = 0;
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    std::vector<SearchCriteria> children;
+
+    static SearchCriteria leaf(Type t)
+    {
+        SearchCriteria c;
+        c.type = t;
+        return c;
+    }
+
+    static SearchCriteria negate(SearchCriteria inner)
+    {
+        SearchCriteria c;
+        c.type = Type::Not;
+        c.children.push_back(std::move(inner));
+        return c;
+    }
+};
+
+// One SORT key (RFC 5256, section 3); ties are always broken by UID.
+struct SortKey
+{
+    enum class Field
+    {
+        Arrival,
+        Cc,
+        Date,
+        From,
+        Size,
+        Subject,
+        To
+    };
+
+    Field field = Field::Arrival;
+    bool reverse = false;
+};
@@ -0,0 +1,58 @@
+#include "FileCollector.h"
+
+#include <filesystem>
+
+FileCollector::FileCollector(std::shared_ptr<ILogger> logger)
+    : m_logger(std::move(logger)), m_worker(&FileCollector::run, this)
+{
+}
+
+FileCollector::~FileCollector()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_cv.notify_all();
+    if (m_worker.joinable()) m_worker.join();
+}
+
+void FileCollector::enqueue(std::vector<std::string> paths)
+{
+    if (paths.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& path : paths)
+            m_queue.push(std::move(path));
+    }
+    m_cv.notify_one();
+}
+
+void FileCollector::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle_cv.wait(lock, [this] { return m_queue.empty() && !m_busy; });
+}
+
+void FileCollector::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this] { return !m_queue.empty() || !m_running; });
+        if (m_queue.empty()) break; // stopped and drained
+
+        std::string path = std::move(m_queue.front());
+        m_queue.pop();
+        m_busy = true;
+        lock.unlock();
+
+        std::error_code ec;
+        if (!std::filesystem::remove(path, ec) && ec && m_logger)
+            m_logger->Log(LogLevel::PROD, "[DB] Failed to remove " + path + ": " + ec.message());
+
+        lock.lock();
+        m_busy = false;
+        if (m_queue.empty()) m_idle_cv.notify_all();
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ILogger.h"
+
+// Unlinks message blobs of expunged rows on a background thread, so large
+// expunges only pay for the DELETE on the request path.
+class FileCollector
+{
+public:
+    explicit FileCollector(std::shared_ptr<ILogger> logger = nullptr);
+    ~FileCollector(); // drains the queue before returning
+
+    FileCollector(const FileCollector&) = delete;
+    FileCollector& operator=(const FileCollector&) = delete;
+
+    void enqueue(std::vector<std::string> paths);
+
+    // blocks until every path queued so far has been processed
+    void waitIdle();
+
+private:
+    std::shared_ptr<ILogger> m_logger;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::condition_variable m_idle_cv;
+    std::queue<std::string> m_queue;
+    bool m_busy = false;
+    bool m_running = true;
+    std::thread m_worker;
+
+    void run();
+};
@@ -0,0 +1,28 @@
+#include "FolderTreeCache.h"
+
+std::shared_ptr<const FolderTree> FolderTreeCache::find(int64_t user_id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_trees.find(user_id);
+    return it != m_trees.end() ? it->second : nullptr;
+}
+
+uint64_t FolderTreeCache::version() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_version;
+}
+
+void FolderTreeCache::store(int64_t user_id, std::shared_ptr<const FolderTree> tree, uint64_t version)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (version == m_version)
+        m_trees[user_id] = std::move(tree);
+}
+
+void FolderTreeCache::invalidate(int64_t user_id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_version;
+    m_trees.erase(user_id);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "Entity/FolderTree.h"
+
+// Per-user folder trees shared by every repository of the process. Folder writes
+// go through MessageRepository, which invalidates the user's entry after the change.
+// A tree is immutable once stored, so readers keep using it without the lock.
+class FolderTreeCache
+{
+public:
+    std::shared_ptr<const FolderTree> find(int64_t user_id) const;
+
+    // version to pass to store(); a tree read before an invalidation is never stored
+    uint64_t version() const;
+    void store(int64_t user_id, std::shared_ptr<const FolderTree> tree, uint64_t version);
+    void invalidate(int64_t user_id);
+
+private:
+    mutable std::mutex m_mutex;
+    uint64_t m_version = 0;
+    std::unordered_map<int64_t, std::shared_ptr<const FolderTree>> m_trees;
+};
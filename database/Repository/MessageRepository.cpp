@@ -1,13 +1,34 @@
 #include "MessageRepository.h"
+#include "Config.h"
 #include <climits>
+#include <set>
 
-MessageRepository::MessageRepository(DataBaseManager& db)
-    : m_db(db)
-    , m_message_dal(db.getDB(), db.pool())
-    , m_folder_dal(db.getDB(), db.pool())
-    , m_recipient_dal(db.getDB(), db.pool())
+MessageRepository::Shard::Shard(DataBaseManager& db)
+    : db(db)
+    , messages(db.getDB(), db.pool())
+    , folders(db.getDB(), db.pool())
+    , recipients(db.getDB(), db.pool())
 {}
 
+MessageRepository::MessageRepository(DataBaseManager& db)
+{
+    m_shards.push_back(std::make_unique<Shard>(db));
+}
+
+MessageRepository::MessageRepository(ShardRouter& router)
+    : m_router(&router)
+{
+    for (size_t k = 0; k < router.size(); ++k)
+        m_shards.push_back(std::make_unique<Shard>(router.shard(k)));
+}
+
+MessageRepository::Shard& MessageRepository::shard(int64_t id) const
+{
+    return *m_shards[m_router ? m_router->shardOfID(id) : 0];
+}
+
+thread_local std::string MessageRepository::m_last_error;
+
 bool MessageRepository::setError(const std::string& msg) const
 {
     m_last_error = msg;
@@ -19,78 +40,166 @@ const std::string& MessageRepository::getLastError() const
     return m_last_error;
 }
 
+bool MessageRepository::write(Shard& shard, const std::function<bool()>& work)
+{
+    // the work runs on the shard's writer thread, carry its error back to this one
+    std::string error;
+    bool ok = shard.db.write([&]
+    {
+        m_last_error.clear();
+        if (work()) return true;
+        error = m_last_error;
+        return false;
+    });
+    if (!ok) return setError(error.empty() ? "write not committed" : error);
+    return true;
+}
+
+int64_t MessageRepository::expungedHistory()
+{
+    return SmtpClient::Config::Instance().GetDatabase().expunged_history;
+}
+
 bool MessageRepository::assignUID(Message& msg, int64_t folder_id)
 {
-    auto lock = m_db.writeLock();
-    Transaction tx(m_db.getDB());
+    Shard& s = shard(folder_id);
+    return write(s, [&]
+    {
+        Transaction tx(s.db.getDB());
+        if (!tx.valid()) return setError("assignUID: failed to begin transaction");
 
-    if (!tx.valid()) return setError("assignUID: failed to begin transaction");
+        // on the writer thread this reads the write connection, so UIDs taken earlier in the batch are seen
+        auto folder = s.folders.findByID(folder_id);
+        if (!folder.has_value())
+            return setError("assignUID: folder not found");
 
-    // Fetch folder INSIDE transaction to prevent race condition
-    auto folder = m_folder_dal.findByID(folder_id);
-    if (!folder.has_value())
-        return setError("assignUID: folder not found");
+        msg.folder_id = folder_id;
+        msg.uid       = folder->next_uid;
 
-    msg.folder_id = folder_id;
-    msg.uid       = folder->next_uid;
+        if (!msg.thread_id.has_value())
+            msg.thread_id = s.messages.findThreadID(msg.user_id, msg.in_reply_to, msg.references_header);
 
-    if (!m_message_dal.insert(msg))
-        return setError(m_message_dal.getLastError());
+        if (!s.messages.insert(msg))
+            return setError(s.messages.getLastError());
 
-    if (!m_folder_dal.incrementNextUID(folder_id))
-        return setError(m_folder_dal.getLastError());
+        if (msg.message_id_header.has_value() &&
+            !s.messages.adoptReplies(msg.user_id, *msg.message_id_header, msg.thread_id.value()))
+            return setError(s.messages.getLastError());
 
-    if (!tx.commit())
-        return setError("assignUID: commit failed");
+        if (!s.folders.incrementNextUID(folder_id))
+            return setError(s.folders.getLastError());
 
-    return true;
+        if (!tx.commit())
+            return setError("assignUID: commit failed");
+
+        return true;
+    });
 }
 
 std::optional<Message> MessageRepository::findByID(int64_t id) const
 {
-    return m_message_dal.findByID(id);
+    return shard(id).messages.findByID(id);
 }
 
 std::optional<Message> MessageRepository::findByUID(int64_t folder_id, int64_t uid) const
 {
-    return m_message_dal.findByUID(folder_id, uid);
+    return shard(folder_id).messages.findByUID(folder_id, uid);
 }
 
 std::vector<Message> MessageRepository::findByUser(int64_t user_id, int limit, int offset) const
 {
-    return m_message_dal.findByUser(user_id, limit, offset);
+    return shard(user_id).messages.findByUser(user_id, limit, offset);
 }
 
 std::vector<Message> MessageRepository::findByFolder(int64_t folder_id, int limit, int offset) const
 {
-    return m_message_dal.findByFolder(folder_id, limit, offset);
+    return shard(folder_id).messages.findByFolder(folder_id, limit, offset);
 }
 
 std::vector<Message> MessageRepository::findUnseen(int64_t folder_id, int limit, int offset) const
 {
-    return m_message_dal.findUnseen(folder_id, limit, offset);
+    return shard(folder_id).messages.findUnseen(folder_id, limit, offset);
+}
+
+std::vector<Message> MessageRepository::findByUserBefore(int64_t user_id, const std::string& before_date,
+                                                        int64_t before_id, int limit) const
+{
+    return shard(user_id).messages.findByUserBefore(user_id, before_date, before_id, limit);
+}
+
+MessageRowSet MessageRepository::findByFolderAfter(int64_t folder_id, int64_t after_uid, int limit) const
+{
+    return shard(folder_id).messages.findByFolderAfter(folder_id, after_uid, limit);
+}
+
+std::vector<Message> MessageRepository::findUnseenAfter(int64_t folder_id, int64_t after_uid, int limit) const
+{
+    return shard(folder_id).messages.findUnseenAfter(folder_id, after_uid, limit);
 }
 
 std::vector<Message> MessageRepository::findDeleted(int64_t folder_id, int limit, int offset) const
 {
-    return m_message_dal.findDeleted(folder_id, limit, offset);
+    return shard(folder_id).messages.findDeleted(folder_id, limit, offset);
 }
 
 std::vector<Message> MessageRepository::findFlagged(int64_t folder_id, int limit, int offset) const
 {
-    return m_message_dal.findFlagged(folder_id, limit, offset);
+    return shard(folder_id).messages.findFlagged(folder_id, limit, offset);
 }
 
 std::vector<Message> MessageRepository::search(int64_t user_id, const std::string& query, int limit, int offset) const
 {
-    return m_message_dal.search(user_id, query, limit, offset);
+    return shard(user_id).messages.search(user_id, query, limit, offset);
+}
+
+std::vector<MessageFlagsRow> MessageRepository::findChangedSince(int64_t folder_id, int64_t modseq) const
+{
+    return shard(folder_id).messages.findChangedSince(folder_id, modseq);
+}
+
+std::vector<MessageHeaderRow> MessageRepository::findHeaderRows(
+    int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges) const
+{
+    return shard(folder_id).messages.findHeaderRows(folder_id, uid_ranges);
+}
+
+std::optional<std::vector<int64_t>> MessageRepository::findExpungedSince(int64_t folder_id, int64_t modseq) const
+{
+    return shard(folder_id).messages.findExpungedSince(folder_id, modseq);
+}
+
+std::vector<int64_t> MessageRepository::findUIDsByFolder(int64_t folder_id) const
+{
+    return shard(folder_id).messages.findUIDsByFolder(folder_id);
+}
+
+std::vector<int64_t> MessageRepository::searchUIDs(int64_t folder_id, const SearchCriteria& criteria) const
+{
+    return shard(folder_id).messages.searchUIDs(folder_id, criteria);
+}
+
+std::vector<int64_t> MessageRepository::sortUIDs(int64_t folder_id, const SearchCriteria& criteria,
+                                                 const std::vector<SortKey>& keys) const
+{
+    return shard(folder_id).messages.sortUIDs(folder_id, criteria, keys);
+}
+
+MessageRowSet MessageRepository::searchMessages(int64_t folder_id, const SearchCriteria& criteria) const
+{
+    return shard(folder_id).messages.searchMessages(folder_id, criteria);
+}
+
+std::vector<MessagePart> MessageRepository::findParts(int64_t message_id) const
+{
+    return shard(message_id).messages.findParts(message_id);
 }
 
 bool MessageRepository::deliver(Message& msg, int64_t folder_id)
 {
+    Shard& s = shard(msg.user_id);
     if (folder_id <= 0)
     {
-        auto inbox = m_folder_dal.findByName(msg.user_id, "INBOX");
+        auto inbox = s.folders.findByName(msg.user_id, "INBOX");
         if (!inbox.has_value())
             return setError("deliver: INBOX not found for user");
         folder_id = inbox->id.value();
@@ -103,6 +212,35 @@ bool MessageRepository::deliver(Message& msg, int64_t folder_id)
     return assignUID(msg, folder_id);
 }
 
+bool MessageRepository::indexContent(int64_t id, const std::string& to, const std::string& cc,
+                                     const std::string& body)
+{
+    Shard& s = shard(id);
+    return write(s, [&]
+    {
+        return s.messages.indexContent(id, to, cc, body) || setError(s.messages.getLastError());
+    });
+}
+
+bool MessageRepository::saveParts(int64_t message_id, const std::vector<MessagePart>& parts)
+{
+    Shard& s = shard(message_id);
+    return write(s, [&]
+    {
+        Transaction tx(s.db.getDB());
+        if (!tx.valid())
+            return setError("saveParts: failed to begin transaction");
+
+        if (!s.messages.insertParts(message_id, parts))
+            return setError(s.messages.getLastError());
+
+        if (!tx.commit())
+            return setError("saveParts: commit failed");
+
+        return true;
+    });
+}
+
 bool MessageRepository::saveToFolder(Message& msg, int64_t folder_id)
 {
     msg.is_seen   = true;
@@ -112,271 +250,440 @@ bool MessageRepository::saveToFolder(Message& msg, int64_t folder_id)
 
 bool MessageRepository::markSeen(int64_t id, bool seen)
 {
-    auto lock = m_db.writeLock();
-    return m_message_dal.updateSeen(id, seen);
+    Shard& s = shard(id);
+    return write(s, [&] { return s.messages.updateSeen(id, seen) || setError(s.messages.getLastError()); });
 }
 
 bool MessageRepository::markDeleted(int64_t id, bool deleted)
 {
-    auto lock = m_db.writeLock();
-    return m_message_dal.updateDeleted(id, deleted);
+    Shard& s = shard(id);
+    return write(s, [&] { return s.messages.updateDeleted(id, deleted) || setError(s.messages.getLastError()); });
 }
 
 bool MessageRepository::markFlagged(int64_t id, bool flagged)
 {
-    auto msg = m_message_dal.findByID(id);
-    if (!msg.has_value())
-        return setError("markFlagged: message not found");
+    Shard& s = shard(id);
+    // read-modify-write on the writer thread, so it sees flags changed earlier in the batch
+    return write(s, [&]
+    {
+        auto msg = s.messages.findFlagsByID(id);
+        if (!msg.has_value())
+            return setError("markFlagged: message not found");
 
-    auto lock = m_db.writeLock();
-    return m_message_dal.updateFlags(id, msg->is_seen, msg->is_deleted, msg->is_draft,
-                                     msg->is_answered, flagged, msg->is_recent);
+        return s.messages.updateFlags(id, msg->has(MessageFlags::Seen), msg->has(MessageFlags::Deleted),
+                                      msg->has(MessageFlags::Draft), msg->has(MessageFlags::Answered), flagged,
+                                      msg->has(MessageFlags::Recent))
+            || setError(s.messages.getLastError());
+    });
 }
 
 bool MessageRepository::markAnswered(int64_t id, bool answered)
 {
-    auto msg = m_message_dal.findByID(id);
-    if (!msg.has_value())
-        return setError("markAnswered: message not found");
+    Shard& s = shard(id);
+    // read-modify-write on the writer thread, so it sees flags changed earlier in the batch
+    return write(s, [&]
+    {
+        auto msg = s.messages.findFlagsByID(id);
+        if (!msg.has_value())
+            return setError("markAnswered: message not found");
 
-    auto lock = m_db.writeLock();
-    return m_message_dal.updateFlags(id, msg->is_seen, msg->is_deleted, msg->is_draft,
-                                     answered, msg->is_flagged, msg->is_recent);
+        return s.messages.updateFlags(id, msg->has(MessageFlags::Seen), msg->has(MessageFlags::Deleted),
+                                      msg->has(MessageFlags::Draft), answered, msg->has(MessageFlags::Flagged),
+                                      msg->has(MessageFlags::Recent))
+            || setError(s.messages.getLastError());
+    });
 }
 
 bool MessageRepository::markDraft(int64_t id, bool draft)
 {
-    auto msg = m_message_dal.findByID(id);
-    if (!msg.has_value())
-        return setError("markDraft: message not found");
+    Shard& s = shard(id);
+    // read-modify-write on the writer thread, so it sees flags changed earlier in the batch
+    return write(s, [&]
+    {
+        auto msg = s.messages.findFlagsByID(id);
+        if (!msg.has_value())
+            return setError("markDraft: message not found");
 
-    auto lock = m_db.writeLock();
-    return m_message_dal.updateFlags(id, msg->is_seen, msg->is_deleted, draft,
-                                     msg->is_answered, msg->is_flagged, msg->is_recent);
+        return s.messages.updateFlags(id, msg->has(MessageFlags::Seen), msg->has(MessageFlags::Deleted), draft,
+                                      msg->has(MessageFlags::Answered), msg->has(MessageFlags::Flagged),
+                                      msg->has(MessageFlags::Recent))
+            || setError(s.messages.getLastError());
+    });
 }
 
 bool MessageRepository::updateFlags(int64_t id, bool is_seen, bool is_deleted, bool is_draft,
                                     bool is_answered, bool is_flagged, bool is_recent)
 {
-    auto lock = m_db.writeLock();
-    return m_message_dal.updateFlags(id, is_seen, is_deleted, is_draft, is_answered, is_flagged, is_recent);
+    Shard& s = shard(id);
+    return write(s, [&]
+    {
+        return s.messages.updateFlags(id, is_seen, is_deleted, is_draft, is_answered, is_flagged, is_recent)
+            || setError(s.messages.getLastError());
+    });
+}
+
+bool MessageRepository::updateFlagsBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                                        FlagOperation operation, uint32_t flags, std::vector<MessageFlagsRow>& updated,
+                                        std::vector<int64_t>& modified, std::optional<int64_t> unchanged_since)
+{
+    return updateFlagsBulk(folder_id, uid_ranges, operation, flags, {}, updated, modified, unchanged_since);
+}
+
+bool MessageRepository::updateFlagsBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                                        FlagOperation operation, uint32_t flags,
+                                        const std::vector<std::string>& keywords, std::vector<MessageFlagsRow>& updated,
+                                        std::vector<int64_t>& modified, std::optional<int64_t> unchanged_since)
+{
+    Shard& s = shard(folder_id);
+    return write(s, [&]
+    {
+        Transaction tx(s.db.getDB());
+        if (!tx.valid())
+            return setError("updateFlagsBulk: failed to begin transaction");
+
+        if (!s.messages.updateFlagsBulk(folder_id, uid_ranges, operation, flags, keywords, unchanged_since,
+                                        updated, modified))
+            return setError(s.messages.getLastError());
+
+        if (!tx.commit())
+            return setError("updateFlagsBulk: commit failed");
+
+        return true;
+    });
 }
 
 bool MessageRepository::moveToFolder(int64_t id, int64_t folder_id)
 {
-    auto folder = m_folder_dal.findByID(folder_id);
-    if (!folder.has_value())
-        return setError("moveToFolder: folder not found");
+    Shard& s = shard(id);
+    return write(s, [&]
+    {
+        Transaction tx(s.db.getDB());
+        if (!tx.valid()) return setError("moveToFolder: failed to begin transaction");
 
-    auto lock = m_db.writeLock();
-    Transaction tx(m_db.getDB());
-    if (!tx.valid()) return setError("moveToFolder: failed to begin transaction");
+        auto folder = s.folders.findByID(folder_id);
+        if (!folder.has_value())
+            return setError("moveToFolder: folder not found");
 
-    if (!m_message_dal.moveToFolder(id, folder_id, folder->next_uid))
-        return setError(m_message_dal.getLastError());
+        if (!s.messages.moveToFolder(id, folder_id, folder->next_uid))
+            return setError(s.messages.getLastError());
 
-    if (!m_folder_dal.incrementNextUID(folder_id))
-        return setError(m_folder_dal.getLastError());
+        if (!s.folders.incrementNextUID(folder_id))
+            return setError(s.folders.getLastError());
 
-    if (!tx.commit())
-        return setError("moveToFolder: commit failed");
+        if (!tx.commit())
+            return setError("moveToFolder: commit failed");
 
-    return true;
+        return true;
+    });
 }
 
 bool MessageRepository::expunge(int64_t folder_id)
 {
-    auto deleted = m_message_dal.findDeleted(folder_id, INT_MAX, 0);
-
-    auto lock = m_db.writeLock();
-    Transaction tx(m_db.getDB());
-    if (!tx.valid()) return setError("expunge: failed to begin transaction");
+    std::vector<int64_t> expunged_uids;
+    return expunge(folder_id, expunged_uids);
+}
 
-    for (const auto& msg : deleted)
+bool MessageRepository::expunge(int64_t folder_id, std::vector<int64_t>& expunged_uids)
+{
+    Shard& s = shard(folder_id);
+    std::vector<std::pair<int64_t, std::string>> removed;
+    std::vector<std::string> orphaned;
+    bool ok = write(s, [&]
     {
-        if (!msg.id.has_value()) continue;
-        if (!m_message_dal.hardDelete(msg.id.value()))
-            return setError(m_message_dal.getLastError());
-    }
+        Transaction tx(s.db.getDB());
+        if (!tx.valid()) return setError("expunge: failed to begin transaction");
 
-    if (!tx.commit())
-        return setError("expunge: commit failed");
+        if (!s.messages.expungeDeleted(folder_id, removed))
+            return setError(s.messages.getLastError());
+        if (!removed.empty() && !s.messages.pruneExpunged(folder_id, expungedHistory()))
+            return setError(s.messages.getLastError());
+
+        std::set<std::string> seen;
+        for (const auto& [uid, path] : removed)
+        {
+            if (path.empty() || !seen.insert(path).second) continue;
 
+            bool referenced = false;
+            if (!s.messages.isFileReferenced(path, referenced))
+                return setError(s.messages.getLastError());
+            if (!referenced) orphaned.push_back(path);
+        }
+
+        if (!tx.commit())
+            return setError("expunge: commit failed");
+
+        return true;
+    });
+    // blobs are only unlinked once the batch holding the DELETE has committed
+    if (!ok) return false;
+
+    expunged_uids.clear();
+    for (const auto& [uid, path] : removed)
+        expunged_uids.push_back(uid);
+
+    s.db.fileCollector().enqueue(std::move(orphaned));
     return true;
 }
 
 bool MessageRepository::hardDelete(int64_t id)
 {
-    if (!m_message_dal.findByID(id).has_value())
+    Shard& s = shard(id);
+    if (!s.messages.findByID(id).has_value())
         return setError("hardDelete: message not found");
 
-    auto lock = m_db.writeLock();
-    return m_message_dal.hardDelete(id);
+    return write(s, [&] { return s.messages.hardDelete(id) || setError(s.messages.getLastError()); });
 }
 
 std::optional<Message> MessageRepository::copy(int64_t id, int64_t target_folder_id)
 {
-    auto msg = m_message_dal.findByID(id);
+    Shard& s = shard(id);
+    auto msg = s.messages.findByID(id);
     if (!msg.has_value())
     {
         setError("copy: message not found");
         return std::nullopt;
     }
 
-    auto folder = m_folder_dal.findByID(target_folder_id);
-    if (!folder.has_value())
-    {
-        setError("copy: target folder not found");
-        return std::nullopt;
-    }
-
-    auto recipients = m_recipient_dal.findByMessage(id);
+    auto recipients = s.recipients.findByMessage(id);
 
     Message copy = msg.value();
     copy.id = std::nullopt;
-    copy.uid  = 0;
     copy.folder_id = target_folder_id;
-    copy.uid = folder->next_uid;
 
-    auto lock = m_db.writeLock();
-    Transaction tx(m_db.getDB());
-    if (!tx.valid())
+    bool ok = write(s, [&]
     {
-        setError("copy: failed to begin transaction");
-        return std::nullopt;
-    }
+        Transaction tx(s.db.getDB());
+        if (!tx.valid())
+            return setError("copy: failed to begin transaction");
 
-    if (!m_message_dal.insert(copy))
-    {
-        setError(m_message_dal.getLastError());
-        return std::nullopt;
-    }
+        auto folder = s.folders.findByID(target_folder_id);
+        if (!folder.has_value())
+            return setError("copy: target folder not found");
 
-    for (auto& r : recipients)
-    {
-        r.id = std::nullopt;
-        r.message_id = copy.id.value();
+        copy.uid = folder->next_uid;
 
-        if (!m_recipient_dal.insert(r))
+        if (!s.messages.insert(copy))
+            return setError(s.messages.getLastError());
+
+        if (!s.messages.copyIndexedContent(id, copy.id.value()))
+            return setError(s.messages.getLastError());
+
+        if (!s.messages.copyParts(id, copy.id.value()))
+            return setError(s.messages.getLastError());
+
+        for (auto& r : recipients)
         {
-            setError("copy: failed to copy recipient — " + m_recipient_dal.getLastError());
-            return std::nullopt;
+            r.id = std::nullopt;
+            r.message_id = copy.id.value();
+
+            if (!s.recipients.insert(r))
+                return setError("copy: failed to copy recipient — " + s.recipients.getLastError());
         }
-    }
 
-    if (!m_folder_dal.incrementNextUID(target_folder_id))
-    {
-        setError(m_folder_dal.getLastError());
-        return std::nullopt;
-    }
+        if (!s.folders.incrementNextUID(target_folder_id))
+            return setError(s.folders.getLastError());
 
-    if (!tx.commit())
-    {
-        setError("copy: commit failed");
-        return std::nullopt;
-    }
+        if (!tx.commit())
+            return setError("copy: commit failed");
+
+        return true;
+    });
+    if (!ok) return std::nullopt;
 
     return copy;
 }
 
+bool MessageRepository::copyBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                                 int64_t target_folder_id, std::vector<std::pair<int64_t, int64_t>>& uid_map)
+{
+    return transferBulk(folder_id, uid_ranges, target_folder_id, false, uid_map);
+}
+
+bool MessageRepository::moveBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                                 int64_t target_folder_id, std::vector<std::pair<int64_t, int64_t>>& uid_map)
+{
+    return transferBulk(folder_id, uid_ranges, target_folder_id, true, uid_map);
+}
+
+bool MessageRepository::transferBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                                     int64_t target_folder_id, bool move,
+                                     std::vector<std::pair<int64_t, int64_t>>& uid_map)
+{
+    Shard& s = shard(folder_id);
+    uid_map.clear();
+    if (uid_ranges.empty()) return true;
+
+    std::vector<int64_t> uids;
+    int64_t first_uid = 0;
+    bool ok = write(s, [&]
+    {
+        Transaction tx(s.db.getDB());
+        if (!tx.valid()) return setError("transferBulk: failed to begin transaction");
+
+        if (!s.messages.findUIDsInRanges(folder_id, uid_ranges, uids))
+            return setError(s.messages.getLastError());
+        if (uids.empty()) return true;
+
+        if (!s.folders.reserveUIDs(target_folder_id, static_cast<int64_t>(uids.size()), first_uid))
+            return setError(s.folders.getLastError());
+
+        bool done = move ? s.messages.moveRanges(folder_id, uid_ranges, target_folder_id, first_uid) &&
+                               s.messages.pruneExpunged(folder_id, expungedHistory())
+                         : s.messages.copyRanges(folder_id, uid_ranges, target_folder_id, first_uid);
+        if (!done) return setError(s.messages.getLastError());
+
+        if (!tx.commit())
+            return setError("transferBulk: commit failed");
+
+        return true;
+    });
+    if (!ok) return false;
+
+    uid_map.reserve(uids.size());
+    for (size_t i = 0; i < uids.size(); ++i)
+        uid_map.emplace_back(uids[i], first_uid + static_cast<int64_t>(i));
+    return true;
+}
+
 std::optional<Folder> MessageRepository::findFolderByID(int64_t id) const
 {
-    return m_folder_dal.findByID(id);
+    return shard(id).folders.findByID(id);
 }
 
 std::vector<Folder> MessageRepository::findFoldersByUser(int64_t user_id, int limit, int offset) const
 {
-    return m_folder_dal.findByUser(user_id, limit, offset);
+    return shard(user_id).folders.findByUser(user_id, limit, offset);
 }
 
 std::optional<Folder> MessageRepository::findFolderByName(int64_t user_id, const std::string& name) const
 {
-    return m_folder_dal.findByName(user_id, name);
+    return shard(user_id).folders.findByName(user_id, name);
+}
+
+std::shared_ptr<const FolderTree> MessageRepository::findFolderTree(int64_t user_id) const
+{
+    Shard& s = shard(user_id);
+    FolderTreeCache& cache = s.db.folderTrees();
+    if (auto tree = cache.find(user_id))
+        return tree;
+
+    uint64_t version = cache.version();
+    auto tree = std::make_shared<FolderTree>();
+    std::set<int64_t> parents;
+    for (auto& folder : s.folders.findByUser(user_id, -1, 0))
+    {
+        if (folder.parent_id.has_value())
+            parents.insert(*folder.parent_id);
+        tree->nodes.push_back({std::move(folder), false});
+    }
+    for (auto& node : tree->nodes)
+        node.has_children = parents.count(node.folder.id.value_or(-1)) > 0;
+
+    cache.store(user_id, tree, version);
+    return tree;
+}
+
+FolderStatus MessageRepository::getFolderStats(int64_t folder_id) const
+{
+    return shard(folder_id).messages.statusByFolder(folder_id);
+}
+
+std::unordered_map<int64_t, FolderStatus> MessageRepository::getFolderStatsByUser(int64_t user_id) const
+{
+    return shard(user_id).messages.statusByUser(user_id);
 }
 
 bool MessageRepository::createFolder(Folder& folder)
 {
+    Shard& s = shard(folder.user_id);
     if (folder.name.empty())
         return setError("createFolder: folder name cannot be empty");
 
-    if (m_folder_dal.findByName(folder.user_id, folder.name).has_value())
+    if (s.folders.findByName(folder.user_id, folder.name).has_value())
         return setError("createFolder: folder '" + folder.name + "' already exists");
 
-    auto lock = m_db.writeLock();
-    return m_folder_dal.insert(folder);
+    bool ok = write(s, [&] { return s.folders.insert(folder) || setError(s.folders.getLastError()); });
+    s.db.folderTrees().invalidate(folder.user_id);
+    return ok;
 }
 
 bool MessageRepository::renameFolder(int64_t id, const std::string& new_name)
 {
+    Shard& s = shard(id);
     if (new_name.empty())
         return setError("renameFolder: new name cannot be empty");
 
-    auto folder = m_folder_dal.findByID(id);
+    auto folder = s.folders.findByID(id);
     if (!folder.has_value())
         return setError("renameFolder: folder not found");
 
-    auto existing = m_folder_dal.findByName(folder->user_id, new_name);
+    auto existing = s.folders.findByName(folder->user_id, new_name);
     if (existing.has_value() && existing->id != folder->id)
         return setError("renameFolder: folder '" + new_name + "' already exists");
 
     folder->name = new_name;
 
-    auto lock = m_db.writeLock();
-    return m_folder_dal.update(folder.value());
+    bool ok = write(s, [&] { return s.folders.update(folder.value()) || setError(s.folders.getLastError()); });
+    s.db.folderTrees().invalidate(folder->user_id);
+    return ok;
 }
 
 bool MessageRepository::deleteFolder(int64_t id)
 {
-    if (!m_folder_dal.findByID(id).has_value())
+    Shard& s = shard(id);
+    auto folder = s.folders.findByID(id);
+    if (!folder.has_value())
         return setError("deleteFolder: folder not found");
 
-    auto lock = m_db.writeLock();
-    return m_folder_dal.hardDelete(id);
+    bool ok = write(s, [&] { return s.folders.hardDelete(id) || setError(s.folders.getLastError()); });
+    s.db.folderTrees().invalidate(folder->user_id);
+    return ok;
 }
 
 std::optional<Recipient> MessageRepository::findRecipientByID(int64_t id) const
 {
-    return m_recipient_dal.findByID(id);
+    return shard(id).recipients.findByID(id);
 }
 
 std::vector<Recipient> MessageRepository::findRecipientsByMessage(int64_t message_id) const
 {
-    return m_recipient_dal.findByMessage(message_id);
+    return shard(message_id).recipients.findByMessage(message_id);
 }
 
 bool MessageRepository::addRecipient(Recipient& recipient)
 {
-    if (!m_message_dal.findByID(recipient.message_id).has_value())
+    Shard& s = shard(recipient.message_id);
+    if (!s.messages.findByID(recipient.message_id).has_value())
         return setError("addRecipient: message not found");
 
     if (recipient.address.empty())
         return setError("addRecipient: address cannot be empty");
 
-    auto lock = m_db.writeLock();
-    return m_recipient_dal.insert(recipient);
+    return write(s, [&] { return s.recipients.insert(recipient) || setError(s.recipients.getLastError()); });
 }
 
 bool MessageRepository::removeRecipient(int64_t id)
 {
-    if (!m_recipient_dal.findByID(id).has_value())
+    Shard& s = shard(id);
+    if (!s.recipients.findByID(id).has_value())
         return setError("removeRecipient: recipient not found");
 
-    auto lock = m_db.writeLock();
-    return m_recipient_dal.hardDelete(id);
+    return write(s, [&] { return s.recipients.hardDelete(id) || setError(s.recipients.getLastError()); });
 }
 
 bool MessageRepository::setFlags(int64_t id, const std::vector<std::string>& flags)
 {
-    auto msg = m_message_dal.findByID(id);
+    Shard& s = shard(id);
+    auto msg = s.messages.findFlagsByID(id);
     if (!msg.has_value())
         return setError("setFlags: message not found");
 
-    bool is_seen     = msg->is_seen;
-    bool is_deleted  = msg->is_deleted;
-    bool is_draft    = msg->is_draft;
-    bool is_answered = msg->is_answered;
-    bool is_flagged  = msg->is_flagged;
-    bool is_recent   = msg->is_recent;
+    bool is_seen     = msg->has(MessageFlags::Seen);
+    bool is_deleted  = msg->has(MessageFlags::Deleted);
+    bool is_draft    = msg->has(MessageFlags::Draft);
+    bool is_answered = msg->has(MessageFlags::Answered);
+    bool is_flagged  = msg->has(MessageFlags::Flagged);
+    bool is_recent   = msg->has(MessageFlags::Recent);
 
     // Check if any flag has a prefix (+ or -)
     bool has_prefix = false;
@@ -390,11 +697,16 @@ bool MessageRepository::setFlags(int64_t id, const std::vector<std::string>& fla
     }
 
     // If no prefixes, it's a replace operation: clear all flags first
-    if (!has_prefix && !flags.empty())
+    bool replace = !has_prefix;
+    if (replace && !flags.empty())
     {
         is_seen = is_deleted = is_draft = is_answered = is_flagged = is_recent = false;
     }
 
+    // anything that is not a system flag is a keyword (the MUA's labels)
+    std::vector<std::string> added;
+    std::vector<std::string> removed;
+
     // If no flags provided, clear all flags
     if (flags.empty())
     {
@@ -428,12 +740,22 @@ bool MessageRepository::setFlags(int64_t id, const std::vector<std::string>& fla
             else if (name == "\\Answered") is_answered = value;
             else if (name == "\\Flagged")  is_flagged  = value;
             else if (name == "\\Recent")   is_recent   = value;
-            else return setError("setFlags: unknown flag '" + name + "'");
+            else if (name.empty() || name[0] == '\\')
+                return setError("setFlags: unknown flag '" + name + "'");
+            else (value ? added : removed).push_back(name);
         }
     }
 
-    auto lock = m_db.writeLock();
-    return m_message_dal.updateFlags(id, is_seen, is_deleted, is_draft, is_answered, is_flagged, is_recent);
+    return write(s, [&]
+    {
+        if (!s.messages.updateFlags(id, is_seen, is_deleted, is_draft, is_answered, is_flagged, is_recent))
+            return setError(s.messages.getLastError());
+
+        bool ok = replace ? s.messages.updateKeywords(id, FlagOperation::Replace, added)
+                          : (added.empty() || s.messages.updateKeywords(id, FlagOperation::Add, added)) &&
+                            (removed.empty() || s.messages.updateKeywords(id, FlagOperation::Remove, removed));
+        return ok || setError(s.messages.getLastError());
+    });
 }
 
 bool MessageRepository::append(Message& msg, int64_t folder_id)
@@ -443,53 +765,44 @@ bool MessageRepository::append(Message& msg, int64_t folder_id)
 
 bool MessageRepository::incrementNextUID(int64_t folder_id)
 {
-    if (!m_folder_dal.findByID(folder_id).has_value())
+    Shard& s = shard(folder_id);
+    if (!s.folders.findByID(folder_id).has_value())
         return setError("incrementNextUID: folder not found");
 
-    auto lock = m_db.writeLock();
-    if (!m_folder_dal.incrementNextUID(folder_id))
-        return setError(m_folder_dal.getLastError());
-
-    return true;
+    return write(s, [&] { return s.folders.incrementNextUID(folder_id) || setError(s.folders.getLastError()); });
 }
 
 bool MessageRepository::clearRecentByFolder(int64_t folder_id)
 {
-    if (!m_folder_dal.findByID(folder_id).has_value())
+    Shard& s = shard(folder_id);
+    if (!s.folders.findByID(folder_id).has_value())
         return setError("clearRecentByFolder: folder not found");
 
-    auto lock = m_db.writeLock();
-    if (!m_message_dal.clearRecentByFolder(folder_id))
-        return setError(m_message_dal.getLastError());
-
-    return true;
+    return write(s, [&] { return s.messages.clearRecentByFolder(folder_id) || setError(s.messages.getLastError()); });
 }
 
 bool MessageRepository::closeFolder(int64_t folder_id)
 {
+    Shard& s = shard(folder_id);
     if (!expunge(folder_id))
         return false;
 
-    auto lock = m_db.writeLock();
-    if (!m_message_dal.clearRecentByFolder(folder_id))
-        return setError(m_message_dal.getLastError());
-
-    return true;
+    return write(s, [&] { return s.messages.clearRecentByFolder(folder_id) || setError(s.messages.getLastError()); });
 }
 
 bool MessageRepository::setSubscribed(int64_t folder_id, bool subscribed)
 {
-    if (!m_folder_dal.findByID(folder_id).has_value())
+    Shard& s = shard(folder_id);
+    auto folder = s.folders.findByID(folder_id);
+    if (!folder.has_value())
         return setError("setSubscribed: folder not found");
 
-    auto lock = m_db.writeLock();
-    if (!m_folder_dal.setSubscribed(folder_id, subscribed))
-        return setError(m_folder_dal.getLastError());
-
-    return true;
+    bool ok = write(s, [&] { return s.folders.setSubscribed(folder_id, subscribed) || setError(s.folders.getLastError()); });
+    s.db.folderTrees().invalidate(folder->user_id);
+    return ok;
 }
 
 std::vector<Folder> MessageRepository::findFoldersByParent(int64_t parent_id, int limit, int offset) const
 {
-    return m_folder_dal.findByParent(parent_id, limit, offset);
+    return shard(parent_id).folders.findByParent(parent_id, limit, offset);
 }
\ No newline at end of file
@@ -4,10 +4,19 @@
 #include <optional>
 #include <string>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
 
 #include "Entity/Message.h"
 #include "Entity/Folder.h"
+#include "Entity/FolderTree.h"
+#include "Entity/MessageFlags.h"
+#include "Entity/MessagePart.h"
+#include "Entity/MessageRowSet.h"
+#include "Entity/MessageRows.h"
 #include "Entity/Recipient.h"
+#include "Entity/SearchCriteria.h"
 
 #include "DAL/MessageDAL.h"
 #include "DAL/FolderDAL.h"
@@ -15,24 +24,46 @@
 
 #include "Transaction.h"
 #include "DataBaseManager.h"
+#include "ShardRouter.h"
 
 class MessageRepository
 {
 public:
     explicit MessageRepository(DataBaseManager& db);
+    // every call goes to the shard named by the id it is given
+    explicit MessageRepository(ShardRouter& router);
 
     std::optional<Message> findByID(int64_t id) const;
     std::optional<Message> findByUID(int64_t folder_id, int64_t uid) const;
     std::vector<Message> findByUser(int64_t user_id, int limit = 50, int offset = 0) const;
     std::vector<Message> findByFolder(int64_t folder_id, int limit = 50, int offset = 0) const;
     std::vector<Message> findUnseen(int64_t folder_id, int limit = 50, int offset = 0) const;
+    // keyset pagination, see MessageDAL
+    std::vector<Message> findByUserBefore(int64_t user_id, const std::string& before_date, int64_t before_id,
+                                          int limit = 50) const;
+    MessageRowSet findByFolderAfter(int64_t folder_id, int64_t after_uid, int limit = 50) const;
+    std::vector<Message> findUnseenAfter(int64_t folder_id, int64_t after_uid, int limit = 50) const;
     std::vector<Message> findDeleted(int64_t folder_id, int limit = 50, int offset = 0) const;
     std::vector<Message> findFlagged(int64_t folder_id, int limit = 50, int offset = 0) const;
     std::vector<Message> search(int64_t user_id, const std::string& query, int limit = 50, int offset = 0) const;
     std::vector<Folder> findFoldersByParent(int64_t parent_id, int limit = 50, int offset = 0) const;
+    std::vector<MessageFlagsRow> findChangedSince(int64_t folder_id, int64_t modseq) const;
+    // FETCH of FLAGS, INTERNALDATE, RFC822.SIZE, MODSEQ and UID only, without loading the message
+    std::vector<MessageHeaderRow> findHeaderRows(int64_t folder_id,
+                                                 const std::vector<std::pair<int64_t, int64_t>>& uid_ranges) const;
+    // nullopt when the folder's tombstones no longer reach back to modseq
+    std::optional<std::vector<int64_t>> findExpungedSince(int64_t folder_id, int64_t modseq) const;
+    std::vector<int64_t> findUIDsByFolder(int64_t folder_id) const;
+    std::vector<int64_t> searchUIDs(int64_t folder_id, const SearchCriteria& criteria) const;
+    std::vector<int64_t> sortUIDs(int64_t folder_id, const SearchCriteria& criteria,
+                                  const std::vector<SortKey>& keys) const;
+    MessageRowSet searchMessages(int64_t folder_id, const SearchCriteria& criteria) const;
+    std::vector<MessagePart> findParts(int64_t message_id) const;
 
     bool deliver(Message& msg, int64_t folder_id = 0);
+    bool indexContent(int64_t id, const std::string& to, const std::string& cc, const std::string& body);
     bool saveToFolder(Message& msg, int64_t folder_id);
+    bool saveParts(int64_t message_id, const std::vector<MessagePart>& parts);
 
     bool markSeen(int64_t id, bool seen);
     bool markDeleted(int64_t id, bool deleted);
@@ -42,16 +73,40 @@ public:
     bool updateFlags(int64_t id, bool is_seen, bool is_deleted, bool is_draft,
                      bool is_answered, bool is_flagged, bool is_recent);
     bool setFlags(int64_t id, const std::vector<std::string>& flags);
+    // One UPDATE and one commit for the whole UID set; updated receives the rows with their
+    // new flags, modified the UIDs skipped by UNCHANGEDSINCE.
+    bool updateFlagsBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                         FlagOperation operation, uint32_t flags, std::vector<MessageFlagsRow>& updated,
+                         std::vector<int64_t>& modified, std::optional<int64_t> unchanged_since = std::nullopt);
+    // keywords are applied with the same operation; Replace with none clears them
+    bool updateFlagsBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                         FlagOperation operation, uint32_t flags, const std::vector<std::string>& keywords,
+                         std::vector<MessageFlagsRow>& updated, std::vector<int64_t>& modified,
+                         std::optional<int64_t> unchanged_since = std::nullopt);
 
     bool moveToFolder(int64_t id, int64_t folder_id);
     bool expunge(int64_t folder_id);
+    // one DELETE for the whole folder; orphaned blobs go to the file collector after commit
+    bool expunge(int64_t folder_id, std::vector<int64_t>& expunged_uids);
 
     bool hardDelete(int64_t id);
     std::optional<Message> copy(int64_t id, int64_t target_folder_id);
 
+    // COPY / MOVE (RFC 6851) of every message of folder_id inside uid_ranges, in one transaction.
+    // uid_map receives (source uid, target uid) pairs in ascending order, ready for COPYUID.
+    bool copyBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                  int64_t target_folder_id, std::vector<std::pair<int64_t, int64_t>>& uid_map);
+    bool moveBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                  int64_t target_folder_id, std::vector<std::pair<int64_t, int64_t>>& uid_map);
+
     std::optional<Folder> findFolderByID(int64_t id) const;
     std::vector<Folder> findFoldersByUser(int64_t user_id, int limit = 50, int offset = 0) const;
     std::optional<Folder> findFolderByName(int64_t user_id, const std::string& name) const;
+    // all folders of the user, served from the process-wide cache until a folder changes
+    std::shared_ptr<const FolderTree> findFolderTree(int64_t user_id) const;
+    // counters maintained by triggers on messages: a lookup, not a scan of the mailbox
+    FolderStatus getFolderStats(int64_t folder_id) const;
+    std::unordered_map<int64_t, FolderStatus> getFolderStatsByUser(int64_t user_id) const;
     bool createFolder(Folder& folder);
     bool renameFolder(int64_t id, const std::string& new_name);
     bool deleteFolder(int64_t id);
@@ -71,12 +126,26 @@ public:
     const std::string& getLastError() const;
 
 private:
-    DataBaseManager& m_db;
-    MessageDAL m_message_dal;
-    FolderDAL m_folder_dal;
-    RecipientDAL m_recipient_dal;
-    mutable std::string m_last_error;
-
+    struct Shard
+    {
+        explicit Shard(DataBaseManager& db);
+
+        DataBaseManager& db;
+        MessageDAL messages;
+        FolderDAL folders;
+        RecipientDAL recipients;
+    };
+
+    ShardRouter* m_router = nullptr;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    // per thread: one repository instance is shared by every IMAP session
+    static thread_local std::string m_last_error;
+
+    Shard& shard(int64_t id) const;
+    static int64_t expungedHistory();
+    bool write(Shard& shard, const std::function<bool()>& work);
     bool assignUID(Message& msg, int64_t folder_id);
+    bool transferBulk(int64_t folder_id, const std::vector<std::pair<int64_t, int64_t>>& uid_ranges,
+                      int64_t target_folder_id, bool move, std::vector<std::pair<int64_t, int64_t>>& uid_map);
     bool setError(const std::string& msg) const;
 };
\ No newline at end of file
@@ -1,12 +1,38 @@
 #include "UserRepository.h"
 
+#include <algorithm>
+
+UserRepository::Shard::Shard(DataBaseManager& db)
+    : db(db)
+    , users(db.getDB(), db.pool())
+    , folders(db.getDB(), db.pool())
+{
+}
+
 UserRepository::UserRepository(DataBaseManager& db)
-    : m_db(db)
-    , m_user_dal(db.getDB(), db.pool())
-    , m_folder_dal(db.getDB(), db.pool())
 {
+    m_shards.push_back(std::make_unique<Shard>(db));
+}
+
+UserRepository::UserRepository(ShardRouter& router)
+    : m_router(&router)
+{
+    for (size_t k = 0; k < router.size(); ++k)
+        m_shards.push_back(std::make_unique<Shard>(router.shard(k)));
+}
+
+UserRepository::Shard& UserRepository::shard(int64_t id) const
+{
+    return *m_shards[m_router ? m_router->shardOfID(id) : 0];
+}
+
+UserRepository::Shard& UserRepository::shardOf(const std::string& username) const
+{
+    return *m_shards[m_router ? m_router->shardOfUser(username) : 0];
 }
 
+thread_local std::string UserRepository::m_last_error;
+
 bool UserRepository::setError(const std::string& error) const
 {
     m_last_error = error;
@@ -18,61 +44,127 @@ const std::string& UserRepository::getLastError() const
     return m_last_error;
 }
 
+bool UserRepository::write(Shard& shard, const std::function<bool()>& work)
+{
+    // the work runs on the shard's writer thread, carry its error back to this one
+    std::string error;
+    bool ok = shard.db.write([&]
+    {
+        m_last_error.clear();
+        if (work()) return true;
+        error = m_last_error;
+        return false;
+    });
+    if (!ok) return setError(error.empty() ? "write not committed" : error);
+    return true;
+}
+
 std::optional<User> UserRepository::findByID(int64_t id) const
 {
-    auto result = m_user_dal.findByID(id);
+    Shard& s = shard(id);
+    auto result = s.users.findByID(id);
     if (!result.has_value())
-        m_last_error = m_user_dal.getLastError();
+        m_last_error = s.users.getLastError();
     return result;
 }
 
 std::optional<User> UserRepository::findByUsername(const std::string& username) const
 {
-    auto result = m_user_dal.findByUsername(username);
+    Shard& s = shardOf(username);
+    auto result = s.users.findByUsername(username);
     if (!result.has_value())
-        m_last_error = m_user_dal.getLastError();
+        m_last_error = s.users.getLastError();
     return result;
 }
 
 std::vector<User> UserRepository::findAll(int limit, int offset) const
 {
-    auto result = m_user_dal.findAll(limit, offset);
-    m_last_error = m_user_dal.getLastError();
+    if (m_shards.size() == 1)
+    {
+        auto result = m_shards[0]->users.findAll(limit, offset);
+        m_last_error = m_shards[0]->users.getLastError();
+        return result;
+    }
+
+    // each shard is ordered by username on its own, the merged list is sorted once more
+    std::vector<User> result;
+    for (const auto& s : m_shards)
+    {
+        auto rows = s->users.findAll(limit < 0 ? -1 : limit + offset, 0);
+        m_last_error = s->users.getLastError();
+        result.insert(result.end(), std::make_move_iterator(rows.begin()), std::make_move_iterator(rows.end()));
+    }
+    std::sort(result.begin(), result.end(), [](const User& a, const User& b) { return a.username < b.username; });
+    result.erase(result.begin(), result.begin() + std::min<size_t>(std::max(offset, 0), result.size()));
+    if (limit >= 0 && result.size() > static_cast<size_t>(limit))
+        result.resize(limit);
+    return result;
+}
+
+std::vector<User> UserRepository::findAllAfter(const std::string& after_username, int limit) const
+{
+    if (m_shards.size() == 1)
+    {
+        auto result = m_shards[0]->users.findAllAfter(after_username, limit);
+        m_last_error = m_shards[0]->users.getLastError();
+        return result;
+    }
+
+    // every shard returns its next page, the merged page is the smallest names among them
+    std::vector<User> result;
+    for (const auto& s : m_shards)
+    {
+        auto rows = s->users.findAllAfter(after_username, limit);
+        m_last_error = s->users.getLastError();
+        result.insert(result.end(), std::make_move_iterator(rows.begin()), std::make_move_iterator(rows.end()));
+    }
+    std::sort(result.begin(), result.end(), [](const User& a, const User& b) { return a.username < b.username; });
+    if (limit >= 0 && result.size() > static_cast<size_t>(limit))
+        result.resize(limit);
     return result;
 }
 
 // FIX: should also create physical folders in data/mailboxes/{user_id}/ if email saving will be distributed by folders
 bool UserRepository::registerUser(User& user, const std::string& password)
 {
-    if (m_user_dal.findByUsername(user.username).has_value())
+    size_t index = m_router ? m_router->shardOfUser(user.username) : 0;
+    Shard& s = *m_shards[index];
+    if (s.users.findByUsername(user.username).has_value())
         return setError("registerUser: username already exists");
 
     user.password_hash = hashPassword(password);
     if (user.password_hash.empty())
         return setError("registerUser: password hashing failed");
 
-    auto lock = m_db.writeLock();
+    bool ok = write(s, [&]
+    {
+        if (!s.users.insert(user))
+            return setError(s.users.getLastError());
 
-    if (!m_user_dal.insert(user))
-        return setError(m_user_dal.getLastError());
+        for (const char* name : {"INBOX", "Sent", "Drafts", "Trash", "Spam"})
+        {
+            Folder f;
+            f.user_id       = user.id.value();
+            f.name          = name;
+            f.next_uid      = 1;
+            f.is_subscribed = true;
+            if (!s.folders.insert(f))
+                return setError(s.folders.getLastError());
+        }
 
-    for (const char* name : {"INBOX", "Sent", "Drafts", "Trash", "Spam"})
-    {
-        Folder f;
-        f.user_id       = user.id.value();
-        f.name          = name;
-        f.next_uid      = 1;
-        f.is_subscribed = true;
-        if (!m_folder_dal.insert(f))
-            return setError(m_folder_dal.getLastError());
-    }
+        return true;
+    });
+    if (!ok) return false;
 
+    // recorded after the commit, so a failed registration never leaves a directory entry behind
+    if (m_router && !m_router->assign(user.username, index))
+        return setError("registerUser: shard directory not updated");
     return true;
 }
 
 bool UserRepository::authorize(const std::string& username, const std::string& password)
 {
-    auto user = m_user_dal.findByUsername(username);
+    auto user = shardOf(username).users.findByUsername(username);
     if (!user.has_value())
         return setError("authorize: user not found");
 
@@ -84,35 +176,46 @@ bool UserRepository::authorize(const std::string& username, const std::string& p
 
 bool UserRepository::changePassword(int64_t id, const std::string& new_password)
 {
-    if (!m_user_dal.findByID(id).has_value())
+    Shard& s = shard(id);
+    if (!s.users.findByID(id).has_value())
         return setError("changePassword: user not found");
 
-    auto lock = m_db.writeLock();
-
-    if (!m_user_dal.updatePassword(id, hashPassword(new_password)))
-        return setError(m_user_dal.getLastError());
-
-    return true;
+    std::string hash = hashPassword(new_password);
+    return write(s, [&] { return s.users.updatePassword(id, hash) || setError(s.users.getLastError()); });
 }
 
 bool UserRepository::update(const User& user)
 {
-    auto lock = m_db.writeLock();
-    if (!m_user_dal.update(user))
-        return setError(m_user_dal.getLastError());
+    Shard& s = shard(user.id.value_or(0));
+    std::optional<User> current;
+    if (m_router && user.id.has_value())
+        current = s.users.findByID(*user.id);
+
+    if (!write(s, [&] { return s.users.update(user) || setError(s.users.getLastError()); }))
+        return false;
+
+    // a renamed user stays on its shard, only the directory key moves
+    if (current.has_value() && current->username != user.username)
+    {
+        m_router->unassign(current->username);
+        if (!m_router->assign(user.username, m_router->shardOfID(*user.id)))
+            return setError("update: shard directory not updated");
+    }
     return true;
 }
 
 bool UserRepository::hardDelete(int64_t id)
 {
-    if (!m_user_dal.findByID(id).has_value())
+    Shard& s = shard(id);
+    auto user = s.users.findByID(id);
+    if (!user.has_value())
         return setError("hardDelete: user not found");
 
-    auto lock = m_db.writeLock();
-
-    if (!m_user_dal.hardDelete(id))
-        return setError(m_user_dal.getLastError());
+    if (!write(s, [&] { return s.users.hardDelete(id) || setError(s.users.getLastError()); }))
+        return false;
 
+    s.db.folderTrees().invalidate(id);
+    if (m_router) m_router->unassign(user->username);
     return true;
 }
 
@@ -120,23 +223,22 @@ bool UserRepository::updateProfile(int64_t id, const std::optional<std::string>&
                                    const std::optional<std::string>& last_name,
                                    const std::optional<std::string>& birthdate)
 {
-    auto lock = m_db.writeLock();
-    if (!m_user_dal.updateProfile(id, first_name, last_name, birthdate))
-        return setError(m_user_dal.getLastError());
-    return true;
+    Shard& s = shard(id);
+    return write(s, [&]
+    {
+        return s.users.updateProfile(id, first_name, last_name, birthdate) || setError(s.users.getLastError());
+    });
 }
 
 bool UserRepository::updateAvatar(int64_t id, const std::optional<std::string>& avatar_b64)
 {
-    auto lock = m_db.writeLock();
-    if (!m_user_dal.updateAvatar(id, avatar_b64))
-        return setError(m_user_dal.getLastError());
-    return true;
+    Shard& s = shard(id);
+    return write(s, [&] { return s.users.updateAvatar(id, avatar_b64) || setError(s.users.getLastError()); });
 }
 
 std::optional<std::string> UserRepository::getAvatar(int64_t id) const
 {
-    return m_user_dal.getAvatar(id);
+    return shard(id).users.getAvatar(id);
 }
 
 std::string UserRepository::hashPassword(const std::string& password) const
@@ -4,6 +4,8 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <sodium.h>
 
 #include "Entity/User.h"
@@ -11,15 +13,19 @@
 #include "DAL/UserDAL.h"
 #include "DAL/FolderDAL.h"
 #include "DataBaseManager.h"
+#include "ShardRouter.h"
 
 class UserRepository
 {
 public:
     explicit UserRepository(DataBaseManager& db);
+    // users are found by id or through the router's username directory
+    explicit UserRepository(ShardRouter& router);
 
     std::optional<User> findByID(int64_t id) const;
     std::optional<User> findByUsername(const std::string& username) const;
     std::vector<User> findAll(int limit = 50, int offset = 0) const;
+    std::vector<User> findAllAfter(const std::string& after_username, int limit = 50) const;
 
     bool registerUser(User& user, const std::string& password);
     bool authorize(const std::string& username, const std::string& password);
@@ -37,11 +43,22 @@ public:
     const std::string& getLastError() const;
 
 private:
-    DataBaseManager& m_db;
-    UserDAL m_user_dal;
-    FolderDAL m_folder_dal;
-    mutable std::string m_last_error;
+    struct Shard
+    {
+        explicit Shard(DataBaseManager& db);
 
+        DataBaseManager& db;
+        UserDAL users;
+        FolderDAL folders;
+    };
+
+    ShardRouter* m_router = nullptr;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    static thread_local std::string m_last_error;
+
+    Shard& shard(int64_t id) const;
+    Shard& shardOf(const std::string& username) const;
+    bool write(Shard& shard, const std::function<bool()>& work);
     std::string hashPassword(const std::string& password) const;
     bool setError(const std::string& error) const;
 };
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include "ShardRouter.h"
+
+#include <mutex>
+#include "StatementCache.h"
+
+namespace
+{
+
+constexpr const char* DIRECTORY_SCHEMA =
+    "CREATE TABLE IF NOT EXISTS user_shards ("
+    "    username TEXT PRIMARY KEY,"
+    "    shard    INTEGER NOT NULL"
+    ") WITHOUT ROWID;";
+
+constexpr int DIRECTORY_READERS = 2;
+
+// every table whose rows are addressed by id from outside the shard
+constexpr const char* ID_TABLES[] = {"users", "folders", "messages", "expunged_messages", "recipients"};
+
+} // namespace
+
+ShardRouter::ShardRouter(DataBaseManager& db)
+{
+    m_shards.push_back(&db);
+}
+
+ShardRouter::ShardRouter(const std::string& base_path, int shard_count, std::string_view migration_sql,
+                         std::shared_ptr<ILogger> logger, int read_pool_size)
+    : m_logger(std::move(logger))
+{
+    m_directory = std::make_unique<DataBaseManager>(base_path + ".directory.db", DIRECTORY_SCHEMA, m_logger,
+                                                    DIRECTORY_READERS);
+    if (!m_directory->isConnected()) return;
+
+    for (int k = 0; k < shard_count; ++k)
+    {
+        auto db = std::make_unique<DataBaseManager>(base_path + ".shard" + std::to_string(k) + ".db",
+                                                    migration_sql, m_logger, read_pool_size);
+        if (!db->isConnected() || !reserveIDs(*db, static_cast<size_t>(k)))
+        {
+            if (m_logger) m_logger->Log(LogLevel::PROD, "[DB] Shard " + std::to_string(k) + " unavailable");
+            m_shards.clear();
+            return;
+        }
+        m_shards.push_back(db.get());
+        m_owned.push_back(std::move(db));
+    }
+
+    if (m_logger) m_logger->Log(LogLevel::DEBUG, "[DB] Sharded over " + std::to_string(shard_count) + " files");
+}
+
+ShardRouter::~ShardRouter() = default;
+
+std::unique_ptr<ShardRouter> ShardRouter::open(const std::string& path, int shard_count, std::string_view migration_sql,
+                                               std::shared_ptr<ILogger> logger, int read_pool_size)
+{
+    if (shard_count > 1)
+        return std::make_unique<ShardRouter>(path, shard_count, migration_sql, std::move(logger), read_pool_size);
+
+    auto db = std::make_unique<DataBaseManager>(path, migration_sql, std::move(logger), read_pool_size);
+    auto router = std::make_unique<ShardRouter>(*db);
+    router->m_owned.push_back(std::move(db));
+    return router;
+}
+
+bool ShardRouter::isConnected() const
+{
+    if (m_shards.empty()) return false;
+    for (auto* db : m_shards)
+        if (!db->isConnected()) return false;
+    return true;
+}
+
+bool ShardRouter::reserveIDs(DataBaseManager& db, size_t index)
+{
+    if (index == 0) return true;
+
+    // raise every AUTOINCREMENT counter to the start of the shard's range; a no-op once rows exist
+    std::string first = std::to_string(static_cast<int64_t>(index) << ID_SHIFT);
+    std::string sql;
+    for (const char* table : ID_TABLES)
+    {
+        sql += "INSERT INTO sqlite_sequence(name, seq) SELECT '" + std::string(table) + "', " + first +
+               " WHERE NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = '" + table + "');";
+        sql += "UPDATE sqlite_sequence SET seq = " + first + " WHERE name = '" + table + "' AND seq < " + first + ";";
+    }
+
+    return db.write([&] { return sqlite3_exec(db.getDB(), sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK; });
+}
+
+size_t ShardRouter::shardOfID(int64_t id) const
+{
+    if (id <= 0) return 0;
+    size_t index = static_cast<size_t>(id >> ID_SHIFT);
+    return index < m_shards.size() ? index : 0;
+}
+
+size_t ShardRouter::shardOfUser(const std::string& username) const
+{
+    if (m_shards.size() <= 1) return 0;
+
+    auto recorded = lookup(username);
+    if (recorded.has_value() && *recorded < m_shards.size())
+        return *recorded;
+
+    return placement(username);
+}
+
+std::optional<size_t> ShardRouter::lookup(const std::string& username) const
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(m_cache_mutex);
+        auto it = m_cache.find(username);
+        if (it != m_cache.end()) return it->second;
+    }
+
+    ConnectionPool& pool = m_directory->pool();
+    ReadGuard g(pool);
+    Statement stmt(pool, g.db(), "SELECT shard FROM user_shards WHERE username = ?;");
+    if (!stmt) return std::nullopt;
+
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(stmt) != SQLITE_ROW) return std::nullopt;
+
+    size_t index = static_cast<size_t>(sqlite3_column_int64(stmt, 0));
+
+    // only hits are cached, an unknown name may register on another process at any time
+    std::unique_lock<std::shared_mutex> lock(m_cache_mutex);
+    m_cache[username] = index;
+    return index;
+}
+
+size_t ShardRouter::placement(const std::string& username) const
+{
+    // FNV-1a: unlike std::hash it is the same on every build, so a name always lands on one shard
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : username)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return static_cast<size_t>(hash % m_shards.size());
+}
+
+bool ShardRouter::assign(const std::string& username, size_t shard)
+{
+    if (!m_directory) return shard == 0;
+
+    bool ok = m_directory->write([&]
+    {
+        sqlite3* db = m_directory->getDB();
+        Statement stmt(m_directory->pool(), db, "INSERT OR REPLACE INTO user_shards(username, shard) VALUES (?, ?);");
+        if (!stmt) return false;
+
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, static_cast<int64_t>(shard));
+        return sqlite3_step(stmt) == SQLITE_DONE;
+    });
+    if (!ok) return false;
+
+    std::unique_lock<std::shared_mutex> lock(m_cache_mutex);
+    m_cache[username] = shard;
+    return true;
+}
+
+bool ShardRouter::unassign(const std::string& username)
+{
+    if (!m_directory) return true;
+
+    bool ok = m_directory->write([&]
+    {
+        sqlite3* db = m_directory->getDB();
+        Statement stmt(m_directory->pool(), db, "DELETE FROM user_shards WHERE username = ?;");
+        if (!stmt) return false;
+
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+        return sqlite3_step(stmt) == SQLITE_DONE;
+    });
+
+    std::unique_lock<std::shared_mutex> lock(m_cache_mutex);
+    m_cache.erase(username);
+    return ok;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "DataBaseManager.h"
+#include "ILogger.h"
+
+// Spreads users over several database files. Every shard is a full DataBaseManager with its own
+// writer thread, write lock and read pool, so writes of users on different shards commit in parallel.
+// A small directory database maps each username to the shard that holds it.
+class ShardRouter
+{
+public:
+    // the ids of shard k start above k << ID_SHIFT, so a user, folder, message or recipient id names its shard
+    static constexpr int ID_SHIFT = 40;
+
+    // one unsharded database: everything lives in shard 0 and no directory is kept
+    explicit ShardRouter(DataBaseManager& db);
+    // <base_path>.directory.db plus <base_path>.shard<k>.db for every k below shard_count
+    ShardRouter(const std::string& base_path, int shard_count, std::string_view migration_sql,
+                std::shared_ptr<ILogger> logger = nullptr, int read_pool_size = 0);
+    ~ShardRouter();
+
+    // database.db_shards decides the layout: one shard opens <path> itself, as before sharding existed
+    static std::unique_ptr<ShardRouter> open(const std::string& path, int shard_count, std::string_view migration_sql,
+                                             std::shared_ptr<ILogger> logger = nullptr, int read_pool_size = 0);
+
+    ShardRouter(const ShardRouter&) = delete;
+    ShardRouter& operator=(const ShardRouter&) = delete;
+
+    bool isConnected() const;
+    size_t size() const { return m_shards.size(); }
+    DataBaseManager& shard(size_t index) const { return *m_shards[index]; }
+
+    size_t shardOfID(int64_t id) const;
+    // id with its shard bits cleared: unique within one shard and never above 2^ID_SHIFT
+    static int64_t localID(int64_t id) { return id & ((int64_t{1} << ID_SHIFT) - 1); }
+    // the shard holding username, or the one it is placed on when it registers
+    size_t shardOfUser(const std::string& username) const;
+    bool assign(const std::string& username, size_t shard);
+    bool unassign(const std::string& username);
+
+private:
+    std::vector<DataBaseManager*> m_shards;
+    std::vector<std::unique_ptr<DataBaseManager>> m_owned;
+    std::unique_ptr<DataBaseManager> m_directory;
+    std::shared_ptr<ILogger> m_logger;
+
+    mutable std::shared_mutex m_cache_mutex;
+    mutable std::unordered_map<std::string, size_t> m_cache;
+
+    bool reserveIDs(DataBaseManager& db, size_t index);
+    std::optional<size_t> lookup(const std::string& username) const;
+    size_t placement(const std::string& username) const;
+};
@@ -0,0 +1,81 @@
+#include "StatementCache.h"
+#include "ConnectionPool.h"
+
+StatementCache::~StatementCache()
+{
+    for (auto& [sql, stmt] : m_idle)
+        sqlite3_finalize(stmt);
+}
+
+sqlite3_stmt* StatementCache::acquire(const char* sql)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_idle.find(sql);
+        if (it != m_idle.end())
+        {
+            sqlite3_stmt* stmt = it->second;
+            m_idle.erase(it);
+            return stmt;
+        }
+    }
+
+    // a miss, or the same statement is already in use further up the stack
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v3(m_db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK)
+    {
+        sqlite3_finalize(stmt);
+        return nullptr;
+    }
+    return stmt;
+}
+
+void StatementCache::release(const char* sql, sqlite3_stmt* stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_idle.size() < MAX_IDLE)
+        {
+            m_idle.emplace(sql, stmt);
+            return;
+        }
+    }
+    sqlite3_finalize(stmt);
+}
+
+Statement::Statement(ConnectionPool& pool, sqlite3* db, const char* sql)
+{
+    m_cache = pool.statements(db);
+    if (m_cache)
+    {
+        m_sql = sql;
+        m_stmt = m_cache->acquire(sql);
+    }
+    else if (sqlite3_prepare_v2(db, sql, -1, &m_stmt, nullptr) != SQLITE_OK)
+    {
+        sqlite3_finalize(m_stmt);
+        m_stmt = nullptr;
+    }
+}
+
+Statement::Statement(sqlite3* db, const std::string& sql)
+{
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &m_stmt, nullptr) != SQLITE_OK)
+    {
+        sqlite3_finalize(m_stmt);
+        m_stmt = nullptr;
+    }
+}
+
+Statement::~Statement()
+{
+    if (!m_stmt) return;
+
+    if (m_cache)
+        m_cache->release(m_sql, m_stmt);
+    else
+        sqlite3_finalize(m_stmt);
+}
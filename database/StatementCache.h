@@ -0,0 +1,51 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Idle prepared statements of one connection, keyed by the address of the SQL literal they were
+// compiled from. Only string literals may be used as keys: their address is stable for the whole run.
+class StatementCache
+{
+public:
+    static constexpr size_t MAX_IDLE = 128;
+
+    explicit StatementCache(sqlite3* db) : m_db(db) {}
+    ~StatementCache();
+
+    StatementCache(const StatementCache&) = delete;
+    StatementCache& operator=(const StatementCache&) = delete;
+
+    sqlite3_stmt* acquire(const char* sql);
+    void release(const char* sql, sqlite3_stmt* stmt);
+
+private:
+    sqlite3* m_db;
+    std::mutex m_mutex;
+    std::unordered_multimap<const char*, sqlite3_stmt*> m_idle;
+};
+
+class ConnectionPool;
+
+// RAII handle over a prepared statement. The cached form hands the statement back reset and
+// unbound; the std::string form is for dynamically built SQL and is finalized on destruction.
+class Statement
+{
+public:
+    Statement(ConnectionPool& pool, sqlite3* db, const char* sql);
+    Statement(sqlite3* db, const std::string& sql);
+    ~Statement();
+
+    Statement(const Statement&) = delete;
+    Statement& operator=(const Statement&) = delete;
+
+    explicit operator bool() const { return m_stmt != nullptr; }
+    operator sqlite3_stmt*() const { return m_stmt; }
+
+private:
+    StatementCache* m_cache = nullptr;
+    const char* m_sql = nullptr;
+    sqlite3_stmt* m_stmt = nullptr;
+};
@@ -2,24 +2,30 @@
 
 #include <sqlite3.h>
 
+// Opened while another transaction is active (a repository call running inside a
+// WriteQueue batch), it becomes a savepoint: commit releases it, destruction rolls back
+// only its own changes.
 class Transaction
 {
 public:
-    explicit Transaction(sqlite3* db) : m_db(db), m_committed(false), m_valid(false)
+    explicit Transaction(sqlite3* db)
+        : m_db(db), m_committed(false), m_valid(false), m_nested(db && sqlite3_get_autocommit(db) == 0)
     {
-        m_valid = (sqlite3_exec(m_db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) == SQLITE_OK);
+        m_valid = (sqlite3_exec(m_db, m_nested ? "SAVEPOINT nested_tx;" : "BEGIN IMMEDIATE;",
+                                nullptr, nullptr, nullptr) == SQLITE_OK);
     }
 
     ~Transaction()
     {
         if (m_valid && !m_committed)
-            sqlite3_exec(m_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            sqlite3_exec(m_db, m_nested ? "ROLLBACK TO nested_tx; RELEASE nested_tx;" : "ROLLBACK;",
+                         nullptr, nullptr, nullptr);
     }
 
     bool commit()
     {
         if (!m_valid) return false;
-        if (sqlite3_exec(m_db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK)
+        if (sqlite3_exec(m_db, m_nested ? "RELEASE nested_tx;" : "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK)
             return false;
         m_committed = true;
         return true;
@@ -35,4 +41,5 @@ private:
     sqlite3* m_db;
     bool     m_committed;
     bool     m_valid;
-};
\ No newline at end of file
+    bool     m_nested;
+};
@@ -0,0 +1,139 @@
+#include "WalCheckpointer.h"
+
+#include <algorithm>
+
+namespace
+{
+    constexpr int SQLITE_AUTOCHECKPOINT_FRAMES = 1000; // SQLite's built-in default
+}
+
+WalCheckpointer::WalCheckpointer(const std::string& db_path, sqlite3* writer, Options options,
+                                 std::shared_ptr<ILogger> logger)
+    : m_writer(writer), m_options(options), m_logger(std::move(logger))
+{
+    int rc = sqlite3_open_v2(db_path.c_str(), &m_conn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr);
+    if (rc != SQLITE_OK)
+    {
+        if (m_logger) m_logger->Log(LogLevel::PROD, "[DB] Checkpointer disabled: " + std::string(sqlite3_errstr(rc)));
+        sqlite3_close(m_conn);
+        m_conn = nullptr;
+        return;
+    }
+
+    // a connection that has not looked at the file yet does not know it is in WAL mode
+    sqlite3_exec(m_conn, "PRAGMA journal_mode=WAL;", nullptr, nullptr, nullptr);
+    // RESTART waits this long for readers to move on before it reports busy
+    sqlite3_busy_timeout(m_conn, static_cast<int>(m_options.interval.count()));
+
+    // replaces the auto-checkpoint hook, so commits no longer checkpoint inline
+    sqlite3_wal_hook(m_writer, &WalCheckpointer::onCommit, this);
+    m_thread = std::thread(&WalCheckpointer::run, this);
+}
+
+WalCheckpointer::~WalCheckpointer()
+{
+    if (!m_conn) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) m_thread.join();
+
+    sqlite3_wal_autocheckpoint(m_writer, SQLITE_AUTOCHECKPOINT_FRAMES);
+    sqlite3_close(m_conn);
+}
+
+int WalCheckpointer::onCommit(void* self, sqlite3*, const char*, int frames)
+{
+    auto* checkpointer = static_cast<WalCheckpointer*>(self);
+    checkpointer->m_frames.store(frames, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(checkpointer->m_stats_mutex);
+        checkpointer->m_stats.wal_frames = frames;
+        checkpointer->m_stats.wal_frames_max = std::max(checkpointer->m_stats.wal_frames_max, frames);
+    }
+
+    if (checkpointer->pending() >= checkpointer->m_options.passive_frames ||
+        frames >= checkpointer->m_options.restart_frames)
+    {
+        {
+            std::lock_guard<std::mutex> lock(checkpointer->m_mutex);
+            if (checkpointer->m_wake) return SQLITE_OK;
+            checkpointer->m_wake = true;
+        }
+        checkpointer->m_cv.notify_one();
+    }
+    return SQLITE_OK;
+}
+
+int WalCheckpointer::pending() const
+{
+    int frames = m_frames.load(std::memory_order_relaxed);
+    int backfilled = m_backfilled.load(std::memory_order_relaxed);
+    // a log shorter than what was copied back means the writer started it over
+    return frames >= backfilled ? frames - backfilled : frames;
+}
+
+bool WalCheckpointer::checkpoint(int mode)
+{
+    if (!m_conn) return false;
+
+    std::lock_guard<std::mutex> guard(m_checkpoint_mutex);
+    auto started = std::chrono::steady_clock::now();
+    int log = 0;
+    int copied = 0;
+    int rc = sqlite3_wal_checkpoint_v2(m_conn, nullptr, mode, &log, &copied);
+    auto took = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started);
+
+    int before = m_backfilled.load(std::memory_order_relaxed);
+    int gained = copied >= before ? copied - before : copied;
+    bool restarted = rc == SQLITE_OK && mode == SQLITE_CHECKPOINT_RESTART;
+    // after a RESTART the next commit writes from the start of the log
+    m_backfilled.store(restarted ? 0 : std::max(copied, 0), std::memory_order_relaxed);
+    if (restarted) m_frames.store(0, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        if (mode == SQLITE_CHECKPOINT_RESTART) ++m_stats.restarts;
+        else ++m_stats.passive;
+        if (rc == SQLITE_BUSY) ++m_stats.busy;
+        m_stats.frames_backfilled += static_cast<uint64_t>(std::max(gained, 0));
+        m_stats.time_total += took;
+        m_stats.time_max = std::max(m_stats.time_max, took);
+    }
+
+    if (rc != SQLITE_OK && rc != SQLITE_BUSY)
+    {
+        if (m_logger) m_logger->Log(LogLevel::PROD, "[DB] Checkpoint failed: " + std::string(sqlite3_errmsg(m_conn)));
+        return false;
+    }
+    return rc == SQLITE_OK;
+}
+
+WalCheckpointer::Stats WalCheckpointer::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_stats_mutex);
+    return m_stats;
+}
+
+void WalCheckpointer::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop)
+    {
+        bool woken = m_cv.wait_for(lock, m_options.interval, [this] { return m_stop || m_wake; });
+        if (m_stop) break;
+        m_wake = false;
+        lock.unlock();
+
+        if (m_frames.load(std::memory_order_relaxed) >= m_options.restart_frames)
+            checkpoint(SQLITE_CHECKPOINT_RESTART);
+        else if (pending() >= m_options.passive_frames || (!woken && pending() > 0))
+            checkpoint(SQLITE_CHECKPOINT_PASSIVE);
+
+        lock.lock();
+    }
+}
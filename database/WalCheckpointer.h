@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sqlite3.h>
+
+#include "ILogger.h"
+
+// Moves WAL checkpoints off the commit path. A WAL hook on the write connection replaces
+// SQLite's auto-checkpoint and only records how long the log is; a background thread with a
+// connection of its own copies frames back into the database file.
+//   PASSIVE  copies what no reader still needs, never blocks readers or the writer;
+//   RESTART  once the log is too long, waits for readers so the writer starts it over.
+class WalCheckpointer
+{
+public:
+    struct Options
+    {
+        std::chrono::milliseconds interval{1000}; // an idle pass runs PASSIVE over whatever is pending
+        int passive_frames = 1000;
+        int restart_frames = 10000;
+    };
+
+    struct Stats
+    {
+        uint64_t passive = 0;
+        uint64_t restarts = 0;
+        uint64_t busy = 0;               // RESTART gave up waiting for a reader or the writer
+        uint64_t frames_backfilled = 0;
+        int wal_frames = 0;              // log length reported by the last commit
+        int wal_frames_max = 0;
+        std::chrono::nanoseconds time_total{0};
+        std::chrono::nanoseconds time_max{0};
+    };
+
+    WalCheckpointer(const std::string& db_path, sqlite3* writer, Options options,
+                    std::shared_ptr<ILogger> logger = nullptr);
+    ~WalCheckpointer(); // detaches the hook; call before the write connection closes
+
+    WalCheckpointer(const WalCheckpointer&) = delete;
+    WalCheckpointer& operator=(const WalCheckpointer&) = delete;
+
+    bool isRunning() const { return m_conn != nullptr; }
+    // one checkpoint now on the calling thread, SQLITE_CHECKPOINT_PASSIVE or _RESTART
+    bool checkpoint(int mode);
+    Stats stats() const;
+
+private:
+    sqlite3* m_writer;
+    sqlite3* m_conn = nullptr;
+    Options m_options;
+    std::shared_ptr<ILogger> m_logger;
+
+    std::atomic<int> m_frames{0};
+    std::atomic<int> m_backfilled{0};  // frames of the current log already copied back
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_wake = false;
+    bool m_stop = false;
+    std::thread m_thread;
+
+    std::mutex m_checkpoint_mutex;
+    mutable std::mutex m_stats_mutex;
+    Stats m_stats;
+
+    static int onCommit(void* self, sqlite3* db, const char* name, int frames);
+    int pending() const;
+    void run();
+};
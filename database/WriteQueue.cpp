@@ -0,0 +1,114 @@
+#include "WriteQueue.h"
+#include "Transaction.h"
+
+#include <algorithm>
+#include <string>
+
+namespace
+{
+    thread_local const WriteQueue* t_writer = nullptr;
+}
+
+WriteQueue::WriteQueue(sqlite3* db, std::mutex& write_mutex, ConnectionPool& pool, std::shared_ptr<ILogger> logger)
+    : m_db(db), m_write_mutex(write_mutex), m_pool(pool), m_logger(std::move(logger))
+    , m_worker(&WriteQueue::run, this)
+{
+}
+
+WriteQueue::~WriteQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_cv.notify_all();
+    if (m_worker.joinable()) m_worker.join();
+}
+
+std::future<bool> WriteQueue::submit(Work work)
+{
+    Request request{std::move(work), {}};
+    std::future<bool> result = request.done.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running)
+        {
+            request.done.set_value(false);
+            return result;
+        }
+        m_queue.push_back(std::move(request));
+    }
+    m_cv.notify_one();
+    return result;
+}
+
+bool WriteQueue::execute(Work work)
+{
+    if (onWriterThread())
+        return work();
+    return submit(std::move(work)).get();
+}
+
+bool WriteQueue::onWriterThread() const
+{
+    return t_writer == this;
+}
+
+void WriteQueue::run()
+{
+    t_writer = this;
+    m_pool.pinReadsToWriter();
+
+    std::vector<Request> batch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this] { return !m_queue.empty() || !m_running; });
+        if (m_queue.empty()) break; // stopped and drained
+
+        // everything that queued up while the previous batch was committing goes into this one
+        size_t count = std::min(m_queue.size(), MAX_BATCH);
+        batch.assign(std::make_move_iterator(m_queue.begin()), std::make_move_iterator(m_queue.begin() + count));
+        m_queue.erase(m_queue.begin(), m_queue.begin() + count);
+        lock.unlock();
+
+        runBatch(batch);
+        batch.clear();
+
+        lock.lock();
+    }
+}
+
+void WriteQueue::runBatch(std::vector<Request>& batch)
+{
+    std::vector<bool> results(batch.size(), false);
+    bool committed = false;
+    {
+        std::lock_guard<std::mutex> write_lock(m_write_mutex);
+        Transaction tx(m_db);
+        if (tx.valid())
+        {
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                // a failed request only rolls back its own savepoint
+                Transaction item(m_db);
+                try
+                {
+                    results[i] = item.valid() && batch[i].work() && item.commit();
+                }
+                catch (const std::exception& e)
+                {
+                    if (m_logger) m_logger->Log(LogLevel::PROD, std::string("[DB] Write failed: ") + e.what());
+                }
+            }
+            committed = tx.commit();
+        }
+
+        if (!committed && m_logger)
+            m_logger->Log(LogLevel::PROD, "[DB] Batch of " + std::to_string(batch.size()) +
+                                              " writes not committed: " + sqlite3_errmsg(m_db));
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i)
+        batch[i].done.set_value(committed && results[i]);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sqlite3.h>
+
+#include "ConnectionPool.h"
+#include "ILogger.h"
+
+// Single writer thread for the write connection. Concurrent write requests are
+// group-committed: one transaction per batch, each request inside its own savepoint,
+// and every future is fulfilled only after the batch's COMMIT returned.
+class WriteQueue
+{
+public:
+    using Work = std::function<bool()>;
+
+    static constexpr size_t MAX_BATCH = 64;
+
+    WriteQueue(sqlite3* db, std::mutex& write_mutex, ConnectionPool& pool, std::shared_ptr<ILogger> logger = nullptr);
+    ~WriteQueue(); // drains the queue before returning
+
+    WriteQueue(const WriteQueue&) = delete;
+    WriteQueue& operator=(const WriteQueue&) = delete;
+
+    // false when the work failed (its changes are rolled back) or the batch could not commit
+    std::future<bool> submit(Work work);
+
+    // submit() and wait; called from inside a work item it runs inline in the same batch
+    bool execute(Work work);
+
+    bool onWriterThread() const;
+
+private:
+    struct Request
+    {
+        Work work;
+        std::promise<bool> done;
+    };
+
+    sqlite3* m_db;
+    std::mutex& m_write_mutex;
+    ConnectionPool& m_pool;
+    std::shared_ptr<ILogger> m_logger;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<Request> m_queue;
+    bool m_running = true;
+    std::thread m_worker;
+
+    void run();
+    void runBatch(std::vector<Request>& batch);
+};
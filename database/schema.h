@@ -1,7 +1,7 @@
 #pragma once
 #include <string_view>
 
-// Generated by xxd -i from scheme/001_init_scheme.sql
+// Generated by xxd -i from scheme/*.sql, joined in order by cmake/EmbedSchema.cmake
 extern "C" {
 extern unsigned char init_schema_sql[];
 extern unsigned int init_schema_sql_len;
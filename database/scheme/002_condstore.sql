@@ -0,0 +1,67 @@
+-- CONDSTORE/QRESYNC (RFC 7162): every message change bumps the folder's highest_modseq
+-- and stamps the message with it; expunged UIDs are kept as tombstones so clients can
+-- resynchronise with VANISHED instead of refetching the whole mailbox. Only the newest
+-- database.expunged_history tombstones of a folder are kept; expunged_modseq is the highest
+-- mod-sequence pruned, a client older than that gets VANISHED computed from the UIDs it knows.
+ALTER TABLE folders  ADD COLUMN highest_modseq  INTEGER NOT NULL DEFAULT 0;
+ALTER TABLE folders  ADD COLUMN expunged_modseq INTEGER NOT NULL DEFAULT 0;
+ALTER TABLE messages ADD COLUMN modseq          INTEGER NOT NULL DEFAULT 0;
+
+-- mod-sequences start at 1; mail stored before them is all of the first one
+UPDATE messages SET modseq = 1;
+UPDATE folders SET highest_modseq = 1 WHERE id IN (SELECT folder_id FROM messages);
+
+CREATE INDEX idx_messages_folder_modseq ON messages(folder_id, modseq);
+
+CREATE TABLE expunged_messages (
+    id        INTEGER PRIMARY KEY AUTOINCREMENT,
+    folder_id INTEGER NOT NULL,
+    uid       INTEGER NOT NULL,
+    modseq    INTEGER NOT NULL,
+    FOREIGN KEY (folder_id) REFERENCES folders(id) ON DELETE CASCADE
+);
+
+CREATE INDEX idx_expunged_folder_modseq ON expunged_messages(folder_id, modseq);
+
+CREATE TRIGGER trg_messages_modseq_insert
+AFTER INSERT ON messages
+BEGIN
+    UPDATE folders SET highest_modseq = highest_modseq + 1 WHERE id = NEW.folder_id;
+    UPDATE messages SET modseq = (SELECT highest_modseq FROM folders WHERE id = NEW.folder_id)
+    WHERE id = NEW.id;
+END;
+
+-- \Recent is session state, not a flag change other clients need to see.
+CREATE TRIGGER trg_messages_modseq_flags
+AFTER UPDATE OF is_seen, is_deleted, is_draft, is_answered, is_flagged ON messages
+WHEN NEW.folder_id = OLD.folder_id
+ AND (NEW.is_seen IS NOT OLD.is_seen OR NEW.is_deleted IS NOT OLD.is_deleted
+      OR NEW.is_draft IS NOT OLD.is_draft OR NEW.is_answered IS NOT OLD.is_answered
+      OR NEW.is_flagged IS NOT OLD.is_flagged)
+BEGIN
+    UPDATE folders SET highest_modseq = highest_modseq + 1 WHERE id = NEW.folder_id;
+    UPDATE messages SET modseq = (SELECT highest_modseq FROM folders WHERE id = NEW.folder_id)
+    WHERE id = NEW.id;
+END;
+
+CREATE TRIGGER trg_messages_modseq_move
+AFTER UPDATE OF folder_id ON messages
+WHEN NEW.folder_id <> OLD.folder_id
+BEGIN
+    UPDATE folders SET highest_modseq = highest_modseq + 1 WHERE id = OLD.folder_id;
+    INSERT INTO expunged_messages (folder_id, uid, modseq)
+    SELECT OLD.folder_id, OLD.uid, highest_modseq FROM folders WHERE id = OLD.folder_id;
+    UPDATE folders SET highest_modseq = highest_modseq + 1 WHERE id = NEW.folder_id;
+    UPDATE messages SET modseq = (SELECT highest_modseq FROM folders WHERE id = NEW.folder_id)
+    WHERE id = NEW.id;
+END;
+
+-- Skipped when the folder itself is going away (cascade delete): nobody can resync it.
+CREATE TRIGGER trg_messages_modseq_delete
+AFTER DELETE ON messages
+WHEN EXISTS (SELECT 1 FROM folders WHERE id = OLD.folder_id)
+BEGIN
+    UPDATE folders SET highest_modseq = highest_modseq + 1 WHERE id = OLD.folder_id;
+    INSERT INTO expunged_messages (folder_id, uid, modseq)
+    SELECT OLD.folder_id, OLD.uid, highest_modseq FROM folders WHERE id = OLD.folder_id;
+END;
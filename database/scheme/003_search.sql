@@ -0,0 +1,35 @@
+-- SEARCH: flag, date and size criteria are answered from these instead of scanning the folder.
+CREATE INDEX idx_messages_folder_unseen  ON messages(folder_id, uid) WHERE is_seen = 0;
+CREATE INDEX idx_messages_folder_flagged ON messages(folder_id, uid) WHERE is_flagged = 1;
+CREATE INDEX idx_messages_folder_deleted ON messages(folder_id, uid) WHERE is_deleted = 1;
+CREATE INDEX idx_messages_folder_date    ON messages(folder_id, internal_date);
+CREATE INDEX idx_messages_folder_size    ON messages(folder_id, size_bytes);
+
+-- Full-text index, rowid = messages.id. Subject and sender are kept in sync by triggers;
+-- recipients and the decoded body are filled in at delivery (MessageRepository::indexContent).
+CREATE VIRTUAL TABLE messages_fts USING fts5(
+    subject, from_address, to_address, cc_address, body,
+    tokenize = 'unicode61 remove_diacritics 2'
+);
+
+CREATE TRIGGER trg_messages_fts_insert
+AFTER INSERT ON messages
+BEGIN
+    INSERT INTO messages_fts (rowid, subject, from_address) VALUES (NEW.id, NEW.subject, NEW.from_address);
+END;
+
+CREATE TRIGGER trg_messages_fts_update
+AFTER UPDATE OF subject, from_address ON messages
+BEGIN
+    UPDATE messages_fts SET subject = NEW.subject, from_address = NEW.from_address WHERE rowid = NEW.id;
+END;
+
+CREATE TRIGGER trg_messages_fts_delete
+AFTER DELETE ON messages
+BEGIN
+    DELETE FROM messages_fts WHERE rowid = OLD.id;
+END;
+
+-- Backfill rows stored before the index existed.
+INSERT INTO messages_fts (rowid, subject, from_address)
+SELECT id, subject, from_address FROM messages WHERE id NOT IN (SELECT rowid FROM messages_fts);
@@ -0,0 +1,18 @@
+-- SORT/THREAD (RFC 5256): thread_id is the id of the conversation root, resolved at delivery
+-- from In-Reply-To/References; sort_subject is the base subject used by SORT SUBJECT
+ALTER TABLE messages ADD COLUMN thread_id    INTEGER;
+ALTER TABLE messages ADD COLUMN sort_subject TEXT NOT NULL DEFAULT '';
+
+-- existing mail starts one thread per message; base_subject() is MessageDAL::baseSubject
+UPDATE messages SET thread_id = id, sort_subject = base_subject(subject);
+
+CREATE INDEX idx_messages_folder_thread  ON messages(folder_id, thread_id);
+CREATE INDEX idx_messages_folder_subject ON messages(folder_id, sort_subject);
+CREATE INDEX idx_messages_in_reply_to    ON messages(in_reply_to) WHERE in_reply_to IS NOT NULL;
+
+CREATE TRIGGER trg_messages_thread_root
+AFTER INSERT ON messages
+WHEN NEW.thread_id IS NULL
+BEGIN
+    UPDATE messages SET thread_id = NEW.id WHERE id = NEW.id;
+END;
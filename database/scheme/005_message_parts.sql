@@ -0,0 +1,11 @@
+-- Partial FETCH: byte ranges of the MIME parts inside raw_file_path, so a slice of a part is
+-- read with one pread instead of loading and splitting the whole file
+CREATE TABLE message_parts (
+    message_id   INTEGER NOT NULL,
+    section      TEXT    NOT NULL,
+    header_start INTEGER NOT NULL,
+    body_start   INTEGER NOT NULL,
+    body_end     INTEGER NOT NULL,
+    PRIMARY KEY (message_id, section),
+    FOREIGN KEY (message_id) REFERENCES messages(id) ON DELETE CASCADE
+) WITHOUT ROWID;
@@ -0,0 +1,2 @@
+-- COPY shares the blob between rows; EXPUNGE only unlinks it once nothing points at it
+CREATE INDEX idx_messages_raw_file_path ON messages(raw_file_path);
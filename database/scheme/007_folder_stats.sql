@@ -0,0 +1,65 @@
+-- SELECT/STATUS counters kept up to date by triggers, so reading them never scans the mailbox.
+-- A folder without messages may have no row yet; readers treat that as all zeros.
+CREATE TABLE folder_stats (
+    folder_id   INTEGER PRIMARY KEY,
+    messages    INTEGER NOT NULL DEFAULT 0,
+    recent      INTEGER NOT NULL DEFAULT 0,
+    unseen      INTEGER NOT NULL DEFAULT 0,
+    deleted     INTEGER NOT NULL DEFAULT 0,
+    total_bytes INTEGER NOT NULL DEFAULT 0,
+    FOREIGN KEY (folder_id) REFERENCES folders(id) ON DELETE CASCADE
+);
+
+CREATE TRIGGER trg_messages_stats_insert
+AFTER INSERT ON messages
+BEGIN
+    INSERT INTO folder_stats (folder_id, messages, recent, unseen, deleted, total_bytes)
+    VALUES (NEW.folder_id, 1, NEW.is_recent <> 0, NEW.is_seen = 0, NEW.is_deleted <> 0, NEW.size_bytes)
+    ON CONFLICT (folder_id) DO UPDATE SET
+        messages    = messages + 1,
+        recent      = recent + excluded.recent,
+        unseen      = unseen + excluded.unseen,
+        deleted     = deleted + excluded.deleted,
+        total_bytes = total_bytes + excluded.total_bytes;
+END;
+
+CREATE TRIGGER trg_messages_stats_update
+AFTER UPDATE OF folder_id, is_seen, is_deleted, is_recent, size_bytes ON messages
+WHEN NEW.folder_id <> OLD.folder_id OR NEW.is_seen IS NOT OLD.is_seen OR NEW.is_deleted IS NOT OLD.is_deleted
+  OR NEW.is_recent IS NOT OLD.is_recent OR NEW.size_bytes IS NOT OLD.size_bytes
+BEGIN
+    UPDATE folder_stats SET
+        messages    = messages - 1,
+        recent      = recent - (OLD.is_recent <> 0),
+        unseen      = unseen - (OLD.is_seen = 0),
+        deleted     = deleted - (OLD.is_deleted <> 0),
+        total_bytes = total_bytes - OLD.size_bytes
+    WHERE folder_id = OLD.folder_id;
+    INSERT INTO folder_stats (folder_id, messages, recent, unseen, deleted, total_bytes)
+    VALUES (NEW.folder_id, 1, NEW.is_recent <> 0, NEW.is_seen = 0, NEW.is_deleted <> 0, NEW.size_bytes)
+    ON CONFLICT (folder_id) DO UPDATE SET
+        messages    = messages + 1,
+        recent      = recent + excluded.recent,
+        unseen      = unseen + excluded.unseen,
+        deleted     = deleted + excluded.deleted,
+        total_bytes = total_bytes + excluded.total_bytes;
+END;
+
+CREATE TRIGGER trg_messages_stats_delete
+AFTER DELETE ON messages
+BEGIN
+    UPDATE folder_stats SET
+        messages    = messages - 1,
+        recent      = recent - (OLD.is_recent <> 0),
+        unseen      = unseen - (OLD.is_seen = 0),
+        deleted     = deleted - (OLD.is_deleted <> 0),
+        total_bytes = total_bytes - OLD.size_bytes
+    WHERE folder_id = OLD.folder_id;
+END;
+
+-- Backfill folders that held messages before the counters existed.
+INSERT INTO folder_stats (folder_id, messages, recent, unseen, deleted, total_bytes)
+SELECT folder_id, count(*), total(is_recent <> 0), total(is_seen = 0), total(is_deleted <> 0), total(size_bytes)
+FROM messages
+WHERE folder_id NOT IN (SELECT folder_id FROM folder_stats)
+GROUP BY folder_id;
@@ -0,0 +1,4 @@
+-- keyset pages of a user's messages, newest first: (internal_date, id) < (?, ?);
+-- also serves every plain user_id lookup, so the old single-column index is dropped
+CREATE INDEX idx_messages_user_date ON messages(user_id, internal_date, id);
+DROP INDEX idx_messages_user_id;
@@ -0,0 +1,121 @@
+-- System flags as one MessageFlags bit mask: 1 \Seen, 2 \Deleted, 4 \Draft, 8 \Answered,
+-- 16 \Flagged, 32 \Recent; new mail is \Recent. Converts the six is_* columns of existing
+-- rows, then rebuilds messages without them along with everything that read them.
+ALTER TABLE messages ADD COLUMN flags INTEGER NOT NULL DEFAULT 32;
+
+UPDATE messages SET flags = is_seen | (is_deleted << 1) | (is_draft << 2) | (is_answered << 3)
+                          | (is_flagged << 4) | (is_recent << 5);
+
+DROP TRIGGER trg_messages_modseq_flags;
+DROP TRIGGER trg_messages_stats_insert;
+DROP TRIGGER trg_messages_stats_update;
+DROP TRIGGER trg_messages_stats_delete;
+DROP INDEX idx_messages_folder_unseen;
+DROP INDEX idx_messages_folder_flagged;
+DROP INDEX idx_messages_folder_deleted;
+
+ALTER TABLE messages DROP COLUMN is_seen;
+ALTER TABLE messages DROP COLUMN is_deleted;
+ALTER TABLE messages DROP COLUMN is_draft;
+ALTER TABLE messages DROP COLUMN is_answered;
+ALTER TABLE messages DROP COLUMN is_flagged;
+ALTER TABLE messages DROP COLUMN is_recent;
+
+-- \Recent (32) is session state, not a flag change other clients need to see.
+CREATE TRIGGER trg_messages_modseq_flags
+AFTER UPDATE OF flags ON messages
+WHEN NEW.folder_id = OLD.folder_id AND (NEW.flags & 31) <> (OLD.flags & 31)
+BEGIN
+    UPDATE folders SET highest_modseq = highest_modseq + 1 WHERE id = NEW.folder_id;
+    UPDATE messages SET modseq = (SELECT highest_modseq FROM folders WHERE id = NEW.folder_id)
+    WHERE id = NEW.id;
+END;
+
+-- A query uses a partial index only when it spells the same bit test, see MessageDAL.
+CREATE INDEX idx_messages_folder_unseen  ON messages(folder_id, uid) WHERE (flags & 1) = 0;
+CREATE INDEX idx_messages_folder_flagged ON messages(folder_id, uid) WHERE (flags & 16) <> 0;
+CREATE INDEX idx_messages_folder_deleted ON messages(folder_id, uid) WHERE (flags & 2) <> 0;
+
+CREATE TRIGGER trg_messages_stats_insert
+AFTER INSERT ON messages
+BEGIN
+    INSERT INTO folder_stats (folder_id, messages, recent, unseen, deleted, total_bytes)
+    VALUES (NEW.folder_id, 1, (NEW.flags & 32) <> 0, (NEW.flags & 1) = 0, (NEW.flags & 2) <> 0, NEW.size_bytes)
+    ON CONFLICT (folder_id) DO UPDATE SET
+        messages    = messages + 1,
+        recent      = recent + excluded.recent,
+        unseen      = unseen + excluded.unseen,
+        deleted     = deleted + excluded.deleted,
+        total_bytes = total_bytes + excluded.total_bytes;
+END;
+
+CREATE TRIGGER trg_messages_stats_update
+AFTER UPDATE OF folder_id, flags, size_bytes ON messages
+WHEN NEW.folder_id <> OLD.folder_id OR (NEW.flags & 35) <> (OLD.flags & 35) OR NEW.size_bytes IS NOT OLD.size_bytes
+BEGIN
+    UPDATE folder_stats SET
+        messages    = messages - 1,
+        recent      = recent - ((OLD.flags & 32) <> 0),
+        unseen      = unseen - ((OLD.flags & 1) = 0),
+        deleted     = deleted - ((OLD.flags & 2) <> 0),
+        total_bytes = total_bytes - OLD.size_bytes
+    WHERE folder_id = OLD.folder_id;
+    INSERT INTO folder_stats (folder_id, messages, recent, unseen, deleted, total_bytes)
+    VALUES (NEW.folder_id, 1, (NEW.flags & 32) <> 0, (NEW.flags & 1) = 0, (NEW.flags & 2) <> 0, NEW.size_bytes)
+    ON CONFLICT (folder_id) DO UPDATE SET
+        messages    = messages + 1,
+        recent      = recent + excluded.recent,
+        unseen      = unseen + excluded.unseen,
+        deleted     = deleted + excluded.deleted,
+        total_bytes = total_bytes + excluded.total_bytes;
+END;
+
+CREATE TRIGGER trg_messages_stats_delete
+AFTER DELETE ON messages
+BEGIN
+    UPDATE folder_stats SET
+        messages    = messages - 1,
+        recent      = recent - ((OLD.flags & 32) <> 0),
+        unseen      = unseen - ((OLD.flags & 1) = 0),
+        deleted     = deleted - ((OLD.flags & 2) <> 0),
+        total_bytes = total_bytes - OLD.size_bytes
+    WHERE folder_id = OLD.folder_id;
+END;
+
+-- Custom keywords (RFC 3501 flag-keyword, the MUA's labels). Names are interned once in
+-- keywords and messages refer to them by id; names compare case-insensitively.
+CREATE TABLE keywords (
+    id   INTEGER PRIMARY KEY,
+    name TEXT NOT NULL UNIQUE COLLATE NOCASE
+);
+
+CREATE TABLE message_keywords (
+    message_id INTEGER NOT NULL,
+    keyword_id INTEGER NOT NULL,
+    PRIMARY KEY (message_id, keyword_id),
+    FOREIGN KEY (message_id) REFERENCES messages(id) ON DELETE CASCADE,
+    FOREIGN KEY (keyword_id) REFERENCES keywords(id)
+) WITHOUT ROWID;
+
+-- SEARCH KEYWORD walks the messages of one keyword
+CREATE INDEX idx_message_keywords_keyword ON message_keywords(keyword_id, message_id);
+
+-- a keyword change is a flag change for CONDSTORE
+CREATE TRIGGER trg_message_keywords_modseq_insert
+AFTER INSERT ON message_keywords
+BEGIN
+    UPDATE folders SET highest_modseq = highest_modseq + 1
+    WHERE id = (SELECT folder_id FROM messages WHERE id = NEW.message_id);
+    UPDATE messages SET modseq = (SELECT highest_modseq FROM folders WHERE id = messages.folder_id)
+    WHERE id = NEW.message_id;
+END;
+
+-- cascades from a deleted message find no row and change nothing
+CREATE TRIGGER trg_message_keywords_modseq_delete
+AFTER DELETE ON message_keywords
+BEGIN
+    UPDATE folders SET highest_modseq = highest_modseq + 1
+    WHERE id = (SELECT folder_id FROM messages WHERE id = OLD.message_id);
+    UPDATE messages SET modseq = (SELECT highest_modseq FROM folders WHERE id = messages.folder_id)
+    WHERE id = OLD.message_id;
+END;
@@ -4,12 +4,15 @@
 #include <atomic>
 #include <chrono>
 #include <filesystem>
+#include <future>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "DataBaseManager.h"
+#include "Config.h"
+#include "ShardRouter.h"
 #include "Repository/MessageRepository.h"
 #include "Repository/UserRepository.h"
 #include "schema.h"
@@ -547,4 +550,394 @@ TEST_F(ConcurrencyTest, ConcurrentExpunge_NoPhantomRows) {
     auto deleted = mr.findDeleted(fid, 100, 0);
     EXPECT_TRUE(deleted.empty())
         << deleted.size() << " deleted messages still present after concurrent expunge";
-}
\ No newline at end of file
+}
+// ─────────────────────────────────────────────────────────────────────────────
+// 9.  One repository shared by all threads (the IMAP server layout):
+//     every thread reads back its own last error
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(ConcurrencyTest, SharedRepository_LastErrorIsPerThread) {
+    auto [uid, fid] = setupUser("shared_repo_user");
+    ASSERT_GT(uid, 0);
+
+    UserRepository shared(*m_mgr);
+    constexpr int ROUNDS = 200;
+    std::atomic<int> mismatches{0};
+
+    auto worker = [&](bool duplicate) {
+        for (int i = 0; i < ROUNDS; ++i) {
+            if (duplicate) {
+                User u; u.username = "shared_repo_user";
+                if (shared.registerUser(u, "pass") ||
+                    shared.getLastError() != "registerUser: username already exists")
+                    ++mismatches;
+            } else {
+                if (shared.authorize("nobody_" + std::to_string(i), "pass") ||
+                    shared.getLastError() != "authorize: user not found")
+                    ++mismatches;
+            }
+        }
+    };
+
+    std::thread a(worker, true);
+    std::thread b(worker, false);
+    a.join();
+    b.join();
+
+    EXPECT_EQ(mismatches.load(), 0);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// 10. Prepared statements are cached per connection: a released statement is
+//     handed out again, a nested use of the same SQL gets its own copy
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(ConcurrencyTest, StatementCache_ReusesAndNestsPerConnection) {
+    static const char* sql = "SELECT count(*) FROM users WHERE username = ?;";
+
+    ReadGuard g(m_mgr->pool());
+    ASSERT_NE(g.statements(), nullptr);
+
+    sqlite3_stmt* first = nullptr;
+    {
+        Statement stmt(m_mgr->pool(), g.db(), sql);
+        ASSERT_TRUE(stmt);
+        first = stmt;
+        sqlite3_bind_text(stmt, 1, "nobody", -1, SQLITE_STATIC);
+        ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+    }
+
+    Statement again(m_mgr->pool(), g.db(), sql);
+    EXPECT_EQ(static_cast<sqlite3_stmt*>(again), first);
+    // handed back reset and unbound
+    EXPECT_EQ(sqlite3_stmt_busy(again), 0);
+    EXPECT_EQ(sqlite3_bind_parameter_count(again), 1);
+    EXPECT_EQ(sqlite3_step(again), SQLITE_ROW);
+
+    Statement nested(m_mgr->pool(), g.db(), sql);
+    ASSERT_TRUE(nested);
+    EXPECT_NE(static_cast<sqlite3_stmt*>(nested), first);
+
+    // the write connection has a cache of its own
+    EXPECT_NE(m_mgr->pool().statements(m_mgr->getDB()), nullptr);
+    EXPECT_NE(m_mgr->pool().statements(m_mgr->getDB()), g.statements());
+}
+
+TEST_F(ConcurrencyTest, StatementCache_ConcurrentReadersSeeOwnResults) {
+    constexpr int USERS = 8;
+    std::vector<int64_t> folders;
+    for (int i = 0; i < USERS; ++i) {
+        auto [uid, fid] = setupUser("cached_stmt_user_" + std::to_string(i));
+        ASSERT_GT(uid, 0);
+        MessageRepository mr(*m_mgr);
+        for (int n = 0; n <= i; ++n) {
+            Message m = makeMessage(uid, fid);
+            ASSERT_TRUE(mr.deliver(m, fid)) << mr.getLastError();
+        }
+        folders.push_back(fid);
+    }
+
+    MessageRepository shared(*m_mgr);
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 16; ++t) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 100; ++round) {
+                int i = (t + round) % USERS;
+                if (shared.findUIDsByFolder(folders[i]).size() != static_cast<size_t>(i + 1))
+                    ++mismatches;
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+
+    EXPECT_EQ(mismatches.load(), 0);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// 11. Lock-free pool: a connection is never handed to two threads at once,
+//     a thread gets its last connection back, waits are counted
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(ConcurrencyTest, ConnectionPool_ExclusiveOwnershipUnderContention) {
+    ConnectionPool pool(m_path, 3);
+    std::mutex owners_mutex;
+    std::vector<sqlite3*> owners;
+    std::atomic<int> double_owned{0};
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 12; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 500; ++i) {
+                ReadGuard g(pool);
+                {
+                    std::lock_guard<std::mutex> lock(owners_mutex);
+                    if (std::find(owners.begin(), owners.end(), g.db()) != owners.end()) ++double_owned;
+                    owners.push_back(g.db());
+                }
+                std::this_thread::yield();
+                std::lock_guard<std::mutex> lock(owners_mutex);
+                owners.erase(std::find(owners.begin(), owners.end(), g.db()));
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+
+    EXPECT_EQ(double_owned.load(), 0);
+    EXPECT_EQ(pool.stats().acquires, 12u * 500u);
+}
+
+TEST_F(ConcurrencyTest, ConnectionPool_AffinityAndWaitStats) {
+    ConnectionPool pool(m_path, 2);
+
+    sqlite3* first = pool.acquire();
+    pool.release(first);
+    sqlite3* again = pool.acquire();
+    EXPECT_EQ(again, first);
+    EXPECT_EQ(pool.stats().affinity_hits, 1u);
+
+    sqlite3* second = pool.acquire();
+    EXPECT_NE(second, first);
+
+    std::thread waiter([&] {
+        sqlite3* conn = pool.acquire();
+        pool.release(conn);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    pool.release(second);
+    waiter.join();
+    pool.release(again);
+
+    auto stats = pool.stats();
+    EXPECT_EQ(stats.acquires, 4u);
+    EXPECT_EQ(stats.waits, 1u);
+    EXPECT_GE(stats.wait_max, std::chrono::milliseconds(10));
+    EXPECT_GE(stats.wait_total, stats.wait_max);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// 12. Group commit: writes queued behind a busy writer share one batch, a
+//     failing request rolls back alone, nested writes run inline
+// ─────────────────────────────────────────────────────────────────────────────
+
+namespace {
+
+bool insertUser(sqlite3* db, const std::string& name) {
+    std::string sql = "INSERT INTO users (username, password_hash) VALUES ('" + name + "', 'x');";
+    return sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+} // namespace
+
+TEST_F(ConcurrencyTest, WriteQueue_FailedRequestRollsBackAlone) {
+    sqlite3* db = m_mgr->getDB();
+    std::promise<void> release_writer;
+    std::shared_future<void> gate = release_writer.get_future().share();
+
+    // keeps the writer busy so the next requests queue up into one batch
+    auto blocker = m_mgr->writeQueue().submit([gate] { gate.wait(); return true; });
+    auto good = m_mgr->writeQueue().submit([&] { return insertUser(db, "batched_good"); });
+    auto bad  = m_mgr->writeQueue().submit([&] { insertUser(db, "batched_bad"); return false; });
+    auto nested = m_mgr->writeQueue().submit([&] {
+        return m_mgr->write([&] { return insertUser(db, "batched_nested"); });
+    });
+    release_writer.set_value();
+
+    EXPECT_TRUE(blocker.get());
+    EXPECT_TRUE(good.get());
+    EXPECT_FALSE(bad.get());
+    EXPECT_TRUE(nested.get());
+
+    UserRepository ur(*m_mgr);
+    EXPECT_TRUE(ur.findByUsername("batched_good").has_value());
+    EXPECT_FALSE(ur.findByUsername("batched_bad").has_value());
+    EXPECT_TRUE(ur.findByUsername("batched_nested").has_value());
+}
+
+TEST_F(ConcurrencyTest, WriteQueue_ErrorReachesCallingThread) {
+    auto [uid, fid] = setupUser("queue_error_user");
+    ASSERT_GT(uid, 0);
+
+    MessageRepository mr(*m_mgr);
+    Message m = makeMessage(uid, fid);
+    EXPECT_FALSE(mr.deliver(m, 999999));
+    EXPECT_EQ(mr.getLastError(), "assignUID: folder not found");
+
+    EXPECT_TRUE(mr.deliver(m, fid)) << mr.getLastError();
+    EXPECT_TRUE(mr.findByUID(fid, m.uid).has_value());
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// 13. Sharding: users land on separate files, ids name their shard, and
+//     deliveries to users on different shards commit independently
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(ConcurrencyTest, ShardRouter_RoutesUsersAndDeliversInParallel) {
+    constexpr int SHARDS = 3;
+    constexpr int USERS = 12;
+    constexpr int PER_USER = 20;
+
+    std::string base = uniqueDbPath();
+    auto cleanup = [&] {
+        removeDb(base + ".directory.db");
+        for (int k = 0; k < SHARDS; ++k)
+            removeDb(base + ".shard" + std::to_string(k) + ".db");
+    };
+
+    {
+        ShardRouter router(base, SHARDS, initSchema(), nullptr, 4);
+        ASSERT_TRUE(router.isConnected());
+        UserRepository ur(router);
+        MessageRepository mr(router);
+
+        std::vector<std::pair<int64_t, int64_t>> users;
+        std::vector<int> per_shard(SHARDS, 0);
+        for (int i = 0; i < USERS; ++i) {
+            User u;
+            u.username = "shard_user_" + std::to_string(i);
+            ASSERT_TRUE(ur.registerUser(u, "pw")) << ur.getLastError();
+
+            size_t index = router.shardOfUser(u.username);
+            EXPECT_EQ(router.shardOfID(*u.id), index);
+            ++per_shard[index];
+
+            auto inbox = mr.findFolderByName(*u.id, "INBOX");
+            ASSERT_TRUE(inbox.has_value());
+            EXPECT_EQ(router.shardOfID(*inbox->id), index);
+            users.emplace_back(*u.id, *inbox->id);
+        }
+        EXPECT_EQ(std::count(per_shard.begin(), per_shard.end(), 0), 0);
+
+        std::atomic<int> failures{0};
+        std::vector<std::thread> threads;
+        for (auto [uid, fid] : users) {
+            threads.emplace_back([&, uid = uid, fid = fid] {
+                for (int n = 0; n < PER_USER; ++n) {
+                    Message m = makeMessage(uid, fid);
+                    if (!mr.deliver(m, fid)) ++failures;
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+        EXPECT_EQ(failures.load(), 0);
+
+        for (auto [uid, fid] : users) {
+            auto uids = mr.findUIDsByFolder(fid);
+            ASSERT_EQ(uids.size(), static_cast<size_t>(PER_USER));
+            EXPECT_EQ(uids.front(), 1);
+            EXPECT_EQ(uids.back(), PER_USER);
+        }
+
+        std::vector<std::string> names;
+        std::string after;
+        for (auto page = ur.findAllAfter(after, 5); !page.empty(); page = ur.findAllAfter(after, 5)) {
+            for (const auto& u : page) names.push_back(u.username);
+            after = page.back().username;
+        }
+        EXPECT_EQ(names.size(), static_cast<size_t>(USERS));
+        EXPECT_TRUE(std::is_sorted(names.begin(), names.end()));
+        EXPECT_EQ(ur.findAll(4, 10).size(), 2u);
+    }
+
+    {
+        // the directory outlives the process: a reopened router finds every user again
+        ShardRouter router(base, SHARDS, initSchema());
+        UserRepository ur(router);
+        for (int i = 0; i < USERS; ++i)
+            EXPECT_TRUE(ur.authorize("shard_user_" + std::to_string(i), "pw")) << ur.getLastError();
+
+        auto user = ur.findByUsername("shard_user_0");
+        ASSERT_TRUE(user.has_value());
+        EXPECT_TRUE(ur.hardDelete(*user->id));
+        EXPECT_FALSE(ur.findByUsername("shard_user_0").has_value());
+    }
+
+    cleanup();
+}
+
+TEST_F(ConcurrencyTest, ShardRouter_OpenPicksLayoutFromShardCount) {
+    std::string path = uniqueDbPath();
+    {
+        // one shard keeps the plain database file every server used before sharding
+        auto router = ShardRouter::open(path, 1, initSchema());
+        ASSERT_TRUE(router->isConnected());
+        EXPECT_EQ(router->size(), 1u);
+        UserRepository ur(*router);
+        User u;
+        u.username = "single_shard_user";
+        ASSERT_TRUE(ur.registerUser(u, "pw")) << ur.getLastError();
+    }
+    EXPECT_TRUE(std::filesystem::exists(path));
+    EXPECT_FALSE(std::filesystem::exists(path + ".directory.db"));
+
+    {
+        auto router = ShardRouter::open(path, 2, initSchema());
+        ASSERT_TRUE(router->isConnected());
+        EXPECT_EQ(router->size(), 2u);
+    }
+    EXPECT_TRUE(std::filesystem::exists(path + ".shard1.db"));
+
+    removeDb(path);
+    removeDb(path + ".directory.db");
+    removeDb(path + ".shard0.db");
+    removeDb(path + ".shard1.db");
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// 14. Checkpointing off the commit path and read connection tuning
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(ConcurrencyTest, WalCheckpointer_PassiveOnThresholdAndRestartOnDemand) {
+    std::string path = uniqueDbPath();
+    sqlite3* writer = nullptr;
+    ASSERT_EQ(sqlite3_open(path.c_str(), &writer), SQLITE_OK);
+    sqlite3_exec(writer, "PRAGMA journal_mode=WAL; CREATE TABLE t (v INTEGER);", nullptr, nullptr, nullptr);
+
+    {
+        WalCheckpointer::Options options;
+        options.interval = std::chrono::milliseconds(50);
+        options.passive_frames = 8;
+        options.restart_frames = 1000000;
+        WalCheckpointer checkpointer(path, writer, options);
+        ASSERT_TRUE(checkpointer.isRunning());
+
+        for (int i = 0; i < 200; ++i)
+            sqlite3_exec(writer, "INSERT INTO t VALUES (1);", nullptr, nullptr, nullptr);
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (checkpointer.stats().frames_backfilled == 0 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        auto stats = checkpointer.stats();
+        EXPECT_GT(stats.passive, 0u);
+        EXPECT_GT(stats.frames_backfilled, 0u);
+        EXPECT_GE(stats.wal_frames_max, 8);
+
+        EXPECT_TRUE(checkpointer.checkpoint(SQLITE_CHECKPOINT_RESTART));
+        EXPECT_EQ(checkpointer.stats().restarts, 1u);
+    }
+
+    sqlite3_close(writer);
+    removeDb(path);
+}
+
+TEST_F(ConcurrencyTest, ReadConnections_UseConfiguredMmapAndReportCacheStats) {
+    ASSERT_NE(m_mgr->checkpointer(), nullptr);
+    auto [uid, fid] = setupUser("mmap_user");
+    ASSERT_GT(uid, 0);
+
+    {
+        ReadGuard g(m_mgr->pool());
+        Statement stmt(g.db(), std::string("PRAGMA mmap_size;"));
+        ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+        int64_t expected = static_cast<int64_t>(SmtpClient::Config::Instance().GetDatabase().mmap_size_mb) << 20;
+        EXPECT_EQ(sqlite3_column_int64(stmt, 0), expected);
+    }
+
+    MessageRepository mr(*m_mgr);
+    for (int i = 0; i < 5; ++i)
+        mr.findFolderByID(fid);
+
+    auto stats = m_mgr->pool().stats();
+    EXPECT_GT(stats.cache_hits + stats.cache_misses, 0u);
+}
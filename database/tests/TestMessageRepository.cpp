@@ -2,10 +2,12 @@
 
 #include <atomic>
 #include <filesystem>
+#include <fstream>
 #include <optional>
 #include <string>
 #include <vector>
 
+#include "DAL/MessageDAL.h"
 #include "DataBaseManager.h"
 #include "Repository/MessageRepository.h"
 #include "Repository/UserRepository.h"
@@ -526,6 +528,18 @@ TEST_F(MessageRepositoryTest, Search_NoMatch_ReturnsEmpty) {
     EXPECT_TRUE(results.empty());
 }
 
+TEST_F(MessageRepositoryTest, Search_PunctuationAndMidWordMatchSubstring) {
+    deliver("bob@example.com", "Re: [ticket-42] \"urgent\" (c++) OR NOT*");
+    deliver("bob@example.com", "Unrelated");
+
+    for (const char* query : {"[ticket-42]", "\"urgent\" (c++)", "OR NOT*", "icket", "@example.c"})
+    {
+        SCOPED_TRACE(query);
+        auto results = m_msg_repo->search(m_user_id, query);
+        EXPECT_EQ(results.size(), query[0] == '@' ? 2u : 1u);
+    }
+}
+
 // ─────────────────────────────────────────────────────────────────────────────
 // Move, Copy, Expunge, HardDelete
 // ─────────────────────────────────────────────────────────────────────────────
@@ -612,6 +626,34 @@ TEST_F(MessageRepositoryTest, Expunge_NoDeletedMessages_NoEffect) {
     EXPECT_TRUE(m_msg_repo->findByID(*m.id).has_value());
 }
 
+TEST_F(MessageRepositoryTest, Expunge_ReturnsUidsAndCollectsOrphanedFiles) {
+    Folder dest = buildFolder("ExpungeCopyDest");
+    ASSERT_TRUE(m_msg_repo->createFolder(dest));
+
+    auto shared = std::filesystem::temp_directory_path() / "expunge_shared.eml";
+    auto own    = std::filesystem::temp_directory_path() / "expunge_own.eml";
+    std::ofstream(shared) << "shared";
+    std::ofstream(own) << "own";
+
+    Message m1 = buildMessage(); m1.raw_file_path = shared.string(); ASSERT_TRUE(m_msg_repo->deliver(m1, m_inbox_id));
+    Message m2 = buildMessage(); ASSERT_TRUE(m_msg_repo->deliver(m2, m_inbox_id));
+    Message m3 = buildMessage(); m3.raw_file_path = own.string(); ASSERT_TRUE(m_msg_repo->deliver(m3, m_inbox_id));
+    ASSERT_TRUE(m_msg_repo->copy(*m1.id, *dest.id).has_value());
+
+    m_msg_repo->markDeleted(*m1.id, true);
+    m_msg_repo->markDeleted(*m3.id, true);
+
+    std::vector<int64_t> uids;
+    ASSERT_TRUE(m_msg_repo->expunge(m_inbox_id, uids));
+    EXPECT_EQ(uids, (std::vector<int64_t>{m1.uid, m3.uid}));
+    EXPECT_TRUE(m_msg_repo->findByID(*m2.id).has_value());
+
+    m_mgr->fileCollector().waitIdle();
+    EXPECT_TRUE (std::filesystem::exists(shared)); // still referenced by the copy
+    EXPECT_FALSE(std::filesystem::exists(own));
+    std::filesystem::remove(shared);
+}
+
 TEST_F(MessageRepositoryTest, HardDelete_RemovesMessageFromDB) {
     Message m = buildMessage(); ASSERT_TRUE(m_msg_repo->deliver(m, m_inbox_id));
     ASSERT_TRUE(m_msg_repo->hardDelete(*m.id));
@@ -763,4 +805,678 @@ TEST_F(MessageRepositoryTest, MultipleDelivers_UIDsUniquePerFolder) {
     for (size_t i = 0; i < uids_f2.size(); ++i)
         for (size_t j = i + 1; j < uids_f2.size(); ++j)
             EXPECT_NE(uids_f2[i], uids_f2[j]);
-}
\ No newline at end of file
+}
+// ─────────────────────────────────────────────────────────────────────────────
+// Mod-sequences (CONDSTORE / QRESYNC)
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(MessageRepositoryTest, Deliver_StampsIncreasingModseq) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+
+    EXPECT_GT(m1.modseq, 0);
+    EXPECT_GT(m2.modseq, m1.modseq);
+    EXPECT_EQ(m_msg_repo->findFolderByID(m_inbox_id)->highest_modseq, m2.modseq);
+}
+
+TEST_F(MessageRepositoryTest, FlagChange_BumpsModseq_RecentDoesNot) {
+    Message m = deliver();
+    int64_t before = m_msg_repo->findByID(*m.id)->modseq;
+
+    ASSERT_TRUE(m_msg_repo->clearRecentByFolder(m_inbox_id));
+    EXPECT_EQ(m_msg_repo->findByID(*m.id)->modseq, before);
+
+    ASSERT_TRUE(m_msg_repo->markSeen(*m.id, true));
+    int64_t after = m_msg_repo->findByID(*m.id)->modseq;
+    EXPECT_GT(after, before);
+
+    // Setting the same value again is not a change
+    ASSERT_TRUE(m_msg_repo->markSeen(*m.id, true));
+    EXPECT_EQ(m_msg_repo->findByID(*m.id)->modseq, after);
+}
+
+TEST_F(MessageRepositoryTest, FindChangedSince_ReturnsOnlyNewerMessages) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+    int64_t known = m_msg_repo->findFolderByID(m_inbox_id)->highest_modseq;
+
+    EXPECT_TRUE(m_msg_repo->findChangedSince(m_inbox_id, known).empty());
+
+    ASSERT_TRUE(m_msg_repo->markFlagged(*m1.id, true));
+    auto changed = m_msg_repo->findChangedSince(m_inbox_id, known);
+    ASSERT_EQ(changed.size(), 1u);
+    EXPECT_EQ(changed[0].id, *m1.id);
+}
+
+TEST_F(MessageRepositoryTest, Expunge_RecordsTombstones) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+    int64_t known = m_msg_repo->findFolderByID(m_inbox_id)->highest_modseq;
+
+    ASSERT_TRUE(m_msg_repo->markDeleted(*m2.id, true));
+    ASSERT_TRUE(m_msg_repo->expunge(m_inbox_id));
+
+    auto vanished = m_msg_repo->findExpungedSince(m_inbox_id, known);
+    ASSERT_TRUE(vanished.has_value());
+    ASSERT_EQ(vanished->size(), 1u);
+    EXPECT_EQ((*vanished)[0], m2.uid);
+    EXPECT_GT(m_msg_repo->findFolderByID(m_inbox_id)->highest_modseq, known);
+}
+
+TEST_F(MessageRepositoryTest, MoveToFolder_TombstonesSourceAndStampsDestination) {
+    Folder dest = buildFolder("ModseqDest");
+    ASSERT_TRUE(m_msg_repo->createFolder(dest));
+
+    Message m = deliver();
+    int64_t src_known  = m_msg_repo->findFolderByID(m_inbox_id)->highest_modseq;
+    int64_t dest_known = m_msg_repo->findFolderByID(*dest.id)->highest_modseq;
+
+    ASSERT_TRUE(m_msg_repo->moveToFolder(*m.id, *dest.id));
+
+    auto vanished = m_msg_repo->findExpungedSince(m_inbox_id, src_known);
+    ASSERT_TRUE(vanished.has_value());
+    ASSERT_EQ(vanished->size(), 1u);
+    EXPECT_EQ((*vanished)[0], m.uid);
+
+    auto changed = m_msg_repo->findChangedSince(*dest.id, dest_known);
+    ASSERT_EQ(changed.size(), 1u);
+    EXPECT_EQ(changed[0].id, *m.id);
+}
+
+TEST_F(MessageRepositoryTest, DeleteFolder_WithMessages_SucceedsWithoutTombstones) {
+    Folder tmp = buildFolder("ModseqTemp");
+    ASSERT_TRUE(m_msg_repo->createFolder(tmp));
+    deliver("a@example.com", "x", *tmp.id);
+
+    ASSERT_TRUE(m_msg_repo->deleteFolder(*tmp.id));
+    EXPECT_TRUE(m_msg_repo->findExpungedSince(*tmp.id, 0).value_or(std::vector<int64_t>{1}).empty());
+}
+
+TEST_F(MessageRepositoryTest, PruneExpunged_KeepsNewestAndReportsIncompleteHistory) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+    Message m3 = deliver();
+    int64_t known = m_msg_repo->findFolderByID(m_inbox_id)->highest_modseq;
+
+    int64_t after_first = 0;
+    for (const Message& m : {m1, m2, m3})
+    {
+        ASSERT_TRUE(m_msg_repo->markDeleted(*m.id, true));
+        ASSERT_TRUE(m_msg_repo->expunge(m_inbox_id));
+        if (after_first == 0)
+            after_first = m_msg_repo->findFolderByID(m_inbox_id)->highest_modseq;
+    }
+
+    {
+        MessageDAL dal(m_mgr->getDB(), m_mgr->pool());
+        auto lock = m_mgr->writeLock();
+        ASSERT_TRUE(dal.pruneExpunged(m_inbox_id, 2));
+    }
+
+    // a client that saw m1 go is still served from the tombstones that are left
+    auto recent = m_msg_repo->findExpungedSince(m_inbox_id, after_first);
+    ASSERT_TRUE(recent.has_value());
+    EXPECT_EQ(*recent, (std::vector<int64_t>{m2.uid, m3.uid}));
+    // an older one is told its history is gone
+    EXPECT_FALSE(m_msg_repo->findExpungedSince(m_inbox_id, known).has_value());
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// SEARCH criteria
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(MessageRepositoryTest, SearchUIDs_FlagCriteria) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+    ASSERT_TRUE(m_msg_repo->markFlagged(*m2.id, true));
+
+    auto flagged = m_msg_repo->searchUIDs(m_inbox_id, SearchCriteria::leaf(SearchCriteria::Type::Flagged));
+    ASSERT_EQ(flagged.size(), 1u);
+    EXPECT_EQ(flagged[0], m2.uid);
+
+    auto unflagged = m_msg_repo->searchUIDs(
+        m_inbox_id, SearchCriteria::negate(SearchCriteria::leaf(SearchCriteria::Type::Flagged)));
+    ASSERT_EQ(unflagged.size(), 1u);
+    EXPECT_EQ(unflagged[0], m1.uid);
+}
+
+TEST_F(MessageRepositoryTest, SearchUIDs_BodyUsesIndexedContent) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+    ASSERT_TRUE(m_msg_repo->indexContent(*m2.id, "carol@example.com", "", "quarterly budget review"));
+
+    SearchCriteria body = SearchCriteria::leaf(SearchCriteria::Type::Body);
+    body.value = "budget";
+    auto found = m_msg_repo->searchUIDs(m_inbox_id, body);
+    ASSERT_EQ(found.size(), 1u);
+    EXPECT_EQ(found[0], m2.uid);
+
+    SearchCriteria to = SearchCriteria::leaf(SearchCriteria::Type::To);
+    to.value = "carol";
+    EXPECT_EQ(m_msg_repo->searchUIDs(m_inbox_id, to), std::vector<int64_t>{m2.uid});
+}
+
+TEST_F(MessageRepositoryTest, SearchUIDs_OrSizeAndDate) {
+    Message small = buildMessage();
+    small.size_bytes = 100;
+    ASSERT_TRUE(m_msg_repo->deliver(small, m_inbox_id));
+    Message old = buildMessage();
+    old.internal_date = "2020-01-01T00:00:00Z";
+    ASSERT_TRUE(m_msg_repo->deliver(old, m_inbox_id));
+    deliver();
+
+    SearchCriteria smaller = SearchCriteria::leaf(SearchCriteria::Type::Smaller);
+    smaller.number = 200;
+    SearchCriteria before = SearchCriteria::leaf(SearchCriteria::Type::Before);
+    before.value = "2021-01-01";
+
+    SearchCriteria either = SearchCriteria::leaf(SearchCriteria::Type::Or);
+    either.children = {smaller, before};
+
+    auto found = m_msg_repo->searchUIDs(m_inbox_id, either);
+    EXPECT_EQ(found, (std::vector<int64_t>{small.uid, old.uid}));
+}
+
+TEST_F(MessageRepositoryTest, CopyMessage_CarriesIndexedContent) {
+    Folder dest = buildFolder("SearchCopyDest");
+    ASSERT_TRUE(m_msg_repo->createFolder(dest));
+
+    Message m = deliver();
+    ASSERT_TRUE(m_msg_repo->indexContent(*m.id, "", "", "invoice attached"));
+    ASSERT_TRUE(m_msg_repo->copy(*m.id, *dest.id));
+
+    SearchCriteria body = SearchCriteria::leaf(SearchCriteria::Type::Body);
+    body.value = "invoice";
+    EXPECT_EQ(m_msg_repo->searchUIDs(*dest.id, body).size(), 1u);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// SORT / THREAD
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(MessageRepositoryTest, Deliver_ReplyJoinsParentThread) {
+    Message root = buildMessage("a@example.com", "Plans");
+    root.message_id_header = "<root@example.com>";
+    ASSERT_TRUE(m_msg_repo->deliver(root, m_inbox_id));
+    EXPECT_EQ(root.thread_id, root.id);
+
+    Message reply = buildMessage("b@example.com", "Re: Plans");
+    reply.message_id_header = "<reply@example.com>";
+    reply.in_reply_to       = "<reply-to-unknown@example.com>";
+    reply.references_header = "<root@example.com> <reply-to-unknown@example.com>";
+    ASSERT_TRUE(m_msg_repo->deliver(reply, m_inbox_id));
+    EXPECT_EQ(reply.thread_id, root.id);
+
+    Message other = deliver();
+    EXPECT_EQ(other.thread_id, other.id);
+}
+
+TEST_F(MessageRepositoryTest, Deliver_ParentAdoptsEarlierReplies) {
+    Message reply = buildMessage("b@example.com", "Re: Late");
+    reply.in_reply_to = "<late@example.com>";
+    ASSERT_TRUE(m_msg_repo->deliver(reply, m_inbox_id));
+    EXPECT_EQ(reply.thread_id, reply.id);
+
+    Message root = buildMessage("a@example.com", "Late");
+    root.message_id_header = "<late@example.com>";
+    ASSERT_TRUE(m_msg_repo->deliver(root, m_inbox_id));
+
+    EXPECT_EQ(m_msg_repo->findByID(*reply.id)->thread_id, root.id);
+}
+
+TEST_F(MessageRepositoryTest, BaseSubject_StripsReplyAndForwardMarkers) {
+    EXPECT_EQ(MessageDAL::baseSubject("Re: [list] FWD: Hello   World (fwd)"), "hello world");
+    EXPECT_EQ(MessageDAL::baseSubject("[Fwd: re[2]: Budget]"), "budget");
+    EXPECT_EQ(MessageDAL::baseSubject("[only-blob]"), "[only-blob]");
+    EXPECT_EQ(MessageDAL::baseSubject("Reply needed"), "reply needed");
+}
+
+TEST_F(MessageRepositoryTest, SortUIDs_SubjectThenReverseSize) {
+    Message b = buildMessage("x@example.com", "Re: beta");
+    b.size_bytes = 10;
+    ASSERT_TRUE(m_msg_repo->deliver(b, m_inbox_id));
+    Message a1 = buildMessage("x@example.com", "alpha");
+    a1.size_bytes = 10;
+    ASSERT_TRUE(m_msg_repo->deliver(a1, m_inbox_id));
+    Message a2 = buildMessage("x@example.com", "Fwd: Alpha");
+    a2.size_bytes = 30;
+    ASSERT_TRUE(m_msg_repo->deliver(a2, m_inbox_id));
+
+    std::vector<SortKey> keys = {{SortKey::Field::Subject, false}, {SortKey::Field::Size, true}};
+    auto sorted = m_msg_repo->sortUIDs(m_inbox_id, SearchCriteria::leaf(SearchCriteria::Type::All), keys);
+    EXPECT_EQ(sorted, (std::vector<int64_t>{a2.uid, a1.uid, b.uid}));
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// MIME part offsets (partial FETCH)
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(MessageRepositoryTest, SaveParts_FollowMessageOnCopyAndDelete) {
+    Folder dest = buildFolder("PartsCopyDest");
+    ASSERT_TRUE(m_msg_repo->createFolder(dest));
+
+    Message m = deliver();
+    MessagePart root;
+    root.section = "";
+    root.body_start = 20;
+    root.body_end = 120;
+    MessagePart first;
+    first.section = "1";
+    first.header_start = 30;
+    first.body_start = 60;
+    first.body_end = 90;
+    ASSERT_TRUE(m_msg_repo->saveParts(*m.id, {root, first}));
+
+    auto parts = m_msg_repo->findParts(*m.id);
+    ASSERT_EQ(parts.size(), 2u);
+    EXPECT_EQ(parts[1].section, "1");
+    EXPECT_EQ(parts[1].body_start, 60);
+    EXPECT_EQ(parts[1].body_end, 90);
+
+    auto copy = m_msg_repo->copy(*m.id, *dest.id);
+    ASSERT_TRUE(copy.has_value());
+    EXPECT_EQ(m_msg_repo->findParts(*copy->id).size(), 2u);
+
+    ASSERT_TRUE(m_msg_repo->hardDelete(*m.id));
+    EXPECT_TRUE(m_msg_repo->findParts(*m.id).empty());
+}
+
+TEST_F(MessageRepositoryTest, UpdateFlagsBulk_AppliesMaskToRangesInOneStep) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+    Message m3 = deliver();
+
+    std::vector<MessageFlagsRow> updated;
+    std::vector<int64_t> modified;
+    ASSERT_TRUE(m_msg_repo->updateFlagsBulk(m_inbox_id, {{m1.uid, m2.uid}}, FlagOperation::Add,
+                                            MessageFlags::Seen | MessageFlags::Flagged, updated, modified));
+    ASSERT_EQ(updated.size(), 2u);
+    EXPECT_TRUE(modified.empty());
+    EXPECT_EQ(updated[0].uid, m1.uid);
+    EXPECT_TRUE(updated[0].has(MessageFlags::Seen));
+    EXPECT_TRUE(updated[1].has(MessageFlags::Flagged));
+    EXPECT_FALSE(m_msg_repo->findByUID(m_inbox_id, m3.uid)->is_seen);
+
+    updated.clear();
+    ASSERT_TRUE(m_msg_repo->updateFlagsBulk(m_inbox_id, {{m2.uid, m3.uid}}, FlagOperation::Replace,
+                                            MessageFlags::Deleted, updated, modified));
+    ASSERT_EQ(updated.size(), 2u);
+    EXPECT_FALSE(updated[0].has(MessageFlags::Seen));
+    EXPECT_FALSE(updated[0].has(MessageFlags::Flagged));
+    EXPECT_TRUE(updated[0].has(MessageFlags::Deleted));
+    EXPECT_TRUE(m_msg_repo->findByUID(m_inbox_id, m1.uid)->is_seen);
+}
+
+TEST_F(MessageRepositoryTest, UpdateFlagsBulk_UnchangedSinceSkipsNewerMessages) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+    int64_t base = m_msg_repo->findByUID(m_inbox_id, m2.uid)->modseq;
+
+    std::vector<MessageFlagsRow> updated;
+    std::vector<int64_t> modified;
+    ASSERT_TRUE(m_msg_repo->updateFlagsBulk(m_inbox_id, {{m2.uid, m2.uid}}, FlagOperation::Add,
+                                            MessageFlags::Answered, updated, modified));
+
+    updated.clear();
+    ASSERT_TRUE(m_msg_repo->updateFlagsBulk(m_inbox_id, {{m1.uid, m2.uid}}, FlagOperation::Add,
+                                            MessageFlags::Seen, updated, modified, base));
+    ASSERT_EQ(updated.size(), 1u);
+    EXPECT_EQ(updated[0].uid, m1.uid);
+    ASSERT_EQ(modified.size(), 1u);
+    EXPECT_EQ(modified[0], m2.uid);
+    EXPECT_FALSE(m_msg_repo->findByUID(m_inbox_id, m2.uid)->is_seen);
+}
+
+TEST_F(MessageRepositoryTest, UpdateFlagsBulk_ThousandsOfDisjointRanges) {
+    // every other message: one range per UID, far past SQLite's expression depth limit
+    std::vector<std::pair<int64_t, int64_t>> odd, all;
+    for (int i = 0; i < 2400; ++i) {
+        Message m = deliver();
+        all.emplace_back(m.uid, m.uid);
+        if (i % 2 == 0) odd.emplace_back(m.uid, m.uid);
+    }
+    int64_t base = m_msg_repo->findFolderByID(m_inbox_id)->highest_modseq;
+
+    std::vector<MessageFlagsRow> updated;
+    std::vector<int64_t> modified;
+    ASSERT_TRUE(m_msg_repo->updateFlagsBulk(m_inbox_id, odd, FlagOperation::Add, MessageFlags::Seen, updated,
+                                            modified)) << m_msg_repo->getLastError();
+    EXPECT_EQ(updated.size(), odd.size());
+    EXPECT_EQ(m_msg_repo->getFolderStats(m_inbox_id).unseen, 1200);
+
+    // UNCHANGEDSINCE skips the 1200 rows just changed, which is another range per UID
+    updated.clear();
+    ASSERT_TRUE(m_msg_repo->updateFlagsBulk(m_inbox_id, all, FlagOperation::Add, MessageFlags::Flagged, {"sparse"},
+                                            updated, modified, base)) << m_msg_repo->getLastError();
+    EXPECT_EQ(modified.size(), odd.size());
+    ASSERT_EQ(updated.size(), all.size() - odd.size());
+    EXPECT_EQ(updated.front().uid, all[1].first);
+    EXPECT_EQ(updated.front().keywords, "sparse");
+    EXPECT_TRUE(m_msg_repo->findByUID(m_inbox_id, all[0].first)->keywords.empty());
+}
+
+TEST_F(MessageRepositoryTest, ProjectionRows_CarryFlagsSizeAndDateOfRequestedUIDs) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+    Message m3 = deliver();
+    ASSERT_TRUE(m_msg_repo->markFlagged(*m2.id, true));
+    ASSERT_TRUE(m_msg_repo->markAnswered(*m2.id, true));
+
+    auto rows = m_msg_repo->findHeaderRows(m_inbox_id, {{m1.uid, m1.uid}, {m3.uid, m3.uid}});
+    ASSERT_EQ(rows.size(), 2u);
+    EXPECT_EQ(rows[0].uid, m1.uid);
+    EXPECT_EQ(rows[1].uid, m3.uid);
+    EXPECT_EQ(rows[1].id, *m3.id);
+
+    auto full = m_msg_repo->findByID(*m1.id);
+    EXPECT_EQ(rows[0].size_bytes, full->size_bytes);
+    EXPECT_EQ(rows[0].internal_date, full->internal_date);
+    EXPECT_EQ(rows[0].modseq, full->modseq);
+
+    rows = m_msg_repo->findHeaderRows(m_inbox_id, {{m2.uid, m2.uid}});
+    ASSERT_EQ(rows.size(), 1u);
+    EXPECT_TRUE(rows[0].has(MessageFlags::Flagged));
+    EXPECT_TRUE(rows[0].has(MessageFlags::Answered));
+    EXPECT_EQ(rows[0].has(MessageFlags::Recent), m_msg_repo->findByID(*m2.id)->is_recent);
+    EXPECT_FALSE(rows[0].has(MessageFlags::Seen));
+}
+
+TEST_F(MessageRepositoryTest, Keywords_StoredInternedAndSearchable) {
+    Message m1 = deliver();
+    Message m2 = deliver();
+
+    ASSERT_TRUE(m_msg_repo->setFlags(*m1.id, {"+\\Seen", "+Work", "+Urgent"}));
+    auto msg = m_msg_repo->findByID(*m1.id);
+    EXPECT_TRUE(msg->is_seen);
+    EXPECT_NE(msg->keywords.find("Work"), std::string::npos);
+    EXPECT_NE(msg->keywords.find("Urgent"), std::string::npos);
+
+    std::vector<MessageFlagsRow> updated;
+    std::vector<int64_t> modified;
+    ASSERT_TRUE(m_msg_repo->updateFlagsBulk(m_inbox_id, {{m1.uid, m2.uid}}, FlagOperation::Add, 0, {"work"}, updated,
+                                            modified));
+    ASSERT_EQ(updated.size(), 2u);
+    EXPECT_EQ(updated[1].keywords, "Work");
+
+    auto hits = m_msg_repo->searchMessages(m_inbox_id, SearchCriteria::leaf(SearchCriteria::Type::Keyword));
+    EXPECT_TRUE(hits.empty());
+    SearchCriteria urgent = SearchCriteria::leaf(SearchCriteria::Type::Keyword);
+    urgent.value = "urgent";
+    hits = m_msg_repo->searchMessages(m_inbox_id, urgent);
+    ASSERT_EQ(hits.size(), 1u);
+    EXPECT_EQ(hits[0].uid, m1.uid);
+    EXPECT_EQ(m_msg_repo->searchMessages(m_inbox_id, SearchCriteria::negate(urgent)).size(), 1u);
+
+    // a replace keeps only the named keywords, system flags included
+    ASSERT_TRUE(m_msg_repo->setFlags(*m1.id, {"\\Flagged", "Urgent"}));
+    msg = m_msg_repo->findByID(*m1.id);
+    EXPECT_FALSE(msg->is_seen);
+    EXPECT_TRUE(msg->is_flagged);
+    EXPECT_EQ(msg->keywords, "Urgent");
+
+    EXPECT_FALSE(m_msg_repo->setFlags(*m1.id, {"\\Bogus"}));
+}
+
+TEST_F(MessageRepositoryTest, CopyBulk_ReservesUidBlockAndCarriesSideTables) {
+    Folder dest = buildFolder("BulkCopyDest");
+    ASSERT_TRUE(m_msg_repo->createFolder(dest));
+    Message pre = deliver("sender@example.com", "Already there", *dest.id);
+
+    Message m1 = deliver();
+    Message m2 = deliver();
+    Message m3 = deliver();
+    ASSERT_TRUE(m_msg_repo->indexContent(*m3.id, "", "", "bulk invoice"));
+    Recipient r; r.message_id = *m3.id; r.address = "to@e.com"; r.type = RecipientType::To;
+    ASSERT_TRUE(m_msg_repo->addRecipient(r));
+    MessagePart part; part.section = "1"; part.body_start = 10; part.body_end = 20;
+    ASSERT_TRUE(m_msg_repo->saveParts(*m3.id, {part}));
+
+    std::vector<std::pair<int64_t, int64_t>> uid_map;
+    ASSERT_TRUE(m_msg_repo->copyBulk(m_inbox_id, {{m1.uid, m1.uid}, {m3.uid, m3.uid}}, *dest.id, uid_map));
+    ASSERT_EQ(uid_map.size(), 2u);
+    EXPECT_EQ(uid_map[0], std::make_pair(m1.uid, pre.uid + 1));
+    EXPECT_EQ(uid_map[1], std::make_pair(m3.uid, pre.uid + 2));
+    EXPECT_EQ(m_msg_repo->findFolderByID(*dest.id)->next_uid, pre.uid + 3);
+
+    auto copy = m_msg_repo->findByUID(*dest.id, pre.uid + 2);
+    ASSERT_TRUE(copy.has_value());
+    EXPECT_EQ(copy->raw_file_path, m3.raw_file_path);
+    EXPECT_EQ(m_msg_repo->findRecipientsByMessage(*copy->id).size(), 1u);
+    EXPECT_EQ(m_msg_repo->findParts(*copy->id).size(), 1u);
+
+    SearchCriteria body = SearchCriteria::leaf(SearchCriteria::Type::Body);
+    body.value = "invoice";
+    EXPECT_EQ(m_msg_repo->searchUIDs(*dest.id, body), (std::vector<int64_t>{pre.uid + 2}));
+    EXPECT_EQ(m_msg_repo->findUIDsByFolder(m_inbox_id).size(), 3u);
+}
+
+TEST_F(MessageRepositoryTest, CopyAndMoveBulk_ThousandsOfDisjointRanges) {
+    Folder copies = buildFolder("SparseCopies");
+    ASSERT_TRUE(m_msg_repo->createFolder(copies));
+    Folder moved = buildFolder("SparseMoved");
+    ASSERT_TRUE(m_msg_repo->createFolder(moved));
+
+    std::vector<std::pair<int64_t, int64_t>> odd;
+    for (int i = 0; i < 2400; ++i) {
+        Message m = deliver();
+        if (i % 2 == 0) odd.emplace_back(m.uid, m.uid);
+    }
+
+    std::vector<std::pair<int64_t, int64_t>> uid_map;
+    ASSERT_TRUE(m_msg_repo->copyBulk(m_inbox_id, odd, *copies.id, uid_map)) << m_msg_repo->getLastError();
+    ASSERT_EQ(uid_map.size(), odd.size());
+    EXPECT_EQ(uid_map.back().first, odd.back().first);
+    EXPECT_EQ(m_msg_repo->findUIDsByFolder(*copies.id).size(), odd.size());
+
+    uid_map.clear();
+    ASSERT_TRUE(m_msg_repo->moveBulk(m_inbox_id, odd, *moved.id, uid_map)) << m_msg_repo->getLastError();
+    ASSERT_EQ(uid_map.size(), odd.size());
+    EXPECT_EQ(m_msg_repo->findUIDsByFolder(*moved.id).size(), odd.size());
+    EXPECT_EQ(m_msg_repo->findUIDsByFolder(m_inbox_id).size(), 2400u - odd.size());
+}
+
+TEST_F(MessageRepositoryTest, MoveBulk_RehomesRowsAndLeavesTombstones) {
+    Folder dest = buildFolder("BulkMoveDest");
+    ASSERT_TRUE(m_msg_repo->createFolder(dest));
+
+    Message m1 = deliver();
+    Message m2 = deliver();
+    Message m3 = deliver();
+    int64_t known = m_msg_repo->findFolderByID(m_inbox_id)->highest_modseq;
+
+    std::vector<std::pair<int64_t, int64_t>> uid_map;
+    ASSERT_TRUE(m_msg_repo->moveBulk(m_inbox_id, {{m2.uid, m3.uid}}, *dest.id, uid_map));
+    ASSERT_EQ(uid_map.size(), 2u);
+    EXPECT_EQ(uid_map[0].first, m2.uid);
+    EXPECT_EQ(uid_map[1].first, m3.uid);
+
+    EXPECT_EQ(m_msg_repo->findUIDsByFolder(m_inbox_id), (std::vector<int64_t>{m1.uid}));
+    auto moved = m_msg_repo->findByUID(*dest.id, uid_map[0].second);
+    ASSERT_TRUE(moved.has_value());
+    EXPECT_EQ(moved->id, m2.id);
+    EXPECT_EQ(*m_msg_repo->findExpungedSince(m_inbox_id, known), (std::vector<int64_t>{m2.uid, m3.uid}));
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// folder_stats: counters follow every insert, flag change, move and expunge
+// ─────────────────────────────────────────────────────────────────────────────
+
+TEST_F(MessageRepositoryTest, FolderStats_TrackDeliveryFlagsMoveAndExpunge) {
+    Folder dest = buildFolder("StatsDest");
+    ASSERT_TRUE(m_msg_repo->createFolder(dest));
+
+    auto empty = m_msg_repo->getFolderStats(*dest.id);
+    EXPECT_EQ(empty.messages, 0);
+    EXPECT_EQ(empty.total_bytes, 0);
+
+    Message m1 = deliver();
+    Message m2 = deliver();
+    Message m3 = deliver();
+
+    auto stats = m_msg_repo->getFolderStats(m_inbox_id);
+    EXPECT_EQ(stats.messages, 3);
+    EXPECT_EQ(stats.recent, 3);
+    EXPECT_EQ(stats.unseen, 3);
+    EXPECT_EQ(stats.deleted, 0);
+    EXPECT_EQ(stats.total_bytes, 3 * 512);
+
+    ASSERT_TRUE(m_msg_repo->markSeen(*m1.id, true));
+    ASSERT_TRUE(m_msg_repo->markSeen(*m1.id, true));  // no change, no drift
+    ASSERT_TRUE(m_msg_repo->markDeleted(*m2.id, true));
+    ASSERT_TRUE(m_msg_repo->clearRecentByFolder(m_inbox_id));
+
+    stats = m_msg_repo->getFolderStats(m_inbox_id);
+    EXPECT_EQ(stats.messages, 3);
+    EXPECT_EQ(stats.recent, 0);
+    EXPECT_EQ(stats.unseen, 2);
+    EXPECT_EQ(stats.deleted, 1);
+
+    std::vector<std::pair<int64_t, int64_t>> uid_map;
+    ASSERT_TRUE(m_msg_repo->moveBulk(m_inbox_id, {{m3.uid, m3.uid}}, *dest.id, uid_map));
+    ASSERT_TRUE(m_msg_repo->expunge(m_inbox_id));
+
+    stats = m_msg_repo->getFolderStats(m_inbox_id);
+    EXPECT_EQ(stats.messages, 1);
+    EXPECT_EQ(stats.unseen, 0);
+    EXPECT_EQ(stats.deleted, 0);
+    EXPECT_EQ(stats.total_bytes, 512);
+
+    auto moved = m_msg_repo->getFolderStats(*dest.id);
+    EXPECT_EQ(moved.messages, 1);
+    EXPECT_EQ(moved.unseen, 1);
+    EXPECT_EQ(moved.total_bytes, 512);
+
+    auto by_user = m_msg_repo->getFolderStatsByUser(m_user_id);
+    EXPECT_EQ(by_user[m_inbox_id].messages, 1);
+    EXPECT_EQ(by_user[*dest.id].messages, 1);
+}
+
+TEST_F(MessageRepositoryTest, KeysetPaging_WalksFolderAndUserWithoutGapsOrRepeats) {
+    std::vector<Message> delivered;
+    for (int i = 0; i < 7; ++i) {
+        Message m = buildMessage();
+        m.internal_date = (i < 4) ? "2024-06-01T10:00:00Z" : "2024-06-02T10:00:00Z";
+        ASSERT_TRUE(m_msg_repo->deliver(m, m_inbox_id));
+        delivered.push_back(m);
+    }
+    ASSERT_TRUE(m_msg_repo->markSeen(*delivered[1].id, true));
+    ASSERT_TRUE(m_msg_repo->markSeen(*delivered[4].id, true));
+
+    std::vector<int64_t> uids;
+    int64_t after = 0;
+    for (;;) {
+        auto page = m_msg_repo->findByFolderAfter(m_inbox_id, after, 3);
+        if (page.empty()) break;
+        EXPECT_LE(page.size(), 3u);
+        for (const auto& m : page) uids.push_back(m.uid);
+        after = page.back().uid;
+    }
+    ASSERT_EQ(uids.size(), delivered.size());
+    for (size_t i = 0; i < uids.size(); ++i)
+        EXPECT_EQ(uids[i], delivered[i].uid);
+
+    auto unseen = m_msg_repo->findUnseenAfter(m_inbox_id, delivered[2].uid, 10);
+    ASSERT_EQ(unseen.size(), 3u);
+    EXPECT_EQ(unseen[0].uid, delivered[3].uid);
+    EXPECT_EQ(unseen[1].uid, delivered[5].uid);
+
+    // newest first; rows sharing an internal_date are ordered by id
+    std::vector<int64_t> ids;
+    auto page = m_msg_repo->findByUser(m_user_id, 2);
+    while (!page.empty()) {
+        for (const auto& m : page) ids.push_back(*m.id);
+        page = m_msg_repo->findByUserBefore(m_user_id, page.back().internal_date, *page.back().id, 2);
+    }
+    ASSERT_EQ(ids.size(), delivered.size());
+    for (size_t i = 0; i < ids.size(); ++i)
+        EXPECT_EQ(ids[i], *delivered[delivered.size() - 1 - i].id);
+}
+
+TEST_F(MessageRepositoryTest, RowSet_ViewsMatchMessagesAndOutliveMoves) {
+    deliver("a@example.com", "Quarterly report");
+    Message m2 = deliver("b@example.com", "Re: Quarterly report");
+    ASSERT_TRUE(m_msg_repo->markFlagged(*m2.id, true));
+
+    MessageRowSet moved = m_msg_repo->findByFolderAfter(m_inbox_id, 0, 10);
+    MessageRowSet rows = std::move(moved);
+    ASSERT_EQ(rows.size(), 2u);
+
+    for (const auto& row : rows) {
+        auto full = m_msg_repo->findByID(*row.id);
+        ASSERT_TRUE(full.has_value());
+        Message copy = row.toMessage();
+        EXPECT_EQ(copy.raw_file_path, full->raw_file_path);
+        EXPECT_EQ(copy.from_address, full->from_address);
+        EXPECT_EQ(copy.subject, full->subject);
+        EXPECT_EQ(copy.internal_date, full->internal_date);
+        EXPECT_EQ(copy.sort_subject, full->sort_subject);
+        EXPECT_EQ(copy.is_flagged, full->is_flagged);
+        EXPECT_EQ(copy.is_recent, full->is_recent);
+    }
+    EXPECT_EQ(rows[0].subject, std::string_view("Quarterly report"));
+    EXPECT_TRUE(rows[1].has(MessageFlags::Flagged));
+    EXPECT_EQ(rows[0].sort_subject, rows[1].sort_subject);
+}
+
+TEST_F(MessageRepositoryTest, KeysetPaging_UsersByName) {
+    for (const char* name : {"carol", "alice", "bob"}) {
+        User u;
+        u.username = name;
+        ASSERT_TRUE(m_user_repo->registerUser(u, "pass"));
+    }
+
+    std::vector<std::string> names;
+    std::string after;
+    for (;;) {
+        auto page = m_user_repo->findAllAfter(after, 2);
+        if (page.empty()) break;
+        for (const auto& u : page) names.push_back(u.username);
+        after = page.back().username;
+    }
+    EXPECT_EQ(names, (std::vector<std::string>{"alice", "bob", "carol", "testuser"}));
+}
+
+// A database created before the flags mask existed: only the first migration step, with rows in it.
+TEST(SchemaMigrationTest, ExistingFlagColumnsAreFoldedIntoMask) {
+    std::string path = uniqueDbPath();
+    std::string_view schema = initSchema();
+    size_t second = schema.find("-- @migration ", 1);
+    ASSERT_NE(second, std::string_view::npos);
+
+    sqlite3* db = nullptr;
+    ASSERT_EQ(sqlite3_open(path.c_str(), &db), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db, std::string(schema.substr(0, second)).c_str(), nullptr, nullptr, nullptr), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db,
+        "INSERT INTO users (username, password_hash) VALUES ('old', 'x');"
+        "INSERT INTO folders (user_id, name, next_uid) VALUES (1, 'INBOX', 3);"
+        "INSERT INTO messages (user_id, folder_id, uid, raw_file_path, from_address, is_seen, is_flagged, is_recent) "
+        "VALUES (1, 1, 1, 'a.eml', 'a@e.com', 1, 1, 0);"
+        "INSERT INTO messages (user_id, folder_id, uid, raw_file_path, from_address, is_deleted, is_draft) "
+        "VALUES (1, 1, 2, 'b.eml', 'b@e.com', 1, 1);",
+        nullptr, nullptr, nullptr), SQLITE_OK);
+    sqlite3_close(db);
+
+    {
+        DataBaseManager mgr(path, initSchema());
+        ASSERT_TRUE(mgr.isConnected());
+        MessageRepository repo(mgr);
+
+        auto rows = repo.findHeaderRows(1, {{1, 2}});
+        ASSERT_EQ(rows.size(), 2u);
+        EXPECT_EQ(rows[0].flags, MessageFlags::Seen | MessageFlags::Flagged);
+        EXPECT_EQ(rows[1].flags, MessageFlags::Deleted | MessageFlags::Draft | MessageFlags::Recent);
+
+        auto unseen = repo.findUnseen(1);
+        ASSERT_EQ(unseen.size(), 1u);
+        EXPECT_EQ(unseen[0].uid, 2);
+        EXPECT_TRUE(repo.setFlags(*unseen[0].id, {"+Later"}));
+    }
+
+    // reopening finds every step applied and runs none again
+    {
+        DataBaseManager mgr(path, initSchema());
+        ASSERT_TRUE(mgr.isConnected());
+        EXPECT_EQ(MessageRepository(mgr).findByUID(1, 2)->keywords, "Later");
+    }
+    removeDb(path);
+}
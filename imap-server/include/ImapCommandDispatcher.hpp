@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <functional>
 #include <map>
 #include <memory>
@@ -38,6 +39,9 @@ private:
 	std::string m_authenticatedUserName;
 	std::optional<int64_t> m_authenticatedUserID;
 	MailboxState m_currentMailbox;
+	bool m_condstoreEnabled = false;
+	bool m_qresyncEnabled = false;
+	bool m_compressionActive = false;
 
 	std::string HandleLogin(const ImapCommand& cmd);
 	std::string HandleLogout(const ImapCommand& cmd);
@@ -62,6 +66,33 @@ private:
 	std::string HandleClose(const ImapCommand& cmd);
 	std::string HandleCheck(const ImapCommand& cmd);
 	std::string HandleStartTLS(const ImapCommand& cmd);
+	std::string HandleEnable(const ImapCommand& cmd);
+	std::string HandleSearch(const ImapCommand& cmd);
+	std::string HandleUidSearch(const ImapCommand& cmd);
+	std::string HandleSort(const ImapCommand& cmd);
+	std::string HandleUidSort(const ImapCommand& cmd);
+	std::string HandleThread(const ImapCommand& cmd);
+	std::string HandleUidThread(const ImapCommand& cmd);
+	std::string HandleCompress(const ImapCommand& cmd);
+	std::string HandleAppend(const ImapCommand& cmd);
+	std::string HandleMove(const ImapCommand& cmd);
+	std::string HandleUidMove(const ImapCommand& cmd);
 
-	std::map<ImapCommandType, std::function<std::string(const ImapCommand&)>> m_handlers;
+	// LIST / LSUB lines for the folders matching reference + pattern, STATUS lines after each
+	// folder when status_items is not empty (LIST-STATUS)
+	std::string ListFolders(const ImapCommand& cmd, bool subscribed_only, const std::vector<std::string>& status_items);
+
+	// rows of the selected mailbox for sorted UIDs, read in keyset pages over the UID span
+	std::vector<Message> LoadMessagesByUID(const std::vector<int64_t>& uids);
+	// FLAGS / INTERNALDATE / RFC822.SIZE / MODSEQ projection of the same rows
+	std::vector<MessageHeaderRow> LoadHeaderRowsByUID(const std::vector<int64_t>& uids);
+
+	// COPY / UID COPY / MOVE / UID MOVE share everything but the set type and the expunge step
+	std::string TransferMessages(const ImapCommand& cmd, bool by_uid, bool move, const std::string& completed);
+	// untagged EXPUNGE responses for the removed UIDs, or one VANISHED once QRESYNC is enabled (RFC 7162 3.2.10)
+	std::string ExpungeResponses(const std::vector<int64_t>& folder_uids, const std::vector<int64_t>& expunged_uids) const;
+
+	// flat jump table indexed by ImapCommandType, shared by all sessions
+	using Handler = std::string (ImapCommandDispatcher::*)(const ImapCommand&);
+	static const std::array<Handler, IMAP_COMMAND_TYPE_COUNT>& Handlers();
 };
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <zlib.h>
+
+// COMPRESS=DEFLATE (RFC 4978): raw DEFLATE in both directions, one instance per session.
+// window_bits and mem_level bound the compressor memory, roughly
+// (1 << (window_bits + 2)) + (1 << (mem_level + 9)) bytes.
+class ImapDeflateStream
+{
+public:
+	ImapDeflateStream(int level, int window_bits, int mem_level);
+	~ImapDeflateStream();
+
+	ImapDeflateStream(const ImapDeflateStream&) = delete;
+	ImapDeflateStream& operator=(const ImapDeflateStream&) = delete;
+
+	bool IsValid() const;
+
+	// appends the compressed data to out; with flush the peer can decode everything so far right away
+	bool Compress(const std::string& data, std::string& out, bool flush = true);
+	// appends the decompressed data to out
+	bool Decompress(const char* data, std::size_t size, std::string& out);
+
+private:
+	static constexpr std::size_t CHUNK_SIZE = 16 * 1024;
+
+	z_stream m_deflate{};
+	z_stream m_inflate{};
+	bool m_deflateReady = false;
+	bool m_inflateReady = false;
+};
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <thread>
+#include <vector>
 
 #include "AppConfig.h"
-#include "DataBaseManager.h"
+#include "ShardRouter.h"
 #include "ILogger.h"
+#include "Repository/MessageRepository.h"
+#include "Repository/UserRepository.h"
 #include "ThreadPool.h"
 
 using namespace SmtpClient;
@@ -12,10 +16,10 @@ using namespace SmtpClient;
 class ImapServer
 {
 public:
-	ImapServer(boost::asio::io_context& context, ILogger& logger, DataBaseManager& db, ThreadPool& pool,
+	ImapServer(boost::asio::io_context& context, ILogger& logger, ShardRouter& db, ThreadPool& pool,
 			   ImapConfig& config);
 	ImapServer(const ImapServer&) = delete;
-	void Start();
+	void Start(); // runs the io_context on io_threads threads, including the caller; returns once it stops
 
 private:
 	void AcceptConnection();
@@ -24,6 +28,11 @@ private:
 	boost::asio::io_context& m_context;
 	boost::asio::ip::tcp::acceptor m_acceptor;
 	ILogger& m_logger;
-	DataBaseManager& m_db;
+	ShardRouter& m_db;
 	ThreadPool& m_thread_pool;
+
+	// shared by all sessions; a session only keeps its protocol state
+	MessageRepository m_mess_repo;
+	UserRepository m_user_repo;
+	std::vector<std::thread> m_io_threads;
 };
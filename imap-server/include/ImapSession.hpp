@@ -1,26 +1,30 @@
 #pragma once
 
+#include <array>
 #include <boost/asio.hpp>
 #include <chrono>
 #include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <map>
 #include <memory>
 #include <optional>
-#include <queue>
 #include <set>
 #include <string>
 #include <vector>
 
 #include "AppConfig.h"
-#include "DataBaseManager.h"
 #include "ImapCommand.hpp"
 #include "ImapCommandDispatcher.hpp"
 #include "ImapSessionTypes.hpp"
+#include "ImapUtils.hpp"
 #include "ILogger.h"
 #include "Repository/MessageRepository.h"
 #include "Repository/UserRepository.h"
 #include "ThreadPool.h"
 #include "ImapConnection.hpp"
+#include "ImapDeflateStream.hpp"
 #include "ServerSecureChannel.hpp"
 
 using namespace SmtpClient;
@@ -28,16 +32,33 @@ using namespace SmtpClient;
 class ImapSession : public std::enable_shared_from_this<ImapSession>
 {
 public:
-	ImapSession(boost::asio::ip::tcp::socket socket, ILogger& logger, DataBaseManager& db, ThreadPool& pool,
-				ImapConfig& config);
+	ImapSession(boost::asio::ip::tcp::socket socket, ILogger& logger, MessageRepository& mess_repo,
+				UserRepository& user_repo, ThreadPool& pool, ImapConfig& config);
+	~ImapSession();
 	void Start();
 
 private:
 	void SendBanner();
 	void ReadCommand();
+	void ReadBuffered(); // ReadCommand while COMPRESS is active or bytes are left behind a literal
+	void ReadRawInput(std::function<void()> on_data); // appends the next chunk from the client to m_input
+	void ReadRecord(std::function<void(std::string)> on_record); // next decrypted record once TLS is active
+	bool AppendInput(const char* data, std::size_t size);
+	void ArmIdleTimer();
+	void EnableCompression();
 	void HandleCommand(const std::string& line);
-	void WriteResponse(const std::string& msg); // adds message to the queue
-	void Write();								// writes to the client from queue
+	void DiscardLongLine(const std::string& head); // drops the rest of a line that overflowed m_buffer
+	void RejectLongLine(const std::string& head);
+	void RunNextCommand(); // dispatches the oldest pipelined command once the previous one is done
+	void CompleteCommand(const ImapCommand& cmd, const std::string& response);
+	static bool IsPipelineBarrier(ImapCommandType type);
+	void BeginLiteral(const std::string& line, const IMAP_UTILS::LiteralSpec& spec);
+	void ReadLiteral();
+	void FinishLiteral();
+	void ResetLiteral();
+	void WriteResponse(std::string msg); // adds message to the queue
+	void Write();						 // writes everything queued so far as one batch
+	void OnWriteComplete();
 	void UpgradeToTLS();
 
 	ImapConfig& m_config;
@@ -49,16 +70,46 @@ private:
 	boost::asio::steady_timer m_timer;
 
 	bool m_is_starttls_pending = false;
+	bool m_is_compress_pending = false;
 
-	std::queue<std::string> m_write_queue;
+	std::unique_ptr<ImapDeflateStream> m_deflate;
+	std::string m_input; // client bytes (decompressed once COMPRESS is active) not yet consumed
+	// allocated by the first raw read: most sessions never leave line mode
+	static constexpr std::size_t READ_CHUNK_SIZE = 16 * 1024;
+	std::unique_ptr<char[]> m_read_chunk;
+
+	// TLS records are read and written asynchronously on the strand like plaintext, so an idle
+	// client holds no pool worker and a record is never sealed while another is being opened
+	std::array<unsigned char, SecureChannel::HEADER_SIZE> m_record_header{};
+	std::string m_record;
+
+	// a command line split by literals: APPEND messages are spooled to disk, other literals
+	// (at most MAX_INLINE_LITERAL bytes) are spliced back into the line as quoted strings
+	static constexpr int64_t MAX_INLINE_LITERAL = 8 * 1024;
+	std::string m_literal_tag;
+	std::string m_literal_line;
+	std::vector<std::string> m_literal_paths;
+	std::unique_ptr<std::ofstream> m_literal_file; // only while an APPEND literal is spooled
+	std::string m_literal_data;
+	int64_t m_literal_remaining = 0;
+	bool m_literal_inline = false;
+	std::string m_literal_error; // sent once a refused non-synchronizing literal is drained
+
+	// RFC 3501 5.5: the session keeps reading while earlier commands run. Commands execute one at
+	// a time in arrival order on the dispatcher; STARTTLS, COMPRESS and LOGOUT stop the reader
+	// because the bytes behind them belong to a different stream (or to nobody).
+	static constexpr std::size_t MAX_PIPELINED_COMMANDS = 64;
+	std::deque<ImapCommand> m_pending_commands;
+	bool m_is_dispatching = false;
+	bool m_read_paused = false; // reader stopped because m_pending_commands is full
+
+	// responses queued while a batch is on the wire; the next Write() takes all of them at once
+	std::vector<std::string> m_write_queue;
 	bool m_is_writing = false;
 	bool m_closing = false;
 
 	ILogger& m_logger;
 	ThreadPool& m_thread_pool;
 
-	MessageRepository m_mess_repo;
-	UserRepository m_user_repo;
-
-	std::unique_ptr<ImapCommandDispatcher> m_dispatcher;
+	ImapCommandDispatcher m_dispatcher;
 };
@@ -1,7 +1,10 @@
 #include "ImapCommandDispatcher.hpp"
 
 #include <algorithm>
+#include <ctime>
+#include <filesystem>
 #include <fstream>
+#include <iterator>
 #include <sstream>
 #include <stdexcept>
 
@@ -14,37 +17,58 @@
 ImapCommandDispatcher::ImapCommandDispatcher(ILogger& logger, UserRepository& userRepo, MessageRepository& messRepo)
 	: m_logger(logger), m_userRepo(userRepo), m_messRepo(messRepo)
 {
-	m_handlers = {{ImapCommandType::Login, [this](const ImapCommand& cmd) { return HandleLogin(cmd); }},
-				  {ImapCommandType::Logout, [this](const ImapCommand& cmd) { return HandleLogout(cmd); }},
-				  {ImapCommandType::Capability, [this](const ImapCommand& cmd) { return HandleCapability(cmd); }},
-				  {ImapCommandType::Noop, [this](const ImapCommand& cmd) { return HandleNoop(cmd); }},
-				  {ImapCommandType::Select, [this](const ImapCommand& cmd) { return HandleSelect(cmd); }},
-				  {ImapCommandType::List, [this](const ImapCommand& cmd) { return HandleList(cmd); }},
-				  {ImapCommandType::Lsub, [this](const ImapCommand& cmd) { return HandleLsub(cmd); }},
-				  {ImapCommandType::Status, [this](const ImapCommand& cmd) { return HandleStatus(cmd); }},
-				  {ImapCommandType::Fetch, [this](const ImapCommand& cmd) { return HandleFetch(cmd); }},
-				  {ImapCommandType::Store, [this](const ImapCommand& cmd) { return HandleStore(cmd); }},
-				  {ImapCommandType::Create, [this](const ImapCommand& cmd) { return HandleCreate(cmd); }},
-				  {ImapCommandType::Delete, [this](const ImapCommand& cmd) { return HandleDelete(cmd); }},
-				  {ImapCommandType::Rename, [this](const ImapCommand& cmd) { return HandleRename(cmd); }},
-				  {ImapCommandType::Copy, [this](const ImapCommand& cmd) { return HandleCopy(cmd); }},
-				  {ImapCommandType::Expunge, [this](const ImapCommand& cmd) { return HandleExpunge(cmd); }},
-				  {ImapCommandType::UidFetch, [this](const ImapCommand& cmd) { return HandleUidFetch(cmd); }},
-				  {ImapCommandType::UidStore, [this](const ImapCommand& cmd) { return HandleUidStore(cmd); }},
-				  {ImapCommandType::UidCopy, [this](const ImapCommand& cmd) { return HandleUidCopy(cmd); }},
-				  {ImapCommandType::Subscribe, [this](const ImapCommand& cmd) { return HandleSubscribe(cmd); }},
-				  {ImapCommandType::Unsubscribe, [this](const ImapCommand& cmd) { return HandleUnsubscribe(cmd); }},
-				  {ImapCommandType::Close, [this](const ImapCommand& cmd) { return HandleClose(cmd); }},
-				  {ImapCommandType::Check, [this](const ImapCommand& cmd) { return HandleCheck(cmd); }},
-				  {ImapCommandType::StartTLS, [this](const ImapCommand& cmd) { return HandleStartTLS(cmd); }}};
+}
+
+const std::array<ImapCommandDispatcher::Handler, IMAP_COMMAND_TYPE_COUNT>& ImapCommandDispatcher::Handlers()
+{
+	static const auto handlers = []
+	{
+		std::array<Handler, IMAP_COMMAND_TYPE_COUNT> table{};
+		table[static_cast<size_t>(ImapCommandType::Login)] = &ImapCommandDispatcher::HandleLogin;
+		table[static_cast<size_t>(ImapCommandType::Logout)] = &ImapCommandDispatcher::HandleLogout;
+		table[static_cast<size_t>(ImapCommandType::Capability)] = &ImapCommandDispatcher::HandleCapability;
+		table[static_cast<size_t>(ImapCommandType::Noop)] = &ImapCommandDispatcher::HandleNoop;
+		table[static_cast<size_t>(ImapCommandType::Select)] = &ImapCommandDispatcher::HandleSelect;
+		table[static_cast<size_t>(ImapCommandType::List)] = &ImapCommandDispatcher::HandleList;
+		table[static_cast<size_t>(ImapCommandType::Lsub)] = &ImapCommandDispatcher::HandleLsub;
+		table[static_cast<size_t>(ImapCommandType::Status)] = &ImapCommandDispatcher::HandleStatus;
+		table[static_cast<size_t>(ImapCommandType::Fetch)] = &ImapCommandDispatcher::HandleFetch;
+		table[static_cast<size_t>(ImapCommandType::Store)] = &ImapCommandDispatcher::HandleStore;
+		table[static_cast<size_t>(ImapCommandType::Create)] = &ImapCommandDispatcher::HandleCreate;
+		table[static_cast<size_t>(ImapCommandType::Delete)] = &ImapCommandDispatcher::HandleDelete;
+		table[static_cast<size_t>(ImapCommandType::Rename)] = &ImapCommandDispatcher::HandleRename;
+		table[static_cast<size_t>(ImapCommandType::Copy)] = &ImapCommandDispatcher::HandleCopy;
+		table[static_cast<size_t>(ImapCommandType::Expunge)] = &ImapCommandDispatcher::HandleExpunge;
+		table[static_cast<size_t>(ImapCommandType::UidFetch)] = &ImapCommandDispatcher::HandleUidFetch;
+		table[static_cast<size_t>(ImapCommandType::UidStore)] = &ImapCommandDispatcher::HandleUidStore;
+		table[static_cast<size_t>(ImapCommandType::UidCopy)] = &ImapCommandDispatcher::HandleUidCopy;
+		table[static_cast<size_t>(ImapCommandType::Subscribe)] = &ImapCommandDispatcher::HandleSubscribe;
+		table[static_cast<size_t>(ImapCommandType::Unsubscribe)] = &ImapCommandDispatcher::HandleUnsubscribe;
+		table[static_cast<size_t>(ImapCommandType::Close)] = &ImapCommandDispatcher::HandleClose;
+		table[static_cast<size_t>(ImapCommandType::Check)] = &ImapCommandDispatcher::HandleCheck;
+		table[static_cast<size_t>(ImapCommandType::StartTLS)] = &ImapCommandDispatcher::HandleStartTLS;
+		table[static_cast<size_t>(ImapCommandType::Enable)] = &ImapCommandDispatcher::HandleEnable;
+		table[static_cast<size_t>(ImapCommandType::Search)] = &ImapCommandDispatcher::HandleSearch;
+		table[static_cast<size_t>(ImapCommandType::UidSearch)] = &ImapCommandDispatcher::HandleUidSearch;
+		table[static_cast<size_t>(ImapCommandType::Sort)] = &ImapCommandDispatcher::HandleSort;
+		table[static_cast<size_t>(ImapCommandType::UidSort)] = &ImapCommandDispatcher::HandleUidSort;
+		table[static_cast<size_t>(ImapCommandType::Thread)] = &ImapCommandDispatcher::HandleThread;
+		table[static_cast<size_t>(ImapCommandType::UidThread)] = &ImapCommandDispatcher::HandleUidThread;
+		table[static_cast<size_t>(ImapCommandType::Compress)] = &ImapCommandDispatcher::HandleCompress;
+		table[static_cast<size_t>(ImapCommandType::Append)] = &ImapCommandDispatcher::HandleAppend;
+		table[static_cast<size_t>(ImapCommandType::Move)] = &ImapCommandDispatcher::HandleMove;
+		table[static_cast<size_t>(ImapCommandType::UidMove)] = &ImapCommandDispatcher::HandleUidMove;
+		return table;
+	}();
+	return handlers;
 }
 
 std::string ImapCommandDispatcher::Dispatch(const ImapCommand& cmd)
 {
-	auto it = m_handlers.find(cmd.m_type);
-	if (it != m_handlers.end())
+	Handler handler = Handlers()[static_cast<size_t>(cmd.m_type)];
+	if (handler != nullptr)
 	{
-		return it->second(cmd);
+		return (this->*handler)(cmd);
 	}
 	return ImapResponse::Bad(cmd.m_tag, "Command not implemented");
 }
@@ -164,27 +188,37 @@ std::string ImapCommandDispatcher::HandleSelect(const ImapCommand& cmd)
 	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleSelect - Start");
 
 	std::string response;
-	if (cmd.m_args.size() != 1)
+	bool condstore = false;
+	std::optional<IMAP_UTILS::QresyncParams> qresync;
+	if (cmd.m_args.size() != 1 && cmd.m_args.size() != 2)
 	{
 		response = ImapResponse::Bad(cmd.m_tag, "Invalid arguments number");
 	}
+	else if (cmd.m_args.size() == 2 && !IMAP_UTILS::ParseSelectParams(cmd.m_args[1], condstore, qresync))
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Invalid select parameters");
+	}
+	else if (qresync.has_value() && !m_qresyncEnabled)
+	{
+		// RFC 7162 3.2.5: QRESYNC parameter is only allowed after ENABLE QRESYNC
+		response = ImapResponse::Bad(cmd.m_tag, "QRESYNC is not enabled");
+	}
 	else
 	{
 		auto folder_opt = m_messRepo.findFolderByName(m_authenticatedUserID.value(), cmd.m_args[0]);
 		if (folder_opt.has_value())
 		{
+			m_condstoreEnabled = m_condstoreEnabled || condstore;
 			m_currentMailbox.m_name = folder_opt->name;
-			auto all_messages = m_messRepo.findByFolder(folder_opt->id.value());
-			m_currentMailbox.m_exists = all_messages.size();
-			m_currentMailbox.m_recent = std::count_if(all_messages.begin(), all_messages.end(),
-													  [](const Message& msg) { return msg.is_recent; });
+			auto stats = m_messRepo.getFolderStats(folder_opt->id.value());
+			m_currentMailbox.m_exists = stats.messages;
+			m_currentMailbox.m_recent = stats.recent;
 			m_messRepo.clearRecentByFolder(folder_opt->id.value());
 			m_currentMailbox.m_id = folder_opt->id;
 
-			size_t unseen_count = std::count_if(all_messages.begin(), all_messages.end(),
-												[](const Message& msg) { return !msg.is_seen; });
+			int64_t unseen_count = stats.unseen;
 			int64_t uidnext = folder_opt->next_uid;
-			int64_t uidvalidity = folder_opt->id.value();
+			int64_t uidvalidity = IMAP_UTILS::UidValidity(*folder_opt);
 
 			response = ImapResponse::Flags();
 			response += "* OK [UIDVALIDITY " + std::to_string(uidvalidity) + "]\r\n";
@@ -193,7 +227,49 @@ std::string ImapCommandDispatcher::HandleSelect(const ImapCommand& cmd)
 			response += "* OK [UNSEEN " + std::to_string(unseen_count) + "]\r\n";
 			response += ImapResponse::Exists(m_currentMailbox.m_exists);
 			response += "* OK [UIDNEXT " + std::to_string(uidnext) + "]\r\n";
+			response += "* OK [HIGHESTMODSEQ " + std::to_string(folder_opt->highest_modseq) + "]\r\n";
 			response += ImapResponse::Recent(m_currentMailbox.m_recent);
+
+			// QRESYNC: report only what changed since the client's last known mod-sequence
+			if (qresync.has_value() && qresync->m_uidValidity == uidvalidity)
+			{
+				// sequence numbers are only needed here, so only QRESYNC pays for the UID list
+				auto uids = m_messRepo.findUIDsByFolder(folder_opt->id.value());
+				std::vector<int64_t> known;
+				if (!qresync->m_knownUids.empty())
+					known = IMAP_UTILS::ParseSequenceSet(qresync->m_knownUids, uidnext - 1);
+
+				auto vanished = m_messRepo.findExpungedSince(folder_opt->id.value(), qresync->m_modseq);
+				if (!vanished.has_value())
+				{
+					// the tombstones were pruned: every known UID that no longer exists is reported
+					if (qresync->m_knownUids.empty() && uidnext > 1)
+						known = IMAP_UTILS::ParseSequenceSet("1:" + std::to_string(uidnext - 1), uidnext - 1);
+					vanished.emplace();
+					std::set_difference(known.begin(), known.end(), uids.begin(), uids.end(),
+										std::back_inserter(*vanished));
+				}
+				else if (!qresync->m_knownUids.empty())
+				{
+					vanished->erase(std::remove_if(vanished->begin(), vanished->end(), [&known](int64_t uid)
+												   { return !std::binary_search(known.begin(), known.end(), uid); }),
+									vanished->end());
+				}
+				if (!vanished->empty())
+				{
+					response += ImapResponse::Untagged("VANISHED (EARLIER) " + IMAP_UTILS::FormatSequenceSet(*vanished));
+				}
+				for (const auto& changed : m_messRepo.findChangedSince(folder_opt->id.value(), qresync->m_modseq))
+				{
+					auto it = std::lower_bound(uids.begin(), uids.end(), changed.uid);
+					if (it == uids.end() || *it != changed.uid) continue;
+
+					std::string flags = IMAP_UTILS::FormatFlagsResponse(changed, true);
+					response += ImapResponse::Fetch(std::distance(uids.begin(), it) + 1,
+													"(UID " + std::to_string(changed.uid) + " " + flags.substr(1));
+				}
+			}
+
 			response += ImapResponse::Ok(cmd.m_tag, "[READ-WRITE] Select completed");
 			m_state = SessionState::Selected;
 			m_logger.Log(PROD, "ImapCommandDispatcher::HandleSelect - Mailbox selected: " + m_currentMailbox.m_name);
@@ -217,11 +293,17 @@ std::string ImapCommandDispatcher::HandleList(const ImapCommand& cmd)
 	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleList - Start");
 
 	std::string response = "";
+	std::vector<std::string> status_items;
 
-	if (cmd.m_args.size() != 2)
+	if (cmd.m_args.size() != 2 && cmd.m_args.size() != 4)
 	{
 		response = ImapResponse::Bad(cmd.m_tag, "Invalid arguments number");
 	}
+	else if (cmd.m_args.size() == 4 && (IMAP_UTILS::ToUpper(cmd.m_args[2]) != "RETURN" ||
+										!IMAP_UTILS::ParseListReturnOptions(cmd.m_args[3], status_items)))
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Invalid return options");
+	}
 	else if (cmd.m_args[1] == "")
 	{
 		response = ImapResponse::List('/', "", "Noselect");
@@ -229,11 +311,7 @@ std::string ImapCommandDispatcher::HandleList(const ImapCommand& cmd)
 	}
 	else
 	{
-		auto folders = m_messRepo.findFoldersByUser(m_authenticatedUserID.value());
-		for (const auto& folder : folders)
-		{
-			response += ImapResponse::List('/', folder.name, "HasNoChildren");
-		}
+		response = ListFolders(cmd, false, status_items);
 		response += ImapResponse::Ok(cmd.m_tag, "List completed");
 	}
 
@@ -261,14 +339,7 @@ std::string ImapCommandDispatcher::HandleLsub(const ImapCommand& cmd)
 	}
 	else
 	{
-		auto folders = m_messRepo.findFoldersByUser(m_authenticatedUserID.value());
-		std::vector<Folder> subscribed_folders;
-		std::copy_if(folders.begin(), folders.end(), std::back_inserter(subscribed_folders),
-					 [](Folder& folder) { return folder.is_subscribed; });
-		for (const auto& folder : subscribed_folders)
-		{
-			response += ImapResponse::Lsub('/', folder.name, "HasNoChildren");
-		}
+		response = ListFolders(cmd, true, {});
 		response += ImapResponse::Ok(cmd.m_tag, "Lsub completed");
 	}
 
@@ -277,6 +348,96 @@ std::string ImapCommandDispatcher::HandleLsub(const ImapCommand& cmd)
 	return response;
 }
 
+std::vector<Message> ImapCommandDispatcher::LoadMessagesByUID(const std::vector<int64_t>& uids)
+{
+	constexpr int PAGE_SIZE = 256;
+
+	std::vector<Message> messages;
+	if (uids.empty()) return messages;
+
+	int64_t folder_id = m_currentMailbox.m_id.value();
+	int64_t after = uids.front() - 1;
+	while (after < uids.back())
+	{
+		auto page = m_messRepo.findByFolderAfter(folder_id, after, PAGE_SIZE);
+		if (page.empty()) break;
+
+		after = page.back().uid;
+		// rows outside the set are skipped without copying any of their strings out of the page
+		for (const auto& row : page)
+		{
+			if (std::binary_search(uids.begin(), uids.end(), row.uid)) messages.push_back(row.toMessage());
+		}
+		if (static_cast<int>(page.size()) < PAGE_SIZE) break;
+	}
+	return messages;
+}
+
+std::vector<MessageHeaderRow> ImapCommandDispatcher::LoadHeaderRowsByUID(const std::vector<int64_t>& uids)
+{
+	// every range costs two bound parameters, a scattered set is read as one span and filtered
+	constexpr size_t MAX_RANGES = 256;
+
+	std::vector<std::pair<int64_t, int64_t>> ranges;
+	for (int64_t uid : uids)
+	{
+		if (!ranges.empty() && ranges.back().second + 1 == uid) ranges.back().second = uid;
+		else ranges.emplace_back(uid, uid);
+	}
+	if (ranges.empty()) return {};
+
+	bool filter = ranges.size() > MAX_RANGES;
+	if (filter) ranges = {{uids.front(), uids.back()}};
+
+	auto rows = m_messRepo.findHeaderRows(m_currentMailbox.m_id.value(), ranges);
+	if (filter)
+	{
+		rows.erase(std::remove_if(rows.begin(), rows.end(), [&uids](const MessageHeaderRow& row)
+								  { return !std::binary_search(uids.begin(), uids.end(), row.uid); }),
+				   rows.end());
+	}
+	return rows;
+}
+
+std::string ImapCommandDispatcher::ListFolders(const ImapCommand& cmd, bool subscribed_only,
+											   const std::vector<std::string>& status_items)
+{
+	// a reference of just the delimiter means the root, as clients send LIST "/" "*"
+	std::string pattern = cmd.m_args[0] + cmd.m_args[1];
+	pattern.erase(0, pattern.find_first_not_of('/'));
+
+	auto tree = m_messRepo.findFolderTree(m_authenticatedUserID.value());
+	std::unordered_map<int64_t, FolderStatus> statuses;
+	if (!status_items.empty())
+	{
+		statuses = m_messRepo.getFolderStatsByUser(m_authenticatedUserID.value());
+	}
+
+	std::string response;
+	for (const auto& node : tree->nodes)
+	{
+		const Folder& folder = node.folder;
+		if ((subscribed_only && !folder.is_subscribed) || !IMAP_UTILS::MatchMailboxPattern(folder.name, pattern))
+		{
+			continue;
+		}
+
+		const char* attributes = node.has_children ? "HasChildren" : "HasNoChildren";
+		response += subscribed_only ? ImapResponse::Lsub('/', folder.name, attributes)
+									: ImapResponse::List('/', folder.name, attributes);
+
+		if (!status_items.empty())
+		{
+			auto it = statuses.find(folder.id.value_or(0));
+			std::string items;
+			IMAP_UTILS::FormatStatusItems(status_items, folder, it != statuses.end() ? it->second : FolderStatus{},
+										  items);
+			response += ImapResponse::Status("\"" + folder.name + "\"", items);
+		}
+	}
+	return response;
+}
+
 std::string ImapCommandDispatcher::HandleStatus(const ImapCommand& cmd)
 {
 	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleStatus - In: tag=" + cmd.m_tag + ", args=[" +
@@ -293,50 +454,11 @@ std::string ImapCommandDispatcher::HandleStatus(const ImapCommand& cmd)
 		auto folder_opt = m_messRepo.findFolderByName(m_authenticatedUserID.value(), cmd.m_args[0]);
 		if (folder_opt.has_value())
 		{
-			auto all_messages = m_messRepo.findByFolder(folder_opt->id.value());
+			auto status = m_messRepo.getFolderStats(folder_opt->id.value());
 			auto reqs = IMAP_UTILS::SplitArgs(IMAP_UTILS::TrimParentheses(cmd.m_args[1]));
-			bool success = false;
-
-			for (auto& req : reqs)
-			{
-				if (req == "MESSAGES")
-				{
-					success = true;
-					response += "MESSAGES " + std::to_string(all_messages.size()) + " ";
-				}
-				else if (req == "RECENT")
-				{
-					success = true;
-					size_t recent = std::count_if(all_messages.begin(), all_messages.end(),
-												  [](const Message& msg) { return msg.is_recent; });
-					response += "RECENT " + std::to_string(recent) + " ";
-				}
-				else if (req == "UIDNEXT")
-				{
-					success = true;
-					response += "UIDNEXT " + std::to_string(folder_opt->next_uid) + " ";
-				}
-				else if (req == "UIDVALIDITY")
-				{
-					success = true;
-					response += "UIDVALIDITY " + std::to_string(folder_opt->id.value()) + " ";
-				}
-				else if (req == "UNSEEN")
-				{
-					success = true;
-					size_t unseen = std::count_if(all_messages.begin(), all_messages.end(),
-												  [](const Message& msg) { return !msg.is_seen; });
-					response += "UNSEEN " + std::to_string(unseen) + " ";
-				}
-			}
 
-			if (success)
+			if (IMAP_UTILS::FormatStatusItems(reqs, folder_opt.value(), status, response))
 			{
-				if (!response.empty() && response.back() == ' ')
-				{
-					response.pop_back();
-				}
-
 				response = ImapResponse::Status(cmd.m_args[0], response);
 				response += ImapResponse::Ok(cmd.m_tag, "Status completed");
 			}
@@ -377,22 +499,33 @@ std::string ImapCommandDispatcher::HandleFetch(const ImapCommand& cmd)
 	{
 		try
 		{
-			auto messages = m_messRepo.findByFolder(m_currentMailbox.m_id.value());
-			auto lists_ids = IMAP_UTILS::ParseSequenceSet(cmd.m_args[0], messages.size());
+			std::vector<std::string> args = cmd.m_args;
+			std::optional<int64_t> changed_since;
+			bool vanished = false;
+			int64_t modseq = 0;
+			if (args.size() > 2 && IMAP_UTILS::ParseChangedSince(args.back(), modseq, vanished))
+			{
+				changed_since = modseq;
+				args.pop_back();
+			}
+			if (vanished)
+			{
+				throw std::invalid_argument("VANISHED is only allowed with UID FETCH");
+			}
 
-			std::vector<Message> selected_messages;
-			selected_messages.reserve(lists_ids.size());
+			// sequence numbers are positions in the UID list; only the requested rows are loaded
+			auto folder_uids = m_messRepo.findUIDsByFolder(m_currentMailbox.m_id.value());
+			auto lists_ids = IMAP_UTILS::ParseSequenceSet(args[0], folder_uids.size());
 
-			for (int seq_num : lists_ids)
+			std::vector<int64_t> selected_uids;
+			selected_uids.reserve(lists_ids.size());
+			for (int64_t seq_num : lists_ids)
 			{
-				if (seq_num > 0 && seq_num <= static_cast<int>(messages.size()))
-				{
-					// seq_num is coming from IMAP so it is 1-based, while vector is 0-based, so we need to subtract 1
-					selected_messages.push_back(messages[seq_num - 1]);
-				}
+				if (seq_num > 0 && seq_num <= static_cast<int64_t>(folder_uids.size()))
+					selected_uids.push_back(folder_uids[seq_num - 1]);
 			}
 
-			auto data_items_str = IMAP_UTILS::TrimParentheses(cmd.m_args[1]);
+			auto data_items_str = IMAP_UTILS::TrimParentheses(args[1]);
 			auto data_items = IMAP_UTILS::SplitArgs(data_items_str);
 
 			// Combine split BODY[HEADER.FIELDS ...] sections
@@ -430,10 +563,35 @@ std::string ImapCommandDispatcher::HandleFetch(const ImapCommand& cmd)
 				}
 			}
 
-			for (size_t i = 0; i < selected_messages.size(); ++i)
+			// CONDSTORE: once the client is mod-sequence aware every FETCH carries MODSEQ
+			bool has_flags = std::find(expanded_items.begin(), expanded_items.end(), "FLAGS") != expanded_items.end();
+			bool has_modseq = std::find(expanded_items.begin(), expanded_items.end(), "MODSEQ") != expanded_items.end();
+			if (changed_since.has_value() || has_modseq || (m_condstoreEnabled && has_flags))
+			{
+				m_condstoreEnabled = true;
+				if (!has_modseq) expanded_items.push_back("MODSEQ");
+			}
+
+			// flags, dates and sizes come from a narrow projection, the message row is never read
+			std::vector<Message> selected_messages;
+			if (IMAP_UTILS::IsSummaryFetch(expanded_items))
+			{
+				for (const auto& row : LoadHeaderRowsByUID(selected_uids))
+				{
+					if (changed_since.has_value() && row.modseq <= changed_since.value()) continue;
+					response += ImapResponse::Fetch(IMAP_UTILS::UidToSequenceNumber(folder_uids, row.uid),
+													"(" + IMAP_UTILS::FormatSummaryItems(row, expanded_items) + ")");
+				}
+			}
+			else
+			{
+				selected_messages = LoadMessagesByUID(selected_uids);
+			}
+
+			for (const auto& msg : selected_messages)
 			{
-				const auto& msg = selected_messages[i];
-				size_t seq_num = lists_ids[i];
+				size_t seq_num = std::lower_bound(folder_uids.begin(), folder_uids.end(), msg.uid) - folder_uids.begin() + 1;
+				if (changed_since.has_value() && msg.modseq <= changed_since.value()) continue;
 
 				std::optional<SmtpClient::Email> email_opt;
 				std::optional<SmtpClient::MimePart> mime_part_opt;
@@ -462,6 +620,7 @@ std::string ImapCommandDispatcher::HandleFetch(const ImapCommand& cmd)
 						if (msg.is_answered) fetch_response += "\\Answered ";
 						if (msg.is_flagged) fetch_response += "\\Flagged ";
 						if (msg.is_recent) fetch_response += "\\Recent ";
+						fetch_response += msg.keywords;
 						if (fetch_response.back() == ' ') fetch_response.pop_back();
 						fetch_response += ") ";
 					}
@@ -556,7 +715,7 @@ std::string ImapCommandDispatcher::HandleFetch(const ImapCommand& cmd)
 
 						std::string headers, body;
 						SmtpClient::MimeParser::SplitHeadersAndBody(raw_mime, headers, body);
-						std::string headers_list = IMAP_UTILS::TrimParentheses(cmd.m_args[2]);
+						std::string headers_list = IMAP_UTILS::TrimParentheses(args[2]);
 
 						std::vector<std::string> requested_headers;
 						std::istringstream iss(headers_list);
@@ -602,12 +761,33 @@ std::string ImapCommandDispatcher::HandleFetch(const ImapCommand& cmd)
 							throw std::invalid_argument("Invalid BODY section: " + item);
 						}
 						std::string section = item.substr(bracket_start, bracket_end - bracket_start);
-
-						std::string body_content = IMAP_UTILS::GetBodySection(msg, section);
 						std::string item_name = is_peek ? "BODY.PEEK[" + section + "]" : "BODY[" + section + "]";
+
+						std::string body_content;
+						std::string partial = item.substr(bracket_end + 1);
+						int64_t offset = 0, length = 0;
+						if (partial.empty())
+						{
+							body_content = IMAP_UTILS::GetBodySection(msg, section);
+						}
+						else if (IMAP_UTILS::ParsePartialRange(partial, offset, length))
+						{
+							// only the origin octet is echoed back (RFC 3501, section 7.4.2)
+							body_content = IMAP_UTILS::GetBodySectionRange(msg, section, offset, length, m_messRepo);
+							item_name += "<" + std::to_string(offset) + ">";
+						}
+						else
+						{
+							throw std::invalid_argument("Invalid BODY partial range: " + item);
+						}
+
 						fetch_response +=
 							item_name + " {" + std::to_string(body_content.size()) + "}\r\n" + body_content + " ";
 					}
+					else if (item == "MODSEQ")
+					{
+						fetch_response += "MODSEQ (" + std::to_string(msg.modseq) + ") ";
+					}
 					else if (item == "UID")
 					{
 						fetch_response += "UID " + std::to_string(msg.uid) + " ";
@@ -661,7 +841,7 @@ std::string ImapCommandDispatcher::HandleStore(const ImapCommand& cmd)
 	{
 		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
 	}
-	else if (cmd.m_args.size() != 3)
+	else if (cmd.m_args.size() != 3 && cmd.m_args.size() != 4)
 	{
 		response = ImapResponse::Bad(cmd.m_tag, "Invalid arguments number");
 	}
@@ -669,58 +849,88 @@ std::string ImapCommandDispatcher::HandleStore(const ImapCommand& cmd)
 	{
 		try
 		{
-			// db doesn`t support custom flags
-			auto raw_flags = IMAP_UTILS::SplitArgs(IMAP_UTILS::TrimParentheses(cmd.m_args[2]));
+			std::vector<std::string> args = cmd.m_args;
+			std::optional<int64_t> unchanged_since;
+			int64_t modseq = 0;
+			if (args.size() == 4)
+			{
+				if (!IMAP_UTILS::ParseUnchangedSince(args[1], modseq))
+				{
+					throw std::invalid_argument("Invalid store modifier: " + args[1]);
+				}
+				unchanged_since = modseq;
+				m_condstoreEnabled = true;
+				args.erase(args.begin() + 1);
+			}
+
+			// names without a backslash are keywords; an unknown system flag is an error
+			auto raw_flags = IMAP_UTILS::SplitArgs(IMAP_UTILS::TrimParentheses(args[2]));
 			const std::set<std::string> valid_system_flags = {"\\Seen",		"\\Deleted", "\\Draft",
 															  "\\Answered", "\\Flagged", "\\Recent"};
 
+			std::vector<std::string> keywords;
 			for (const auto& f : raw_flags)
 			{
-				if (valid_system_flags.find(f) == valid_system_flags.end())
+				if (f[0] != '\\')
+					keywords.push_back(f);
+				else if (valid_system_flags.find(f) == valid_system_flags.end())
 				{
 					return ImapResponse::Bad(cmd.m_tag, "Unknown flag: " + f);
 				}
 			}
 
-			char operation = cmd.m_args[1][0]; // '+', '-' or 'F'
-			bool is_silence = cmd.m_args[1].find(".SILENT") != std::string::npos;
-
-			auto all_messages = m_messRepo.findByFolder(m_currentMailbox.m_id.value());
-			auto seq_ids = IMAP_UTILS::ParseSequenceSet(cmd.m_args[0], all_messages.size());
-
-			std::string fetch_responses = "";
+			char operation = args[1][0]; // '+', '-' or 'F'
+			bool is_silence = args[1].find(".SILENT") != std::string::npos;
 
-			for (int seq_num : seq_ids)
+			uint32_t mask = 0;
+			for (const auto& f : raw_flags)
 			{
-				if (seq_num < 1 || seq_num > all_messages.size())
-				{
-					continue;
-				}
+				mask |= MessageFlags::fromName(f);
+			}
 
-				auto& msg = all_messages[seq_num - 1];
+			// the whole set is one UPDATE and one commit
+			int64_t folder_id = m_currentMailbox.m_id.value();
+			auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
+			auto uid_ranges = IMAP_UTILS::SequenceToUidRanges(args[0], folder_uids);
+
+			std::vector<MessageFlagsRow> updated;
+			std::vector<int64_t> modified_uids;
+			if (!m_messRepo.updateFlagsBulk(folder_id, uid_ranges,
+											operation == '+'   ? FlagOperation::Add
+											: operation == '-' ? FlagOperation::Remove
+															   : FlagOperation::Replace,
+											mask, keywords, updated, modified_uids, unchanged_since))
+			{
+				throw std::runtime_error(m_messRepo.getLastError());
+			}
 
-				// repository format
-				std::vector<std::string> flags_to_send = raw_flags;
-				if (operation == '+' || operation == '-')
+			std::string fetch_responses = "";
+			if (!is_silence)
+			{
+				for (const auto& msg : updated)
 				{
-					for (auto& f : flags_to_send)
-						f = operation + f;
+					fetch_responses +=
+						ImapResponse::Fetch(IMAP_UTILS::UidToSequenceNumber(folder_uids, msg.uid),
+											IMAP_UTILS::FormatFlagsResponse(msg, m_condstoreEnabled));
 				}
+			}
 
-				if (m_messRepo.setFlags(msg.id.value(), flags_to_send))
-				{
-					if (!is_silence)
-					{
-						auto updated = m_messRepo.findByID(msg.id.value());
-						if (updated)
-						{
-							fetch_responses += ImapResponse::Fetch(seq_num, IMAP_UTILS::FormatFlagsResponse(*updated));
-						}
-					}
-				}
+			std::vector<int64_t> modified;
+			for (int64_t uid : modified_uids)
+			{
+				modified.push_back(IMAP_UTILS::UidToSequenceNumber(folder_uids, uid));
 			}
 
-			response = fetch_responses + ImapResponse::Ok(cmd.m_tag, "Store completed");
+			if (modified.empty())
+			{
+				response = fetch_responses + ImapResponse::Ok(cmd.m_tag, "Store completed");
+			}
+			else
+			{
+				response = fetch_responses + ImapResponse::Ok(cmd.m_tag, "[MODIFIED " +
+																		  IMAP_UTILS::FormatSequenceSet(modified) +
+																		  "] Conditional STORE failed");
+			}
 		}
 		catch (const std::exception& ex)
 		{
@@ -912,57 +1122,7 @@ std::string ImapCommandDispatcher::HandleCopy(const ImapCommand& cmd)
 							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
 	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleCopy - Start");
 
-	std::string response = "";
-	if (m_state != SessionState::Selected)
-	{
-		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
-	}
-	else if (cmd.m_args.size() != 2)
-	{
-		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
-	}
-	else
-	{
-		auto folder_dest_opt = m_messRepo.findFolderByName(m_authenticatedUserID.value(), cmd.m_args[1]);
-		if (!folder_dest_opt.has_value())
-		{
-			response = ImapResponse::Bad(cmd.m_tag, "No such folder");
-		}
-		else
-		{
-			try
-			{
-				auto messages = m_messRepo.findByFolder(m_currentMailbox.m_id.value());
-				auto lists_ids = IMAP_UTILS::ParseSequenceSet(cmd.m_args[0], messages.size());
-
-				std::vector<Message> selected_messages;
-				selected_messages.reserve(lists_ids.size());
-
-				for (int seq_num : lists_ids)
-				{
-					if (seq_num > 0 && seq_num <= static_cast<int>(messages.size()))
-					{
-						// seq_num is coming from IMAP so it is 1-based, while vector is 0-based,
-						// so we need to subtract 1
-						selected_messages.push_back(messages[seq_num - 1]);
-					}
-				}
-
-				for (const auto& msg : selected_messages)
-				{
-					m_messRepo.copy(msg.id.value(), folder_dest_opt->id.value());
-				}
-
-				response = ImapResponse::Ok(cmd.m_tag, "Copy completed");
-			}
-			catch (const std::exception& ex)
-			{
-				response = ImapResponse::Bad(cmd.m_tag, "Invalid message sequence");
-				m_logger.Log(PROD, "ImapCommandDispatcher::handleCopy - Invalid COPY usage, exception: " +
-									   std::string(ex.what()));
-			}
-		}
-	}
+	std::string response = TransferMessages(cmd, false, false, "Copy completed");
 
 	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleCopy - Out: " + response);
 	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleCopy - End");
@@ -986,35 +1146,20 @@ std::string ImapCommandDispatcher::HandleExpunge(const ImapCommand& cmd)
 	}
 	else
 	{
-		auto messages = m_messRepo.findByFolder(m_currentMailbox.m_id.value());
-
-		std::vector<std::pair<Message, int>> messages_indexes;
-		int index = 1;
-		std::transform(messages.begin(), messages.end(), std::back_inserter(messages_indexes),
-					   [&index](const Message& msg) { return std::make_pair(msg, index++); });
-
-		std::vector<std::pair<Message, int>> expunged_seq_nums;
-		std::copy_if(messages_indexes.begin(), messages_indexes.end(), std::back_inserter(expunged_seq_nums),
-					 [](const std::pair<Message, int>& msg_pair) { return msg_pair.first.is_deleted; });
-
-		// sorting by sequence numbers to send expunged responses in correct order
-		std::sort(expunged_seq_nums.begin(), expunged_seq_nums.end(),
-				  [](const std::pair<Message, int>& a, const std::pair<Message, int>& b)
-				  { return a.second > b.second; });
+		int64_t folder_id = m_currentMailbox.m_id.value();
+		auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
 
-		for (const auto& [mess, index] : expunged_seq_nums)
+		std::vector<int64_t> expunged_uids;
+		if (m_messRepo.expunge(folder_id, expunged_uids))
 		{
-			if (m_messRepo.hardDelete(mess.id.value()))
-			{
-				response += ImapResponse::Untagged(std::to_string(index) + " EXPUNGE");
-			}
-			else
-			{
-				m_logger.Log(PROD, "HandleExpunge failed to delete message: " + m_messRepo.getLastError());
-			}
+			response += ExpungeResponses(folder_uids, expunged_uids);
+			response += ImapResponse::Ok(cmd.m_tag, "Expunge completed");
+		}
+		else
+		{
+			m_logger.Log(PROD, "HandleExpunge failed: " + m_messRepo.getLastError());
+			response = ImapResponse::No(cmd.m_tag, "Expunge failed");
 		}
-
-		response += ImapResponse::Ok(cmd.m_tag, "Expunge completed");
 	}
 
 	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleExpunge - Out: " + response);
@@ -1041,9 +1186,26 @@ std::string ImapCommandDispatcher::HandleUidFetch(const ImapCommand& cmd)
 	{
 		try
 		{
-			auto uids = IMAP_UTILS::ParseSequenceSet(cmd.m_args[0], INT64_MAX);
-			auto all_messages = m_messRepo.findByFolder(m_currentMailbox.m_id.value());
-			auto data_items_str = IMAP_UTILS::TrimParentheses(cmd.m_args[1]);
+			std::vector<std::string> args = cmd.m_args;
+			std::optional<int64_t> changed_since;
+			bool vanished = false;
+			int64_t modseq = 0;
+			if (args.size() > 2 && IMAP_UTILS::ParseChangedSince(args.back(), modseq, vanished))
+			{
+				changed_since = modseq;
+				args.pop_back();
+			}
+			if (vanished && !m_qresyncEnabled)
+			{
+				throw std::invalid_argument("VANISHED requires ENABLE QRESYNC");
+			}
+
+			// "*" is the highest UID in use, not INT64_MAX, otherwise "1:*" never finishes expanding
+			auto folder_opt = m_messRepo.findFolderByID(m_currentMailbox.m_id.value());
+			int64_t max_uid = folder_opt.has_value() ? folder_opt->next_uid - 1 : 0;
+			auto uids = IMAP_UTILS::ParseSequenceSet(args[0], max_uid);
+			auto folder_uids = m_messRepo.findUIDsByFolder(m_currentMailbox.m_id.value());
+			auto data_items_str = IMAP_UTILS::TrimParentheses(args[1]);
 			auto data_items = IMAP_UTILS::SplitArgs(data_items_str);
 
 			// Combine split BODY[HEADER.FIELDS ...] sections
@@ -1080,22 +1242,71 @@ std::string ImapCommandDispatcher::HandleUidFetch(const ImapCommand& cmd)
 				}
 			}
 
-			for (int64_t uid : uids)
+			// CONDSTORE: once the client is mod-sequence aware every FETCH carries MODSEQ
+			bool has_flags = std::find(expanded_items.begin(), expanded_items.end(), "FLAGS") != expanded_items.end();
+			bool has_modseq = std::find(expanded_items.begin(), expanded_items.end(), "MODSEQ") != expanded_items.end();
+			if (changed_since.has_value() || has_modseq || (m_condstoreEnabled && has_flags))
 			{
-				auto msg_opt = m_messRepo.findByUID(m_currentMailbox.m_id.value(), uid);
-				if (!msg_opt.has_value()) continue;
+				m_condstoreEnabled = true;
+				if (!has_modseq) expanded_items.push_back("MODSEQ");
+			}
 
-				const auto& msg = msg_opt.value();
+			std::vector<int64_t> target_uids;
+			if (changed_since.has_value())
+			{
+				// resync cost follows the number of changes, not the size of the requested range
+				for (const auto& changed : m_messRepo.findChangedSince(m_currentMailbox.m_id.value(), changed_since.value()))
+				{
+					if (std::binary_search(uids.begin(), uids.end(), changed.uid)) target_uids.push_back(changed.uid);
+				}
 
-				size_t seq_num = 0;
-				for (size_t i = 0; i < all_messages.size(); ++i)
+				if (vanished)
 				{
-					if (all_messages[i].uid == uid)
+					std::vector<int64_t> expunged;
+					auto history = m_messRepo.findExpungedSince(m_currentMailbox.m_id.value(), changed_since.value());
+					if (history.has_value())
+					{
+						for (int64_t uid : *history)
+							if (std::binary_search(uids.begin(), uids.end(), uid)) expunged.push_back(uid);
+					}
+					else
+					{
+						// the tombstones were pruned: every requested UID that no longer exists is reported
+						std::set_difference(uids.begin(), uids.end(), folder_uids.begin(), folder_uids.end(),
+											std::back_inserter(expunged));
+					}
+					if (!expunged.empty())
 					{
-						seq_num = i + 1; // sequence numbers are 1-based
-						break;
+						response += ImapResponse::Untagged("VANISHED (EARLIER) " + IMAP_UTILS::FormatSequenceSet(expunged));
 					}
 				}
+			}
+			else
+			{
+				target_uids = std::move(uids);
+			}
+
+			std::vector<Message> targets;
+			if (IMAP_UTILS::IsSummaryFetch(expanded_items))
+			{
+				for (const auto& row : LoadHeaderRowsByUID(target_uids))
+				{
+					std::string fetch_response = "(UID " + std::to_string(row.uid) + " " +
+												 IMAP_UTILS::FormatSummaryItems(row, expanded_items);
+					if (fetch_response.back() == ' ') fetch_response.pop_back();
+					response += ImapResponse::Fetch(IMAP_UTILS::UidToSequenceNumber(folder_uids, row.uid),
+													fetch_response + ")");
+				}
+			}
+			else
+			{
+				targets = LoadMessagesByUID(target_uids);
+			}
+
+			for (const auto& msg : targets)
+			{
+				auto pos = std::lower_bound(folder_uids.begin(), folder_uids.end(), msg.uid);
+				size_t seq_num = pos != folder_uids.end() && *pos == msg.uid ? pos - folder_uids.begin() + 1 : 0;
 
 				std::optional<SmtpClient::Email> email_opt;
 				std::optional<SmtpClient::MimePart> mime_part_opt;
@@ -1124,6 +1335,7 @@ std::string ImapCommandDispatcher::HandleUidFetch(const ImapCommand& cmd)
 						if (msg.is_answered) fetch_response += "\\Answered ";
 						if (msg.is_flagged) fetch_response += "\\Flagged ";
 						if (msg.is_recent) fetch_response += "\\Recent ";
+						fetch_response += msg.keywords;
 						if (fetch_response.back() == ' ') fetch_response.pop_back();
 						fetch_response += ") ";
 					}
@@ -1218,7 +1430,7 @@ std::string ImapCommandDispatcher::HandleUidFetch(const ImapCommand& cmd)
 
 						std::string headers, body;
 						SmtpClient::MimeParser::SplitHeadersAndBody(raw_mime, headers, body);
-						std::string headers_list = IMAP_UTILS::TrimParentheses(cmd.m_args[2]);
+						std::string headers_list = IMAP_UTILS::TrimParentheses(args[2]);
 
 						std::vector<std::string> requested_headers;
 						std::istringstream iss(headers_list);
@@ -1263,12 +1475,33 @@ std::string ImapCommandDispatcher::HandleUidFetch(const ImapCommand& cmd)
 							throw std::invalid_argument("Invalid BODY section: " + item);
 						}
 						std::string section = item.substr(bracket_start, bracket_end - bracket_start);
-
-						std::string body_content = IMAP_UTILS::GetBodySection(msg, section);
 						std::string item_name = is_peek ? "BODY.PEEK[" + section + "]" : "BODY[" + section + "]";
+
+						std::string body_content;
+						std::string partial = item.substr(bracket_end + 1);
+						int64_t offset = 0, length = 0;
+						if (partial.empty())
+						{
+							body_content = IMAP_UTILS::GetBodySection(msg, section);
+						}
+						else if (IMAP_UTILS::ParsePartialRange(partial, offset, length))
+						{
+							// only the origin octet is echoed back (RFC 3501, section 7.4.2)
+							body_content = IMAP_UTILS::GetBodySectionRange(msg, section, offset, length, m_messRepo);
+							item_name += "<" + std::to_string(offset) + ">";
+						}
+						else
+						{
+							throw std::invalid_argument("Invalid BODY partial range: " + item);
+						}
+
 						fetch_response +=
 							item_name + " {" + std::to_string(body_content.size()) + "}\r\n" + body_content + " ";
 					}
+					else if (item == "MODSEQ")
+					{
+						fetch_response += "MODSEQ (" + std::to_string(msg.modseq) + ") ";
+					}
 					else if (item == "UID")
 					{
 						fetch_response += "UID " + std::to_string(msg.uid) + " ";
@@ -1322,7 +1555,7 @@ std::string ImapCommandDispatcher::HandleUidStore(const ImapCommand& cmd)
 	{
 		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
 	}
-	else if (cmd.m_args.size() != 3)
+	else if (cmd.m_args.size() != 3 && cmd.m_args.size() != 4)
 	{
 		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
 	}
@@ -1330,15 +1563,32 @@ std::string ImapCommandDispatcher::HandleUidStore(const ImapCommand& cmd)
 	{
 		try
 		{
-			// db doesn`t support custom flags
-			auto raw_flags = IMAP_UTILS::SplitArgs(IMAP_UTILS::TrimParentheses(cmd.m_args[2]));
+			std::vector<std::string> args = cmd.m_args;
+			std::optional<int64_t> unchanged_since;
+			int64_t modseq = 0;
+			if (args.size() == 4)
+			{
+				if (!IMAP_UTILS::ParseUnchangedSince(args[1], modseq))
+				{
+					throw std::invalid_argument("Invalid store modifier: " + args[1]);
+				}
+				unchanged_since = modseq;
+				m_condstoreEnabled = true;
+				args.erase(args.begin() + 1);
+			}
+
+			// names without a backslash are keywords; an unknown system flag is an error
+			auto raw_flags = IMAP_UTILS::SplitArgs(IMAP_UTILS::TrimParentheses(args[2]));
 			const std::set<std::string> valid_system_flags = {"\\Seen",		"\\Deleted", "\\Draft",
 															  "\\Answered", "\\Flagged", "\\Recent"};
 
 			bool all_flags_valid = true;
+			std::vector<std::string> keywords;
 			for (const auto& f : raw_flags)
 			{
-				if (valid_system_flags.find(f) == valid_system_flags.end())
+				if (f[0] != '\\')
+					keywords.push_back(f);
+				else if (valid_system_flags.find(f) == valid_system_flags.end())
 				{
 					response = ImapResponse::Bad(cmd.m_tag, "Unknown flag: " + f);
 					all_flags_valid = false;
@@ -1348,42 +1598,54 @@ std::string ImapCommandDispatcher::HandleUidStore(const ImapCommand& cmd)
 
 			if (all_flags_valid)
 			{
-				char operation = cmd.m_args[1][0]; // '+', '-' or 'F'
-				bool is_silence = cmd.m_args[1].find(".SILENT") != std::string::npos;
-
-				auto uids = IMAP_UTILS::ParseSequenceSet(cmd.m_args[0], INT64_MAX);
-				std::string fetch_responses = "";
+				char operation = args[1][0]; // '+', '-' or 'F'
+				bool is_silence = args[1].find(".SILENT") != std::string::npos;
 
-				for (size_t i = 0; i < uids.size(); ++i)
+				uint32_t mask = 0;
+				for (const auto& f : raw_flags)
 				{
-					int64_t uid = uids[i];
-					auto msg_opt = m_messRepo.findByUID(m_currentMailbox.m_id.value(), uid);
-					if (!msg_opt.has_value()) continue;
+					mask |= MessageFlags::fromName(f);
+				}
 
-					// repository format
-					std::vector<std::string> flags_to_send = raw_flags;
-					if (operation == '+' || operation == '-')
-					{
-						for (auto& f : flags_to_send)
-							f = operation + f;
-					}
+				// the whole set is one UPDATE and one commit
+				int64_t folder_id = m_currentMailbox.m_id.value();
+				auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
+				int64_t max_uid = folder_uids.empty() ? 0 : folder_uids.back();
+				auto uid_ranges = IMAP_UTILS::ParseSequenceRanges(args[0], max_uid);
+
+				std::vector<MessageFlagsRow> updated;
+				std::vector<int64_t> modified;
+				if (!m_messRepo.updateFlagsBulk(folder_id, uid_ranges,
+												operation == '+'   ? FlagOperation::Add
+												: operation == '-' ? FlagOperation::Remove
+																   : FlagOperation::Replace,
+												mask, keywords, updated, modified, unchanged_since))
+				{
+					throw std::runtime_error(m_messRepo.getLastError());
+				}
 
-					if (m_messRepo.setFlags(msg_opt->id.value(), flags_to_send))
+				std::string fetch_responses = "";
+				if (!is_silence)
+				{
+					for (const auto& msg : updated)
 					{
-						if (!is_silence)
-						{
-							auto updated = m_messRepo.findByID(msg_opt->id.value());
-							if (updated)
-							{
-								// UID STORE response must include UID token
-								std::string flags_body = "(UID " + std::to_string(updated->uid) + " " +
-														 IMAP_UTILS::FormatFlagsResponse(*updated) + ")";
-								fetch_responses += ImapResponse::Fetch(i + 1, flags_body);
-							}
-						}
+						// UID STORE response must include UID token
+						std::string flags_body = "(UID " + std::to_string(msg.uid) + " " +
+												 IMAP_UTILS::FormatFlagsResponse(msg, m_condstoreEnabled) + ")";
+						fetch_responses +=
+							ImapResponse::Fetch(IMAP_UTILS::UidToSequenceNumber(folder_uids, msg.uid), flags_body);
 					}
 				}
-				response = fetch_responses + ImapResponse::Ok(cmd.m_tag, "Uid Store completed");
+				if (modified.empty())
+				{
+					response = fetch_responses + ImapResponse::Ok(cmd.m_tag, "Uid Store completed");
+				}
+				else
+				{
+					response = fetch_responses + ImapResponse::Ok(cmd.m_tag, "[MODIFIED " +
+																			  IMAP_UTILS::FormatSequenceSet(modified) +
+																			  "] Conditional STORE failed");
+				}
 			}
 		}
 		catch (const std::exception& ex)
@@ -1405,46 +1667,7 @@ std::string ImapCommandDispatcher::HandleUidCopy(const ImapCommand& cmd)
 							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
 	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidCopy - Start");
 
-	std::string response = "";
-	if (m_state != SessionState::Selected)
-	{
-		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
-	}
-	else if (cmd.m_args.size() != 2)
-	{
-		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
-	}
-	else
-	{
-		auto folder_dest_opt = m_messRepo.findFolderByName(m_authenticatedUserID.value(), cmd.m_args[1]);
-		if (!folder_dest_opt.has_value())
-		{
-			response = ImapResponse::Bad(cmd.m_tag, "No such folder");
-		}
-		else
-		{
-			try
-			{
-				auto uids = IMAP_UTILS::ParseSequenceSet(cmd.m_args[0], INT64_MAX);
-
-				for (int64_t uid : uids)
-				{
-					auto msg_opt = m_messRepo.findByUID(m_currentMailbox.m_id.value(), uid);
-					if (!msg_opt.has_value()) continue;
-
-					m_messRepo.copy(msg_opt->id.value(), folder_dest_opt->id.value());
-				}
-
-				response = ImapResponse::Ok(cmd.m_tag, "Uid Copy completed");
-			}
-			catch (const std::exception& ex)
-			{
-				response = ImapResponse::Bad(cmd.m_tag, "Invalid message sequence");
-				m_logger.Log(PROD, "ImapCommandDispatcher::HandleUidCopy - Invalid UID COPY usage, exception: " +
-									   std::string(ex.what()));
-			}
-		}
-	}
+	std::string response = TransferMessages(cmd, true, false, "Uid Copy completed");
 
 	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleUidCopy - Out: " + response);
 	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidCopy - End");
@@ -1593,4 +1816,677 @@ std::string ImapCommandDispatcher::HandleStartTLS(const ImapCommand& cmd)
 	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleStartTLS - Out: " + response);
 	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleStartTLS - End");
 	return response;
-}
\ No newline at end of file
+}
+
+std::string ImapCommandDispatcher::HandleEnable(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleEnable - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleEnable - Start");
+
+	std::string response;
+	if (cmd.m_args.empty())
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
+	}
+	else
+	{
+		std::string enabled;
+		for (const auto& arg : cmd.m_args)
+		{
+			std::string capability = IMAP_UTILS::ToUpper(arg);
+			if (capability == "CONDSTORE")
+			{
+				m_condstoreEnabled = true;
+			}
+			else if (capability == "QRESYNC")
+			{
+				// QRESYNC implies CONDSTORE (RFC 7162, section 3.2.3)
+				m_condstoreEnabled = true;
+				m_qresyncEnabled = true;
+			}
+			else
+			{
+				continue; // unknown extensions are silently ignored
+			}
+			enabled += " " + capability;
+		}
+
+		response = ImapResponse::Untagged("ENABLED" + enabled) + ImapResponse::Ok(cmd.m_tag, "Enable completed");
+	}
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleEnable - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleEnable - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleSearch(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleSearch - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleSearch - Start");
+
+	std::string response;
+	if (m_state != SessionState::Selected)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
+	}
+	else if (cmd.m_args.empty())
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
+	}
+	else
+	{
+		try
+		{
+			int64_t folder_id = m_currentMailbox.m_id.value();
+			auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
+			auto criteria = IMAP_UTILS::ParseSearchCriteria(cmd.m_args, folder_uids);
+
+			std::string result = "SEARCH";
+			for (int64_t uid : m_messRepo.searchUIDs(folder_id, criteria))
+			{
+				auto it = std::lower_bound(folder_uids.begin(), folder_uids.end(), uid);
+				if (it == folder_uids.end() || *it != uid) continue;
+				result += " " + std::to_string(std::distance(folder_uids.begin(), it) + 1);
+			}
+
+			response = ImapResponse::Untagged(result) + ImapResponse::Ok(cmd.m_tag, "Search completed");
+		}
+		catch (const std::exception& ex)
+		{
+			response = ImapResponse::Bad(cmd.m_tag, "Invalid search criteria");
+			m_logger.Log(PROD, "ImapCommandDispatcher::HandleSearch - Invalid SEARCH usage, exception: " +
+								   std::string(ex.what()));
+		}
+	}
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleSearch - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleSearch - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleUidSearch(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleUidSearch - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidSearch - Start");
+
+	std::string response;
+	if (m_state != SessionState::Selected)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
+	}
+	else if (cmd.m_args.empty())
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
+	}
+	else
+	{
+		try
+		{
+			int64_t folder_id = m_currentMailbox.m_id.value();
+			auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
+			auto criteria = IMAP_UTILS::ParseSearchCriteria(cmd.m_args, folder_uids);
+
+			std::string result = "SEARCH";
+			for (int64_t uid : m_messRepo.searchUIDs(folder_id, criteria))
+			{
+				result += " " + std::to_string(uid);
+			}
+
+			response = ImapResponse::Untagged(result) + ImapResponse::Ok(cmd.m_tag, "Uid Search completed");
+		}
+		catch (const std::exception& ex)
+		{
+			response = ImapResponse::Bad(cmd.m_tag, "Invalid search criteria");
+			m_logger.Log(PROD, "ImapCommandDispatcher::HandleUidSearch - Invalid UID SEARCH usage, exception: " +
+								   std::string(ex.what()));
+		}
+	}
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleUidSearch - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidSearch - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleSort(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleSort - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleSort - Start");
+
+	std::string response;
+	if (m_state != SessionState::Selected)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
+	}
+	else if (cmd.m_args.size() < 3)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
+	}
+	else
+	{
+		try
+		{
+			int64_t folder_id = m_currentMailbox.m_id.value();
+			auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
+
+			// the charset is mandatory here, reuse the SEARCH handling of it
+			std::vector<std::string> search_args = {"CHARSET", cmd.m_args[1]};
+			search_args.insert(search_args.end(), cmd.m_args.begin() + 2, cmd.m_args.end());
+			auto criteria = IMAP_UTILS::ParseSearchCriteria(search_args, folder_uids);
+			auto keys = IMAP_UTILS::ParseSortCriteria(cmd.m_args[0]);
+
+			std::string result = "SORT";
+			for (int64_t uid : m_messRepo.sortUIDs(folder_id, criteria, keys))
+			{
+				auto it = std::lower_bound(folder_uids.begin(), folder_uids.end(), uid);
+				if (it == folder_uids.end() || *it != uid) continue;
+				result += " " + std::to_string(std::distance(folder_uids.begin(), it) + 1);
+			}
+
+			response = ImapResponse::Untagged(result) + ImapResponse::Ok(cmd.m_tag, "Sort completed");
+		}
+		catch (const std::exception& ex)
+		{
+			response = ImapResponse::Bad(cmd.m_tag, "Invalid sort criteria");
+			m_logger.Log(PROD, "ImapCommandDispatcher::HandleSort - Invalid SORT usage, exception: " +
+								   std::string(ex.what()));
+		}
+	}
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleSort - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleSort - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleUidSort(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleUidSort - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidSort - Start");
+
+	std::string response;
+	if (m_state != SessionState::Selected)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
+	}
+	else if (cmd.m_args.size() < 3)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
+	}
+	else
+	{
+		try
+		{
+			int64_t folder_id = m_currentMailbox.m_id.value();
+			auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
+
+			// the charset is mandatory here, reuse the SEARCH handling of it
+			std::vector<std::string> search_args = {"CHARSET", cmd.m_args[1]};
+			search_args.insert(search_args.end(), cmd.m_args.begin() + 2, cmd.m_args.end());
+			auto criteria = IMAP_UTILS::ParseSearchCriteria(search_args, folder_uids);
+			auto keys = IMAP_UTILS::ParseSortCriteria(cmd.m_args[0]);
+
+			std::string result = "SORT";
+			for (int64_t uid : m_messRepo.sortUIDs(folder_id, criteria, keys))
+			{
+				result += " " + std::to_string(uid);
+			}
+
+			response = ImapResponse::Untagged(result) + ImapResponse::Ok(cmd.m_tag, "Uid Sort completed");
+		}
+		catch (const std::exception& ex)
+		{
+			response = ImapResponse::Bad(cmd.m_tag, "Invalid sort criteria");
+			m_logger.Log(PROD, "ImapCommandDispatcher::HandleUidSort - Invalid UID SORT usage, exception: " +
+								   std::string(ex.what()));
+		}
+	}
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleUidSort - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidSort - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleThread(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleThread - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleThread - Start");
+
+	std::string response;
+	if (m_state != SessionState::Selected)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
+	}
+	else if (cmd.m_args.size() < 3)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
+	}
+	else
+	{
+		try
+		{
+			int64_t folder_id = m_currentMailbox.m_id.value();
+			auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
+
+			// the charset is mandatory here, reuse the SEARCH handling of it
+			std::vector<std::string> search_args = {"CHARSET", cmd.m_args[1]};
+			search_args.insert(search_args.end(), cmd.m_args.begin() + 2, cmd.m_args.end());
+			auto criteria = IMAP_UTILS::ParseSearchCriteria(search_args, folder_uids);
+			auto messages = m_messRepo.searchMessages(folder_id, criteria);
+
+			// THREAD reports sequence numbers, so renumber before formatting
+			for (auto& msg : messages)
+			{
+				auto it = std::lower_bound(folder_uids.begin(), folder_uids.end(), msg.uid);
+				msg.uid = std::distance(folder_uids.begin(), it) + 1;
+			}
+
+			std::string threads = IMAP_UTILS::FormatThreads(messages, cmd.m_args[0]);
+			std::string result = threads.empty() ? "THREAD" : "THREAD " + threads;
+
+			response = ImapResponse::Untagged(result) + ImapResponse::Ok(cmd.m_tag, "Thread completed");
+		}
+		catch (const std::exception& ex)
+		{
+			response = ImapResponse::Bad(cmd.m_tag, "Invalid thread criteria");
+			m_logger.Log(PROD, "ImapCommandDispatcher::HandleThread - Invalid THREAD usage, exception: " +
+								   std::string(ex.what()));
+		}
+	}
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleThread - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleThread - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleUidThread(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleUidThread - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidThread - Start");
+
+	std::string response;
+	if (m_state != SessionState::Selected)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
+	}
+	else if (cmd.m_args.size() < 3)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
+	}
+	else
+	{
+		try
+		{
+			int64_t folder_id = m_currentMailbox.m_id.value();
+			auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
+
+			// the charset is mandatory here, reuse the SEARCH handling of it
+			std::vector<std::string> search_args = {"CHARSET", cmd.m_args[1]};
+			search_args.insert(search_args.end(), cmd.m_args.begin() + 2, cmd.m_args.end());
+			auto criteria = IMAP_UTILS::ParseSearchCriteria(search_args, folder_uids);
+			auto messages = m_messRepo.searchMessages(folder_id, criteria);
+
+			std::string threads = IMAP_UTILS::FormatThreads(messages, cmd.m_args[0]);
+			std::string result = threads.empty() ? "THREAD" : "THREAD " + threads;
+
+			response = ImapResponse::Untagged(result) + ImapResponse::Ok(cmd.m_tag, "Uid Thread completed");
+		}
+		catch (const std::exception& ex)
+		{
+			response = ImapResponse::Bad(cmd.m_tag, "Invalid thread criteria");
+			m_logger.Log(PROD, "ImapCommandDispatcher::HandleUidThread - Invalid UID THREAD usage, exception: " +
+								   std::string(ex.what()));
+		}
+	}
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleUidThread - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidThread - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleCompress(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleCompress - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleCompress - Start");
+
+	std::string response;
+	if (cmd.m_args.size() != 1)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Missing arguments");
+	}
+	else if (IMAP_UTILS::ToUpper(cmd.m_args[0]) != "DEFLATE")
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Unsupported compression mechanism");
+	}
+	else if (m_compressionActive)
+	{
+		response = ImapResponse::No(cmd.m_tag, "[COMPRESSIONACTIVE] DEFLATE active via COMPRESS");
+	}
+	else
+	{
+		// the session switches the stream once this response is on the wire
+		m_compressionActive = true;
+		response = ImapResponse::Ok(cmd.m_tag, "DEFLATE active");
+	}
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleCompress - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleCompress - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleAppend(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleAppend - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleAppend - Start");
+
+	// MULTIAPPEND (RFC 3502): mailbox 1*(SP [flag-list SP] [date-time SP] literal)
+	struct AppendItem
+	{
+		std::string m_flags;
+		std::string m_date;
+		std::string m_path;
+	};
+
+	std::string response;
+	std::vector<AppendItem> items;
+	std::optional<Folder> folder_opt;
+
+	try
+	{
+		if (cmd.m_args.size() < 2)
+		{
+			throw std::invalid_argument("Missing arguments");
+		}
+
+		AppendItem item;
+		for (size_t i = 1; i < cmd.m_args.size(); ++i)
+		{
+			const std::string& arg = cmd.m_args[i];
+			if (!arg.empty() && arg.front() == '(')
+			{
+				item.m_flags = IMAP_UTILS::TrimParentheses(arg);
+			}
+			else if (!arg.empty() && arg.front() == '{')
+			{
+				if (items.size() >= cmd.m_literals.size())
+				{
+					throw std::invalid_argument("Literal data missing");
+				}
+				item.m_path = cmd.m_literals[items.size()];
+				items.push_back(item);
+				item = AppendItem();
+			}
+			else
+			{
+				item.m_date = IMAP_UTILS::ImapDateTimeToInternal(arg);
+			}
+		}
+
+		if (items.empty() || !item.m_flags.empty() || !item.m_date.empty())
+		{
+			throw std::invalid_argument("Missing message literal");
+		}
+
+		folder_opt = m_messRepo.findFolderByName(m_authenticatedUserID.value(), cmd.m_args[0]);
+	}
+	catch (const std::exception& ex)
+	{
+		response = ImapResponse::Bad(cmd.m_tag, "Invalid APPEND arguments");
+		m_logger.Log(PROD, "ImapCommandDispatcher::HandleAppend - Invalid APPEND usage, exception: " +
+							   std::string(ex.what()));
+	}
+
+	if (response.empty() && !folder_opt.has_value())
+	{
+		response = ImapResponse::No(cmd.m_tag, "[TRYCREATE] No such folder");
+	}
+
+	if (response.empty())
+	{
+		const std::string mail_dir = "mailstore/" + m_authenticatedUserName;
+		std::vector<Message> appended;
+		std::error_code ec;
+		std::filesystem::create_directories(mail_dir, ec);
+
+		for (const auto& item : items)
+		{
+			std::string file_path = mail_dir + "/" + IMAP_UTILS::GenerateMailFilename();
+			std::filesystem::rename(item.m_path, file_path, ec);
+			if (ec)
+			{
+				// spool and mailstore may sit on different filesystems
+				ec.clear();
+				std::filesystem::copy_file(item.m_path, file_path, ec);
+				if (ec) break;
+				std::filesystem::remove(item.m_path, ec);
+				ec.clear();
+			}
+
+			auto headers = IMAP_UTILS::ReadHeaderFields(file_path);
+			auto header = [&headers](const char* name) -> std::optional<std::string>
+			{
+				auto it = headers.find(name);
+				if (it == headers.end() || it->second.empty()) return std::nullopt;
+				return it->second;
+			};
+
+			Message msg;
+			msg.user_id = m_authenticatedUserID.value();
+			msg.raw_file_path = file_path;
+			msg.size_bytes = static_cast<int64_t>(std::filesystem::file_size(file_path, ec));
+			msg.from_address = header("FROM").value_or("");
+			msg.subject = header("SUBJECT");
+			msg.message_id_header = header("MESSAGE-ID");
+			msg.in_reply_to = header("IN-REPLY-TO");
+			msg.references_header = header("REFERENCES");
+			msg.date_header = header("DATE");
+
+			std::string flags = IMAP_UTILS::ToUpper(item.m_flags);
+			msg.is_seen = flags.find("\\SEEN") != std::string::npos;
+			msg.is_answered = flags.find("\\ANSWERED") != std::string::npos;
+			msg.is_flagged = flags.find("\\FLAGGED") != std::string::npos;
+			msg.is_deleted = flags.find("\\DELETED") != std::string::npos;
+			msg.is_draft = flags.find("\\DRAFT") != std::string::npos;
+			msg.is_recent = true;
+
+			if (item.m_date.empty())
+			{
+				char buf[32];
+				std::time_t now = std::time(nullptr);
+				std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::gmtime(&now));
+				msg.internal_date = buf;
+			}
+			else
+			{
+				msg.internal_date = item.m_date;
+			}
+
+			if (!m_messRepo.append(msg, folder_opt->id.value()))
+			{
+				std::filesystem::remove(file_path, ec);
+				ec = std::make_error_code(std::errc::io_error);
+				break;
+			}
+			appended.push_back(msg);
+
+			if (!m_messRepo.indexContent(msg.id.value(), header("TO").value_or(""), header("CC").value_or(""), ""))
+			{
+				m_logger.Log(PROD, "ImapCommandDispatcher::HandleAppend - Failed to index message: " +
+									   m_messRepo.getLastError());
+			}
+		}
+
+		if (appended.size() != items.size())
+		{
+			// MULTIAPPEND is all-or-nothing
+			for (const auto& msg : appended)
+			{
+				m_messRepo.hardDelete(msg.id.value());
+				std::filesystem::remove(msg.raw_file_path, ec);
+			}
+			response = ImapResponse::No(cmd.m_tag, "Append failed");
+			m_logger.Log(PROD, "ImapCommandDispatcher::HandleAppend - Append failed: " + m_messRepo.getLastError());
+		}
+		else
+		{
+			std::vector<int64_t> uids;
+			for (const auto& msg : appended)
+			{
+				uids.push_back(msg.uid);
+			}
+
+			response = ImapResponse::Ok(cmd.m_tag, "[APPENDUID " + std::to_string(IMAP_UTILS::UidValidity(*folder_opt)) + " " +
+													   IMAP_UTILS::FormatSequenceSet(uids) + "] Append completed");
+		}
+	}
+
+	for (const auto& path : cmd.m_literals)
+	{
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+	}
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleAppend - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleAppend - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleMove(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleMove - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleMove - Start");
+
+	std::string response = TransferMessages(cmd, false, true, "Move completed");
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleMove - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleMove - End");
+	return response;
+}
+
+std::string ImapCommandDispatcher::HandleUidMove(const ImapCommand& cmd)
+{
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleUidMove - In: tag=" + cmd.m_tag + ", args=[" +
+							IMAP_UTILS::JoinArgs(cmd.m_args) + "]");
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidMove - Start");
+
+	std::string response = TransferMessages(cmd, true, true, "Uid Move completed");
+
+	m_logger.Log(TRACE, "ImapCommandDispatcher::HandleUidMove - Out: " + response);
+	m_logger.Log(DEBUG, "ImapCommandDispatcher::HandleUidMove - End");
+	return response;
+}
+
+// The whole set is one transaction: the target UID block is reserved up front, copies share
+// the message files, and MOVE (RFC 6851) is a single UPDATE of folder_id/uid.
+std::string ImapCommandDispatcher::TransferMessages(const ImapCommand& cmd, bool by_uid, bool move,
+													const std::string& completed)
+{
+	if (m_state != SessionState::Selected)
+	{
+		return ImapResponse::Bad(cmd.m_tag, "No mailbox selected");
+	}
+	if (cmd.m_args.size() != 2)
+	{
+		return ImapResponse::Bad(cmd.m_tag, "Missing arguments");
+	}
+
+	auto folder_dest_opt = m_messRepo.findFolderByName(m_authenticatedUserID.value(), cmd.m_args[1]);
+	if (!folder_dest_opt.has_value())
+	{
+		return move ? ImapResponse::No(cmd.m_tag, "[TRYCREATE] No such folder")
+					: ImapResponse::Bad(cmd.m_tag, "No such folder");
+	}
+
+	int64_t folder_id = m_currentMailbox.m_id.value();
+	auto folder_uids = m_messRepo.findUIDsByFolder(folder_id);
+	std::vector<std::pair<int64_t, int64_t>> uid_map;
+	try
+	{
+		auto uid_ranges = by_uid ? IMAP_UTILS::ParseSequenceRanges(cmd.m_args[0],
+																	folder_uids.empty() ? 0 : folder_uids.back())
+								 : IMAP_UTILS::SequenceToUidRanges(cmd.m_args[0], folder_uids);
+
+		bool ok = move ? m_messRepo.moveBulk(folder_id, uid_ranges, folder_dest_opt->id.value(), uid_map)
+					   : m_messRepo.copyBulk(folder_id, uid_ranges, folder_dest_opt->id.value(), uid_map);
+		if (!ok)
+		{
+			m_logger.Log(PROD, "ImapCommandDispatcher::TransferMessages - " + m_messRepo.getLastError());
+			return ImapResponse::No(cmd.m_tag, move ? "Move failed" : "Copy failed");
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		m_logger.Log(PROD, "ImapCommandDispatcher::TransferMessages - Invalid " +
+							   IMAP_UTILS::CommandTypeToString(cmd.m_type) + " usage, exception: " +
+							   std::string(ex.what()));
+		return ImapResponse::Bad(cmd.m_tag, "Invalid message sequence");
+	}
+
+	// UIDPLUS (RFC 4315)
+	std::string copy_uid = "";
+	if (!uid_map.empty())
+	{
+		std::vector<int64_t> source_uids, target_uids;
+		for (const auto& [source, target] : uid_map)
+		{
+			source_uids.push_back(source);
+			target_uids.push_back(target);
+		}
+		copy_uid = "[COPYUID " + std::to_string(IMAP_UTILS::UidValidity(*folder_dest_opt)) + " " +
+				   IMAP_UTILS::FormatSequenceSet(source_uids) + " " + IMAP_UTILS::FormatSequenceSet(target_uids) + "] ";
+	}
+
+	if (!move)
+	{
+		return ImapResponse::Ok(cmd.m_tag, copy_uid + completed);
+	}
+
+	std::string response = "";
+	if (!copy_uid.empty())
+	{
+		response += ImapResponse::Untagged("OK " + copy_uid + "Moved");
+	}
+	std::vector<int64_t> moved_uids;
+	moved_uids.reserve(uid_map.size());
+	for (const auto& entry : uid_map)
+	{
+		moved_uids.push_back(entry.first);
+	}
+	response += ExpungeResponses(folder_uids, moved_uids);
+	response += ImapResponse::Ok(cmd.m_tag, completed);
+	return response;
+}
+
+std::string ImapCommandDispatcher::ExpungeResponses(const std::vector<int64_t>& folder_uids,
+													const std::vector<int64_t>& expunged_uids) const
+{
+	if (expunged_uids.empty())
+	{
+		return "";
+	}
+
+	if (m_qresyncEnabled)
+	{
+		std::vector<int64_t> sorted = expunged_uids;
+		std::sort(sorted.begin(), sorted.end());
+		return ImapResponse::Untagged("VANISHED " + IMAP_UTILS::FormatSequenceSet(sorted));
+	}
+
+	// highest first, so every sequence number is still valid when the client applies it
+	std::string response = "";
+	for (auto it = expunged_uids.rbegin(); it != expunged_uids.rend(); ++it)
+	{
+		int64_t seq_num = IMAP_UTILS::UidToSequenceNumber(folder_uids, *it);
+		if (seq_num == 0) continue;
+		response += ImapResponse::Untagged(std::to_string(seq_num) + " EXPUNGE");
+	}
+	return response;
+}
@@ -0,0 +1,73 @@
+#include "ImapDeflateStream.hpp"
+
+#include <algorithm>
+
+ImapDeflateStream::ImapDeflateStream(int level, int window_bits, int mem_level)
+{
+	// raw streams (negative window bits) have no zlib header, as RFC 4978 requires
+	window_bits = std::clamp(window_bits, 9, 15);
+	mem_level = std::clamp(mem_level, 1, MAX_MEM_LEVEL);
+	level = std::clamp(level, Z_NO_COMPRESSION, Z_BEST_COMPRESSION);
+
+	m_deflateReady =
+		deflateInit2(&m_deflate, level, Z_DEFLATED, -window_bits, mem_level, Z_DEFAULT_STRATEGY) == Z_OK;
+
+	// the peer may use any window size, so the decompressor needs the largest one
+	m_inflateReady = inflateInit2(&m_inflate, -MAX_WBITS) == Z_OK;
+}
+
+ImapDeflateStream::~ImapDeflateStream()
+{
+	if (m_deflateReady) deflateEnd(&m_deflate);
+	if (m_inflateReady) inflateEnd(&m_inflate);
+}
+
+bool ImapDeflateStream::IsValid() const
+{
+	return m_deflateReady && m_inflateReady;
+}
+
+bool ImapDeflateStream::Compress(const std::string& data, std::string& out, bool flush)
+{
+	if (!m_deflateReady) return false;
+
+	m_deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+	m_deflate.avail_in = static_cast<uInt>(data.size());
+
+	char chunk[CHUNK_SIZE];
+	do
+	{
+		m_deflate.next_out = reinterpret_cast<Bytef*>(chunk);
+		m_deflate.avail_out = sizeof(chunk);
+
+		if (deflate(&m_deflate, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH) == Z_STREAM_ERROR) return false;
+
+		out.append(chunk, sizeof(chunk) - m_deflate.avail_out);
+	} while (m_deflate.avail_out == 0);
+
+	return true;
+}
+
+bool ImapDeflateStream::Decompress(const char* data, std::size_t size, std::string& out)
+{
+	if (!m_inflateReady) return false;
+
+	m_inflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	m_inflate.avail_in = static_cast<uInt>(size);
+
+	char chunk[CHUNK_SIZE];
+	do
+	{
+		m_inflate.next_out = reinterpret_cast<Bytef*>(chunk);
+		m_inflate.avail_out = sizeof(chunk);
+
+		int rc = inflate(&m_inflate, Z_NO_FLUSH);
+		if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) return false;
+
+		out.append(chunk, sizeof(chunk) - m_inflate.avail_out);
+
+		if (rc == Z_STREAM_END || rc == Z_BUF_ERROR) break;
+	} while (m_inflate.avail_in > 0 || m_inflate.avail_out == 0);
+
+	return true;
+}
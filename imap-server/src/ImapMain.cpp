@@ -45,12 +45,18 @@ int main(int argc, char** argv)
 
 		auto cnfg = SmtpClient::Config::Instance().GetImap();
 		boost::asio::io_context io;
-		DataBaseManager db(path_to_root + "./data/mail.db", initSchema(), logger);
+		auto db = ShardRouter::open(path_to_root + "./data/mail.db", SmtpClient::Config::Instance().GetDatabase().db_shards,
+									initSchema(), logger);
+		if (!db->isConnected())
+		{
+			logger->Log(PROD, "Database connection failed");
+			return 1;
+		}
 		ThreadPool pool;
 		pool.initialize(cnfg.worker_threads);
 		pool.set_logger(logger.get());
 
-		ImapServer imap(io, *logger, db, pool, cnfg);
+		ImapServer imap(io, *logger, *db, pool, cnfg);
 		imap.Start();
 	}
 	catch (const std::exception& e)
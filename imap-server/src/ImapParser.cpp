@@ -6,7 +6,7 @@
 
 #include "ImapUtils.hpp"
 
-std::vector<std::string> ImapParser::ParseArguments(const std::string& args)
+std::vector<std::string> ImapParser::ParseArguments(std::string_view args)
 {
 	ElementParser parser(args);
 	return parser.ParseArgs();
@@ -26,7 +26,7 @@ std::vector<std::string> ImapParser::ElementParser::ParseArgs()
 
 		if (m_pos > elemStart)
 		{
-			args.push_back(elem);
+			args.push_back(std::move(elem));
 		}
 
 		SkipWhitespace();
@@ -59,6 +59,17 @@ std::string ImapParser::ElementParser::ParseQuoted()
 	if (m_pos >= m_str.size() || m_str[m_pos] != '"') return "";
 
 	++m_pos;
+
+	// common case: no escapes, the content is a plain slice of the line
+	size_t end = m_str.find_first_of("\\\"", m_pos);
+	if (end == std::string_view::npos || m_str[end] == '"')
+	{
+		size_t stop = (end == std::string_view::npos) ? m_str.size() : end;
+		std::string result(m_str.substr(m_pos, stop - m_pos));
+		m_pos = (end == std::string_view::npos) ? stop : stop + 1;
+		return result;
+	}
+
 	std::string result;
 	while (m_pos < m_str.size())
 	{
@@ -84,10 +95,59 @@ std::string ImapParser::ElementParser::ParseQuoted()
 	return result;
 }
 
+// Finds the end of the list starting at m_pos using the same rules as ParseList. Returns false
+// when ParseList would rewrite the text (escapes or an unterminated quoted string).
+bool ImapParser::ElementParser::ScanVerbatimList(size_t& end) const
+{
+	size_t pos = m_pos + 1;
+	int depth = 1;
+	while (pos < m_str.size() && depth > 0)
+	{
+		char c = m_str[pos++];
+		if (c == '(')
+		{
+			++depth;
+		}
+		else if (c == ')')
+		{
+			--depth;
+		}
+		else if (c == '[')
+		{
+			int bracketDepth = 1;
+			while (pos < m_str.size() && bracketDepth > 0)
+			{
+				char bc = m_str[pos++];
+				if (bc == '[')
+					++bracketDepth;
+				else if (bc == ']')
+					--bracketDepth;
+			}
+		}
+		else if (c == '"')
+		{
+			size_t close = m_str.find_first_of("\\\"", pos);
+			if (close == std::string_view::npos || m_str[close] != '"') return false;
+			pos = close + 1;
+		}
+	}
+
+	end = pos;
+	return true;
+}
+
 std::string ImapParser::ElementParser::ParseList()
 {
 	if (m_pos >= m_str.size() || m_str[m_pos] != '(') return "";
 
+	size_t end = 0;
+	if (ScanVerbatimList(end))
+	{
+		std::string result(m_str.substr(m_pos, end - m_pos));
+		m_pos = end;
+		return result;
+	}
+
 	++m_pos;
 	int depth = 1;
 	std::string result = "(";
@@ -207,7 +267,7 @@ std::string ImapParser::ElementParser::ParseLiteral()
 		++m_pos;
 	}
 
-	return m_str.substr(start, m_pos - start);
+	return std::string(m_str.substr(start, m_pos - start));
 }
 
 std::string ImapParser::ElementParser::ParseAtom()
@@ -220,10 +280,10 @@ std::string ImapParser::ElementParser::ParseAtom()
 		++m_pos;
 	}
 
-	return m_str.substr(start, m_pos - start);
+	return std::string(m_str.substr(start, m_pos - start));
 }
 
-ImapCommand ImapParser::Parse(const std::string& line)
+ImapCommand ImapParser::Parse(std::string_view line)
 {
 	ImapCommand cmd;
 
@@ -233,74 +293,38 @@ ImapCommand ImapParser::Parse(const std::string& line)
 	}
 
 	size_t spacePos = line.find(' ');
-	if (spacePos == std::string::npos)
+	if (spacePos == std::string_view::npos)
 	{
 		cmd.m_tag = "";
 		cmd.m_type = ImapCommandType::Unknown;
 		return cmd;
 	}
 
-	cmd.m_tag = line.substr(0, spacePos);
-	std::string rest = line.substr(spacePos + 1);
+	cmd.m_tag = std::string(line.substr(0, spacePos));
+	std::string_view rest = line.substr(spacePos + 1);
 
 	size_t argStart = rest.find(' ');
-	std::string commandStr;
-	std::string argsStr;
+	std::string_view commandStr = rest.substr(0, argStart);
+	std::string_view argsStr = (argStart == std::string_view::npos) ? std::string_view() : rest.substr(argStart + 1);
 
-	if (argStart == std::string::npos)
-	{
-		commandStr = rest;
-		argsStr = "";
-	}
-	else
+	cmd.m_type = IMAP_UTILS::StringToCommandType(commandStr);
+	if (cmd.m_type != ImapCommandType::UidFetch) // "UID"
 	{
-		commandStr = rest.substr(0, argStart);
-		argsStr = rest.substr(argStart + 1);
+		cmd.m_args = ParseArguments(argsStr);
+		return cmd;
 	}
 
-	std::string upperCommand = IMAP_UTILS::ToUpper(commandStr);
-
-	if (upperCommand == "UID")
+	size_t spaceInUidArgs = argsStr.find(' ');
+	if (spaceInUidArgs == std::string_view::npos)
 	{
-		cmd.m_type = IMAP_UTILS::StringToCommandType("UID");
-		IMAP_UTILS::TrimParentheses(argsStr);
-		std::string uidArgs = argsStr;
-		size_t spaceInUidArgs = uidArgs.find(' ');
-		if (spaceInUidArgs != std::string::npos)
-		{
-			std::string subCommand = uidArgs.substr(0, spaceInUidArgs);
-			std::string restArgs = uidArgs.substr(spaceInUidArgs + 1);
-
-			std::string upperSub = IMAP_UTILS::ToUpper(subCommand);
-			if (upperSub == "FETCH")
-			{
-				cmd.m_type = ImapCommandType::UidFetch;
-				cmd.m_args = ParseArguments(restArgs);
-			}
-			else if (upperSub == "STORE")
-			{
-				cmd.m_type = ImapCommandType::UidStore;
-				cmd.m_args = ParseArguments(restArgs);
-			}
-			else if (upperSub == "COPY")
-			{
-				cmd.m_type = ImapCommandType::UidCopy;
-				cmd.m_args = ParseArguments(restArgs);
-			}
-			else
-			{
-				cmd.m_type = ImapCommandType::Unknown;
-			}
-		}
-		else
-		{
-			cmd.m_type = ImapCommandType::Unknown;
-		}
+		cmd.m_type = ImapCommandType::Unknown;
+		return cmd;
 	}
-	else
+
+	cmd.m_type = IMAP_UTILS::ToUidCommandType(IMAP_UTILS::StringToCommandType(argsStr.substr(0, spaceInUidArgs)));
+	if (cmd.m_type != ImapCommandType::Unknown)
 	{
-		cmd.m_args = ParseArguments(argsStr);
-		cmd.m_type = IMAP_UTILS::StringToCommandType(commandStr);
+		cmd.m_args = ParseArguments(argsStr.substr(spaceInUidArgs + 1));
 	}
 
 	return cmd;
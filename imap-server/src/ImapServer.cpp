@@ -1,12 +1,14 @@
 #include "ImapServer.hpp"
 
+#include <algorithm>
+
 #include "ImapSession.hpp"
 
-ImapServer::ImapServer(boost::asio::io_context& context, ILogger& logger, DataBaseManager& db, ThreadPool& pool,
+ImapServer::ImapServer(boost::asio::io_context& context, ILogger& logger, ShardRouter& db, ThreadPool& pool,
 					   ImapConfig& config)
 	: m_config(config), m_context(context),
 	  m_acceptor(context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), m_config.port)), m_logger(logger),
-	  m_db(db), m_thread_pool(pool)
+	  m_db(db), m_thread_pool(pool), m_mess_repo(db), m_user_repo(db)
 {
 	m_logger.Log(PROD, "Imap server entity created");
 }
@@ -15,7 +17,23 @@ void ImapServer::Start()
 {
 	m_logger.Log(PROD, "Server started");
 	AcceptConnection();
+
+	// every session handler is bound to the session strand, so sessions can be spread over several threads
+	int extra_threads = std::max(m_config.io_threads, 1) - 1;
+	m_io_threads.reserve(extra_threads);
+	for (int i = 0; i < extra_threads; ++i)
+	{
+		m_io_threads.emplace_back([this]() { m_context.run(); });
+	}
+	m_logger.Log(PROD, "IO threads running: " + std::to_string(extra_threads + 1));
+
 	m_context.run();
+
+	for (auto& thread : m_io_threads)
+	{
+		thread.join();
+	}
+	m_io_threads.clear();
 }
 
 void ImapServer::AcceptConnection()
@@ -32,7 +50,9 @@ void ImapServer::AcceptConnection()
 
 			if (!ec)
 			{
-				std::make_shared<ImapSession>(std::move(socket), m_logger, m_db, m_thread_pool, m_config)->Start();
+				std::make_shared<ImapSession>(std::move(socket), m_logger, m_mess_repo, m_user_repo, m_thread_pool,
+											  m_config)
+					->Start();
 			}
 			else
 			{
@@ -1,23 +1,40 @@
 #include "ImapSession.hpp"
 
+#include <algorithm>
+#include <filesystem>
 #include <istream>
 
 #include "ImapParser.hpp"
 #include "ImapResponse.hpp"
 
-ImapSession::ImapSession(boost::asio::ip::tcp::socket socket, ILogger& logger, DataBaseManager& db, ThreadPool& pool,
-						 ImapConfig& config)
-	: m_config(config), m_socket(std::move(socket)), m_logger(logger), m_mess_repo(db), m_user_repo(db),
-	  m_conn(m_socket), m_secure_channel(std::make_unique<ServerSecureChannel>(m_conn)), m_thread_pool(pool),
-	  m_strand(boost::asio::make_strand(m_socket.get_executor())), m_timer(m_socket.get_executor())
+ImapSession::ImapSession(boost::asio::ip::tcp::socket socket, ILogger& logger, MessageRepository& mess_repo,
+						 UserRepository& user_repo, ThreadPool& pool, ImapConfig& config)
+	: m_config(config), m_socket(std::move(socket)), m_conn(m_socket),
+	  m_secure_channel(std::make_unique<ServerSecureChannel>(m_conn)),
+	  m_buffer(static_cast<std::size_t>(config.max_command_line_kb) * 1024),
+	  m_strand(boost::asio::make_strand(m_socket.get_executor())), m_timer(m_socket.get_executor()), m_logger(logger),
+	  m_thread_pool(pool), m_dispatcher(logger, user_repo, mess_repo)
 {
 	m_logger.Log(PROD, "New ImapSession created");
 	m_logger.Log(TRACE, "ImapSession::ImapSession - socket accepted");
 
-	m_dispatcher = std::make_unique<ImapCommandDispatcher>(m_logger, m_user_repo, m_mess_repo);
 	m_secure_channel->setLogger(&m_logger);
 }
 
+ImapSession::~ImapSession()
+{
+	// spool files of an APPEND interrupted by a disconnect
+	ResetLiteral();
+	for (const auto& cmd : m_pending_commands)
+	{
+		for (const auto& path : cmd.m_literals)
+		{
+			std::error_code ec;
+			std::filesystem::remove(path, ec);
+		}
+	}
+}
+
 void ImapSession::Start()
 {
 	m_logger.Log(DEBUG, "ImapSession::Start - Start");
@@ -34,10 +51,8 @@ void ImapSession::SendBanner()
 	ReadCommand();
 }
 
-void ImapSession::ReadCommand()
+void ImapSession::ArmIdleTimer()
 {
-	m_logger.Log(DEBUG, "ImapSession::ReadCommand - Start");
-
 	auto self = shared_from_this();
 
 	m_timer.expires_after(std::chrono::minutes(m_config.timeout_mins));
@@ -54,32 +69,40 @@ void ImapSession::ReadCommand()
 									   WriteResponse(ImapResponse::Untagged("BYE Autologout; idle for too long"));
 									   m_logger.Log(DEBUG, "Closing socket due to timeout");
 								   }));
+}
 
-	if (m_secure_channel->isSecure())
+void ImapSession::ReadCommand()
+{
+	m_logger.Log(DEBUG, "ImapSession::ReadCommand - Start");
+
+	auto self = shared_from_this();
+
+	ArmIdleTimer();
+
+	if (m_deflate || !m_input.empty())
+	{
+		ReadBuffered();
+	}
+	else if (m_secure_channel->isSecure())
 	{
-		m_thread_pool.add_task(
-			[this, self]()
+		ReadRecord(
+			[this](std::string record)
 			{
-				std::string line;
-				bool ok = m_secure_channel->Receive(line);
+				m_timer.cancel();
 
-				boost::asio::post(m_strand,
-								  [this, self, ok, line]()
-								  {
-									  if (ok)
-									  {
-										  m_timer.cancel();
-										  HandleCommand(line);
-									  }
-									  else
-									  {
-										  m_logger.Log(PROD, "IMAP: Secure Receive failed");
-										  m_socket.close();
-									  }
-								  });
+				// a LITERAL+ client may send literal data in the record of the command line
+				std::size_t eol = record.find("\r\n");
+				if (eol != std::string::npos)
+				{
+					m_input.append(record, eol + 2, std::string::npos);
+					record.resize(eol);
+				}
+				if (!record.empty() && record.back() == '\n') record.pop_back();
+				if (!record.empty() && record.back() == '\r') record.pop_back();
+
+				HandleCommand(record);
 			});
 	}
-
 	else
 	{
 		boost::asio::async_read_until(
@@ -102,6 +125,14 @@ void ImapSession::ReadCommand()
 											   m_logger.Log(TRACE, "ImapSession::ReadCommand - Calling HandleCommand");
 											   HandleCommand(line);
 										   }
+										   else if (ec == boost::asio::error::not_found)
+										   {
+											   // m_buffer filled up to its max_size without a line break
+											   std::string head(boost::asio::buffers_begin(m_buffer.data()),
+																boost::asio::buffers_begin(m_buffer.data()) +
+																	std::min<std::size_t>(m_buffer.size(), 64));
+											   DiscardLongLine(head);
+										   }
 										   else
 										   {
 											   m_logger.Log(PROD, "ImapSession::ReadCommand - Error: " + ec.message());
@@ -113,12 +144,207 @@ void ImapSession::ReadCommand()
 	m_logger.Log(DEBUG, "ImapSession::ReadCommand - End");
 }
 
+void ImapSession::ReadBuffered()
+{
+	m_logger.Log(DEBUG, "ImapSession::ReadBuffered - Start");
+
+	auto self = shared_from_this();
+
+	std::size_t eol = m_input.find("\r\n");
+	if (eol != std::string::npos)
+	{
+		m_timer.cancel();
+		std::string line = m_input.substr(0, eol);
+		m_input.erase(0, eol + 2);
+		m_logger.Log(DEBUG, "ImapSession::ReadBuffered - Acquired: " + line);
+		boost::asio::post(m_strand, [this, self, line]() { HandleCommand(line); });
+		m_logger.Log(DEBUG, "ImapSession::ReadBuffered - End");
+		return;
+	}
+
+	if (m_input.size() > static_cast<std::size_t>(m_config.compress_max_buffer_kb) * 1024)
+	{
+		m_logger.Log(PROD, "ImapSession::ReadBuffered - Command line exceeds the buffer limit");
+		m_socket.close();
+		return;
+	}
+
+	ReadRawInput([this]() { ReadCommand(); });
+
+	m_logger.Log(DEBUG, "ImapSession::ReadBuffered - End");
+}
+
+void ImapSession::ReadRawInput(std::function<void()> on_data)
+{
+	auto self = shared_from_this();
+
+	if (m_secure_channel->isSecure())
+	{
+		ReadRecord(
+			[this, on_data](std::string record)
+			{
+				if (AppendInput(record.data(), record.size()))
+				{
+					on_data();
+				}
+				else
+				{
+					m_logger.Log(PROD, "ImapSession::ReadRawInput - invalid DEFLATE data");
+					m_socket.close();
+				}
+			});
+	}
+	else
+	{
+		if (!m_read_chunk)
+		{
+			m_read_chunk = std::make_unique<char[]>(READ_CHUNK_SIZE);
+		}
+		m_socket.async_read_some(
+			boost::asio::buffer(m_read_chunk.get(), READ_CHUNK_SIZE),
+			boost::asio::bind_executor(m_strand,
+									   [this, self, on_data](boost::system::error_code ec, std::size_t bytes)
+									   {
+										   if (!ec && AppendInput(m_read_chunk.get(), bytes))
+										   {
+											   on_data();
+										   }
+										   else
+										   {
+											   m_logger.Log(PROD, "ImapSession::ReadRawInput - Error: " +
+																	  (ec ? ec.message() : "invalid DEFLATE data"));
+											   m_socket.close();
+										   }
+									   }));
+	}
+}
+
+void ImapSession::ReadRecord(std::function<void(std::string)> on_record)
+{
+	auto self = shared_from_this();
+
+	boost::asio::async_read(
+		m_socket, boost::asio::buffer(m_record_header),
+		boost::asio::bind_executor(
+			m_strand,
+			[this, self, on_record](boost::system::error_code ec, std::size_t)
+			{
+				auto size = ec ? std::nullopt : SecureChannel::RecordSize(m_record_header.data());
+				if (!size.has_value())
+				{
+					m_logger.Log(PROD, "ImapSession::ReadRecord - Error: " +
+										   (ec ? ec.message() : "invalid record length"));
+					m_socket.close();
+					return;
+				}
+
+				m_record.resize(*size);
+				boost::asio::async_read(
+					m_socket, boost::asio::buffer(m_record),
+					boost::asio::bind_executor(m_strand,
+											   [this, self, on_record](boost::system::error_code ec, std::size_t)
+											   {
+												   std::string data;
+												   if (ec || !m_secure_channel->Open(m_record, data))
+												   {
+													   m_logger.Log(PROD, "IMAP: Secure Receive failed");
+													   m_socket.close();
+													   return;
+												   }
+												   on_record(std::move(data));
+											   }));
+			}));
+}
+
+bool ImapSession::AppendInput(const char* data, std::size_t size)
+{
+	if (m_deflate)
+	{
+		return m_deflate->Decompress(data, size, m_input);
+	}
+	m_input.append(data, size);
+	return true;
+}
+
+void ImapSession::EnableCompression()
+{
+	m_logger.Log(DEBUG, "ImapSession::EnableCompression - Start");
+
+	m_deflate = std::make_unique<ImapDeflateStream>(m_config.compress_level, m_config.compress_window_bits,
+													m_config.compress_mem_level);
+	if (!m_deflate->IsValid())
+	{
+		m_logger.Log(PROD, "ImapSession::EnableCompression - zlib initialization failed");
+		m_socket.close();
+		return;
+	}
+
+	// bytes that arrived right behind the COMPRESS line are already compressed
+	if (m_buffer.size() > 0 || !m_input.empty())
+	{
+		std::string pending = std::move(m_input);
+		m_input.clear();
+		pending.append(boost::asio::buffers_begin(m_buffer.data()), boost::asio::buffers_end(m_buffer.data()));
+		m_buffer.consume(m_buffer.size());
+		if (!m_deflate->Decompress(pending.data(), pending.size(), m_input))
+		{
+			m_logger.Log(PROD, "ImapSession::EnableCompression - invalid DEFLATE data");
+			m_socket.close();
+			return;
+		}
+	}
+
+	m_logger.Log(PROD, "IMAP: COMPRESS=DEFLATE active");
+	m_logger.Log(DEBUG, "ImapSession::EnableCompression - End");
+	ReadCommand();
+}
+
 void ImapSession::HandleCommand(const std::string& line)
 {
-	m_logger.Log(TRACE, "ImapSession::HandleCommand - In: line=" + line);
 	m_logger.Log(DEBUG, "ImapSession::HandleCommand - Start");
 
-	auto cmd = ImapParser::Parse(line);
+	// the command parsers work on the whole line, so its size is bounded before any of them runs
+	if (m_literal_line.size() + line.size() > static_cast<std::size_t>(m_config.max_command_line_kb) * 1024)
+	{
+		RejectLongLine(m_literal_line.empty() ? line : m_literal_line);
+		ResetLiteral();
+		m_logger.Log(DEBUG, "ImapSession::HandleCommand - End");
+		ReadCommand();
+		return;
+	}
+	m_logger.Log(TRACE, "ImapSession::HandleCommand - In: line=" + line);
+
+	auto literal = IMAP_UTILS::ParseLiteralSpec(line);
+	if (literal.has_value())
+	{
+		literal->m_offset += m_literal_line.size();
+		BeginLiteral(m_literal_line + line, literal.value());
+		m_logger.Log(DEBUG, "ImapSession::HandleCommand - End");
+		return;
+	}
+
+	std::string full_line = m_literal_line + line;
+	std::string literal_error = m_literal_error;
+	std::vector<std::string> literal_paths = std::move(m_literal_paths);
+	m_literal_paths.clear();
+	ResetLiteral();
+
+	if (!literal_error.empty())
+	{
+		for (const auto& path : literal_paths)
+		{
+			std::error_code ec;
+			std::filesystem::remove(path, ec);
+		}
+		WriteResponse(literal_error);
+		m_logger.Log(TRACE, "ImapSession::HandleCommand - Out: " + literal_error);
+		m_logger.Log(DEBUG, "ImapSession::HandleCommand - End");
+		ReadCommand();
+		return;
+	}
+
+	auto cmd = ImapParser::Parse(full_line);
+	cmd.m_literals = std::move(literal_paths);
 
 	if (cmd.m_type == ImapCommandType::Unknown)
 	{
@@ -131,17 +357,104 @@ void ImapSession::HandleCommand(const std::string& line)
 		return;
 	}
 
-	if (m_dispatcher->RequiresAuth(cmd.m_type) && m_dispatcher->get_State() == SessionState::NonAuthenticated)
+	// authentication is checked when the command runs: a pipelined LOGIN may still be queued
+	bool barrier = IsPipelineBarrier(cmd.m_type);
+	m_pending_commands.push_back(std::move(cmd));
+	RunNextCommand();
+
+	if (barrier)
+	{
+		m_logger.Log(DEBUG, "ImapSession::HandleCommand - Reading stopped until the command completes");
+	}
+	else if (m_pending_commands.size() >= MAX_PIPELINED_COMMANDS)
+	{
+		m_logger.Log(DEBUG, "ImapSession::HandleCommand - Pipeline full, reading paused");
+		m_read_paused = true;
+	}
+	else
 	{
-		m_logger.Log(PROD, "ImapSession::HandleCommand - User not authenticated");
-		std::string response = cmd.m_tag + " BAD Not authenticated\r\n";
-		WriteResponse(response);
-		m_logger.Log(TRACE, "ImapSession::HandleCommand - Out: " + response);
-		m_logger.Log(DEBUG, "ImapSession::HandleCommand - End");
 		ReadCommand();
+	}
+
+	m_logger.Log(DEBUG, "ImapSession::HandleCommand - End");
+}
+
+void ImapSession::DiscardLongLine(const std::string& head)
+{
+	// the last byte is kept in case it is the CR of the line break
+	m_buffer.consume(m_buffer.size() - 1);
+
+	auto self = shared_from_this();
+	boost::asio::async_read_until(
+		m_socket, m_buffer, "\r\n",
+		boost::asio::bind_executor(m_strand,
+								   [this, self, head](boost::system::error_code ec, std::size_t bytes)
+								   {
+									   if (ec == boost::asio::error::not_found)
+									   {
+										   DiscardLongLine(head);
+									   }
+									   else if (ec)
+									   {
+										   m_logger.Log(PROD, "ImapSession::DiscardLongLine - Error: " + ec.message());
+										   m_socket.close();
+									   }
+									   else
+									   {
+										   m_timer.cancel();
+										   m_buffer.consume(bytes);
+										   RejectLongLine(head);
+										   ReadCommand();
+									   }
+								   }));
+}
+
+void ImapSession::RejectLongLine(const std::string& head)
+{
+	m_logger.Log(PROD, "ImapSession::RejectLongLine - Command line exceeds " +
+						   std::to_string(m_config.max_command_line_kb) + " KB");
+
+	std::string tag = head.substr(0, std::min<std::size_t>(head.find(' '), 64));
+	if (tag.empty() || tag.size() == 64)
+	{
+		tag = "*";
+	}
+	WriteResponse(ImapResponse::Bad(tag, "Command line too long"));
+}
+
+bool ImapSession::IsPipelineBarrier(ImapCommandType type)
+{
+	return type == ImapCommandType::StartTLS || type == ImapCommandType::Compress ||
+		   type == ImapCommandType::Logout;
+}
+
+void ImapSession::RunNextCommand()
+{
+	if (m_is_dispatching || m_pending_commands.empty())
+	{
+		return;
+	}
+
+	m_logger.Log(DEBUG, "ImapSession::RunNextCommand - Start");
+
+	ImapCommand cmd = std::move(m_pending_commands.front());
+	m_pending_commands.pop_front();
+
+	// no command is running, so the dispatcher state is stable here
+	if (m_dispatcher.RequiresAuth(cmd.m_type) && m_dispatcher.get_State() == SessionState::NonAuthenticated)
+	{
+		m_logger.Log(PROD, "ImapSession::RunNextCommand - User not authenticated");
+		for (const auto& path : cmd.m_literals)
+		{
+			std::error_code ec;
+			std::filesystem::remove(path, ec);
+		}
+		CompleteCommand(cmd, cmd.m_tag + " BAD Not authenticated\r\n");
+		m_logger.Log(DEBUG, "ImapSession::RunNextCommand - End");
 		return;
 	}
 
+	m_is_dispatching = true;
 	auto self = shared_from_this();
 
 	m_thread_pool.add_task(
@@ -150,51 +463,246 @@ void ImapSession::HandleCommand(const std::string& line)
 			std::string response;
 			try
 			{
-				response = m_dispatcher->Dispatch(cmd);
+				response = m_dispatcher.Dispatch(cmd);
 			}
 			catch (const std::exception& ex)
 			{
 				m_logger.Log(PROD, std::string("Exception in command dispatch: ") + ex.what());
 				response = "BAD Internal server error\r\n";
 			}
-			boost::asio::post(
-				m_strand,
-				[this, self, response, cmd]()
-				{
-					if (cmd.m_type == ImapCommandType::StartTLS && m_secure_channel->isSecure())
-					{
-						m_logger.Log(
-							DEBUG,
-							"STARTTLS command received when TLS is invoked already. Changing response result to BAD");
-						WriteResponse(cmd.m_tag + " BAD TLS already active\r\n");
-						ReadCommand();
-					}
-					else if (cmd.m_type == ImapCommandType::StartTLS)
-					{
-						m_is_starttls_pending = true;
-						m_logger.Log(DEBUG, "STARTTLS response queued. Waiting for Write() to finish.");
-						WriteResponse(response);
-					}
-					else
-					{
-						WriteResponse(response);
-						if (cmd.m_type != ImapCommandType::Logout)
-						{
-							ReadCommand();
-						}
-					}
-				});
+			boost::asio::post(m_strand,
+							  [this, self, response, cmd]()
+							  {
+								  m_is_dispatching = false;
+								  CompleteCommand(cmd, response);
+							  });
 		});
 
-	m_logger.Log(DEBUG, "ImapSession::HandleCommand - End");
+	m_logger.Log(DEBUG, "ImapSession::RunNextCommand - End");
+}
+
+void ImapSession::CompleteCommand(const ImapCommand& cmd, const std::string& response)
+{
+	m_logger.Log(DEBUG, "ImapSession::CompleteCommand - Start");
+
+	if (cmd.m_type == ImapCommandType::StartTLS && m_secure_channel->isSecure())
+	{
+		m_logger.Log(DEBUG, "STARTTLS command received when TLS is invoked already. Changing response result to BAD");
+		WriteResponse(cmd.m_tag + " BAD TLS already active\r\n");
+		ReadCommand();
+	}
+	else if (cmd.m_type == ImapCommandType::StartTLS && response.rfind(cmd.m_tag + " OK", 0) == 0)
+	{
+		m_is_starttls_pending = true;
+		m_logger.Log(DEBUG, "STARTTLS response queued. Waiting for Write() to finish.");
+		WriteResponse(response);
+	}
+	else if (cmd.m_type == ImapCommandType::Compress && response.rfind(cmd.m_tag + " OK", 0) == 0)
+	{
+		// the OK itself goes out uncompressed, everything after it is deflated
+		m_is_compress_pending = true;
+		WriteResponse(response);
+	}
+	else
+	{
+		WriteResponse(response);
+		// a barrier that did not switch streams lets the reader continue
+		if (IsPipelineBarrier(cmd.m_type) && cmd.m_type != ImapCommandType::Logout)
+		{
+			ReadCommand();
+		}
+	}
+
+	if (m_read_paused && m_pending_commands.size() < MAX_PIPELINED_COMMANDS)
+	{
+		m_read_paused = false;
+		ReadCommand();
+	}
+
+	RunNextCommand();
+
+	m_logger.Log(DEBUG, "ImapSession::CompleteCommand - End");
+}
+
+void ImapSession::BeginLiteral(const std::string& line, const IMAP_UTILS::LiteralSpec& spec)
+{
+	m_logger.Log(TRACE, "ImapSession::BeginLiteral - In: line=" + line);
+	m_logger.Log(DEBUG, "ImapSession::BeginLiteral - Start");
+
+	// the first line already names the command, so it is refused before any literal byte is stored
+	auto cmd = ImapParser::Parse(line);
+	m_literal_tag = cmd.m_tag;
+
+	// a refused command keeps its error while the rest of it is drained
+	std::string error = m_literal_error;
+	if (!error.empty())
+	{
+		m_logger.Log(DEBUG, "ImapSession::BeginLiteral - Draining refused command");
+	}
+	else if (cmd.m_type == ImapCommandType::Unknown)
+	{
+		error = cmd.m_tag + " BAD Command not recognized\r\n";
+	}
+	else if (!m_is_dispatching && m_pending_commands.empty() && m_dispatcher.RequiresAuth(cmd.m_type) &&
+			 m_dispatcher.get_State() == SessionState::NonAuthenticated)
+	{
+		// behind a pipelined LOGIN the check is left to RunNextCommand
+		error = cmd.m_tag + " BAD Not authenticated\r\n";
+	}
+	else if (cmd.m_type == ImapCommandType::Append &&
+			 spec.m_size > static_cast<int64_t>(m_config.max_append_size_mb) * 1024 * 1024)
+	{
+		error = cmd.m_tag + " NO [TOOBIG] Message exceeds the size limit\r\n";
+	}
+	else if (cmd.m_type != ImapCommandType::Append && spec.m_size > MAX_INLINE_LITERAL)
+	{
+		error = cmd.m_tag + " BAD Literal too large\r\n";
+	}
+	else if (cmd.m_type == ImapCommandType::Append)
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(m_config.spool_dir, ec);
+		std::string path = m_config.spool_dir + "/" + IMAP_UTILS::GenerateMailFilename();
+		m_literal_file = std::make_unique<std::ofstream>(path, std::ios::binary | std::ios::trunc);
+		if (m_literal_file->is_open())
+		{
+			m_literal_paths.push_back(path);
+		}
+		else
+		{
+			m_literal_file.reset();
+			error = cmd.m_tag + " NO Cannot store message\r\n";
+		}
+	}
+
+	if (!error.empty() && spec.m_synchronizing)
+	{
+		// the client waits for the continuation, so the literal is never sent
+		m_logger.Log(PROD, "ImapSession::BeginLiteral - Literal refused: " + error);
+		ResetLiteral();
+		WriteResponse(error);
+		m_logger.Log(DEBUG, "ImapSession::BeginLiteral - End");
+		ReadCommand();
+		return;
+	}
+
+	m_literal_error = error;
+	m_literal_inline = error.empty() && cmd.m_type != ImapCommandType::Append;
+	m_literal_line = m_literal_inline ? line.substr(0, spec.m_offset) : line;
+	m_literal_remaining = spec.m_size;
+	m_literal_data.clear();
+
+	if (spec.m_synchronizing)
+	{
+		WriteResponse("+ Ready for literal data\r\n");
+	}
+
+	// literal bytes read together with the command line
+	if (m_buffer.size() > 0)
+	{
+		m_input.append(boost::asio::buffers_begin(m_buffer.data()), boost::asio::buffers_end(m_buffer.data()));
+		m_buffer.consume(m_buffer.size());
+	}
+
+	m_logger.Log(DEBUG, "ImapSession::BeginLiteral - End");
+	ReadLiteral();
+}
+
+void ImapSession::ReadLiteral()
+{
+	auto take = std::min<int64_t>(m_literal_remaining, static_cast<int64_t>(m_input.size()));
+	if (take > 0)
+	{
+		if (m_literal_file)
+		{
+			m_literal_file->write(m_input.data(), take);
+		}
+		else if (m_literal_inline)
+		{
+			m_literal_data.append(m_input, 0, take);
+		}
+		m_input.erase(0, take);
+		m_literal_remaining -= take;
+	}
+
+	if (m_literal_remaining == 0)
+	{
+		FinishLiteral();
+		return;
+	}
+
+	ArmIdleTimer();
+	ReadRawInput(
+		[this]()
+		{
+			m_timer.cancel();
+			ReadLiteral();
+		});
+}
+
+void ImapSession::FinishLiteral()
+{
+	m_logger.Log(DEBUG, "ImapSession::FinishLiteral - Start");
+
+	if (m_literal_file)
+	{
+		m_literal_file->close();
+		if (m_literal_file->fail() && m_literal_error.empty())
+		{
+			m_literal_error = m_literal_tag + " NO Cannot store message\r\n";
+		}
+		m_literal_file.reset();
+	}
+	else if (m_literal_inline)
+	{
+		if (m_literal_data.find_first_of(std::string("\r\n\0", 3)) != std::string::npos)
+		{
+			m_literal_error = m_literal_tag + " BAD Literal must not contain line breaks\r\n";
+		}
+		else
+		{
+			std::string quoted = "\"";
+			for (char c : m_literal_data)
+			{
+				if (c == '"' || c == '\\') quoted += '\\';
+				quoted += c;
+			}
+			m_literal_line += quoted + "\"";
+		}
+		m_literal_data.clear();
+	}
+
+	m_logger.Log(DEBUG, "ImapSession::FinishLiteral - End");
+
+	// the command line continues after the literal
+	ReadCommand();
+}
+
+void ImapSession::ResetLiteral()
+{
+	m_literal_file.reset();
+
+	for (const auto& path : m_literal_paths)
+	{
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+	}
+
+	m_literal_tag.clear();
+	m_literal_line.clear();
+	m_literal_paths.clear();
+	m_literal_data.clear();
+	m_literal_remaining = 0;
+	m_literal_inline = false;
+	m_literal_error.clear();
 }
 
-void ImapSession::WriteResponse(const std::string& msg)
+void ImapSession::WriteResponse(std::string msg)
 {
 	m_logger.Log(TRACE, "ImapSession::WriteResponse - In: msg length=" + std::to_string(msg.size()));
 	m_logger.Log(DEBUG, "ImapSession::WriteResponse - Start");
 
-	m_write_queue.push(msg);
+	m_write_queue.push_back(std::move(msg));
 	if (!m_is_writing)
 	{
 		Write();
@@ -209,91 +717,112 @@ void ImapSession::Write()
 
 	m_is_writing = true;
 	auto self = shared_from_this();
-	auto payload = std::make_shared<std::string>(m_write_queue.front());
 
-	auto write_handler = [this, self, payload](boost::system::error_code ec, std::size_t bytes_transferred)
+	// responses that piled up behind the previous write leave in one write (one record under TLS)
+	auto batch = std::make_shared<std::vector<std::string>>();
+	batch->swap(m_write_queue);
+
+	if (m_deflate)
 	{
-		if (ec)
+		// a single sync flush at the end of the batch
+		std::string payload;
+		for (std::size_t i = 0; i < batch->size(); ++i)
 		{
-			m_logger.Log(PROD, "ImapSession::Write - Error: " + ec.message());
-			m_socket.close();
-			return;
+			if (!m_deflate->Compress((*batch)[i], payload, i + 1 == batch->size()))
+			{
+				m_logger.Log(PROD, "ImapSession::Write - DEFLATE failed");
+				m_socket.close();
+				return;
+			}
 		}
+		batch->assign(1, std::move(payload));
+	}
 
-		m_logger.Log(DEBUG, "ImapSession::Write - Sent " + std::to_string(bytes_transferred) + " bytes");
-
-		m_write_queue.pop();
-		if (!m_write_queue.empty())
+	if (m_secure_channel->isSecure())
+	{
+		// a record is capped at MAX_MESSAGE_SIZE, so a large batch is split into as few records as fit
+		std::vector<std::string> records;
+		for (auto& entry : *batch)
 		{
-			Write();
+			if (records.empty() || records.back().size() + entry.size() > SecureChannel::MAX_MESSAGE_SIZE)
+			{
+				records.push_back(std::move(entry));
+			}
+			else
+			{
+				records.back() += entry;
+			}
 		}
-		else
+		for (auto& record : records)
 		{
-			m_is_writing = false;
-
-			if (m_closing)
+			auto sealed = m_secure_channel->Seal(record);
+			if (!sealed.has_value())
 			{
+				m_logger.Log(PROD, "Secure send failed");
 				m_socket.close();
 				return;
 			}
+			record = std::move(*sealed);
+		}
+		batch->swap(records);
+	}
 
-			if (m_is_starttls_pending)
-			{
-				m_is_starttls_pending = false;
-				m_logger.Log(PROD, "STARTTLS response physically sent. Triggering Handshake!");
+	std::vector<boost::asio::const_buffer> buffers;
+	buffers.reserve(batch->size());
+	for (const auto& entry : *batch)
+	{
+		buffers.push_back(boost::asio::buffer(entry));
+	}
 
-				UpgradeToTLS();
-			}
-		}
-	};
+	boost::asio::async_write(m_socket, buffers,
+							 boost::asio::bind_executor(
+								 m_strand,
+								 [this, self, batch](boost::system::error_code ec, std::size_t bytes_transferred)
+								 {
+									 if (ec)
+									 {
+										 m_logger.Log(PROD, "ImapSession::Write - Error: " + ec.message());
+										 m_socket.close();
+										 return;
+									 }
+
+									 m_logger.Log(DEBUG, "ImapSession::Write - Sent " +
+															 std::to_string(bytes_transferred) + " bytes");
+									 OnWriteComplete();
+								 }));
 
-	if (m_secure_channel->isSecure())
+	m_logger.Log(DEBUG, "ImapSession::Write - End");
+}
+
+void ImapSession::OnWriteComplete()
+{
+	if (!m_write_queue.empty())
 	{
-		m_thread_pool.add_task(
-			[this, self, payload]()
-			{
-				bool ok = m_secure_channel->Send(*payload);
+		Write();
+		return;
+	}
 
-				boost::asio::post(m_strand,
-								  [this, self, ok]()
-								  {
-									  if (!ok)
-									  {
-										  m_logger.Log(PROD, "Secure send failed");
-										  m_socket.close();
-										  return;
-									  }
-									  m_write_queue.pop();
-									  if (!m_write_queue.empty())
-									  {
-										  Write();
-									  }
-									  else
-									  {
-										  m_is_writing = false;
-
-										  if (m_closing)
-										  {
-											  m_socket.close();
-											  return;
-										  }
-
-										  if (m_is_starttls_pending)
-										  {
-											  m_is_starttls_pending = false;
-											  UpgradeToTLS();
-										  }
-									  }
-								  });
-			});
+	m_is_writing = false;
+
+	if (m_closing)
+	{
+		m_socket.close();
+		return;
 	}
-	else
+
+	if (m_is_starttls_pending)
 	{
-		boost::asio::async_write(m_socket, boost::asio::buffer(*payload),
-								 boost::asio::bind_executor(m_strand, write_handler));
+		m_is_starttls_pending = false;
+		m_logger.Log(PROD, "STARTTLS response physically sent. Triggering Handshake!");
+
+		UpgradeToTLS();
 	}
 
-	m_logger.Log(DEBUG, "ImapSession::Write - End");
+	if (m_is_compress_pending)
+	{
+		m_is_compress_pending = false;
+		EnableCompression();
+	}
 }
 
 void ImapSession::UpgradeToTLS()
@@ -1,15 +1,27 @@
 #include "ImapUtils.hpp"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
 #include <fstream>
 #include <numeric>
+#include <random>
+#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <unordered_map>
 
 #include "Entity/Recipient.h"
+#include "ImapParser.hpp"
 #include "MimeBuilder.h"
 #include "MimePart.h"
 #include "Repository/MessageRepository.h"
+#include "ShardRouter.h"
 #include "StringUtils.h"
 
 namespace IMAP_UTILS
@@ -45,40 +57,136 @@ std::string JoinArgs(const std::vector<std::string>& args)
 	return result;
 }
 
-ImapCommandType StringToCommandType(const std::string& cmd)
-{
-	static const std::unordered_map<std::string, ImapCommandType> commandMap = {
-		{"LOGIN", ImapCommandType::Login},
-		{"LOGOUT", ImapCommandType::Logout},
-		{"CAPABILITY", ImapCommandType::Capability},
-		{"NOOP", ImapCommandType::Noop},
-		{"SELECT", ImapCommandType::Select},
-		{"LIST", ImapCommandType::List},
-		{"LSUB", ImapCommandType::Lsub},
-		{"STATUS", ImapCommandType::Status},
-		{"FETCH", ImapCommandType::Fetch},
-		{"STORE", ImapCommandType::Store},
-		{"CREATE", ImapCommandType::Create},
-		{"DELETE", ImapCommandType::Delete},
-		{"RENAME", ImapCommandType::Rename},
-		{"COPY", ImapCommandType::Copy},
-		{"EXPUNGE", ImapCommandType::Expunge},
-		{"UID", ImapCommandType::UidFetch},
-		{"SUBSCRIBE", ImapCommandType::Subscribe},
-		{"UNSUBSCRIBE", ImapCommandType::Unsubscribe},
-		{"CLOSE", ImapCommandType::Close},
-		{"CHECK", ImapCommandType::Check},
-		{"STARTTLS", ImapCommandType::StartTLS}
-	};
+namespace
+{
 
-	auto it = commandMap.find(IMAP_UTILS::ToUpper(cmd));
-	if (it != commandMap.end())
+struct CommandName
+{
+	std::string_view name;
+	ImapCommandType type;
+};
+
+constexpr CommandName COMMAND_NAMES[] = {
+	{"LOGIN", ImapCommandType::Login},
+	{"LOGOUT", ImapCommandType::Logout},
+	{"CAPABILITY", ImapCommandType::Capability},
+	{"NOOP", ImapCommandType::Noop},
+	{"SELECT", ImapCommandType::Select},
+	{"LIST", ImapCommandType::List},
+	{"LSUB", ImapCommandType::Lsub},
+	{"STATUS", ImapCommandType::Status},
+	{"FETCH", ImapCommandType::Fetch},
+	{"STORE", ImapCommandType::Store},
+	{"CREATE", ImapCommandType::Create},
+	{"DELETE", ImapCommandType::Delete},
+	{"RENAME", ImapCommandType::Rename},
+	{"COPY", ImapCommandType::Copy},
+	{"EXPUNGE", ImapCommandType::Expunge},
+	{"UID", ImapCommandType::UidFetch},
+	{"SUBSCRIBE", ImapCommandType::Subscribe},
+	{"UNSUBSCRIBE", ImapCommandType::Unsubscribe},
+	{"CLOSE", ImapCommandType::Close},
+	{"CHECK", ImapCommandType::Check},
+	{"STARTTLS", ImapCommandType::StartTLS},
+	{"ENABLE", ImapCommandType::Enable},
+	{"SEARCH", ImapCommandType::Search},
+	{"SORT", ImapCommandType::Sort},
+	{"THREAD", ImapCommandType::Thread},
+	{"COMPRESS", ImapCommandType::Compress},
+	{"APPEND", ImapCommandType::Append},
+	{"MOVE", ImapCommandType::Move},
+};
+
+constexpr size_t COMMAND_COUNT = sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0]);
+
+// FNV-1a over the upper-cased name; the seed is picked so the top 6 bits are unique per command.
+// When a command is added and the static_assert below fires, search for a new seed.
+constexpr uint32_t COMMAND_HASH_SEED = 872;
+constexpr unsigned COMMAND_TABLE_BITS = 6;
+
+constexpr char AsciiUpper(char c) { return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c; }
+
+constexpr size_t CommandSlot(std::string_view name)
+{
+	uint32_t h = COMMAND_HASH_SEED;
+	for (char c : name)
 	{
-		return it->second;
+		h = (h ^ static_cast<uint8_t>(AsciiUpper(c))) * 16777619u;
+	}
+	return h >> (32 - COMMAND_TABLE_BITS);
+}
+
+struct CommandTable
+{
+	int8_t slots[1u << COMMAND_TABLE_BITS];
+	bool perfect;
+};
+
+constexpr CommandTable BuildCommandTable()
+{
+	CommandTable table{};
+	table.perfect = true;
+	for (auto& slot : table.slots)
+	{
+		slot = -1;
+	}
+	for (size_t i = 0; i < COMMAND_COUNT; ++i)
+	{
+		size_t slot = CommandSlot(COMMAND_NAMES[i].name);
+		if (table.slots[slot] != -1) table.perfect = false;
+		table.slots[slot] = static_cast<int8_t>(i);
+	}
+	return table;
+}
+
+constexpr CommandTable COMMAND_TABLE = BuildCommandTable();
+static_assert(COMMAND_TABLE.perfect, "IMAP command names collide in COMMAND_TABLE, change COMMAND_HASH_SEED");
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view upper)
+{
+	if (a.size() != upper.size()) return false;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (AsciiUpper(a[i]) != upper[i]) return false;
+	}
+	return true;
+}
+
+} // namespace
+
+ImapCommandType StringToCommandType(std::string_view cmd)
+{
+	int8_t index = COMMAND_TABLE.slots[CommandSlot(cmd)];
+	if (index >= 0 && EqualsIgnoreCase(cmd, COMMAND_NAMES[index].name))
+	{
+		return COMMAND_NAMES[index].type;
 	}
 	return ImapCommandType::Unknown;
 }
 
+ImapCommandType ToUidCommandType(ImapCommandType type)
+{
+	switch (type)
+	{
+	case ImapCommandType::Fetch:
+		return ImapCommandType::UidFetch;
+	case ImapCommandType::Store:
+		return ImapCommandType::UidStore;
+	case ImapCommandType::Copy:
+		return ImapCommandType::UidCopy;
+	case ImapCommandType::Move:
+		return ImapCommandType::UidMove;
+	case ImapCommandType::Search:
+		return ImapCommandType::UidSearch;
+	case ImapCommandType::Sort:
+		return ImapCommandType::UidSort;
+	case ImapCommandType::Thread:
+		return ImapCommandType::UidThread;
+	default:
+		return ImapCommandType::Unknown;
+	}
+}
+
 std::string CommandTypeToString(const ImapCommandType& type)
 {
 	static const std::unordered_map<ImapCommandType, std::string> commandMap = {
@@ -104,7 +212,18 @@ std::string CommandTypeToString(const ImapCommandType& type)
 		{ImapCommandType::Unsubscribe, "UNSUBSCRIBE"},
 		{ImapCommandType::Close, "CLOSE"},
 		{ImapCommandType::Check, "CHECK"},
-		{ImapCommandType::StartTLS, "STARTTLS"}
+		{ImapCommandType::StartTLS, "STARTTLS"},
+		{ImapCommandType::Enable, "ENABLE"},
+		{ImapCommandType::Search, "SEARCH"},
+		{ImapCommandType::UidSearch, "UID SEARCH"},
+		{ImapCommandType::Sort, "SORT"},
+		{ImapCommandType::UidSort, "UID SORT"},
+		{ImapCommandType::Thread, "THREAD"},
+		{ImapCommandType::UidThread, "UID THREAD"},
+		{ImapCommandType::Compress, "COMPRESS"},
+		{ImapCommandType::Append, "APPEND"},
+		{ImapCommandType::Move, "MOVE"},
+		{ImapCommandType::UidMove, "UID MOVE"}
 	};
 
 	auto it = commandMap.find(type);
@@ -731,7 +850,155 @@ std::string GetBodySection(const Message& msg, const std::string& section)
 	return raw_mime;
 }
 
-std::string FormatFlagsResponse(const Message& msg)
+bool ParsePartialRange(const std::string& spec, int64_t& offset, int64_t& length)
+{
+	if (spec.size() < 5 || spec.front() != '<' || spec.back() != '>') return false;
+
+	size_t dot = spec.find('.');
+	if (dot == std::string::npos) return false;
+
+	std::string first = spec.substr(1, dot - 1);
+	std::string second = spec.substr(dot + 1, spec.size() - dot - 2);
+	auto is_number = [](const std::string& s)
+	{ return !s.empty() && s.size() <= 18 && std::all_of(s.begin(), s.end(), ::isdigit); };
+	if (!is_number(first) || !is_number(second)) return false;
+
+	offset = std::stoll(first);
+	length = std::stoll(second);
+	return true;
+}
+
+namespace
+{
+
+std::string ReadFileRange(const std::string& path, int64_t offset, int64_t length)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return "";
+
+	std::string data(static_cast<size_t>(length), '\0');
+	size_t total = 0;
+	while (total < data.size())
+	{
+		ssize_t n = ::pread(fd, &data[total], data.size() - total, static_cast<off_t>(offset + total));
+		if (n <= 0) break;
+		total += static_cast<size_t>(n);
+	}
+	::close(fd);
+
+	data.resize(total);
+	return data;
+}
+
+// [begin, end) of a section in the raw file, following the rules of GetBodySection
+bool ResolveSectionRange(const std::vector<MessagePart>& parts, const std::string& section, int64_t& begin,
+						 int64_t& end)
+{
+	auto find = [&parts](const std::string& name) -> const MessagePart*
+	{
+		for (const auto& part : parts)
+		{
+			if (part.section == name) return &part;
+		}
+		return nullptr;
+	};
+
+	const MessagePart* root = find("");
+	if (!root) return false;
+
+	std::string upper = ToUpper(section);
+	if (upper.empty())
+	{
+		begin = root->header_start;
+		end = root->body_end;
+		return true;
+	}
+	if (upper == "HEADER" || upper == "MIME")
+	{
+		begin = root->header_start;
+		end = root->body_start;
+		return true;
+	}
+	if (upper == "TEXT")
+	{
+		begin = root->body_start;
+		end = root->body_end;
+		return true;
+	}
+	if (!std::isdigit(static_cast<unsigned char>(upper[0]))) return false;
+
+	std::string path = upper;
+	std::string suffix;
+	for (const char* name : {".HEADER", ".MIME", ".TEXT"})
+	{
+		std::string ending(name);
+		if (path.size() > ending.size() && path.compare(path.size() - ending.size(), ending.size(), ending) == 0)
+		{
+			suffix = ending;
+			path.erase(path.size() - ending.size());
+			break;
+		}
+	}
+
+	const MessagePart* part = find(path);
+	if (!part && path == "1" && !find("1"))
+	{
+		// a single-part message is its own part 1
+		part = root;
+	}
+	if (!part) return false;
+
+	bool header = suffix == ".HEADER" || suffix == ".MIME";
+	begin = header ? part->header_start : part->body_start;
+	end = header ? part->body_start : part->body_end;
+	return true;
+}
+
+} // namespace
+
+std::string GetBodySectionRange(const Message& msg, const std::string& section, int64_t offset, int64_t length,
+								MessageRepository& repo)
+{
+	std::string upper = ToUpper(section);
+	if (upper.rfind("HEADER.", 0) == 0)
+	{
+		// HEADER.FIELDS is filtered in memory anyway
+		std::string content = GetBodySection(msg, section);
+		return offset < static_cast<int64_t>(content.size()) ? content.substr(offset, length) : "";
+	}
+
+	std::string raw_mime;
+	auto parts = msg.id.has_value() ? repo.findParts(msg.id.value()) : std::vector<MessagePart>{};
+	if (parts.empty())
+	{
+		raw_mime = GetBodyContent(msg);
+		if (raw_mime.empty()) return "";
+
+		for (const auto& range : SmtpClient::MimeParser::ScanPartRanges(raw_mime))
+		{
+			MessagePart part;
+			part.message_id = msg.id.value_or(0);
+			part.section = range.section;
+			part.header_start = static_cast<int64_t>(range.header_start);
+			part.body_start = static_cast<int64_t>(range.body_start);
+			part.body_end = static_cast<int64_t>(range.body_end);
+			parts.push_back(part);
+		}
+		if (msg.id.has_value()) repo.saveParts(msg.id.value(), parts);
+	}
+
+	int64_t begin = 0, end = 0;
+	if (!ResolveSectionRange(parts, section, begin, end) || offset >= end - begin) return "";
+
+	int64_t count = std::min(length, end - begin - offset);
+	if (!raw_mime.empty())
+	{
+		return raw_mime.substr(begin + offset, count);
+	}
+	return ReadFileRange(msg.raw_file_path, begin + offset, count);
+}
+
+std::string FormatFlagsResponse(const Message& msg, bool with_modseq)
 {
 	std::string f = "(FLAGS (";
 	if (msg.is_seen) f += "\\Seen ";
@@ -740,10 +1007,856 @@ std::string FormatFlagsResponse(const Message& msg)
 	if (msg.is_answered) f += "\\Answered ";
 	if (msg.is_flagged) f += "\\Flagged ";
 	if (msg.is_recent) f += "\\Recent ";
+	if (!msg.keywords.empty()) f += msg.keywords;
 	if (f.back() == ' ') f.pop_back();
-	f += "))";
+	f += ")";
+	if (with_modseq) f += " MODSEQ (" + std::to_string(msg.modseq) + ")";
+	f += ")";
 
 	return f;
 }
 
+namespace
+{
+void AppendFlagList(std::string& out, uint32_t flags, const std::string& keywords)
+{
+	out += "FLAGS (";
+	if (flags & MessageFlags::Seen) out += "\\Seen ";
+	if (flags & MessageFlags::Deleted) out += "\\Deleted ";
+	if (flags & MessageFlags::Draft) out += "\\Draft ";
+	if (flags & MessageFlags::Answered) out += "\\Answered ";
+	if (flags & MessageFlags::Flagged) out += "\\Flagged ";
+	if (flags & MessageFlags::Recent) out += "\\Recent ";
+	out += keywords;
+	if (out.back() == ' ') out.pop_back();
+	out += ")";
+}
+} // namespace
+
+std::string FormatFlagsResponse(const MessageFlagsRow& row, bool with_modseq)
+{
+	std::string f = "(";
+	AppendFlagList(f, row.flags, row.keywords);
+	if (with_modseq) f += " MODSEQ (" + std::to_string(row.modseq) + ")";
+	f += ")";
+
+	return f;
+}
+
+bool IsSummaryFetch(const std::vector<std::string>& items)
+{
+	return std::all_of(items.begin(), items.end(), [](const std::string& item)
+					   { return item == "FLAGS" || item == "INTERNALDATE" || item == "RFC822.SIZE" ||
+								item == "MODSEQ" || item == "UID"; });
+}
+
+std::string FormatSummaryItems(const MessageHeaderRow& row, const std::vector<std::string>& items)
+{
+	std::string out;
+	for (const auto& item : items)
+	{
+		if (!out.empty()) out += " ";
+
+		if (item == "FLAGS") AppendFlagList(out, row.flags, row.keywords);
+		else if (item == "INTERNALDATE") out += "INTERNALDATE \"" + DateToIMAPInternal(row.internal_date) + "\"";
+		else if (item == "RFC822.SIZE") out += "RFC822.SIZE " + std::to_string(row.size_bytes);
+		else if (item == "MODSEQ") out += "MODSEQ (" + std::to_string(row.modseq) + ")";
+		else if (item == "UID") out += "UID " + std::to_string(row.uid);
+	}
+	return out;
+}
+
+std::string FormatSequenceSet(const std::vector<int64_t>& values)
+{
+	std::string result;
+	size_t i = 0;
+	while (i < values.size())
+	{
+		size_t j = i;
+		while (j + 1 < values.size() && values[j + 1] == values[j] + 1)
+		{
+			++j;
+		}
+
+		if (!result.empty()) result += ",";
+		result += std::to_string(values[i]);
+		if (j > i) result += ":" + std::to_string(values[j]);
+		i = j + 1;
+	}
+	return result;
+}
+
+bool ParseChangedSince(const std::string& arg, int64_t& modseq, bool& vanished)
+{
+	auto tokens = SplitArgs(TrimParentheses(arg));
+	if (tokens.size() < 2 || ToUpper(tokens[0]) != "CHANGEDSINCE")
+	{
+		return false;
+	}
+
+	modseq = std::stoll(tokens[1]);
+	vanished = tokens.size() > 2 && ToUpper(tokens[2]) == "VANISHED";
+	return true;
+}
+
+bool ParseUnchangedSince(const std::string& arg, int64_t& modseq)
+{
+	auto tokens = SplitArgs(TrimParentheses(arg));
+	if (tokens.size() != 2 || ToUpper(tokens[0]) != "UNCHANGEDSINCE")
+	{
+		return false;
+	}
+
+	modseq = std::stoll(tokens[1]);
+	return true;
+}
+
+bool ParseSelectParams(const std::string& arg, bool& condstore, std::optional<QresyncParams>& qresync)
+{
+	std::string params = TrimParentheses(arg);
+	std::string upper = ToUpper(params);
+
+	if (upper == "CONDSTORE")
+	{
+		condstore = true;
+		return true;
+	}
+
+	if (upper.rfind("QRESYNC", 0) != 0)
+	{
+		return false;
+	}
+
+	size_t open = params.find('(');
+	size_t close = params.find(')', open);
+	if (open == std::string::npos || close == std::string::npos)
+	{
+		return false;
+	}
+
+	// the optional sequence match data "(seqs uids)" is ignored: known-uids are enough to answer
+	auto tokens = SplitArgs(params.substr(open + 1, close - open - 1));
+	if (tokens.size() < 2)
+	{
+		return false;
+	}
+
+	QresyncParams result;
+	result.m_uidValidity = std::stoll(tokens[0]);
+	result.m_modseq = std::stoll(tokens[1]);
+	if (tokens.size() > 2 && tokens[2].front() != '(')
+	{
+		result.m_knownUids = tokens[2];
+	}
+
+	condstore = true;
+	qresync = result;
+	return true;
+}
+
+std::vector<std::pair<int64_t, int64_t>> ParseSequenceRanges(const std::string& sequenceSet, int64_t maxValue)
+{
+	std::vector<std::pair<int64_t, int64_t>> ranges;
+	for (const auto& part : Split(sequenceSet, ','))
+	{
+		size_t colon_pos = part.find(':');
+		std::string firstPart = part.substr(0, colon_pos);
+		std::string secondPart = colon_pos == std::string::npos ? firstPart : part.substr(colon_pos + 1);
+
+		int64_t first = (firstPart == "*") ? maxValue : std::stoll(firstPart);
+		int64_t second = (secondPart == "*") ? maxValue : std::stoll(secondPart);
+		if (first > second)
+		{
+			std::swap(first, second);
+		}
+		ranges.emplace_back(first, second);
+	}
+	return ranges;
+}
+
+std::vector<std::pair<int64_t, int64_t>> SequenceToUidRanges(const std::string& sequenceSet,
+															 const std::vector<int64_t>& folder_uids)
+{
+	// Sequence numbers are positions in the ascending UID list, so a contiguous sequence range
+	// maps onto the UID range between its first and last message.
+	std::vector<std::pair<int64_t, int64_t>> uid_ranges;
+	int64_t count = static_cast<int64_t>(folder_uids.size());
+	for (auto [first, last] : ParseSequenceRanges(sequenceSet, count))
+	{
+		first = std::max<int64_t>(first, 1);
+		last = std::min(last, count);
+		if (first > last) continue;
+		uid_ranges.emplace_back(folder_uids[first - 1], folder_uids[last - 1]);
+	}
+	return uid_ranges;
+}
+
+int64_t UidToSequenceNumber(const std::vector<int64_t>& folder_uids, int64_t uid)
+{
+	auto it = std::lower_bound(folder_uids.begin(), folder_uids.end(), uid);
+	if (it == folder_uids.end() || *it != uid) return 0;
+	return static_cast<int64_t>(it - folder_uids.begin()) + 1;
+}
+
+std::string ImapDateToIso(const std::string& date)
+{
+	static const char* months[] = {"JAN", "FEB", "MAR", "APR", "MAY", "JUN",
+								   "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"};
+
+	auto parts = Split(date, '-');
+	if (parts.size() != 3 || parts[0].empty() || parts[0].size() > 2 || parts[2].size() != 4)
+	{
+		throw std::invalid_argument("Invalid date: " + date);
+	}
+
+	int month = 0;
+	std::string upper_month = ToUpper(parts[1]);
+	for (int i = 0; i < 12; ++i)
+	{
+		if (upper_month == months[i]) month = i + 1;
+	}
+
+	int day = std::stoi(parts[0]);
+	if (month == 0 || day < 1 || day > 31)
+	{
+		throw std::invalid_argument("Invalid date: " + date);
+	}
+
+	char buf[16];
+	std::snprintf(buf, sizeof(buf), "%s-%02d-%02d", parts[2].c_str(), month, day);
+	return buf;
+}
+
+namespace
+{
+
+class SearchProgramParser
+{
+public:
+	// NOT, OR and parenthesized lists recurse, so a client could otherwise exhaust the worker's stack
+	static constexpr int MAX_DEPTH = 64;
+
+	SearchProgramParser(const std::vector<std::string>& tokens, const std::vector<int64_t>& folder_uids,
+						int depth = 0)
+		: m_tokens(tokens), m_uids(folder_uids), m_depth(depth)
+	{
+	}
+
+	SearchCriteria ParseAll()
+	{
+		SearchCriteria all;
+		all.type = SearchCriteria::Type::And;
+		while (m_pos < m_tokens.size())
+		{
+			all.children.push_back(ParseKey(m_depth));
+		}
+		return all;
+	}
+
+private:
+	const std::vector<std::string>& m_tokens;
+	const std::vector<int64_t>& m_uids;
+	size_t m_pos = 0;
+	int m_depth = 0;
+
+	const std::string& Next()
+	{
+		if (m_pos >= m_tokens.size())
+		{
+			throw std::invalid_argument("Missing search argument");
+		}
+		return m_tokens[m_pos++];
+	}
+
+	static SearchCriteria WithValue(SearchCriteria::Type type, const std::string& value)
+	{
+		SearchCriteria c = SearchCriteria::leaf(type);
+		c.value = value;
+		return c;
+	}
+
+	SearchCriteria UidRanges(const std::vector<std::pair<int64_t, int64_t>>& ranges)
+	{
+		SearchCriteria c = SearchCriteria::leaf(SearchCriteria::Type::Uid);
+		c.ranges = ranges;
+		return c;
+	}
+
+	SearchCriteria SequenceRanges(const std::string& set) { return UidRanges(SequenceToUidRanges(set, m_uids)); }
+
+	SearchCriteria ParseKey(int depth)
+	{
+		using T = SearchCriteria::Type;
+
+		if (depth > MAX_DEPTH)
+		{
+			throw std::invalid_argument("Search program nested too deeply");
+		}
+
+		const std::string& token = Next();
+		if (token.size() >= 2 && token.front() == '(' && token.back() == ')')
+		{
+			auto inner = ImapParser::ParseArguments(TrimParentheses(token));
+			return SearchProgramParser(inner, m_uids, depth + 1).ParseAll();
+		}
+
+		if (std::isdigit(static_cast<unsigned char>(token[0])) || token[0] == '*')
+		{
+			return SequenceRanges(token);
+		}
+
+		std::string key = ToUpper(token);
+		if (key == "ALL") return SearchCriteria::leaf(T::All);
+		if (key == "ANSWERED") return SearchCriteria::leaf(T::Answered);
+		if (key == "DELETED") return SearchCriteria::leaf(T::Deleted);
+		if (key == "DRAFT") return SearchCriteria::leaf(T::Draft);
+		if (key == "FLAGGED") return SearchCriteria::leaf(T::Flagged);
+		if (key == "RECENT") return SearchCriteria::leaf(T::Recent);
+		if (key == "SEEN") return SearchCriteria::leaf(T::Seen);
+		if (key == "UNANSWERED") return SearchCriteria::negate(SearchCriteria::leaf(T::Answered));
+		if (key == "UNDELETED") return SearchCriteria::negate(SearchCriteria::leaf(T::Deleted));
+		if (key == "UNDRAFT") return SearchCriteria::negate(SearchCriteria::leaf(T::Draft));
+		if (key == "UNFLAGGED") return SearchCriteria::negate(SearchCriteria::leaf(T::Flagged));
+		if (key == "UNSEEN") return SearchCriteria::negate(SearchCriteria::leaf(T::Seen));
+		if (key == "OLD") return SearchCriteria::negate(SearchCriteria::leaf(T::Recent));
+		if (key == "NEW")
+		{
+			SearchCriteria c = SearchCriteria::leaf(T::And);
+			c.children.push_back(SearchCriteria::leaf(T::Recent));
+			c.children.push_back(SearchCriteria::negate(SearchCriteria::leaf(T::Seen)));
+			return c;
+		}
+
+		if (key == "BEFORE") return WithValue(T::Before, ImapDateToIso(Next()));
+		if (key == "ON") return WithValue(T::On, ImapDateToIso(Next()));
+		if (key == "SINCE") return WithValue(T::Since, ImapDateToIso(Next()));
+
+		if (key == "LARGER" || key == "SMALLER")
+		{
+			SearchCriteria c = SearchCriteria::leaf(key == "LARGER" ? T::Larger : T::Smaller);
+			c.number = std::stoll(Next());
+			return c;
+		}
+
+		if (key == "FROM") return WithValue(T::From, Next());
+		if (key == "TO") return WithValue(T::To, Next());
+		if (key == "CC") return WithValue(T::Cc, Next());
+		if (key == "BCC") return WithValue(T::Bcc, Next());
+		if (key == "SUBJECT") return WithValue(T::Subject, Next());
+		if (key == "BODY") return WithValue(T::Body, Next());
+		if (key == "TEXT") return WithValue(T::Text, Next());
+
+		if (key == "HEADER")
+		{
+			std::string field = ToUpper(Next());
+			const std::string& value = Next();
+			if (field == "FROM") return WithValue(T::From, value);
+			if (field == "TO") return WithValue(T::To, value);
+			if (field == "CC") return WithValue(T::Cc, value);
+			if (field == "BCC") return WithValue(T::Bcc, value);
+			if (field == "SUBJECT") return WithValue(T::Subject, value);
+			if (field == "MESSAGE-ID") return WithValue(T::MessageID, value);
+			throw std::invalid_argument("Unsupported header in search: " + field);
+		}
+
+		if (key == "KEYWORD") return WithValue(T::Keyword, Next());
+		if (key == "UNKEYWORD") return SearchCriteria::negate(WithValue(T::Keyword, Next()));
+
+		if (key == "NOT") return SearchCriteria::negate(ParseKey(depth + 1));
+		if (key == "OR")
+		{
+			SearchCriteria c = SearchCriteria::leaf(T::Or);
+			c.children.push_back(ParseKey(depth + 1));
+			c.children.push_back(ParseKey(depth + 1));
+			return c;
+		}
+
+		if (key == "UID")
+		{
+			int64_t max_uid = m_uids.empty() ? 0 : m_uids.back();
+			return UidRanges(ParseSequenceRanges(Next(), max_uid));
+		}
+
+		throw std::invalid_argument("Unsupported search key: " + token);
+	}
+};
+
+} // namespace
+
+SearchCriteria ParseSearchCriteria(const std::vector<std::string>& args, const std::vector<int64_t>& folder_uids)
+{
+	std::vector<std::string> tokens = args;
+	if (tokens.size() >= 2 && ToUpper(tokens[0]) == "CHARSET")
+	{
+		std::string charset = ToUpper(tokens[1]);
+		if (charset != "UTF-8" && charset != "US-ASCII")
+		{
+			throw std::invalid_argument("[BADCHARSET (UTF-8 US-ASCII)] Unsupported charset");
+		}
+		tokens.erase(tokens.begin(), tokens.begin() + 2);
+	}
+
+	if (tokens.empty())
+	{
+		throw std::invalid_argument("Missing search criteria");
+	}
+
+	return SearchProgramParser(tokens, folder_uids).ParseAll();
+}
+
+std::vector<SortKey> ParseSortCriteria(const std::string& arg)
+{
+	using F = SortKey::Field;
+	static const std::unordered_map<std::string, F> fields = {
+		{"ARRIVAL", F::Arrival}, {"CC", F::Cc},			  {"DATE", F::Date}, {"FROM", F::From},
+		{"SIZE", F::Size},		 {"SUBJECT", F::Subject}, {"TO", F::To}};
+
+	std::vector<SortKey> keys;
+	bool reverse = false;
+	for (const auto& token : SplitArgs(TrimParentheses(arg)))
+	{
+		std::string upper = ToUpper(token);
+		if (upper == "REVERSE")
+		{
+			reverse = true;
+			continue;
+		}
+
+		auto it = fields.find(upper);
+		if (it == fields.end())
+		{
+			throw std::invalid_argument("Unsupported sort key: " + token);
+		}
+		keys.push_back(SortKey{it->second, reverse});
+		reverse = false;
+	}
+
+	if (keys.empty() || reverse)
+	{
+		throw std::invalid_argument("Invalid sort criteria: " + arg);
+	}
+	return keys;
+}
+
+namespace
+{
+
+struct ThreadNode
+{
+	int64_t m_uid = 0;
+	std::vector<size_t> m_children;
+};
+
+// "3 6 (4 23)(44 7 96)": a single child continues the chain, siblings are parenthesized
+std::string FormatThreadNode(const std::vector<ThreadNode>& nodes, size_t index)
+{
+	std::string result = std::to_string(nodes[index].m_uid);
+	const ThreadNode* current = &nodes[index];
+	while (current->m_children.size() == 1)
+	{
+		current = &nodes[current->m_children[0]];
+		result += " " + std::to_string(current->m_uid);
+	}
+
+	if (!current->m_children.empty())
+	{
+		result += " ";
+		for (size_t child : current->m_children)
+		{
+			result += "(" + FormatThreadNode(nodes, child) + ")";
+		}
+	}
+	return result;
+}
+
+// one top-level thread; several roots share a dummy parent
+std::string FormatThread(const std::vector<ThreadNode>& nodes, const std::vector<size_t>& roots)
+{
+	if (roots.size() == 1)
+	{
+		return "(" + FormatThreadNode(nodes, roots[0]) + ")";
+	}
+
+	std::string result = "(";
+	for (size_t root : roots)
+	{
+		result += "(" + FormatThreadNode(nodes, root) + ")";
+	}
+	return result + ")";
+}
+
+// Rows is std::vector<Message> or MessageRowSet
+template <typename Rows>
+std::string ThreadByReferences(const Rows& messages)
+{
+	std::vector<int64_t> thread_order;
+	std::unordered_map<int64_t, std::vector<size_t>> threads;
+	for (size_t i = 0; i < messages.size(); ++i)
+	{
+		int64_t thread_id = messages[i].thread_id.value_or(messages[i].id.value_or(0));
+		auto& members = threads[thread_id];
+		if (members.empty()) thread_order.push_back(thread_id);
+		members.push_back(i);
+	}
+
+	std::string result;
+	for (int64_t thread_id : thread_order)
+	{
+		const auto& members = threads[thread_id];
+
+		std::vector<ThreadNode> nodes(members.size());
+		std::unordered_map<std::string, size_t> by_message_id;
+		for (size_t n = 0; n < members.size(); ++n)
+		{
+			const auto& msg = messages[members[n]];
+			nodes[n].m_uid = msg.uid;
+			if (msg.message_id_header.has_value()) by_message_id.emplace(std::string(*msg.message_id_header), n);
+		}
+
+		std::vector<size_t> parent(members.size(), SIZE_MAX);
+		auto creates_cycle = [&](size_t node, size_t candidate)
+		{
+			for (size_t p = candidate; p != SIZE_MAX; p = parent[p])
+			{
+				if (p == node) return true;
+			}
+			return false;
+		};
+
+		for (size_t n = 0; n < members.size(); ++n)
+		{
+			const auto& msg = messages[members[n]];
+			std::vector<std::string> ancestors;
+			if (msg.in_reply_to.has_value()) ancestors.emplace_back(*msg.in_reply_to);
+			if (msg.references_header.has_value())
+			{
+				auto refs = SplitArgs(std::string(*msg.references_header));
+				ancestors.insert(ancestors.end(), refs.rbegin(), refs.rend());
+			}
+
+			for (const auto& ancestor : ancestors)
+			{
+				auto it = by_message_id.find(ancestor);
+				if (it == by_message_id.end() || it->second == n || creates_cycle(n, it->second)) continue;
+				parent[n] = it->second;
+				break;
+			}
+		}
+
+		std::vector<size_t> roots;
+		for (size_t n = 0; n < members.size(); ++n)
+		{
+			if (parent[n] == SIZE_MAX)
+				roots.push_back(n);
+			else
+				nodes[parent[n]].m_children.push_back(n);
+		}
+
+		result += FormatThread(nodes, roots);
+	}
+	return result;
+}
+
+template <typename Rows>
+std::string ThreadByOrderedSubject(const Rows& messages)
+{
+	std::vector<std::string> subject_order;
+	std::unordered_map<std::string, std::vector<size_t>> groups;
+	for (size_t i = 0; i < messages.size(); ++i)
+	{
+		std::string subject(messages[i].sort_subject);
+		auto& members = groups[subject];
+		if (members.empty()) subject_order.push_back(subject);
+		members.push_back(i);
+	}
+
+	std::string result;
+	for (const auto& subject : subject_order)
+	{
+		const auto& members = groups[subject];
+
+		// the earliest message is the parent of all the others
+		std::vector<ThreadNode> nodes(members.size());
+		for (size_t n = 0; n < members.size(); ++n)
+		{
+			nodes[n].m_uid = messages[members[n]].uid;
+			if (n > 0) nodes[0].m_children.push_back(n);
+		}
+		result += FormatThread(nodes, {0});
+	}
+	return result;
+}
+
+template <typename Rows>
+std::string FormatThreadsOf(const Rows& messages, const std::string& algorithm)
+{
+	std::string upper = ToUpper(algorithm);
+	if (upper == "REFERENCES")
+	{
+		return ThreadByReferences(messages);
+	}
+	if (upper == "ORDEREDSUBJECT")
+	{
+		return ThreadByOrderedSubject(messages);
+	}
+	throw std::invalid_argument("Unsupported thread algorithm: " + algorithm);
+}
+
+} // namespace
+
+std::string FormatThreads(const std::vector<Message>& messages, const std::string& algorithm)
+{
+	return FormatThreadsOf(messages, algorithm);
+}
+
+std::string FormatThreads(const MessageRowSet& messages, const std::string& algorithm)
+{
+	return FormatThreadsOf(messages, algorithm);
+}
+
+std::optional<LiteralSpec> ParseLiteralSpec(const std::string& line)
+{
+	if (line.empty() || line.back() != '}') return std::nullopt;
+
+	size_t open = line.rfind('{');
+	if (open == std::string::npos) return std::nullopt;
+
+	std::string digits = line.substr(open + 1, line.size() - open - 2);
+	LiteralSpec spec;
+	spec.m_offset = open;
+	if (!digits.empty() && digits.back() == '+')
+	{
+		spec.m_synchronizing = false;
+		digits.pop_back();
+	}
+
+	if (digits.empty() || digits.size() > 18 ||
+		!std::all_of(digits.begin(), digits.end(), [](unsigned char c) { return std::isdigit(c); }))
+	{
+		return std::nullopt;
+	}
+
+	spec.m_size = std::stoll(digits);
+	return spec;
+}
+
+std::string ImapDateTimeToInternal(const std::string& date_time)
+{
+	static const char* months[] = {"JAN", "FEB", "MAR", "APR", "MAY", "JUN",
+								   "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"};
+
+	// "17-Jul-1996 02:44:25 -0700", the day may be space-padded
+	int day = 0, year = 0, hour = 0, minute = 0, second = 0;
+	char month_name[4] = {}, sign = 0;
+	int zone = 0;
+	if (std::sscanf(date_time.c_str(), " %d-%3s-%d %d:%d:%d %c%4d", &day, month_name, &year, &hour, &minute, &second,
+					&sign, &zone) != 8 ||
+		(sign != '+' && sign != '-'))
+	{
+		throw std::invalid_argument("Invalid date-time: " + date_time);
+	}
+
+	int month = 0;
+	std::string upper_month = ToUpper(month_name);
+	for (int i = 0; i < 12; ++i)
+	{
+		if (upper_month == months[i]) month = i + 1;
+	}
+	if (month == 0 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+	{
+		throw std::invalid_argument("Invalid date-time: " + date_time);
+	}
+
+	std::tm tm{};
+	tm.tm_year = year - 1900;
+	tm.tm_mon = month - 1;
+	tm.tm_mday = day;
+	tm.tm_hour = hour;
+	tm.tm_min = minute;
+	tm.tm_sec = second;
+
+	int offset = ((zone / 100) * 60 + zone % 100) * 60;
+	std::time_t utc = timegm(&tm) - (sign == '+' ? offset : -offset);
+
+	char buf[32];
+	std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::gmtime(&utc));
+	return buf;
+}
+
+std::unordered_map<std::string, std::string> ReadHeaderFields(const std::string& path, size_t max_bytes)
+{
+	std::unordered_map<std::string, std::string> fields;
+	std::ifstream file(path, std::ios::binary);
+
+	std::string line, name, value;
+	size_t consumed = 0;
+	auto flush = [&]()
+	{
+		if (!name.empty()) fields.emplace(ToUpper(name), SmtpClient::StringUtils::Trim(value));
+		name.clear();
+		value.clear();
+	};
+
+	while (consumed < max_bytes && std::getline(file, line))
+	{
+		consumed += line.size() + 1;
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty()) break;
+
+		if (line[0] == ' ' || line[0] == '\t')
+		{
+			value += " " + SmtpClient::StringUtils::Trim(line);
+			continue;
+		}
+
+		flush();
+		size_t colon = line.find(':');
+		if (colon == std::string::npos) continue;
+		name = line.substr(0, colon);
+		value = line.substr(colon + 1);
+	}
+	flush();
+
+	return fields;
+}
+
+std::string GenerateMailFilename()
+{
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+
+	static thread_local std::mt19937 gen(std::random_device{}());
+	std::uniform_int_distribution<> dist(0, 15);
+	const char* hex = "0123456789abcdef";
+	std::string rnd;
+	for (int i = 0; i < 16; ++i)
+	{
+		rnd += hex[dist(gen)];
+	}
+
+	return std::to_string(ms) + "_" + rnd + ".eml";
+}
+
+namespace
+{
+
+bool MatchWildcards(std::string_view name, std::string_view pattern, char delimiter)
+{
+	while (!pattern.empty() && pattern.front() != '*' && pattern.front() != '%')
+	{
+		if (name.empty() || name.front() != pattern.front()) return false;
+		name.remove_prefix(1);
+		pattern.remove_prefix(1);
+	}
+	if (pattern.empty()) return name.empty();
+
+	char wildcard = pattern.front();
+	pattern.remove_prefix(1);
+	for (std::size_t taken = 0;; ++taken)
+	{
+		if (MatchWildcards(name.substr(taken), pattern, delimiter)) return true;
+		if (taken == name.size() || (wildcard == '%' && name[taken] == delimiter)) return false;
+	}
+}
+
+bool StartsWithInbox(std::string_view str, char delimiter)
+{
+	return str.size() >= 5 && ToUpper(std::string(str.substr(0, 5))) == "INBOX" &&
+		   (str.size() == 5 || str[5] == delimiter);
+}
+
+const std::set<std::string> STATUS_ITEMS = {"MESSAGES", "RECENT", "UIDNEXT", "UIDVALIDITY", "UNSEEN"};
+
+} // namespace
+
+bool MatchMailboxPattern(std::string_view name, std::string_view pattern, char delimiter)
+{
+	if (StartsWithInbox(name, delimiter) && StartsWithInbox(pattern, delimiter))
+	{
+		name.remove_prefix(5);
+		pattern.remove_prefix(5);
+	}
+	return MatchWildcards(name, pattern, delimiter);
+}
+
+bool ParseListReturnOptions(const std::string& arg, std::vector<std::string>& status_items)
+{
+	std::string options = TrimParentheses(arg);
+	std::size_t pos = 0;
+	while (pos < options.size())
+	{
+		if (options[pos] == ' ')
+		{
+			++pos;
+			continue;
+		}
+
+		std::size_t end = options.find_first_of(" (", pos);
+		std::string option = ToUpper(options.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+		pos = end == std::string::npos ? options.size() : end;
+
+		if (option == "CHILDREN")
+		{
+			continue; // \HasChildren / \HasNoChildren are always returned
+		}
+		if (option != "STATUS")
+		{
+			return false;
+		}
+
+		std::size_t open = options.find('(', pos);
+		std::size_t close = options.find(')', pos);
+		if (open == std::string::npos || close == std::string::npos || close < open ||
+			options.find_first_not_of(' ', pos) != open)
+		{
+			return false;
+		}
+
+		for (auto& item : SplitArgs(options.substr(open + 1, close - open - 1)))
+		{
+			item = ToUpper(item);
+			if (STATUS_ITEMS.count(item) == 0) return false;
+			status_items.push_back(item);
+		}
+		if (status_items.empty()) return false;
+		pos = close + 1;
+	}
+	return true;
+}
+
+int64_t UidValidity(const Folder& folder)
+{
+	int64_t value = ShardRouter::localID(folder.id.value_or(0));
+	if (value <= 0 || value > static_cast<int64_t>(UINT32_MAX))
+		throw std::out_of_range("UIDVALIDITY does not fit in 32 bits");
+	return value;
+}
+
+bool FormatStatusItems(const std::vector<std::string>& items, const Folder& folder, const FolderStatus& status,
+					   std::string& out)
+{
+	bool known = false;
+	for (const auto& item : items)
+	{
+		std::string value;
+		if (item == "MESSAGES")
+			value = std::to_string(status.messages);
+		else if (item == "RECENT")
+			value = std::to_string(status.recent);
+		else if (item == "UIDNEXT")
+			value = std::to_string(folder.next_uid);
+		else if (item == "UIDVALIDITY")
+			value = std::to_string(UidValidity(folder));
+		else if (item == "UNSEEN")
+			value = std::to_string(status.unseen);
+		else
+			continue;
+
+		if (known) out += ' ';
+		out += item + " " + value;
+		known = true;
+	}
+	return known;
+}
+
 } // namespace IMAP_UTILS
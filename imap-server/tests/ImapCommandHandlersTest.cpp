@@ -15,6 +15,7 @@
 #include "ImapCommandDispatcher.hpp"
 #include "Repository/MessageRepository.h"
 #include "Repository/UserRepository.h"
+#include "ShardRouter.h"
 #include "schema.h"
 
 static std::string tempDbPath()
@@ -309,6 +310,7 @@ TEST_F(CmdHandlerTests, HandleSelect_Success)
 						   "* OK [UNSEEN 4]\r\n"
 						   "* 4 EXISTS\r\n"
 						   "* OK [UIDNEXT 5]\r\n"
+						   "* OK [HIGHESTMODSEQ 4]\r\n"
 						   "* 4 RECENT\r\n"
 						   "A002 OK [READ-WRITE] Select completed\r\n";
 	EXPECT_EQ(response, expected);
@@ -334,6 +336,7 @@ TEST_F(CmdHandlerTests, HandleSelect_SuccessDifferentFolder)
 						   "* OK [UNSEEN 1]\r\n"
 						   "* 1 EXISTS\r\n"
 						   "* OK [UIDNEXT 2]\r\n"
+						   "* OK [HIGHESTMODSEQ 1]\r\n"
 						   "* 1 RECENT\r\n"
 						   "A002 OK [READ-WRITE] Select completed\r\n";
 	EXPECT_EQ(response, expected);
@@ -357,6 +360,65 @@ TEST_F(CmdHandlerTests, HandleSelect_MailboxNotFound)
 	EXPECT_EQ(dispatcher->get_State(), SessionState::Authenticated);
 }
 
+TEST(CmdHandlerShardTests, HandleSelect_FolderOnShardOne_UidValidityFits)
+{
+	ASSERT_GE(sodium_init(), 0);
+
+	std::string base = (std::filesystem::temp_directory_path() / "test_cmd_handler_shards").string();
+	auto cleanup = [&]
+	{
+		for (const std::string& file : {base + ".directory.db", base + ".shard0.db", base + ".shard1.db"})
+			for (const char* suffix : {"", "-wal", "-shm"})
+				std::filesystem::remove(file + suffix);
+	};
+	cleanup();
+
+	{
+		ShardRouter router(base, 2, initSchema());
+		ASSERT_TRUE(router.isConnected());
+		UserRepository userRepo(router);
+		MessageRepository messRepo(router);
+		::testing::NiceMock<MockLogger> logger;
+		ImapCommandDispatcher dispatcher(logger, userRepo, messRepo);
+
+		User user;
+		for (int i = 0; user.username.empty() || router.shardOfUser(user.username) != 1; ++i)
+			user.username = "shard_user_" + std::to_string(i);
+		ASSERT_TRUE(userRepo.registerUser(user, "pass123")) << userRepo.getLastError();
+
+		auto inbox = messRepo.findFolderByName(user.id.value(), "INBOX");
+		ASSERT_TRUE(inbox.has_value());
+		ASSERT_EQ(router.shardOfID(inbox->id.value()), 1u);
+		ASSERT_GT(inbox->id.value(), int64_t{UINT32_MAX});
+		std::string uidvalidity = std::to_string(ShardRouter::localID(inbox->id.value()));
+
+		ImapCommand login;
+		login.m_tag = "A000";
+		login.m_type = ImapCommandType::Login;
+		login.m_args = {user.username, "pass123"};
+		dispatcher.Dispatch(login);
+
+		ImapCommand status;
+		status.m_tag = "A001";
+		status.m_type = ImapCommandType::Status;
+		status.m_args = {"INBOX", "(UIDVALIDITY)"};
+		EXPECT_EQ(dispatcher.Dispatch(status),
+				  "* STATUS INBOX (UIDVALIDITY " + uidvalidity + ")\r\nA001 OK Status completed\r\n");
+
+		ImapCommand select;
+		select.m_tag = "A002";
+		select.m_type = ImapCommandType::Select;
+		select.m_args = {"INBOX"};
+		std::string response = dispatcher.Dispatch(select);
+
+		EXPECT_THAT(response, testing::HasSubstr("* OK [UIDVALIDITY " + uidvalidity + "]\r\n"));
+		EXPECT_THAT(response, testing::HasSubstr("A002 OK [READ-WRITE] Select completed"));
+		EXPECT_EQ(dispatcher.get_State(), SessionState::Selected);
+	}
+
+	cleanup();
+}
+
 TEST_F(CmdHandlerTests, HandleList_AfterLogin_AllFolders)
 {
 	Login("alice");
@@ -937,7 +999,7 @@ TEST_F(CmdHandlerTests, HandleCopy_Success)
 
 	std::string response = dispatcher->Dispatch(cmd);
 
-	std::string expected = "A002 OK Copy completed\r\n";
+	std::string expected = "A002 OK [COPYUID 2 1 2] Copy completed\r\n";
 	EXPECT_EQ(response, expected);
 }
 
@@ -952,7 +1014,7 @@ TEST_F(CmdHandlerTests, HandleCopy_MultipleMessages)
 
 	std::string response = dispatcher->Dispatch(cmd);
 
-	std::string expected = "A002 OK Copy completed\r\n";
+	std::string expected = "A002 OK [COPYUID 2 1:2 2:3] Copy completed\r\n";
 	EXPECT_EQ(response, expected);
 }
 
@@ -1078,7 +1140,7 @@ TEST_F(CmdHandlerTests, HandleCapability_NoAuthRequired)
 
 	std::string response = dispatcher->Dispatch(cmd);
 
-	std::string expected = "* CAPABILITY IMAP4rev1\r\n";
+	std::string expected = "* CAPABILITY IMAP4rev1 ENABLE CONDSTORE QRESYNC SORT THREAD=REFERENCES THREAD=ORDEREDSUBJECT COMPRESS=DEFLATE LITERAL+ MULTIAPPEND MOVE LIST-STATUS\r\n";
 	EXPECT_THAT(response, testing::HasSubstr(expected));
 }
 
@@ -1282,7 +1344,7 @@ TEST_F(CmdHandlerTests, HandleUidCopy_Success)
 
 	std::string response = dispatcher->Dispatch(cmd);
 
-	EXPECT_EQ(response, "A002 OK Uid Copy completed\r\n");
+	EXPECT_EQ(response, "A002 OK [COPYUID 2 1 2] Uid Copy completed\r\n");
 }
 
 TEST_F(CmdHandlerTests, HandleUidCopy_MultipleMessages)
@@ -1296,7 +1358,7 @@ TEST_F(CmdHandlerTests, HandleUidCopy_MultipleMessages)
 
 	std::string response = dispatcher->Dispatch(cmd);
 
-	EXPECT_EQ(response, "A002 OK Uid Copy completed\r\n");
+	EXPECT_EQ(response, "A002 OK [COPYUID 2 1:3 2:4] Uid Copy completed\r\n");
 }
 
 TEST_F(CmdHandlerTests, HandleUidCopy_DestinationNotFound)
@@ -1538,6 +1600,60 @@ TEST_F(CmdHandlerTests, HandleList_WithReference)
 	EXPECT_THAT(response, testing::HasSubstr("A001 OK"));
 }
 
+TEST_F(CmdHandlerTests, HandleList_ChildrenAndPercent)
+{
+	Login("alice");
+
+	ImapCommand list;
+	list.m_tag = "A001";
+	list.m_type = ImapCommandType::List;
+	list.m_args = {"", "Archive*"};
+	EXPECT_THAT(dispatcher->Dispatch(list), testing::HasSubstr("* LIST (\\HasNoChildren) \"/\" \"Archive\"\r\n"));
+
+	// the cached tree is dropped by CREATE
+	ImapCommand create;
+	create.m_tag = "A002";
+	create.m_type = ImapCommandType::Create;
+	create.m_args = {"Archive/2024"};
+	ASSERT_EQ(dispatcher->Dispatch(create), "A002 OK Create completed\r\n");
+
+	list.m_tag = "A003";
+	std::string response = dispatcher->Dispatch(list);
+	EXPECT_THAT(response, testing::HasSubstr("* LIST (\\HasChildren) \"/\" \"Archive\"\r\n"));
+	EXPECT_THAT(response, testing::HasSubstr("* LIST (\\HasNoChildren) \"/\" \"Archive/2024\"\r\n"));
+	EXPECT_THAT(response, testing::Not(testing::HasSubstr("INBOX")));
+
+	list.m_tag = "A004";
+	list.m_args = {"", "%"};
+	response = dispatcher->Dispatch(list);
+	EXPECT_THAT(response, testing::HasSubstr("\"Archive\"\r\n"));
+	EXPECT_THAT(response, testing::Not(testing::HasSubstr("Archive/2024")));
+
+	list.m_tag = "A005";
+	list.m_args = {"Archive/", "%"};
+	response = dispatcher->Dispatch(list);
+	EXPECT_EQ(response, "* LIST (\\HasNoChildren) \"/\" \"Archive/2024\"\r\nA005 OK List completed\r\n");
+}
+
+TEST_F(CmdHandlerTests, HandleList_ReturnStatus)
+{
+	Login("alice");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A001";
+	cmd.m_type = ImapCommandType::List;
+	cmd.m_args = {"", "INBOX", "RETURN", "(STATUS (MESSAGES UIDNEXT))"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	EXPECT_EQ(response, "* LIST (\\HasNoChildren) \"/\" \"INBOX\"\r\n"
+						"* STATUS \"INBOX\" (MESSAGES 4 UIDNEXT 5)\r\n"
+						"A001 OK List completed\r\n");
+
+	cmd.m_args[3] = "(STATUS (BOGUS))";
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "A001 BAD Invalid return options\r\n");
+}
+
 TEST_F(CmdHandlerTests, HandleLsub_WildcardAsterisk)
 {
 	Login("alice");
@@ -1755,6 +1871,32 @@ TEST_F(CmdHandlerTests, HandleStore_InvalidFlags)
 	EXPECT_EQ(response, expected);
 }
 
+TEST_F(CmdHandlerTests, HandleStore_KeywordsAreKeptAndSearchable)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Store;
+	cmd.m_args = {"1", "+FLAGS", "(\\Flagged Work)"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	EXPECT_THAT(response, testing::HasSubstr("\\Flagged"));
+	EXPECT_THAT(response, testing::HasSubstr("Work)"));
+	EXPECT_THAT(response, testing::HasSubstr("A002 OK"));
+
+	cmd.m_tag = "A003";
+	cmd.m_type = ImapCommandType::Search;
+	cmd.m_args = {"KEYWORD", "work"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "* SEARCH 1\r\nA003 OK Search completed\r\n");
+
+	cmd.m_tag = "A004";
+	cmd.m_type = ImapCommandType::Store;
+	cmd.m_args = {"1", "-FLAGS", "(Work)"};
+	EXPECT_THAT(dispatcher->Dispatch(cmd), testing::Not(testing::HasSubstr("Work")));
+}
+
 TEST_F(CmdHandlerTests, HandleCreate_InvalidName)
 {
 	Login("alice");
@@ -1824,7 +1966,7 @@ TEST_F(CmdHandlerTests, HandleCopy_ToSelf)
 
 	std::string response = dispatcher->Dispatch(cmd);
 
-	std::string expected = "A002 OK Copy completed\r\n";
+	std::string expected = "A002 OK [COPYUID 1 1 5] Copy completed\r\n";
 	EXPECT_EQ(response, expected);
 }
 
@@ -1935,7 +2077,7 @@ TEST_F(CmdHandlerTests, HandleUidCopy_ToSelf)
 
 	std::string response = dispatcher->Dispatch(cmd);
 
-	std::string expected = "A002 OK Uid Copy completed\r\n";
+	std::string expected = "A002 OK [COPYUID 1 1 5] Uid Copy completed\r\n";
 	EXPECT_EQ(response, expected);
 }
 
@@ -2173,4 +2315,524 @@ TEST_F(CmdHandlerTests, HandleUidFetch_MultipleDataItems)
 	EXPECT_THAT(response, testing::HasSubstr("ENVELOPE"));
 	EXPECT_THAT(response, testing::HasSubstr("Hello Bob"));
 	EXPECT_THAT(response, testing::HasSubstr("A002 OK"));
-}
\ No newline at end of file
+}
+TEST_F(CmdHandlerTests, HandleEnable_CondstoreQresync)
+{
+	Login("alice");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Enable;
+	cmd.m_args = {"CONDSTORE", "QRESYNC", "X-UNKNOWN"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	std::string expected = "* ENABLED CONDSTORE QRESYNC\r\nA002 OK Enable completed\r\n";
+	EXPECT_EQ(response, expected);
+}
+
+TEST_F(CmdHandlerTests, HandleSelect_Qresync_ReportsOnlyChanges)
+{
+	Login("alice");
+	auto inbox = messRepo->findFolderByName(1, "INBOX");
+	ASSERT_TRUE(inbox.has_value());
+
+	auto msg2 = messRepo->findByUID(inbox->id.value(), 2);
+	auto msg3 = messRepo->findByUID(inbox->id.value(), 3);
+	ASSERT_TRUE(msg2.has_value() && msg3.has_value());
+	ASSERT_TRUE(messRepo->markSeen(msg2->id.value(), true));	 // modseq 5
+	ASSERT_TRUE(messRepo->markDeleted(msg3->id.value(), true)); // modseq 6
+	ASSERT_TRUE(messRepo->expunge(inbox->id.value()));			 // modseq 7
+
+	ImapCommand enable;
+	enable.m_tag = "A001";
+	enable.m_type = ImapCommandType::Enable;
+	enable.m_args = {"QRESYNC"};
+	dispatcher->Dispatch(enable);
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Select;
+	cmd.m_args = {"INBOX", "(QRESYNC (" + std::to_string(inbox->id.value()) + " 4))"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	EXPECT_THAT(response, testing::HasSubstr("* OK [HIGHESTMODSEQ 7]\r\n"));
+	EXPECT_THAT(response, testing::HasSubstr("* VANISHED (EARLIER) 3\r\n"));
+	EXPECT_THAT(response, testing::HasSubstr("* 2 FETCH (UID 2 FLAGS (\\Seen \\Answered \\Flagged) MODSEQ (5))\r\n"));
+	EXPECT_THAT(response, testing::Not(testing::HasSubstr("UID 1 ")));
+	EXPECT_THAT(response, testing::HasSubstr("A002 OK [READ-WRITE] Select completed"));
+}
+
+TEST_F(CmdHandlerTests, HandleSelect_Qresync_UidValidityMismatch_NoResync)
+{
+	Login("alice");
+
+	ImapCommand enable;
+	enable.m_tag = "A001";
+	enable.m_type = ImapCommandType::Enable;
+	enable.m_args = {"QRESYNC"};
+	dispatcher->Dispatch(enable);
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Select;
+	cmd.m_args = {"INBOX", "(QRESYNC (999 0))"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	EXPECT_THAT(response, testing::Not(testing::HasSubstr("FETCH")));
+	EXPECT_THAT(response, testing::Not(testing::HasSubstr("VANISHED")));
+	EXPECT_THAT(response, testing::HasSubstr("A002 OK [READ-WRITE] Select completed"));
+}
+
+TEST_F(CmdHandlerTests, HandleSelect_QresyncWithoutEnable_Bad)
+{
+	Login("alice");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Select;
+	cmd.m_args = {"INBOX", "(QRESYNC (1 0))"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	EXPECT_EQ(response, "A002 BAD QRESYNC is not enabled\r\n");
+}
+
+TEST_F(CmdHandlerTests, HandleFetch_ChangedSince_ReturnsOnlyChangedMessages)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand store;
+	store.m_tag = "A002";
+	store.m_type = ImapCommandType::Store;
+	store.m_args = {"3", "+FLAGS.SILENT", "(\\Flagged)"};
+	dispatcher->Dispatch(store);
+
+	ImapCommand cmd;
+	cmd.m_tag = "A003";
+	cmd.m_type = ImapCommandType::Fetch;
+	cmd.m_args = {"1:*", "(FLAGS)", "(CHANGEDSINCE 4)"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	std::string expected = "* 3 FETCH (FLAGS (\\Flagged) MODSEQ (5))\r\nA003 OK Fetch completed\r\n";
+	EXPECT_EQ(response, expected);
+}
+
+TEST_F(CmdHandlerTests, HandleUidFetch_ChangedSinceVanished_ReportsExpunged)
+{
+	Login("alice");
+
+	ImapCommand enable;
+	enable.m_tag = "A001";
+	enable.m_type = ImapCommandType::Enable;
+	enable.m_args = {"QRESYNC"};
+	dispatcher->Dispatch(enable);
+
+	ImapCommand select;
+	select.m_tag = "A002";
+	select.m_type = ImapCommandType::Select;
+	select.m_args = {"INBOX"};
+	dispatcher->Dispatch(select);
+
+	ImapCommand store;
+	store.m_tag = "A003";
+	store.m_type = ImapCommandType::UidStore;
+	store.m_args = {"3", "+FLAGS.SILENT", "(\\Deleted)"};
+	dispatcher->Dispatch(store);
+
+	ImapCommand expunge;
+	expunge.m_tag = "A004";
+	expunge.m_type = ImapCommandType::Expunge;
+	dispatcher->Dispatch(expunge);
+
+	ImapCommand cmd;
+	cmd.m_tag = "A005";
+	cmd.m_type = ImapCommandType::UidFetch;
+	cmd.m_args = {"1:*", "(FLAGS)", "(CHANGEDSINCE 4 VANISHED)"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	std::string expected = "* VANISHED (EARLIER) 3\r\nA005 OK Uid Fetch completed\r\n";
+	EXPECT_EQ(response, expected);
+}
+
+TEST_F(CmdHandlerTests, HandleExpunge_QresyncEnabled_ReportsVanished)
+{
+	Login("alice");
+
+	ImapCommand enable;
+	enable.m_tag = "A001";
+	enable.m_type = ImapCommandType::Enable;
+	enable.m_args = {"QRESYNC"};
+	dispatcher->Dispatch(enable);
+
+	ImapCommand select;
+	select.m_tag = "A002";
+	select.m_type = ImapCommandType::Select;
+	select.m_args = {"INBOX"};
+	dispatcher->Dispatch(select);
+
+	ImapCommand store;
+	store.m_tag = "A003";
+	store.m_type = ImapCommandType::UidStore;
+	store.m_args = {"2:3", "+FLAGS.SILENT", "(\\Deleted)"};
+	dispatcher->Dispatch(store);
+
+	ImapCommand expunge;
+	expunge.m_tag = "A004";
+	expunge.m_type = ImapCommandType::Expunge;
+
+	EXPECT_EQ(dispatcher->Dispatch(expunge), "* VANISHED 2:3\r\nA004 OK Expunge completed\r\n");
+}
+
+TEST_F(CmdHandlerTests, HandleMove_QresyncEnabled_ReportsVanished)
+{
+	Login("alice");
+
+	ImapCommand enable;
+	enable.m_tag = "A001";
+	enable.m_type = ImapCommandType::Enable;
+	enable.m_args = {"QRESYNC"};
+	dispatcher->Dispatch(enable);
+
+	ImapCommand select;
+	select.m_tag = "A002";
+	select.m_type = ImapCommandType::Select;
+	select.m_args = {"INBOX"};
+	dispatcher->Dispatch(select);
+
+	ImapCommand cmd;
+	cmd.m_tag = "A003";
+	cmd.m_type = ImapCommandType::Move;
+	cmd.m_args = {"1,3", "Sent"};
+
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "* OK [COPYUID 2 1,3 2:3] Moved\r\n"
+										 "* VANISHED 1,3\r\n"
+										 "A003 OK Move completed\r\n");
+}
+
+TEST_F(CmdHandlerTests, HandleUidFetch_VanishedWithoutQresync_Bad)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::UidFetch;
+	cmd.m_args = {"1:*", "(FLAGS)", "(CHANGEDSINCE 1 VANISHED)"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	EXPECT_THAT(response, testing::HasSubstr("A002 BAD"));
+}
+
+TEST_F(CmdHandlerTests, HandleStore_UnchangedSince_ReportsModified)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand first;
+	first.m_tag = "A002";
+	first.m_type = ImapCommandType::Store;
+	first.m_args = {"1", "+FLAGS.SILENT", "(\\Seen)"};
+	dispatcher->Dispatch(first);
+
+	ImapCommand cmd;
+	cmd.m_tag = "A003";
+	cmd.m_type = ImapCommandType::Store;
+	cmd.m_args = {"1:2", "(UNCHANGEDSINCE 4)", "+FLAGS", "(\\Draft)"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	std::string expected = "* 2 FETCH (FLAGS (\\Draft \\Answered \\Flagged) MODSEQ (6))\r\n"
+						   "A003 OK [MODIFIED 1] Conditional STORE failed\r\n";
+	EXPECT_EQ(response, expected);
+}
+
+TEST_F(CmdHandlerTests, HandleSearch_FlagsAndSubject)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Search;
+	cmd.m_args = {"FLAGGED"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "* SEARCH 2\r\nA002 OK Search completed\r\n");
+
+	cmd.m_tag = "A003";
+	cmd.m_args = {"OR", "SUBJECT", "hello", "SUBJECT", "third"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "* SEARCH 1 3\r\nA003 OK Search completed\r\n");
+
+	cmd.m_tag = "A004";
+	cmd.m_args = {"SUBJECT", "nothing-like-this"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "* SEARCH\r\nA004 OK Search completed\r\n");
+}
+
+TEST_F(CmdHandlerTests, HandleUidSearch_SequenceRangeAndNot)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::UidSearch;
+	cmd.m_args = {"2:*", "NOT", "FLAGGED"};
+
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "* SEARCH 3 4\r\nA002 OK Uid Search completed\r\n");
+}
+
+TEST_F(CmdHandlerTests, HandleSearch_InvalidCriteriaOrNoMailbox_Bad)
+{
+	Login("alice");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Search;
+	cmd.m_args = {"ALL"};
+	EXPECT_THAT(dispatcher->Dispatch(cmd), testing::HasSubstr("A002 BAD"));
+
+	ImapCommand select;
+	select.m_tag = "A003";
+	select.m_type = ImapCommandType::Select;
+	select.m_args = {"INBOX"};
+	dispatcher->Dispatch(select);
+
+	cmd.m_tag = "A004";
+	cmd.m_args = {"SENTSINCE", "1-Feb-1994"};
+	EXPECT_THAT(dispatcher->Dispatch(cmd), testing::HasSubstr("A004 BAD"));
+}
+
+TEST_F(CmdHandlerTests, HandleSearch_DeeplyNested_Bad)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Search;
+	cmd.m_args.assign(50000, "NOT");
+	cmd.m_args.push_back("ALL");
+
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "A002 BAD Invalid search criteria\r\n");
+}
+
+TEST_F(CmdHandlerTests, HandleSort_BySubject)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Sort;
+	cmd.m_args = {"(SUBJECT)", "UTF-8", "ALL"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "* SORT 1 4 2 3\r\nA002 OK Sort completed\r\n");
+
+	cmd.m_tag = "A003";
+	cmd.m_type = ImapCommandType::UidSort;
+	cmd.m_args = {"(REVERSE SUBJECT)", "US-ASCII", "NOT", "FLAGGED"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "* SORT 3 4 1\r\nA003 OK Uid Sort completed\r\n");
+
+	cmd.m_tag = "A004";
+	cmd.m_args = {"(SUBJECT)", "ALL"};
+	EXPECT_THAT(dispatcher->Dispatch(cmd), testing::HasSubstr("A004 BAD"));
+}
+
+TEST_F(CmdHandlerTests, HandleThread_ReferencesGroupsReplies)
+{
+	auto inbox = messRepo->findFolderByName(1, "INBOX");
+	ASSERT_TRUE(inbox.has_value());
+
+	auto addThreaded = [&](const std::string& subject, const std::string& id, const std::string& parent)
+	{
+		Message msg;
+		msg.user_id = 1;
+		msg.raw_file_path = tempMsgPath(subject);
+		msg.from_address = "bob@test.com";
+		msg.subject = subject;
+		msg.message_id_header = id;
+		if (!parent.empty()) msg.in_reply_to = parent;
+		msg.internal_date = "2024-02-01 12:00:00";
+		ASSERT_TRUE(messRepo->deliver(msg, inbox->id.value()));
+	};
+	addThreaded("Lunch", "<lunch@test.com>", "");
+	addThreaded("Re: Lunch", "<r1@test.com>", "<lunch@test.com>");
+	addThreaded("Re: Lunch", "<r2@test.com>", "<lunch@test.com>");
+
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::UidThread;
+	cmd.m_args = {"REFERENCES", "UTF-8", "ALL"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd),
+			  "* THREAD (1)(2)(3)(4)(5 (6)(7))\r\nA002 OK Uid Thread completed\r\n");
+
+	cmd.m_tag = "A003";
+	cmd.m_type = ImapCommandType::Thread;
+	cmd.m_args = {"ORDEREDSUBJECT", "UTF-8", "SUBJECT", "lunch"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "* THREAD (5 (6)(7))\r\nA003 OK Thread completed\r\n");
+}
+
+TEST_F(CmdHandlerTests, HandleCompress_DeflateOnlyOnce)
+{
+	Login("alice");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Compress;
+	cmd.m_args = {"LZW"};
+	EXPECT_THAT(dispatcher->Dispatch(cmd), testing::HasSubstr("A002 BAD"));
+
+	cmd.m_tag = "A003";
+	cmd.m_args = {"deflate"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "A003 OK DEFLATE active\r\n");
+
+	cmd.m_tag = "A004";
+	cmd.m_args = {"DEFLATE"};
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "A004 NO [COMPRESSIONACTIVE] DEFLATE active via COMPRESS\r\n");
+}
+
+TEST_F(CmdHandlerTests, HandleAppend_MultiAppendWithFlagsAndDate)
+{
+	Login("alice");
+
+	auto spool = [](const std::string& name, const std::string& subject)
+	{
+		std::string path = tempMsgPath(name);
+		std::ofstream file(path, std::ios::binary);
+		file << "From: carol@test.com\r\n";
+		file << "To: alice@test.com\r\n";
+		file << "Subject: " << subject << "\r\n";
+		file << "Message-ID: <" << name << "@test.com>\r\n";
+		file << "\r\n";
+		file << "Appended body\r\n";
+		return path;
+	};
+
+	auto inbox = messRepo->findFolderByName(dispatcher->get_AuthenticatedUserID().value(), "INBOX");
+	ASSERT_TRUE(inbox.has_value());
+	int64_t first_uid = inbox->next_uid;
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Append;
+	cmd.m_args = {"INBOX", "(\\Seen \\Flagged)", "17-Jul-1996 02:44:25 -0700", "{80}", "{80}"};
+	cmd.m_literals = {spool("append_one", "First appended"), spool("append_two", "Second appended")};
+
+	std::string expected = "A002 OK [APPENDUID " + std::to_string(inbox->id.value()) + " " +
+						   std::to_string(first_uid) + ":" + std::to_string(first_uid + 1) + "] Append completed\r\n";
+	EXPECT_EQ(dispatcher->Dispatch(cmd), expected);
+
+	auto first = messRepo->findByUID(inbox->id.value(), first_uid);
+	ASSERT_TRUE(first.has_value());
+	EXPECT_EQ(first->subject.value_or(""), "First appended");
+	EXPECT_EQ(first->from_address, "carol@test.com");
+	EXPECT_EQ(first->internal_date, "1996-07-17 09:44:25");
+	EXPECT_TRUE(first->is_seen);
+	EXPECT_TRUE(first->is_flagged);
+	EXPECT_TRUE(std::filesystem::exists(first->raw_file_path));
+
+	auto second = messRepo->findByUID(inbox->id.value(), first_uid + 1);
+	ASSERT_TRUE(second.has_value());
+	EXPECT_EQ(second->subject.value_or(""), "Second appended");
+	EXPECT_FALSE(second->is_seen);
+
+	// spool files are consumed by the append
+	for (const auto& path : cmd.m_literals)
+	{
+		EXPECT_FALSE(std::filesystem::exists(path));
+	}
+
+	std::filesystem::remove(first->raw_file_path);
+	std::filesystem::remove(second->raw_file_path);
+}
+
+TEST_F(CmdHandlerTests, HandleAppend_RejectsMissingMailboxAndBadDate)
+{
+	Login("alice");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Append;
+	cmd.m_args = {"NoSuchFolder", "{10}"};
+	cmd.m_literals = {tempMsgPath("append_missing")};
+	std::ofstream(cmd.m_literals[0]) << "Subject: x\r\n";
+	EXPECT_EQ(dispatcher->Dispatch(cmd), "A002 NO [TRYCREATE] No such folder\r\n");
+	EXPECT_FALSE(std::filesystem::exists(cmd.m_literals[0]));
+
+	cmd.m_tag = "A003";
+	cmd.m_args = {"INBOX", "31-Foo-2020 00:00:00 +0000", "{10}"};
+	EXPECT_THAT(dispatcher->Dispatch(cmd), testing::HasSubstr("A003 BAD"));
+
+	cmd.m_tag = "A004";
+	cmd.m_args = {"INBOX", "{10}"};
+	cmd.m_literals.clear();
+	EXPECT_THAT(dispatcher->Dispatch(cmd), testing::HasSubstr("A004 BAD"));
+}
+
+TEST_F(CmdHandlerTests, HandleFetch_PartialBodySection)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	auto fetch = [&](const std::string& item)
+	{
+		ImapCommand cmd;
+		cmd.m_tag = "A002";
+		cmd.m_type = ImapCommandType::Fetch;
+		cmd.m_args = {"4", "(" + item + ")"};
+		return dispatcher->Dispatch(cmd);
+	};
+
+	EXPECT_THAT(fetch("BODY.PEEK[1]<0.5>"), testing::HasSubstr("BODY.PEEK[1]<0> {5}\r\nPlain)"));
+	EXPECT_THAT(fetch("BODY.PEEK[1]<6.100>"), testing::HasSubstr("BODY.PEEK[1]<6> {13}\r\ntext version.)"));
+	EXPECT_THAT(fetch("BODY.PEEK[]<0.4>"), testing::HasSubstr("BODY.PEEK[]<0> {4}\r\nFrom)"));
+	EXPECT_THAT(fetch("BODY.PEEK[1]<500.10>"), testing::HasSubstr("BODY.PEEK[1]<500> {0}\r\n)"));
+	EXPECT_THAT(fetch("BODY.PEEK[1]<5>"), testing::HasSubstr("A002 BAD"));
+
+	// the offsets computed by the first ranged read are kept for the next ones
+	auto msg = messRepo->findByUID(dispatcher->get_MailboxState().m_id.value(), 4);
+	ASSERT_TRUE(msg.has_value());
+	EXPECT_EQ(messRepo->findParts(msg->id.value()).size(), 3u);
+
+	std::string full = fetch("BODY.PEEK[2]");
+	std::string ranged = fetch("BODY.PEEK[2]<0.1000>");
+	std::string full_body = full.substr(full.find("}\r\n") + 3);
+	std::string ranged_body = ranged.substr(ranged.find("}\r\n") + 3);
+	EXPECT_EQ(full_body, ranged_body);
+}
+
+TEST_F(CmdHandlerTests, HandleMove_ExpungesFromSourceAndReportsCopyUid)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::Move;
+	cmd.m_args = {"2:3", "Sent"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	EXPECT_EQ(response, "* OK [COPYUID 2 2:3 2:3] Moved\r\n"
+						"* 3 EXPUNGE\r\n"
+						"* 2 EXPUNGE\r\n"
+						"A002 OK Move completed\r\n");
+
+	auto inbox = messRepo->findFolderByName(dispatcher->get_AuthenticatedUserID().value(), "INBOX");
+	auto sent = messRepo->findFolderByName(dispatcher->get_AuthenticatedUserID().value(), "Sent");
+	EXPECT_EQ(messRepo->findUIDsByFolder(inbox->id.value()), (std::vector<int64_t>{1, 4}));
+	auto moved = messRepo->findByUID(sent->id.value(), 2);
+	ASSERT_TRUE(moved.has_value());
+	EXPECT_EQ(moved->subject.value_or(""), "Re: Project");
+}
+
+TEST_F(CmdHandlerTests, HandleUidMove_MissingDestination)
+{
+	LoginAndSelect("alice", "INBOX");
+
+	ImapCommand cmd;
+	cmd.m_tag = "A002";
+	cmd.m_type = ImapCommandType::UidMove;
+	cmd.m_args = {"1", "Nowhere"};
+
+	std::string response = dispatcher->Dispatch(cmd);
+
+	EXPECT_EQ(response, "A002 NO [TRYCREATE] No such folder\r\n");
+}
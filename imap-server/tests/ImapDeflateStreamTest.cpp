@@ -0,0 +1,75 @@
+#include "ImapDeflateStream.hpp"
+
+#include <gtest/gtest.h>
+#include <string>
+
+TEST(ImapDeflateStreamTest, RoundTripAcrossSeparateFlushes)
+{
+	ImapDeflateStream server(6, 15, 8);
+	ImapDeflateStream client(6, 15, 8);
+	ASSERT_TRUE(server.IsValid());
+	ASSERT_TRUE(client.IsValid());
+
+	std::string first, second;
+	ASSERT_TRUE(server.Compress("* 1 FETCH (FLAGS (\\Seen))\r\n", first));
+	ASSERT_TRUE(server.Compress("A001 OK Fetch completed\r\n", second));
+
+	// every chunk is flushed, so the peer decodes it without waiting for more
+	std::string inflated;
+	ASSERT_TRUE(client.Decompress(first.data(), first.size(), inflated));
+	EXPECT_EQ(inflated, "* 1 FETCH (FLAGS (\\Seen))\r\n");
+	ASSERT_TRUE(client.Decompress(second.data(), second.size(), inflated));
+	EXPECT_EQ(inflated, "* 1 FETCH (FLAGS (\\Seen))\r\nA001 OK Fetch completed\r\n");
+}
+
+TEST(ImapDeflateStreamTest, BatchFlushedOnlyAtTheEnd)
+{
+	ImapDeflateStream server(6, 15, 8);
+	ImapDeflateStream client(6, 15, 8);
+
+	// a write batch defers the flush to its last response
+	std::string batch;
+	ASSERT_TRUE(server.Compress("* 1 FETCH (FLAGS (\\Seen))\r\n", batch, false));
+	ASSERT_TRUE(server.Compress("* 2 FETCH (FLAGS (\\Seen))\r\n", batch, false));
+	ASSERT_TRUE(server.Compress("A001 OK Fetch completed\r\n", batch));
+
+	std::string inflated;
+	ASSERT_TRUE(client.Decompress(batch.data(), batch.size(), inflated));
+	EXPECT_EQ(inflated, "* 1 FETCH (FLAGS (\\Seen))\r\n* 2 FETCH (FLAGS (\\Seen))\r\nA001 OK Fetch completed\r\n");
+}
+
+TEST(ImapDeflateStreamTest, CompressesRepetitiveResponses)
+{
+	ImapDeflateStream stream(6, 15, 8);
+
+	std::string listing;
+	for (int i = 1; i <= 200; ++i)
+		listing += "* " + std::to_string(i) + " FETCH (FLAGS (\\Seen) RFC822.SIZE 2048)\r\n";
+
+	std::string compressed;
+	ASSERT_TRUE(stream.Compress(listing, compressed));
+	EXPECT_LT(compressed.size() * 4, listing.size());
+
+	std::string inflated;
+	ASSERT_TRUE(stream.Decompress(compressed.data(), compressed.size(), inflated));
+	EXPECT_EQ(inflated, listing);
+}
+
+TEST(ImapDeflateStreamTest, SmallWindowStillDecodableByPeer)
+{
+	ImapDeflateStream small(9, 9, 1);
+	ImapDeflateStream peer(6, 15, 8);
+
+	std::string data(100000, 'x'), compressed, inflated;
+	ASSERT_TRUE(small.Compress(data, compressed));
+	ASSERT_TRUE(peer.Decompress(compressed.data(), compressed.size(), inflated));
+	EXPECT_EQ(inflated, data);
+}
+
+TEST(ImapDeflateStreamTest, GarbageInputFails)
+{
+	ImapDeflateStream stream(6, 15, 8);
+	std::string garbage = "\xff\xff\xff\xff not deflate";
+	std::string inflated;
+	EXPECT_FALSE(stream.Decompress(garbage.data(), garbage.size(), inflated));
+}
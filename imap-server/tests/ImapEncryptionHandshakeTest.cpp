@@ -8,9 +8,11 @@
 #include "ClientSecureChannel.hpp"
 #include "DataBaseManager.h"
 #include "ILoggerStrategy.h"
-#include "ImapConfig.hpp"
+#include "AppConfig.h"
+#include "ImapDeflateStream.hpp"
 #include "ImapServer.hpp"
 #include "Logger.h"
+#include "Repository/UserRepository.h"
 #include "ServerSecureChannel.hpp"
 #include "SocketConnection.hpp"
 #include "SocketConnector.hpp"
@@ -40,6 +42,7 @@ struct ImapStartTlsFixture : public ::testing::Test
 	static boost::asio::io_context serverIo;
 	static boost::asio::io_context clientIo;
 	static std::unique_ptr<DataBaseManager> db;
+	static std::unique_ptr<ShardRouter> shards;
 	static std::unique_ptr<ThreadPool> pool;
 	static ImapConfig config;
 	static std::unique_ptr<ImapServer> imapServer;
@@ -57,11 +60,17 @@ struct ImapStartTlsFixture : public ::testing::Test
 		std::string m_dbPath = tempDbPath();
 		db = std::make_unique<DataBaseManager>(m_dbPath, initSchema());
 
+		UserRepository users(*db);
+		User user;
+		user.username = "compress";
+		users.registerUser(user, "pass123");
+
 		pool = std::make_unique<ThreadPool>();
 		pool->initialize(config.worker_threads);
 		pool->set_logger(&logger);
 
-		imapServer = std::make_unique<ImapServer>(serverIo, logger, *db, *pool, config);
+		shards = std::make_unique<ShardRouter>(*db);
+		imapServer = std::make_unique<ImapServer>(serverIo, logger, *shards, *pool, config);
 		serverThread = std::thread([]() { imapServer->Start(); });
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 	}
@@ -74,6 +83,7 @@ struct ImapStartTlsFixture : public ::testing::Test
 			serverThread.join();
 		}
 		pool->terminate();
+		shards.reset();
 		db.reset();
 
 		std::filesystem::remove(tempDbPath()); 
@@ -131,6 +141,7 @@ Logger ImapStartTlsFixture::logger(std::make_unique<NullStrategy>());
 boost::asio::io_context ImapStartTlsFixture::serverIo;
 boost::asio::io_context ImapStartTlsFixture::clientIo;
 std::unique_ptr<DataBaseManager> ImapStartTlsFixture::db;
+std::unique_ptr<ShardRouter> ImapStartTlsFixture::shards;
 std::unique_ptr<ThreadPool> ImapStartTlsFixture::pool;
 ImapConfig ImapStartTlsFixture::config;
 std::unique_ptr<ImapServer> ImapStartTlsFixture::imapServer;
@@ -143,7 +154,7 @@ TEST_F(ImapStartTlsFixture, ClientDisconnectBeforeTlsIsHandledGracefully)
 	SocketConnector connector;
 	connector.Initialize(clientIo);
 	std::unique_ptr<SocketConnection> newConn;
-	EXPECT_NO_THROW(connector.Connect("localhost", config.PORT, newConn));
+	EXPECT_NO_THROW(connector.Connect("localhost", config.port, newConn));
 }
 
 TEST_F(ImapStartTlsFixture, UnknownCommandBeforeTlsReturnsBad)
@@ -191,6 +202,30 @@ TEST_F(ImapStartTlsFixture, OversizedCommandIsRejected)
 	EXPECT_NE(resp.find("BAD"), std::string::npos) << "Got: " << resp;
 }
 
+TEST_F(ImapStartTlsFixture, DeeplyNestedSearchIsRejectedAndSessionSurvives)
+{
+	sendPlain("L001 LOGIN compress pass123");
+	ASSERT_NE(recvPlain().find("L001 OK"), std::string::npos);
+	sendPlain("L002 SELECT INBOX");
+	for (std::string line = recvPlain(); line.rfind("L002 ", 0) != 0; line = recvPlain())
+	{
+		ASSERT_FALSE(line.empty());
+	}
+
+	// past max_command_line_kb: drained and refused before anything parses it
+	std::string nots;
+	for (int i = 0; i < 50000; ++i) nots += "NOT ";
+	sendPlain("S001 SEARCH " + nots + "ALL");
+	EXPECT_EQ(recvPlain(), "S001 BAD Command line too long");
+
+	// within the line limit but nested past the search parser's depth limit
+	sendPlain("S002 SEARCH " + nots.substr(0, 4 * 1000) + "ALL");
+	EXPECT_EQ(recvPlain(), "S002 BAD Invalid search criteria");
+
+	sendPlain("S003 NOOP");
+	EXPECT_NE(recvPlain().find("S003 OK"), std::string::npos);
+}
+
 TEST_F(ImapStartTlsFixture, SecondStartTlsRejectedWithBad)
 {
 	ASSERT_TRUE(upgradeToTls("T001"));
@@ -227,4 +262,157 @@ TEST_F(ImapStartTlsFixture, MessageIntegrityOverTls)
 
 		EXPECT_NE(recv.find(tag + " OK"), std::string::npos) << "NOOP #" << i << " did not return OK, got: " << recv;
 	}
-}
\ No newline at end of file
+}
+
+TEST_F(ImapStartTlsFixture, CompressDeflateRoundTrip)
+{
+	sendPlain("C001 LOGIN compress pass123");
+	ASSERT_NE(recvPlain().find("C001 OK"), std::string::npos);
+
+	sendPlain("C002 COMPRESS DEFLATE");
+	ASSERT_EQ(recvPlain(), "C002 OK DEFLATE active");
+
+	ImapDeflateStream stream(6, 15, 8);
+	ASSERT_TRUE(stream.IsValid());
+
+	std::string request;
+	ASSERT_TRUE(stream.Compress("C003 NOOP\r\n", request));
+	ASSERT_TRUE(clientConn->SendRaw(reinterpret_cast<const unsigned char*>(request.data()), request.size()));
+
+	std::string inflated;
+	while (inflated.find("C003 ") == std::string::npos || inflated.back() != '\n')
+	{
+		unsigned char byte = 0;
+		ASSERT_TRUE(clientConn->ReceiveRaw(&byte, 1));
+		ASSERT_TRUE(stream.Decompress(reinterpret_cast<const char*>(&byte), 1, inflated));
+	}
+	EXPECT_NE(inflated.find("C003 OK"), std::string::npos) << "Got: " << inflated;
+}
+
+TEST_F(ImapStartTlsFixture, CompressDeflateOverTls)
+{
+	ASSERT_TRUE(upgradeToTls());
+
+	std::string resp;
+	tlsClient->Send("C001 LOGIN compress pass123\r\n");
+	ASSERT_TRUE(tlsClient->Receive(resp));
+	ASSERT_NE(resp.find("C001 OK"), std::string::npos);
+
+	tlsClient->Send("C002 COMPRESS DEFLATE\r\n");
+	ASSERT_TRUE(tlsClient->Receive(resp));
+	ASSERT_EQ(resp, "C002 OK DEFLATE active");
+
+	// compression sits beneath encryption: each record carries deflated bytes
+	ImapDeflateStream stream(6, 15, 8);
+	std::string request;
+	ASSERT_TRUE(stream.Compress("C003 NOOP\r\n", request));
+	ASSERT_TRUE(tlsClient->Send(request));
+
+	std::string record;
+	ASSERT_TRUE(tlsClient->ReceiveRecord(record));
+	std::string inflated;
+	ASSERT_TRUE(stream.Decompress(record.data(), record.size(), inflated));
+	EXPECT_EQ(inflated, "C003 OK Noop completed\r\n");
+}
+
+TEST_F(ImapStartTlsFixture, AppendSynchronizingLiteral)
+{
+	sendPlain("A001 LOGIN compress pass123");
+	ASSERT_NE(recvPlain().find("A001 OK"), std::string::npos);
+
+	std::string message = "Subject: synchronizing\r\n\r\nHello\r\n";
+	sendPlain("A002 APPEND INBOX (\\Seen) {" + std::to_string(message.size()) + "}");
+	ASSERT_EQ(recvPlain(), "+ Ready for literal data");
+
+	// the CRLF added by sendPlain ends the command line
+	sendPlain(message);
+	EXPECT_NE(recvPlain().find("A002 OK [APPENDUID "), std::string::npos);
+}
+
+TEST_F(ImapStartTlsFixture, AppendNonSynchronizingMultiAppend)
+{
+	sendPlain("A001 LOGIN compress pass123");
+	ASSERT_NE(recvPlain().find("A001 OK"), std::string::npos);
+
+	std::string first = "Subject: literal plus one\r\n\r\nOne\r\n";
+	std::string second = "Subject: literal plus two\r\n\r\nTwo\r\n";
+	sendPlain("A002 APPEND INBOX {" + std::to_string(first.size()) + "+}\r\n" + first + " (\\Flagged) {" +
+			  std::to_string(second.size()) + "+}\r\n" + second);
+
+	std::string resp = recvPlain();
+	EXPECT_NE(resp.find("A002 OK [APPENDUID "), std::string::npos) << "Got: " << resp;
+	EXPECT_NE(resp.find(":"), std::string::npos) << "Got: " << resp;
+
+	// a refused non-synchronizing literal is drained before the error
+	sendPlain("A003 APPEND NoSuchFolder {5+}\r\nabcde");
+	EXPECT_EQ(recvPlain(), "A003 NO [TRYCREATE] No such folder");
+
+	sendPlain("A004 NOOP");
+	EXPECT_NE(recvPlain().find("A004 OK"), std::string::npos);
+}
+
+TEST_F(ImapStartTlsFixture, AppendNonSynchronizingOverTls)
+{
+	ASSERT_TRUE(upgradeToTls());
+
+	std::string resp;
+	tlsClient->Send("A001 LOGIN compress pass123\r\n");
+	ASSERT_TRUE(tlsClient->Receive(resp));
+	ASSERT_NE(resp.find("A001 OK"), std::string::npos);
+
+	// command line and literal share one record
+	std::string message = "Subject: over tls\r\n\r\nSecret\r\n";
+	tlsClient->Send("A002 APPEND INBOX {" + std::to_string(message.size()) + "+}\r\n" + message + "\r\n");
+	ASSERT_TRUE(tlsClient->Receive(resp));
+	EXPECT_NE(resp.find("A002 OK [APPENDUID "), std::string::npos) << "Got: " << resp;
+}
+
+TEST_F(ImapStartTlsFixture, PipelinedCommandsAnswerInOrder)
+{
+	// SELECT is pipelined behind LOGIN, so it must see the state LOGIN leaves behind
+	sendPlain("P001 LOGIN compress pass123\r\nP002 SELECT INBOX\r\nP003 NOOP");
+
+	std::vector<std::string> tagged;
+	for (int i = 0; i < 32 && (tagged.empty() || tagged.back().rfind("P003 ", 0) != 0); ++i)
+	{
+		std::string line = recvPlain();
+		ASSERT_FALSE(line.empty());
+		if (line[0] != '*')
+		{
+			tagged.push_back(line);
+		}
+	}
+
+	ASSERT_EQ(tagged.size(), 3u);
+	EXPECT_EQ(tagged[0].rfind("P001 OK", 0), 0u) << "Got: " << tagged[0];
+	EXPECT_EQ(tagged[1].rfind("P002 OK", 0), 0u) << "Got: " << tagged[1];
+	EXPECT_EQ(tagged[2].rfind("P003 OK", 0), 0u) << "Got: " << tagged[2];
+}
+
+TEST_F(ImapStartTlsFixture, PipelinedRecordsOverTlsAnswerInOrder)
+{
+	ASSERT_TRUE(upgradeToTls());
+
+	// records keep arriving while earlier responses are being written back
+	constexpr int count = 20;
+	for (int i = 0; i < count; ++i)
+	{
+		ASSERT_TRUE(tlsClient->Send("Q" + std::to_string(i) + " NOOP\r\n"));
+	}
+
+	std::string received;
+	for (int i = 0; i < count && received.find("Q" + std::to_string(count - 1) + " OK") == std::string::npos; ++i)
+	{
+		std::string record;
+		ASSERT_TRUE(tlsClient->ReceiveRecord(record));
+		received += record;
+	}
+
+	std::size_t pos = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		std::size_t next = received.find("Q" + std::to_string(i) + " OK", pos);
+		ASSERT_NE(next, std::string::npos) << "Missing Q" << i << " in: " << received;
+		pos = next;
+	}
+}
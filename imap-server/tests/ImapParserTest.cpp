@@ -226,7 +226,7 @@ TEST(ImapParserTest, ParseLiteral)
 {
 	auto cmd = ImapParser::Parse("A019 APPEND INBOX {12}");
 
-	EXPECT_EQ(cmd.m_type, ImapCommandType::Unknown);
+	EXPECT_EQ(cmd.m_type, ImapCommandType::Append);
 	EXPECT_EQ(cmd.m_args.size(), 2);
 	EXPECT_EQ(cmd.m_args[0], "INBOX");
 	EXPECT_EQ(cmd.m_args[1], "{12}");
@@ -252,3 +252,53 @@ TEST(ImapParserTest, ParseListWithResponseCode)
 	EXPECT_EQ(cmd.m_args[1], "");
 	EXPECT_EQ(cmd.m_args[2], "*");
 }
+
+TEST(ImapParserTest, ParseUidSearch)
+{
+	auto cmd = ImapParser::Parse("A022 UID SEARCH 1:* (FROM \"bob\" UNSEEN)");
+
+	EXPECT_EQ(cmd.m_type, ImapCommandType::UidSearch);
+	EXPECT_EQ(cmd.m_args.size(), 2);
+	EXPECT_EQ(cmd.m_args[0], "1:*");
+	EXPECT_EQ(cmd.m_args[1], "(FROM \"bob\" UNSEEN)");
+}
+
+TEST(ImapParserTest, ParseUidMove)
+{
+	auto cmd = ImapParser::Parse("A023 UID MOVE 4:7 Archive");
+
+	EXPECT_EQ(cmd.m_type, ImapCommandType::UidMove);
+	EXPECT_EQ(cmd.m_args.size(), 2);
+	EXPECT_EQ(cmd.m_args[0], "4:7");
+	EXPECT_EQ(cmd.m_args[1], "Archive");
+}
+
+TEST(ImapParserTest, ParseQuotedAndListEscapes)
+{
+	auto cmd = ImapParser::Parse("A024 SEARCH SUBJECT \"say \\\"hi\\\"\" (FROM \"a\\\\b\" [x \"y\"]) \"plain\"");
+
+	EXPECT_EQ(cmd.m_type, ImapCommandType::Search);
+	ASSERT_EQ(cmd.m_args.size(), 4);
+	EXPECT_EQ(cmd.m_args[1], "say \"hi\"");
+	EXPECT_EQ(cmd.m_args[2], "(FROM \"a\\b\" [x \"y\"])");
+	EXPECT_EQ(cmd.m_args[3], "plain");
+}
+
+TEST(ImapParserTest, ParseUidWithoutUidVariant)
+{
+	auto cmd = ImapParser::Parse("A025 UID APPEND INBOX {3}");
+
+	EXPECT_EQ(cmd.m_type, ImapCommandType::Unknown);
+	EXPECT_TRUE(cmd.m_args.empty());
+}
+
+TEST(ImapParserTest, ParseListReturnStatus)
+{
+	auto cmd = ImapParser::Parse("A026 LIST \"\" \"*\" RETURN (STATUS (MESSAGES UNSEEN))");
+
+	EXPECT_EQ(cmd.m_type, ImapCommandType::List);
+	ASSERT_EQ(cmd.m_args.size(), 4);
+	EXPECT_EQ(cmd.m_args[1], "*");
+	EXPECT_EQ(cmd.m_args[2], "RETURN");
+	EXPECT_EQ(cmd.m_args[3], "(STATUS (MESSAGES UNSEEN))");
+}
@@ -49,7 +49,7 @@ TEST(ImapResponseTest, UntaggedWithMessage)
 TEST(ImapResponseTest, Capability)
 {
 	auto result = Capability();
-	EXPECT_EQ(result, "* CAPABILITY IMAP4rev1\r\n");
+	EXPECT_EQ(result, "* CAPABILITY IMAP4rev1 ENABLE CONDSTORE QRESYNC SORT THREAD=REFERENCES THREAD=ORDEREDSUBJECT COMPRESS=DEFLATE LITERAL+ MULTIAPPEND MOVE LIST-STATUS\r\n");
 }
 
 TEST(ImapResponseTest, FlagsDefault)
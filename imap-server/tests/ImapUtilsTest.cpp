@@ -1,5 +1,7 @@
 #include "ImapUtils.hpp"
 
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <stdexcept>
 
@@ -117,7 +119,11 @@ TEST(ImapUtilsTest, StringToCommandType)
 		{"COPY", ImapCommandType::Copy},
 		{"EXPUNGE", ImapCommandType::Expunge},
 		{"UNKNOWNCMD", ImapCommandType::Unknown},
-		{"login", ImapCommandType::Login}};
+		{"login", ImapCommandType::Login},
+		{"uId", ImapCommandType::UidFetch},
+		{"Move", ImapCommandType::Move},
+		{"MOVES", ImapCommandType::Unknown},
+		{"", ImapCommandType::Unknown}};
 
 	for (const auto& [input_string, expected_type] : test_cases)
 	{
@@ -403,4 +409,225 @@ TEST(ImapUtilsTest, DateToIMAPInternal_InvalidFormat)
 TEST(ImapUtilsTest, DateToIMAPInternal_MalformedInput)
 {
 	EXPECT_THROW(IMAP_UTILS::DateToIMAPInternal("2025-01-15"), std::runtime_error);
-}
\ No newline at end of file
+}
+TEST(ImapUtilsTest, FormatSequenceSet_CollapsesRuns)
+{
+	EXPECT_EQ(IMAP_UTILS::FormatSequenceSet({1, 2, 3, 7, 9, 10}), "1:3,7,9:10");
+	EXPECT_EQ(IMAP_UTILS::FormatSequenceSet({5}), "5");
+	EXPECT_EQ(IMAP_UTILS::FormatSequenceSet({}), "");
+}
+
+TEST(ImapUtilsTest, ParseChangedSince_WithAndWithoutVanished)
+{
+	int64_t modseq = 0;
+	bool vanished = false;
+
+	EXPECT_TRUE(IMAP_UTILS::ParseChangedSince("(CHANGEDSINCE 12345)", modseq, vanished));
+	EXPECT_EQ(modseq, 12345);
+	EXPECT_FALSE(vanished);
+
+	EXPECT_TRUE(IMAP_UTILS::ParseChangedSince("(changedsince 7 VANISHED)", modseq, vanished));
+	EXPECT_EQ(modseq, 7);
+	EXPECT_TRUE(vanished);
+
+	EXPECT_FALSE(IMAP_UTILS::ParseChangedSince("(FLAGS UID)", modseq, vanished));
+}
+
+TEST(ImapUtilsTest, ParseSelectParams_CondstoreAndQresync)
+{
+	bool condstore = false;
+	std::optional<IMAP_UTILS::QresyncParams> qresync;
+
+	EXPECT_TRUE(IMAP_UTILS::ParseSelectParams("(CONDSTORE)", condstore, qresync));
+	EXPECT_TRUE(condstore);
+	EXPECT_FALSE(qresync.has_value());
+
+	condstore = false;
+	EXPECT_TRUE(IMAP_UTILS::ParseSelectParams("(QRESYNC (67890007 90060115194045000 41,43:211))", condstore, qresync));
+	EXPECT_TRUE(condstore);
+	ASSERT_TRUE(qresync.has_value());
+	EXPECT_EQ(qresync->m_uidValidity, 67890007);
+	EXPECT_EQ(qresync->m_modseq, 90060115194045000);
+	EXPECT_EQ(qresync->m_knownUids, "41,43:211");
+
+	EXPECT_FALSE(IMAP_UTILS::ParseSelectParams("(READ-ONLY)", condstore, qresync));
+}
+
+TEST(ImapUtilsTest, ImapDateToIso_ConvertsAndRejects)
+{
+	EXPECT_EQ(IMAP_UTILS::ImapDateToIso("1-Feb-1994"), "1994-02-01");
+	EXPECT_EQ(IMAP_UTILS::ImapDateToIso("15-dec-2024"), "2024-12-15");
+	EXPECT_THROW(IMAP_UTILS::ImapDateToIso("2024-12-15"), std::invalid_argument);
+}
+
+TEST(ImapUtilsTest, ParseSearchCriteria_BuildsTree)
+{
+	std::vector<int64_t> uids = {10, 11, 15};
+
+	auto criteria = IMAP_UTILS::ParseSearchCriteria({"CHARSET", "UTF-8", "2:*", "OR", "UNSEEN", "(FROM \"bob smith\" LARGER 10)"}, uids);
+
+	ASSERT_EQ(criteria.type, SearchCriteria::Type::And);
+	ASSERT_EQ(criteria.children.size(), 2u);
+
+	const auto& seq = criteria.children[0];
+	EXPECT_EQ(seq.type, SearchCriteria::Type::Uid);
+	ASSERT_EQ(seq.ranges.size(), 1u);
+	EXPECT_EQ(seq.ranges[0].first, 11);
+	EXPECT_EQ(seq.ranges[0].second, 15);
+
+	const auto& either = criteria.children[1];
+	ASSERT_EQ(either.type, SearchCriteria::Type::Or);
+	ASSERT_EQ(either.children.size(), 2u);
+	EXPECT_EQ(either.children[0].type, SearchCriteria::Type::Not);
+	ASSERT_EQ(either.children[1].children.size(), 2u);
+	EXPECT_EQ(either.children[1].children[0].value, "bob smith");
+	EXPECT_EQ(either.children[1].children[1].number, 10);
+
+	EXPECT_THROW(IMAP_UTILS::ParseSearchCriteria({"SENTBEFORE", "1-Feb-1994"}, uids), std::invalid_argument);
+	EXPECT_THROW(IMAP_UTILS::ParseSearchCriteria({"CHARSET", "KOI8-R", "ALL"}, uids), std::invalid_argument);
+}
+
+TEST(ImapUtilsTest, ParseSearchCriteria_DeepNestingRejected)
+{
+	std::vector<int64_t> uids = {1, 2, 3};
+
+	std::vector<std::string> nots(50000, "NOT");
+	nots.push_back("ALL");
+	EXPECT_THROW(IMAP_UTILS::ParseSearchCriteria(nots, uids), std::invalid_argument);
+
+	std::vector<std::string> ors;
+	for (int i = 0; i < 50000; ++i)
+	{
+		ors.push_back("OR");
+		ors.push_back("SEEN");
+	}
+	ors.push_back("ALL");
+	EXPECT_THROW(IMAP_UTILS::ParseSearchCriteria(ors, uids), std::invalid_argument);
+
+	EXPECT_THROW(IMAP_UTILS::ParseSearchCriteria({std::string(10000, '(') + "ALL" + std::string(10000, ')')}, uids),
+				 std::invalid_argument);
+
+	// shallow nesting still parses
+	std::vector<std::string> few(10, "NOT");
+	few.push_back("(SEEN)");
+	EXPECT_NO_THROW(IMAP_UTILS::ParseSearchCriteria(few, uids));
+}
+
+TEST(ImapUtilsTest, ParseSortCriteria_KeysAndReverse)
+{
+	auto keys = IMAP_UTILS::ParseSortCriteria("(REVERSE SUBJECT date)");
+	ASSERT_EQ(keys.size(), 2u);
+	EXPECT_EQ(keys[0].field, SortKey::Field::Subject);
+	EXPECT_TRUE(keys[0].reverse);
+	EXPECT_EQ(keys[1].field, SortKey::Field::Date);
+	EXPECT_FALSE(keys[1].reverse);
+
+	EXPECT_THROW(IMAP_UTILS::ParseSortCriteria("(SUBJECT REVERSE)"), std::invalid_argument);
+	EXPECT_THROW(IMAP_UTILS::ParseSortCriteria("(COLOR)"), std::invalid_argument);
+}
+
+TEST(ImapUtilsTest, FormatThreads_ReferencesAndOrderedSubject)
+{
+	auto make = [](int64_t uid, int64_t thread, const std::string& id, const std::string& parent,
+				   const std::string& subject)
+	{
+		Message msg;
+		msg.id = uid;
+		msg.uid = uid;
+		msg.thread_id = thread;
+		msg.message_id_header = id;
+		if (!parent.empty()) msg.in_reply_to = parent;
+		msg.sort_subject = subject;
+		return msg;
+	};
+
+	std::vector<Message> messages = {
+		make(2, 2, "<b>", "", "other"),
+		make(3, 3, "<c>", "", "topic"),
+		make(6, 3, "<f>", "<c>", "topic"),
+		make(4, 3, "<d>", "<f>", "topic"),
+		make(44, 3, "<x>", "<f>", "topic"),
+		make(23, 3, "<w>", "<d>", "topic"),
+		make(7, 3, "<g>", "<x>", "topic"),
+	};
+
+	EXPECT_EQ(IMAP_UTILS::FormatThreads(messages, "REFERENCES"), "(2)(3 6 (4 23)(44 7))");
+	EXPECT_EQ(IMAP_UTILS::FormatThreads(messages, "orderedsubject"), "(2)(3 (6)(4)(44)(23)(7))");
+	EXPECT_EQ(IMAP_UTILS::FormatThreads({}, "REFERENCES"), "");
+	EXPECT_THROW(IMAP_UTILS::FormatThreads(messages, "X-UNKNOWN"), std::invalid_argument);
+}
+
+TEST(ImapUtilsTest, ParseLiteralSpec_SynchronizingAndNonSynchronizing)
+{
+	auto sync = IMAP_UTILS::ParseLiteralSpec("A1 APPEND INBOX {310}");
+	ASSERT_TRUE(sync.has_value());
+	EXPECT_EQ(sync->m_size, 310);
+	EXPECT_TRUE(sync->m_synchronizing);
+	EXPECT_EQ(sync->m_offset, 16u);
+
+	auto plus = IMAP_UTILS::ParseLiteralSpec("A1 APPEND INBOX (\\Seen) {0+}");
+	ASSERT_TRUE(plus.has_value());
+	EXPECT_EQ(plus->m_size, 0);
+	EXPECT_FALSE(plus->m_synchronizing);
+
+	EXPECT_FALSE(IMAP_UTILS::ParseLiteralSpec("A1 NOOP").has_value());
+	EXPECT_FALSE(IMAP_UTILS::ParseLiteralSpec("A1 APPEND INBOX {}").has_value());
+	EXPECT_FALSE(IMAP_UTILS::ParseLiteralSpec("A1 APPEND INBOX {12a}").has_value());
+	EXPECT_FALSE(IMAP_UTILS::ParseLiteralSpec("A1 APPEND INBOX {310} x").has_value());
+}
+
+TEST(ImapUtilsTest, MatchMailboxPattern_Wildcards)
+{
+	EXPECT_TRUE(IMAP_UTILS::MatchMailboxPattern("Work/Reports/2024", "*"));
+	EXPECT_TRUE(IMAP_UTILS::MatchMailboxPattern("Work/Reports/2024", "Work/*"));
+	EXPECT_TRUE(IMAP_UTILS::MatchMailboxPattern("Work", "%"));
+	EXPECT_FALSE(IMAP_UTILS::MatchMailboxPattern("Work/Reports", "%"));
+	EXPECT_TRUE(IMAP_UTILS::MatchMailboxPattern("Work/Reports", "Work/%"));
+	EXPECT_FALSE(IMAP_UTILS::MatchMailboxPattern("Work/Reports/2024", "Work/%"));
+	EXPECT_TRUE(IMAP_UTILS::MatchMailboxPattern("Work/Reports/2024", "W%/%/*4"));
+	EXPECT_FALSE(IMAP_UTILS::MatchMailboxPattern("Sent", "sent"));
+	EXPECT_TRUE(IMAP_UTILS::MatchMailboxPattern("INBOX", "inbox"));
+	EXPECT_TRUE(IMAP_UTILS::MatchMailboxPattern("INBOX/Later", "Inbox/%"));
+}
+
+TEST(ImapUtilsTest, ParseListReturnOptions_StatusItems)
+{
+	std::vector<std::string> items;
+	ASSERT_TRUE(IMAP_UTILS::ParseListReturnOptions("(CHILDREN STATUS (messages UNSEEN))", items));
+	EXPECT_EQ(items, (std::vector<std::string>{"MESSAGES", "UNSEEN"}));
+
+	items.clear();
+	EXPECT_TRUE(IMAP_UTILS::ParseListReturnOptions("()", items));
+	EXPECT_TRUE(items.empty());
+
+	EXPECT_FALSE(IMAP_UTILS::ParseListReturnOptions("(STATUS (SIZE))", items));
+	EXPECT_FALSE(IMAP_UTILS::ParseListReturnOptions("(SUBSCRIBED)", items));
+	EXPECT_FALSE(IMAP_UTILS::ParseListReturnOptions("(STATUS MESSAGES)", items));
+}
+
+TEST(ImapUtilsTest, ImapDateTimeToInternal_ConvertsToUtc)
+{
+	EXPECT_EQ(IMAP_UTILS::ImapDateTimeToInternal("17-Jul-1996 02:44:25 -0700"), "1996-07-17 09:44:25");
+	EXPECT_EQ(IMAP_UTILS::ImapDateTimeToInternal(" 1-jan-2025 00:30:00 +0100"), "2024-12-31 23:30:00");
+	EXPECT_THROW(IMAP_UTILS::ImapDateTimeToInternal("17-Jul-1996"), std::invalid_argument);
+	EXPECT_THROW(IMAP_UTILS::ImapDateTimeToInternal("17-Foo-1996 02:44:25 -0700"), std::invalid_argument);
+}
+
+TEST(ImapUtilsTest, ReadHeaderFields_UnfoldsAndStopsAtBody)
+{
+	std::string path = (std::filesystem::temp_directory_path() / "test_read_header_fields.eml").string();
+	{
+		std::ofstream file(path, std::ios::binary);
+		file << "Subject: folded\r\n\tsubject\r\n";
+		file << "message-id: <a@b>\r\n";
+		file << "\r\n";
+		file << "X-Not-A-Header: body\r\n";
+	}
+
+	auto fields = IMAP_UTILS::ReadHeaderFields(path);
+	EXPECT_EQ(fields["SUBJECT"], "folded subject");
+	EXPECT_EQ(fields["MESSAGE-ID"], "<a@b>");
+	EXPECT_EQ(fields.count("X-NOT-A-HEADER"), 0u);
+
+	std::filesystem::remove(path);
+}
@@ -21,6 +21,7 @@ public:
 									std::string& out_headers, std::string& out_body);
 	static std::string GetHeaderValue(const std::string& headers, const std::string& key);
 	static std::string ExtractBoundary(const std::string& content_type_header);
+	static std::vector<MimePartRange> ScanPartRanges(const std::string& raw_mime);
 
 private:
 	static void ParseMainHeaders(const std::string& top_headers, Email& out_email, ILogger& logger);
@@ -31,6 +32,8 @@ private:
 	static std::string              ExtractCharset(const std::string& content_type_header);
 	static std::string              ExtractFileName(const std::string& part_headers, ILogger& logger);
 	static std::vector<std::string> SplitAddresses(const std::string& header_value);
+	static void                     ScanMultipartRanges(const std::string& raw_mime, const MimePartRange& entity,
+														std::vector<MimePartRange>& out_ranges);
 	static void                     ParsePartStructure(const std::string& raw_part, MimePart& out_part,
 													   ILogger& logger);
 };
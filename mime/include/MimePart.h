@@ -41,4 +41,17 @@ struct MimePart
 	bool IsAttachment()  const { return !filename.empty(); }
 };
 
+/**
+ * Byte range of one MIME entity inside the raw message, used to serve IMAP partial FETCH
+ * without re-parsing. section is the IMAP part specifier: "" for the whole message,
+ * "1", "2.1", ... for parts of multipart bodies.
+ */
+struct MimePartRange
+{
+	std::string section;
+	std::size_t header_start = 0;
+	std::size_t body_start   = 0; // first byte after the blank line
+	std::size_t body_end     = 0; // exclusive, before the CRLF that precedes the next boundary
+};
+
 } // namespace SmtpClient
@@ -28,6 +28,18 @@ std::string ToLower(std::string s)
 	return s;
 }
 
+// first byte of the body inside [begin, end), same rules as SplitHeadersAndBody
+size_t FindBodyStart(const std::string& raw, size_t begin, size_t end)
+{
+	size_t pos = raw.find("\r\n\r\n", begin);
+	if (pos != std::string::npos && pos + 4 <= end) return pos + 4;
+
+	pos = raw.find("\n\n", begin);
+	if (pos != std::string::npos && pos + 2 <= end) return pos + 2;
+
+	return begin;
+}
+
 } // anonymous namespace
 
 bool MimeParser::ParseEmail(const std::string& raw_mime, Email& out_email,
@@ -572,4 +584,67 @@ void MimeParser::ParsePartStructure(const std::string& raw_part, MimePart& out_p
 	}
 }
 
+std::vector<MimePartRange> MimeParser::ScanPartRanges(const std::string& raw_mime)
+{
+	std::vector<MimePartRange> ranges;
+
+	MimePartRange root;
+	root.body_start = FindBodyStart(raw_mime, 0, raw_mime.size());
+	root.body_end   = raw_mime.size();
+	ranges.push_back(root);
+
+	ScanMultipartRanges(raw_mime, root, ranges);
+	return ranges;
+}
+
+void MimeParser::ScanMultipartRanges(const std::string& raw_mime, const MimePartRange& entity,
+									 std::vector<MimePartRange>& out_ranges)
+{
+	std::string headers = raw_mime.substr(entity.header_start, entity.body_start - entity.header_start);
+	std::string content_type = GetHeaderValue(headers, "Content-Type:");
+	if (ToLower(content_type).find("multipart") == std::string::npos) return;
+
+	std::string boundary = ExtractBoundary(content_type);
+	if (boundary.empty()) return;
+
+	const std::string delimiter = "--" + boundary;
+	const std::string prefix = entity.section.empty() ? "" : entity.section + ".";
+	int index = 0;
+
+	size_t pos = raw_mime.find(delimiter, entity.body_start);
+	while (pos != std::string::npos && pos < entity.body_end)
+	{
+		size_t part_start = pos + delimiter.size();
+		if (raw_mime.compare(part_start, 2, "--") == 0) break; // close delimiter
+
+		if (part_start < entity.body_end && raw_mime[part_start] == '\r') part_start++;
+		if (part_start < entity.body_end && raw_mime[part_start] == '\n') part_start++;
+
+		size_t next = raw_mime.find(delimiter, part_start);
+		size_t part_end = (next == std::string::npos || next > entity.body_end) ? entity.body_end : next;
+
+		// the line break before a boundary belongs to the boundary
+		if (part_end - part_start >= 2 && raw_mime[part_end - 2] == '\r' && raw_mime[part_end - 1] == '\n')
+			part_end -= 2;
+		else if (part_end - part_start >= 1 && raw_mime[part_end - 1] == '\n')
+			part_end -= 1;
+
+		MimePartRange part;
+		part.section      = prefix + std::to_string(++index);
+		part.header_start = part_start;
+		part.body_start   = FindBodyStart(raw_mime, part_start, part_end);
+		part.body_end     = part_end;
+
+		while (part.body_start < part_end &&
+			   (raw_mime[part.body_start] == '\r' || raw_mime[part.body_start] == '\n'))
+			part.body_start++;
+
+		out_ranges.push_back(part);
+		ScanMultipartRanges(raw_mime, part, out_ranges);
+
+		if (next == std::string::npos || next >= entity.body_end) break;
+		pos = next;
+	}
+}
+
 } // namespace SmtpClient
@@ -343,3 +343,53 @@ TEST(MimeParserTest, RoundTrip_ThreadingHeaders)
 	EXPECT_EQ(parsed.in_reply_to, "<prev.001@test.com>");
 	EXPECT_EQ(parsed.references,  "<prev.001@test.com>");
 }
+
+TEST(MimeParserTest, ScanPartRanges_NestedMultipart)
+{
+	std::string raw =
+		"Content-Type: multipart/mixed; boundary=\"outer\"\r\n"
+		"\r\n"
+		"--outer\r\n"
+		"Content-Type: multipart/alternative; boundary=\"inner\"\r\n"
+		"\r\n"
+		"--inner\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"plain text\r\n"
+		"--inner\r\n"
+		"Content-Type: text/html\r\n"
+		"\r\n"
+		"<p>html</p>\r\n"
+		"--inner--\r\n"
+		"\r\n"
+		"--outer\r\n"
+		"Content-Type: application/octet-stream\r\n"
+		"\r\n"
+		"QUJD\r\n"
+		"--outer--\r\n";
+
+	auto ranges = MimeParser::ScanPartRanges(raw);
+	ASSERT_EQ(ranges.size(), 5u);
+
+	auto body = [&](size_t i) { return raw.substr(ranges[i].body_start, ranges[i].body_end - ranges[i].body_start); };
+	auto header = [&](size_t i) { return raw.substr(ranges[i].header_start, ranges[i].body_start - ranges[i].header_start); };
+
+	EXPECT_EQ(ranges[0].section, "");
+	EXPECT_EQ(ranges[0].body_end, raw.size());
+	EXPECT_EQ(ranges[1].section, "1");
+	EXPECT_EQ(ranges[2].section, "1.1");
+	EXPECT_EQ(body(2), "plain text");
+	EXPECT_EQ(ranges[3].section, "1.2");
+	EXPECT_EQ(body(3), "<p>html</p>");
+	EXPECT_EQ(ranges[4].section, "2");
+	EXPECT_EQ(body(4), "QUJD");
+	EXPECT_EQ(header(4), "Content-Type: application/octet-stream\r\n\r\n");
+}
+
+TEST(MimeParserTest, ScanPartRanges_SinglePart)
+{
+	std::string raw = "Subject: hi\r\n\r\nbody\r\n";
+	auto ranges = MimeParser::ScanPartRanges(raw);
+	ASSERT_EQ(ranges.size(), 1u);
+	EXPECT_EQ(raw.substr(ranges[0].body_start), "body\r\n");
+}
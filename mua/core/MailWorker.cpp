@@ -1685,6 +1685,14 @@ void MailWorker::handleMoveMail(const MoveMailCommand& cmd)
         return;
     }
 
+    // MOVE (RFC 6851) is one atomic round trip; servers without it get COPY + STORE + EXPUNGE
+    auto [moveOk, _0] = imapExchange("MOVE " + std::to_string(cmd.mailId) + " " + QuoteImap(cmd.targetFolder));
+    if (moveOk)
+    {
+        m_onResult(MailActionResult{true, ""});
+        return;
+    }
+
     auto [copyOk, _1] = imapExchange("COPY " + std::to_string(cmd.mailId) + " " + QuoteImap(cmd.targetFolder));
     if (!copyOk)
     {
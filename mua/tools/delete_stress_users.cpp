@@ -2,8 +2,9 @@
 #include <regex>
 #include <string>
 
-#include "DataBaseManager.h"
+#include "Config.h"
 #include "Repository/UserRepository.h"
+#include "ShardRouter.h"
 #include "schema.h"
 
 namespace
@@ -26,26 +27,30 @@ int main(int argc, char** argv)
 	std::cout << "Searching for stress test users...\n";
 
 	const std::string dbPath = root + "data/mail.db";
-	DataBaseManager db(dbPath, initSchema());
-	if (!db.isConnected())
+	// same database layout as the IMAP server started from this root
+	SmtpClient::Config::Instance().Load(root + "default_config.json");
+	auto db = ShardRouter::open(dbPath, SmtpClient::Config::Instance().GetDatabase().db_shards, initSchema());
+	if (!db->isConnected())
 	{
 		std::cerr << "Failed to connect to DB\n";
 		return 1;
 	}
 
-	UserRepository repo(db);
+	UserRepository repo(*db);
 
 	// pattern: user followed by digits only e.g. user1, user42, user100
 	const std::regex stressUserPattern("^stress_user[0-9]+$");
 
 	int deleted = 0;
-	int offset = 0;
+	std::string after;
 	const int batchSize = 100;
 
+	// keyset paging: deleting rows cannot shift the next page, unlike an offset
 	while (true)
 	{
-		auto batch = repo.findAll(batchSize, offset);
+		auto batch = repo.findAllAfter(after, batchSize);
 		if (batch.empty()) break;
+		after = batch.back().username;
 
 		for (const auto& user : batch)
 		{
@@ -65,8 +70,6 @@ int main(int argc, char** argv)
 
 		// if we got less than batchSize, we reached the end
 		if ((int)batch.size() < batchSize) break;
-
-		offset += batchSize;
 	}
 
 	std::cout << "Done! Deleted " << deleted << " stress test users\n";
@@ -2,8 +2,9 @@
 #include <optional>
 #include <string>
 
-#include "DataBaseManager.h"
+#include "Config.h"
 #include "Repository/UserRepository.h"
+#include "ShardRouter.h"
 #include "schema.h"
 
 namespace
@@ -46,14 +47,16 @@ int main(int argc, char** argv)
 	std::cout << "Seeding " << count << " stress test users...\n";
 
 	const std::string dbPath = root + "data/mail.db";
-	DataBaseManager db(dbPath, initSchema());
-	if (!db.isConnected())
+	// same database layout as the IMAP server started from this root
+	SmtpClient::Config::Instance().Load(root + "default_config.json");
+	auto db = ShardRouter::open(dbPath, SmtpClient::Config::Instance().GetDatabase().db_shards, initSchema());
+	if (!db->isConnected())
 	{
 		std::cerr << "Failed to connect to DB\n";
 		return 1;
 	}
 
-	UserRepository repo(db);
+	UserRepository repo(*db);
 	bool ok = true;
 
 	for (int i = 1; i <= count; i++)
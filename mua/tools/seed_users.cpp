@@ -1,8 +1,9 @@
 #include <optional>
 #include <string>
 
-#include "DataBaseManager.h"
+#include "Config.h"
 #include "Repository/UserRepository.h"
+#include "ShardRouter.h"
 #include "schema.h"
 
 namespace
@@ -74,13 +75,15 @@ int main(int argc, char** argv)
     root = normalizeRoot(root);
 
     const std::string dbPath = root + "data/mail.db";
-    DataBaseManager db(dbPath, initSchema());
-    if (!db.isConnected())
+    // same database layout as the IMAP server started from this root
+    SmtpClient::Config::Instance().Load(root + "default_config.json");
+    auto db = ShardRouter::open(dbPath, SmtpClient::Config::Instance().GetDatabase().db_shards, initSchema());
+    if (!db->isConnected())
     {
         return 1;
     }
 
-    UserRepository repo(db);
+    UserRepository repo(*db);
 
     bool ok = true;
     ok = ensureUser(repo, "alice", "pass", "Alice", "User", "1990-01-01") && ok;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -28,12 +29,28 @@ enum class ImapCommandType
 	Close,
 	Check,
 	Unknown,
-	StartTLS
+	StartTLS,
+	Enable,
+	Search,
+	UidSearch,
+	Sort,
+	UidSort,
+	Thread,
+	UidThread,
+	Compress,
+	Append,
+	Move,
+	UidMove
 };
 
+// number of ImapCommandType values, keep in sync with the last enumerator
+constexpr size_t IMAP_COMMAND_TYPE_COUNT = static_cast<size_t>(ImapCommandType::UidMove) + 1;
+
 struct ImapCommand
 {
 	std::string m_tag;
 	ImapCommandType m_type = ImapCommandType::Unknown;
 	std::vector<std::string> m_args;
+	// APPEND message literals, spooled to disk by the session; one path per "{n}" argument
+	std::vector<std::string> m_literals;
 };
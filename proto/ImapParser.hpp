@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "ImapCommand.hpp"
@@ -8,28 +9,30 @@
 class ImapParser
 {
 public:
-	static ImapCommand Parse(const std::string& line);
+	// Tokens are scanned as views over the line; each argument is materialized with a single
+	// allocation, quoted strings and lists are only rebuilt when they contain escapes.
+	static ImapCommand Parse(std::string_view line);
+	static std::vector<std::string> ParseArguments(std::string_view args);
 
 private:
 	class ElementParser
 	{
 	public:
-		explicit ElementParser(const std::string& str) : m_str(str), m_pos(0) {}
+		explicit ElementParser(std::string_view str) : m_str(str), m_pos(0) {}
 
 		std::vector<std::string> ParseArgs();
 
 	private:
-		std::string m_str;
+		std::string_view m_str;
 		size_t m_pos;
 
 		void SkipWhitespace();
 		std::string ParseElement();
 		std::string ParseQuoted();
 		std::string ParseList();
+		bool ScanVerbatimList(size_t& end) const;
 		std::string ParseResponse();
 		std::string ParseLiteral();
 		std::string ParseAtom();
 	};
-
-	static std::vector<std::string> ParseArguments(const std::string& args);
 };
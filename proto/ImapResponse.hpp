@@ -27,7 +27,7 @@ inline std::string Untagged(const std::string& message)
 
 inline std::string Capability()
 {
-	return "* CAPABILITY IMAP4rev1\r\n";
+	return "* CAPABILITY IMAP4rev1 ENABLE CONDSTORE QRESYNC SORT THREAD=REFERENCES THREAD=ORDEREDSUBJECT COMPRESS=DEFLATE LITERAL+ MULTIAPPEND MOVE LIST-STATUS\r\n";
 }
 
 inline std::string Flags(const std::string& flagList = "(\\Seen \\Answered \\Flagged \\Draft \\Deleted \\Recent)")
@@ -1,9 +1,16 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "Entity/Folder.h"
 #include "Entity/Message.h"
+#include "Entity/MessageRowSet.h"
+#include "Entity/MessageRows.h"
+#include "Entity/SearchCriteria.h"
 #include "ImapCommand.hpp"
 #include "MimeParser.h"
 #include "MimePart.h"
@@ -21,7 +28,11 @@ std::vector<std::string> Split(const std::string& str, char delim);
 
 std::string JoinArgs(const std::vector<std::string>& args);
 
-ImapCommandType StringToCommandType(const std::string& cmd);
+// case-insensitive, allocation-free (compile-time perfect hash over the command names)
+ImapCommandType StringToCommandType(std::string_view cmd);
+
+// "UID <cmd>" form of a command type, Unknown when the command has no UID variant
+ImapCommandType ToUidCommandType(ImapCommandType type);
 
 std::string CommandTypeToString(const ImapCommandType& type);
 
@@ -54,8 +65,102 @@ std::string GetBodyContent(const Message& msg);
 
 std::string GetBodySection(const Message& msg, const std::string& section);
 
+// partial fetch suffix of a BODY[section] item, example: "<0.2048>"
+bool ParsePartialRange(const std::string& spec, int64_t& offset, int64_t& length);
+
+// BODY[section]<offset.length>: only the requested bytes are read (pread), located through the
+// stored MIME part offsets; offsets of messages stored without them are computed once and saved
+std::string GetBodySectionRange(const Message& msg, const std::string& section, int64_t offset, int64_t length,
+								MessageRepository& repo);
+
 std::vector<std::string> CombineSplitBodySections(const std::vector<std::string>& items);
 
-std::string FormatFlagsResponse(const Message& msg);
+std::string FormatFlagsResponse(const Message& msg, bool with_modseq = false);
+std::string FormatFlagsResponse(const MessageFlagsRow& row, bool with_modseq = false);
+
+// true when every expanded FETCH item is answered by a MessageHeaderRow (FLAGS, INTERNALDATE,
+// RFC822.SIZE, MODSEQ, UID), so the full message row need not be loaded
+bool IsSummaryFetch(const std::vector<std::string>& items);
+
+// the FETCH items of a summary fetch for one message, space separated, example:
+// "FLAGS (\\Seen) RFC822.SIZE 1024"
+std::string FormatSummaryItems(const MessageHeaderRow& row, const std::vector<std::string>& items);
+
+// example: {1, 2, 3, 7, 9, 10} -> "1:3,7,9:10"; values must be sorted ascending
+std::string FormatSequenceSet(const std::vector<int64_t>& values);
+
+// CONDSTORE fetch modifier, example: "(CHANGEDSINCE 12345 VANISHED)"
+bool ParseChangedSince(const std::string& arg, int64_t& modseq, bool& vanished);
+
+// CONDSTORE store modifier, example: "(UNCHANGEDSINCE 12345)"
+bool ParseUnchangedSince(const std::string& arg, int64_t& modseq);
+
+struct QresyncParams
+{
+	int64_t m_uidValidity = 0;
+	int64_t m_modseq = 0;
+	std::string m_knownUids; // empty when the client did not send known-uids
+};
+
+// like ParseSequenceSet, but keeps ranges as [first, last] pairs instead of expanding them
+std::vector<std::pair<int64_t, int64_t>> ParseSequenceRanges(const std::string& sequenceSet, int64_t maxValue);
+
+// message sequence set to UID ranges, folder_uids = ascending UIDs of the selected mailbox
+std::vector<std::pair<int64_t, int64_t>> SequenceToUidRanges(const std::string& sequenceSet,
+															 const std::vector<int64_t>& folder_uids);
+
+// 1-based position of uid in folder_uids, 0 if the message is gone
+int64_t UidToSequenceNumber(const std::vector<int64_t>& folder_uids, int64_t uid);
+
+// example: "1-Feb-1994" -> "1994-02-01"
+std::string ImapDateToIso(const std::string& date);
+
+// SEARCH program -> criteria tree; sequence numbers are resolved through folder_uids (ascending)
+SearchCriteria ParseSearchCriteria(const std::vector<std::string>& args, const std::vector<int64_t>& folder_uids);
+
+// example: "(REVERSE SUBJECT DATE)"
+std::vector<SortKey> ParseSortCriteria(const std::string& arg);
+
+// THREAD response body for messages ordered by arrival, example: "(1 2 (3)(4))(5)".
+// REFERENCES follows the thread_id assigned at delivery; ORDEREDSUBJECT groups by base subject.
+std::string FormatThreads(const std::vector<Message>& messages, const std::string& algorithm);
+std::string FormatThreads(const MessageRowSet& messages, const std::string& algorithm);
+
+// trailing "{n}" or "{n+}" (LITERAL+) of a command line
+struct LiteralSpec
+{
+	int64_t m_size = 0;
+	bool m_synchronizing = true;
+	size_t m_offset = 0; // position of '{'
+};
+std::optional<LiteralSpec> ParseLiteralSpec(const std::string& line);
+
+// APPEND date-time to the internal_date format, example: "17-Jul-1996 02:44:25 -0700" -> "1996-07-17 09:44:25"
+std::string ImapDateTimeToInternal(const std::string& date_time);
+
+// header block of a stored message, names upper-cased, folded lines joined; reads at most max_bytes
+std::unordered_map<std::string, std::string> ReadHeaderFields(const std::string& path, size_t max_bytes = 64 * 1024);
+
+// unique file name inside a mail directory, same scheme as SMTP delivery
+std::string GenerateMailFilename();
+
+// SELECT parameters, example: "(CONDSTORE)" or "(QRESYNC (67890007 20050715194045000 41,43:211))"
+bool ParseSelectParams(const std::string& arg, bool& condstore, std::optional<QresyncParams>& qresync);
+
+// LIST mailbox pattern (RFC 3501 6.3.8): '*' matches anything, '%' anything but the delimiter;
+// the INBOX prefix is matched case-insensitively
+bool MatchMailboxPattern(std::string_view name, std::string_view pattern, char delimiter = '/');
+
+// LIST return options, example: "(STATUS (MESSAGES UNSEEN))" (RFC 5819); status_items stays empty
+// when STATUS is not requested, false on an unknown option or status item
+bool ParseListReturnOptions(const std::string& arg, std::vector<std::string>& status_items);
+
+// UIDVALIDITY of a folder: the shard-local part of its id, since the full id of a folder on shard k>=1
+// is above 2^40 and UIDVALIDITY is a 32-bit nz-number; throws std::out_of_range if it still does not fit
+int64_t UidValidity(const Folder& folder);
+
+// "MESSAGES 3 UNSEEN 1" for STATUS and LIST-STATUS; unknown items are skipped, false if none is known
+bool FormatStatusItems(const std::vector<std::string>& items, const Folder& folder, const FolderStatus& status,
+					   std::string& out);
 
 } // namespace IMAP_UTILS
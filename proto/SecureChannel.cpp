@@ -97,67 +97,117 @@ bool SecureChannel::Send(const std::string& data)
 		return m_conn.Send(data);
 	}
 
-	if (m_logger) m_logger->Log(LogLevel::TRACE, "ENCRYPT: encrypting message");
-	std::string encrypted_text = Encrypt(data);
+	auto record = Seal(data);
+	if (!record.has_value())
+	{
+		return false;
+	}
 
-	if (encrypted_text.empty())
+	if (!m_conn.SendRaw(reinterpret_cast<const unsigned char*>(record->data()), record->size()))
 	{
-		if (m_logger) m_logger->Log(LogLevel::TRACE, "ENCRYPT: failed");
+		if (m_logger) m_logger->Log(LogLevel::PROD, "SECURECHANNEL_SEND: failed to send message");
 		return false;
 	}
 
-	std::uint32_t text_len = static_cast<std::uint32_t>(encrypted_text.size());
-	std::uint32_t net_len = htonl(text_len);
+	if (m_logger) m_logger->Log(LogLevel::TRACE, "SECURECHANNEL_SEND: sent " + std::to_string(data.size()) + " bytes");
+	return true;
+}
 
-	if (!m_conn.SendRaw(reinterpret_cast<const unsigned char*>(&net_len), sizeof(net_len)))
+bool SecureChannel::Receive(std::string& data)
+{
+	if (!m_secure)
 	{
-		if (m_logger) m_logger->Log(LogLevel::PROD, "SECURECHANNEL_SEND: failed to send message length");
-		return false;
+		return m_conn.Receive(data);
 	}
 
-	if (!m_conn.SendRaw(reinterpret_cast<const unsigned char*>(encrypted_text.data()), encrypted_text.size()))
+	if (!ReceiveRecord(data))
 	{
-		if (m_logger) m_logger->Log(LogLevel::PROD, "SECURECHANNEL_SEND: failed to send message");
 		return false;
 	}
 
-	++m_txSeq;
+	if (!data.empty() && data.back() == '\n') data.pop_back();
+	if (!data.empty() && data.back() == '\r') data.pop_back();
 
-	if (m_logger) m_logger->Log(LogLevel::TRACE, "SECURECHANNEL_SEND: sent " + std::to_string(data.size()) + " bytes");
+	if (m_logger) m_logger->Log(LogLevel::TRACE, "Receive: received " + std::to_string(data.size()) + " bytes");
 	return true;
 }
 
-bool SecureChannel::Receive(std::string& data)
+bool SecureChannel::ReceiveRecord(std::string& data)
 {
 	if (!m_secure)
 	{
-		return m_conn.Receive(data);
+		return false;
 	}
 
-	std::uint32_t text_len = 0;
+	unsigned char header[HEADER_SIZE] = {};
 
-	if (!m_conn.ReceiveRaw(reinterpret_cast<unsigned char*>(&text_len), sizeof(text_len)))
+	if (!m_conn.ReceiveRaw(header, sizeof(header)))
 	{
 		if (m_logger) m_logger->Log(LogLevel::PROD, "SECURECHANNEL_RECEIVE: failed to receive message length");
 		return false;
 	}
 
-	text_len = ntohl(text_len);
-
-	if (text_len == 0 || text_len > MAX_MESSAGE_SIZE)
+	auto text_len = RecordSize(header);
+	if (!text_len.has_value())
 	{
-		if (m_logger) m_logger->Log(LogLevel::PROD, "SECURECHANNEL_RECEIVE: message too large (" + std::to_string(text_len) + " bytes)");
+		if (m_logger) m_logger->Log(LogLevel::PROD, "SECURECHANNEL_RECEIVE: invalid message length");
 		return false;
 	}
 
-	std::string encrypted_text(text_len, '\0');
-	if (!m_conn.ReceiveRaw(reinterpret_cast<unsigned char*>(&encrypted_text[0]), text_len))
+	std::string encrypted_text(*text_len, '\0');
+	if (!m_conn.ReceiveRaw(reinterpret_cast<unsigned char*>(&encrypted_text[0]), *text_len))
 	{
 		if (m_logger) m_logger->Log(LogLevel::PROD, "SECURECHANNEL_RECEIVE: failed to receive message");
 		return false;
 	}
 
-	auto decrypted = Decrypt(encrypted_text);
+	return Open(encrypted_text, data);
+}
+
+std::optional<std::uint32_t> SecureChannel::RecordSize(const unsigned char* header)
+{
+	std::uint32_t net_len = 0;
+	std::memcpy(&net_len, header, sizeof(net_len));
+	std::uint32_t text_len = ntohl(net_len);
+
+	if (text_len == 0 || text_len > MAX_MESSAGE_SIZE)
+	{
+		return std::nullopt;
+	}
+	return text_len;
+}
+
+std::optional<std::string> SecureChannel::Seal(const std::string& data)
+{
+	if (data.size() > MAX_MESSAGE_SIZE)
+	{
+		if (m_logger) m_logger->Log(LogLevel::PROD, "SECURECHANNEL_SEND: message too large");
+		return std::nullopt;
+	}
+
+	if (m_logger) m_logger->Log(LogLevel::TRACE, "ENCRYPT: encrypting message");
+	std::string encrypted_text = Encrypt(data);
+
+	if (encrypted_text.empty())
+	{
+		if (m_logger) m_logger->Log(LogLevel::TRACE, "ENCRYPT: failed");
+		return std::nullopt;
+	}
+
+	std::uint32_t net_len = htonl(static_cast<std::uint32_t>(encrypted_text.size()));
+
+	std::string record;
+	record.reserve(HEADER_SIZE + encrypted_text.size());
+	record.append(reinterpret_cast<const char*>(&net_len), sizeof(net_len));
+	record.append(encrypted_text);
+
+	++m_txSeq;
+	return record;
+}
+
+bool SecureChannel::Open(const std::string& record, std::string& data)
+{
+	auto decrypted = Decrypt(record);
 
 	if (!decrypted.has_value())
 	{
@@ -168,10 +218,5 @@ bool SecureChannel::Receive(std::string& data)
 	data = std::move(*decrypted);
 
 	if (m_logger) m_logger->Log(LogLevel::TRACE, "DECRYPT: message decrypted successfully");
-
-	if (!data.empty() && data.back() == '\n') data.pop_back();
-	if (!data.empty() && data.back() == '\r') data.pop_back();
-
-	if (m_logger) m_logger->Log(LogLevel::TRACE, "Receive: received " + std::to_string(data.size()) + " bytes");
 	return true;
 }
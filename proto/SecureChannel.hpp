@@ -11,6 +11,8 @@
 class SecureChannel
 {
 public:
+	static constexpr std::uint32_t MAX_MESSAGE_SIZE = 10 * 1024 * 1024; // plan to use config value
+
 	SecureChannel(IConnection& conn) : m_conn(conn){};
 	virtual ~SecureChannel() 
 	{
@@ -20,6 +22,15 @@ public:
 
 	bool Send(const std::string& data);
 	bool Receive(std::string& data);
+	// one decrypted record as sent by the peer, without line-ending trimming (binary payloads)
+	bool ReceiveRecord(std::string& data);
+
+	// record framing for callers that do their own (asynchronous) socket I/O:
+	// a record is a HEADER_SIZE length prefix followed by that many encrypted bytes
+	static constexpr std::size_t HEADER_SIZE = sizeof(std::uint32_t);
+	static std::optional<std::uint32_t> RecordSize(const unsigned char* header);
+	std::optional<std::string> Seal(const std::string& data); // header included
+	bool Open(const std::string& record, std::string& data);  // record body without the header
 
 	virtual bool StartTLS() = 0;
 	
@@ -40,8 +51,6 @@ protected:
 							const unsigned char* private_key) = 0;
 
 private:
-	static constexpr std::uint32_t MAX_MESSAGE_SIZE = 10 * 1024 * 1024; // plan to use config value
-
 	std::uint64_t m_txSeq = 0;
 	std::uint64_t m_rxSeq = 0;
 
@@ -69,6 +69,37 @@ namespace
         ofs.write(body.data(), static_cast<std::streamsize>(body.size()));
         return ofs ? path : std::string{};
     }
+
+
+    std::string JoinAddresses(const std::vector<std::string>& addrs)
+    {
+        std::string joined;
+        for (const auto& addr : addrs)
+        {
+            if (!joined.empty()) joined += ", ";
+            joined += addr;
+        }
+        return joined;
+    }
+
+
+    // Text fed to the full-text index: the decoded plain part, or the HTML part with tags dropped.
+    std::string SearchableBody(const SmtpClient::Email& email)
+    {
+        if (!email.plain_text.empty())
+            return email.plain_text;
+
+        std::string text;
+        text.reserve(email.html_text.size());
+        bool in_tag = false;
+        for (char c : email.html_text)
+        {
+            if (c == '<')      { in_tag = true; continue; }
+            if (c == '>')      { in_tag = false; text += ' '; continue; }
+            if (!in_tag) text += c;
+        }
+        return text;
+    }
 } // anonymous namespace
 
 bool SmtpSession::SaveMessage()
@@ -103,6 +134,18 @@ bool SmtpSession::SaveMessage()
         }
     }
 
+    // byte ranges of the MIME parts, so IMAP partial FETCH can read a slice of the stored file
+    std::vector<MessagePart> parts;
+    for (const auto& range : SmtpClient::MimeParser::ScanPartRanges(m_body))
+    {
+        MessagePart part;
+        part.section      = range.section;
+        part.header_start = static_cast<int64_t>(range.header_start);
+        part.body_start   = static_cast<int64_t>(range.body_start);
+        part.body_end     = static_cast<int64_t>(range.body_end);
+        parts.push_back(part);
+    }
+
     bool any_saved = false;
 
     for (const auto& recipient_addr : m_recipients)
@@ -175,6 +218,9 @@ bool SmtpSession::SaveMessage()
 
         if (!m_message_repo->deliver(msg, inbox->id.value()))
             continue;
+
+        if (!m_message_repo->saveParts(msg.id.value(), parts) && m_logger)
+            m_logger->Log(PROD, "SaveMessage: failed to store part offsets: " + m_message_repo->getLastError());
 		
 
         Recipient rec;
@@ -205,6 +251,11 @@ bool SmtpSession::SaveMessage()
             add_mime_recipients(parsed_email.to, RecipientType::To);
             add_mime_recipients(parsed_email.cc, RecipientType::Cc);
             add_mime_recipients(parsed_email.bcc, RecipientType::Bcc);
+
+            if (!m_message_repo->indexContent(msg.id.value(), JoinAddresses(parsed_email.to),
+                                              JoinAddresses(parsed_email.cc), SearchableBody(parsed_email))
+                && m_logger)
+                m_logger->Log(PROD, "SaveMessage: failed to index message: " + m_message_repo->getLastError());
         }
 
         any_saved = true;
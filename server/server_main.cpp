@@ -6,7 +6,8 @@
 #include "FileStrategy.h"
 #include "ILogger.h"
 #include "Logger.h"
-#include "DataBaseManager.h"
+#include "Config.h"
+#include "ShardRouter.h"
 #include "schema.h"
 #include "ThreadPool.h"
 #include "ServerSecureChannel.hpp"
@@ -14,7 +15,7 @@
 #include "SocketAcceptor.hpp"
 #include "SocketConnection.hpp"
 
-int main()
+int main(int argc, char** argv)
 {
 	if (sodium_init() < 0) {
 		std::cerr << "Failed to initialize libsodium\n";
@@ -26,15 +27,21 @@ int main()
 
 	try
 	{
-		DataBaseManager db("mail.db", initSchema());
-		if (!db.isConnected())
+		// optional path to the root folder holding default_config.json
+		const std::string path_to_root = argc >= 2 ? argv[1] : "./";
+		if (!SmtpClient::Config::Instance().Load(path_to_root + "default_config.json"))
+		{
+			std::cerr << "Couldn`t read config. Default values will be used\n";
+		}
+
+		auto db = ShardRouter::open("mail.db", SmtpClient::Config::Instance().GetDatabase().db_shards, initSchema());
+		if (!db->isConnected())
 		{
 			std::cerr << "Database connection failed\n";
 			return 1;
 		}
-		UserDAL user_dal(db.getDB(), db.pool());
-		UserRepository user_repo(db);
-		MessageRepository message_repo(db);
+		UserRepository user_repo(*db);
+		MessageRepository message_repo(*db);
 
 		auto loger_shared = std::make_shared<Logger>(std::make_shared<FileStrategy>(LogLevel::TRACE));
 		ILogger& logger = *loger_shared;
@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# Opens COUNT idle IMAP connections and reports how much resident memory
+# the imap_server process gained per session.
+
+IMAP_HOST="localhost"
+IMAP_PORT="2553"
+SERVER_NAME="imap_server"
+COUNT=1000
+SETTLE_SECS=2
+
+while [[ $# -gt 0 ]]; do
+    case $1 in
+        -n) COUNT=$2; shift ;;
+        -p) IMAP_PORT=$2; shift ;;
+        *)  COUNT=$1 ;;
+    esac
+    shift
+done
+
+SERVER_PID=$(pgrep -x "$SERVER_NAME" | head -1)
+if [ -z "$SERVER_PID" ]; then
+    echo "ERROR: $SERVER_NAME is not running"
+    exit 1
+fi
+
+# every connection holds one descriptor in this shell
+ulimit -n $((COUNT + 64)) 2>/dev/null || {
+    echo "ERROR: cannot raise the descriptor limit to $((COUNT + 64))"
+    exit 1
+}
+
+rss_kb() {
+    awk '/^VmRSS:/ { print $2 }' "/proc/$SERVER_PID/status"
+}
+
+BEFORE=$(rss_kb)
+
+FDS=()
+OPENED=0
+for ((i = 0; i < COUNT; i++)); do
+    if ! exec {fd}<>"/dev/tcp/$IMAP_HOST/$IMAP_PORT"; then
+        echo "Connection $i failed, stopping"
+        break
+    fi
+    # wait for the banner so the session is fully set up before measuring
+    read -r -t 5 banner <&"$fd"
+    FDS+=("$fd")
+    OPENED=$((OPENED + 1))
+done
+
+sleep "$SETTLE_SECS"
+AFTER=$(rss_kb)
+
+for fd in "${FDS[@]}"; do
+    exec {fd}>&-
+done
+
+if [ "$OPENED" -eq 0 ]; then
+    echo "FAILED (no connection opened)"
+    exit 1
+fi
+
+DELTA_KB=$((AFTER - BEFORE))
+echo "Idle sessions:      $OPENED"
+echo "RSS before:         ${BEFORE} kB"
+echo "RSS after:          ${AFTER} kB"
+echo "Bytes per session:  $((DELTA_KB * 1024 / OPENED))"